@@ -0,0 +1,59 @@
+#ifndef FRED_BENCH_H
+#define FRED_BENCH_H
+
+// Bits every benchmark wants, header only so each bench stays one file
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+#include <clog/clog.h>
+
+typedef std::chrono::steady_clock benchClock;
+
+static inline double elapsedMs(benchClock::time_point start) {
+  return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+}
+
+static inline double median(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+// Hidden window with a GL 3.3 core context and vsync off, NULL on failure
+static inline GLFWwindow *createBenchContext(int width, int height) {
+  if (!glfwInit()) {
+    return NULL;
+  }
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  GLFWwindow *window = glfwCreateWindow(width, height, "bench", NULL, NULL);
+  if (window == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to create a GL context\n");
+    glfwTerminate();
+    return NULL;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+  if (!gladLoadGL(glfwGetProcAddress)) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to init GL!\n");
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return NULL;
+  }
+  glEnable(GL_DEPTH_TEST);
+  glEnable(GL_CULL_FACE);
+  return window;
+}
+
+static inline void destroyBenchContext(GLFWwindow *window) {
+  glfwDestroyWindow(window);
+  glfwTerminate();
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Frustum culling cost for a big scene, brute force against the BVH
+// Usage: bench-culling [assets] [frames] [moving percent]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bench.h"
+#include "culling.h"
+
+static float randomFloat(float low, float high) {
+  return low + (high - low) * (rand() / (float)RAND_MAX);
+}
+
+// Roughly unit boxes, the cube they go in grows with the count so density stays the same
+static fred::Aabb randomBox(float extent) {
+  glm::vec3 center = glm::vec3(randomFloat(-extent, extent), randomFloat(-extent, extent), randomFloat(-extent, extent));
+  glm::vec3 halfSize = glm::vec3(randomFloat(0.25f, 1.0f));
+  return {center - halfSize, center + halfSize};
+}
+
+int main(int argc, char **argv) {
+  int assetCount = argc > 1 ? atoi(argv[1]) : 100000;
+  int frames = argc > 2 ? atoi(argv[2]) : 120;
+  int movingPercent = argc > 3 ? atoi(argv[3]) : 1;
+  if (assetCount < 1 || frames < 1 || movingPercent < 0 || movingPercent > 100) {
+    fprintf(stderr, "Usage: %s [assets] [frames] [moving percent]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1234);
+  float extent = 4.0f * cbrtf((float)assetCount);
+  std::vector<fred::Aabb> boxes(assetCount);
+  for (fred::Aabb &box : boxes) {
+    box = randomBox(extent);
+  }
+
+  fred::BoundsTree tree;
+  std::vector<int> proxies(assetCount);
+  benchClock::time_point buildStart = benchClock::now();
+  for (int i = 0; i < assetCount; i++) {
+    proxies[i] = tree.insert(boxes[i], (void *)(intptr_t)i);
+  }
+  double buildMs = elapsedMs(buildStart);
+
+  int moving = assetCount * movingPercent / 100;
+  std::vector<double> scalarSamples, simdSamples, querySamples, updateSamples;
+  int scalarVisible = 0, simdVisible = 0, treeVisible = 0, refits = 0;
+  std::vector<void *> visible;
+  visible.reserve(assetCount);
+
+  for (int frame = 0; frame < frames; frame++) {
+    // Turn on the spot in the middle of the scene, seeing a slice of it
+    float angle = frame * 2.0f * 3.14159265f / frames;
+    glm::vec3 forward = glm::vec3(cosf(angle), 0.0f, sinf(angle));
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), forward, glm::vec3(0, 1, 0));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, extent * 0.5f);
+    fred::Frustum frustum = fred::Frustum::fromMatrix(projection * view);
+
+    // The same few assets wander a little every frame, the rest stay put
+    benchClock::time_point start = benchClock::now();
+    for (int i = 0; i < moving; i++) {
+      int index = i * (assetCount / moving);
+      glm::vec3 offset = glm::vec3(randomFloat(-0.05f, 0.05f), 0.0f, randomFloat(-0.05f, 0.05f));
+      boxes[index].min += offset;
+      boxes[index].max += offset;
+      refits += tree.move(proxies[index], boxes[index]);
+    }
+    updateSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    scalarVisible = 0;
+    for (const fred::Aabb &box : boxes) {
+      scalarVisible += frustum.testScalar(box) != fred::CullResult::Outside;
+    }
+    scalarSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    simdVisible = 0;
+    for (const fred::Aabb &box : boxes) {
+      simdVisible += frustum.test(box) != fred::CullResult::Outside;
+    }
+    simdSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    visible.clear();
+    tree.query(frustum, visible);
+    querySamples.push_back(elapsedMs(start));
+    treeVisible = visible.size();
+  }
+
+  printf("%d assets, %d frames, %d moving per frame\n", assetCount, frames, moving);
+  printf("BVH build %.3f ms, height %d, %d refits\n", buildMs, tree.getHeight(), refits);
+  printf("%-24s %12s %12s\n", "path", "median (ms)", "visible");
+  printf("%-24s %12.3f %12d\n", "brute force scalar", median(scalarSamples), scalarVisible);
+  printf("%-24s %12.3f %12d\n", "brute force SIMD", median(simdSamples), simdVisible);
+  printf("%-24s %12.3f %12d\n", "BVH query", median(querySamples), treeVisible);
+  printf("%-24s %12.3f\n", "BVH update", median(updateSamples));
+  // The BVH tests fattened boxes so it can only ever keep a few extra
+  if (treeVisible < simdVisible) {
+    fprintf(stderr, "BVH lost %d visible assets!\n", simdVisible - treeVisible);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+// CPU submit cost per draw: the old three VBO attribute dance vs a bound VAO
+// Usage: bench-draw-submit [draws per frame] [frames] [model]
+// Needs a GL 3.3 context, the window is hidden. Run from the build directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "engine.h"
+
+// What fred::render used to do for every asset, every frame
+struct LegacyModel {
+  GLsizei indexCount;
+  GLenum indexType;
+  GLuint vertexBuffer;
+  GLuint uvBuffer;
+  GLuint normalBuffer;
+  GLuint elementBuffer;
+};
+
+static LegacyModel createLegacyModel(const fred::MeshData &mesh) {
+  // The old loader only ever read the first mesh
+  LegacyModel model;
+  model.indexCount = mesh.subMeshes[0].indexCount;
+  model.indexType = mesh.subMeshes[0].indexSize == sizeof(uint32_t) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  glGenBuffers(1, &model.vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, model.vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.positions.size() * sizeof(glm::vec3), mesh.positions.data(), GL_STATIC_DRAW);
+  glGenBuffers(1, &model.uvBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, model.uvBuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.uvs.size() * sizeof(glm::vec2), mesh.uvs.data(), GL_STATIC_DRAW);
+  glGenBuffers(1, &model.normalBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, model.normalBuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(glm::vec3), mesh.normals.data(), GL_STATIC_DRAW);
+  glGenBuffers(1, &model.elementBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, model.elementBuffer);
+  glBufferData(GL_ARRAY_BUFFER, mesh.indices.size(), mesh.indices.data(), GL_STATIC_DRAW);
+  return model;
+}
+
+static void drawLegacy(const LegacyModel &model) {
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, model.vertexBuffer);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+  glEnableVertexAttribArray(1);
+  glBindBuffer(GL_ARRAY_BUFFER, model.uvBuffer);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
+  glEnableVertexAttribArray(2);
+  glBindBuffer(GL_ARRAY_BUFFER, model.normalBuffer);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model.elementBuffer);
+  glDrawElements(GL_TRIANGLES, model.indexCount, model.indexType, (void *)0);
+  glDisableVertexAttribArray(0);
+  glDisableVertexAttribArray(1);
+  glDisableVertexAttribArray(2);
+}
+
+// Median CPU time per draw in nanoseconds, the GPU is drained outside the timer
+template <typename Draw>
+static double measure(int drawsPerFrame, int frames, Draw draw) {
+  std::vector<double> samples;
+  for (int frame = 0; frame < frames; frame++) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    benchClock::time_point start = benchClock::now();
+    for (int i = 0; i < drawsPerFrame; i++) {
+      draw();
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(benchClock::now() - start).count();
+    glFinish();
+    samples.push_back(elapsed / drawsPerFrame);
+  }
+  return median(samples);
+}
+
+int main(int argc, char **argv) {
+  int drawsPerFrame = argc > 1 ? atoi(argv[1]) : 5000;
+  int frames = argc > 2 ? atoi(argv[2]) : 60;
+  const char *modelPath = argc > 3 ? argv[3] : "../models/suzanne.obj";
+  if (drawsPerFrame < 1 || frames < 1) {
+    fprintf(stderr, "Usage: %s [draws per frame] [frames] [model]\n", argv[0]);
+    return 1;
+  }
+
+  GLFWwindow *window = createBenchContext(256, 256);
+  if (window == NULL) {
+    return 1;
+  }
+
+  int status = 0;
+  {
+    fred::ShaderVariants standard("../shaders/standard.vert", "../shaders/standard.frag");
+    fred::Shader shader(standard, fred::SHADER_LIT);
+    glUseProgram(shader.shaderProgram);
+
+    fred::MeshData mesh;
+    if (!fred::importMesh(modelPath, mesh)) {
+      status = 1;
+    } else {
+      GLuint legacyVertexArray; // Core profile wants something bound
+      glGenVertexArrays(1, &legacyVertexArray);
+      glBindVertexArray(legacyVertexArray);
+      LegacyModel legacy = createLegacyModel(mesh);
+      double legacyNs = measure(drawsPerFrame, frames, [&]() { drawLegacy(legacy); });
+      glBindVertexArray(0);
+
+      fred::Model floatModel(modelPath, fred::VertexLayout());
+      double floatNs = measure(drawsPerFrame, frames, [&]() { floatModel.draw(); });
+
+      fred::Model compactModel(modelPath, fred::VertexLayout::compact());
+      double compactNs = measure(drawsPerFrame, frames, [&]() { compactModel.draw(); });
+      glBindVertexArray(0);
+
+      printf("%d draws/frame, %d frames, %s (%zu vertices)\n", drawsPerFrame, frames,
+             modelPath, mesh.positions.size());
+      printf("%-34s %10s %8s\n", "path", "ns/draw", "stride");
+      printf("%-34s %10.1f %8d\n", "3 VBOs, per draw attribute setup", legacyNs, 32);
+      printf("%-34s %10.1f %8u\n", "VAO, float layout", floatNs, fred::VertexLayout().stride());
+      printf("%-34s %10.1f %8u\n", "VAO, compact layout", compactNs, fred::VertexLayout::compact().stride());
+
+      GLuint buffers[4] = {legacy.vertexBuffer, legacy.uvBuffer, legacy.normalBuffer, legacy.elementBuffer};
+      glDeleteBuffers(4, buffers);
+      glDeleteVertexArrays(1, &legacyVertexArray);
+    }
+  }
+
+  destroyBenchContext(window);
+  return status;
+}
@@ -0,0 +1,128 @@
+// Model and MVP matrices for every object in a scene where everything moves,
+// per Asset through glm against the entity pools, scalar and SIMD
+// Usage: bench-entities [frames] [counts...]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "bench.h"
+#include "engine.h"
+
+// As big as an Asset and allocated one at a time like the demo's, so the
+// old path pays for the same cache misses. Making real ones needs GL.
+struct BenchAsset {
+  fred::Transform transform;
+  char rest[sizeof(fred::Asset) - sizeof(fred::Transform)];
+};
+
+static float maxDifference(const glm::mat4 &a, const glm::mat4 &b) {
+  float difference = 0.0f;
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      difference = std::max(difference, fabsf(a[column][row] - b[column][row]));
+    }
+  }
+  return difference;
+}
+
+static bool run(int count, int frames) {
+  srand(1234);
+  glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f) *
+                             glm::lookAt(glm::vec3(0, 50, 100), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+  glm::quat spin = glm::quat(glm::vec3(0.0f, glm::radians(1.0f), 0.0f));
+
+  std::vector<std::unique_ptr<BenchAsset>> owned(count);
+  std::vector<BenchAsset *> assets(count);
+  fred::TransformPool pool;
+  for (int i = 0; i < count; i++) {
+    glm::vec3 position = glm::vec3(rand() % 200 - 100, rand() % 20, rand() % 200 - 100);
+    glm::quat rotation = glm::quat(glm::vec3(0.0f, i * 0.1f, 0.0f));
+    glm::vec3 scale = glm::vec3(0.5f + (rand() % 100) / 100.0f);
+    owned[i].reset(new BenchAsset());
+    owned[i]->transform.setPosition(position);
+    owned[i]->transform.setRotation(rotation);
+    owned[i]->transform.setScale(scale);
+    assets[i] = owned[i].get();
+    pool.add(i, position, rotation, scale);
+  }
+  // Scene order isn't allocation order
+  std::shuffle(assets.begin(), assets.end(), std::mt19937(1234));
+
+  std::vector<glm::mat4> mvps(count);
+  std::vector<double> assetSamples, scalarSamples, simdSamples;
+  for (int frame = 0; frame < frames; frame++) {
+    for (BenchAsset *asset : assets) {
+      asset->transform.rotate(spin);
+    }
+    for (uint32_t slot = 0; slot < pool.size(); slot++) {
+      pool.setRotation(slot, spin * pool.getRotation(slot));
+    }
+
+    benchClock::time_point start = benchClock::now();
+    for (int i = 0; i < count; i++) {
+      mvps[i] = viewProjection * assets[i]->transform.getWorldMatrix();
+    }
+    assetSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    pool.computeMatricesScalar(viewProjection);
+    scalarSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    pool.computeMatrices(viewProjection);
+    simdSamples.push_back(elapsedMs(start));
+  }
+
+  // Both pool paths against glm, owned is still in pool order
+  float worst = 0.0f;
+  for (int i = 0; i < count; i++) {
+    glm::mat4 expected = viewProjection * owned[i]->transform.getWorldMatrix();
+    worst = std::max(worst, maxDifference(expected, pool.modelViewProjection[i]));
+  }
+  pool.computeMatricesScalar(viewProjection);
+  for (int i = 0; i < count; i++) {
+    worst = std::max(worst, maxDifference(viewProjection * owned[i]->transform.getWorldMatrix(), pool.modelViewProjection[i]));
+  }
+
+  printf("%-10d %14.3f %14.3f %14.3f %10.1fx\n", count, median(assetSamples), median(scalarSamples),
+         median(simdSamples), median(assetSamples) / std::max(median(simdSamples), 1e-6));
+  if (worst > 1e-2f) {
+    fprintf(stderr, "Pool matrices are off by %f!\n", worst);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 60;
+  std::vector<int> counts;
+  for (int i = 2; i < argc; i++) {
+    counts.push_back(atoi(argv[i]));
+  }
+  if (counts.empty()) {
+    counts = {1000, 10000, 100000};
+  }
+  if (frames < 1 || *std::min_element(counts.begin(), counts.end()) < 1) {
+    fprintf(stderr, "Usage: %s [frames] [counts...]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%d frames, everything moving every frame, SIMD path is %s\n", frames, fred::TransformPool::getSimdName());
+  printf("%-10s %14s %14s %14s %11s\n", "entities", "Asset (ms)", "scalar (ms)", "SIMD (ms)", "speedup");
+  for (int count : counts) {
+    if (!run(count, frames)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,86 @@
+// Draw calls and frame time for a crowd of identical props, instanced or not
+// Usage: bench-instancing [instances] [frames]
+// Needs a GL 3.3 context, the window is hidden. Run from the build directory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include "bench.h"
+#include "engine.h"
+
+struct FrameResult {
+  double submitMs; // CPU time to issue the draws
+  double frameMs;  // Submit plus waiting for the GPU to finish
+  int drawCalls;
+};
+
+static FrameResult measure(fred::Scene &scene, const glm::mat4 &view, const glm::mat4 &projection, int frames) {
+  std::vector<double> submitSamples;
+  std::vector<double> frameSamples;
+  for (int frame = 0; frame < frames; frame++) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    benchClock::time_point start = benchClock::now();
+    fred::drawAssets(scene, view, projection);
+    submitSamples.push_back(elapsedMs(start));
+    glFinish();
+    frameSamples.push_back(elapsedMs(start));
+  }
+  FrameResult result;
+  result.submitMs = median(submitSamples);
+  result.frameMs = median(frameSamples);
+  result.drawCalls = fred::getRenderStats().drawCalls;
+  return result;
+}
+
+int main(int argc, char **argv) {
+  int instanceCount = argc > 1 ? atoi(argv[1]) : 10000;
+  int frames = argc > 2 ? atoi(argv[2]) : 60;
+  if (instanceCount < 1 || frames < 1) {
+    fprintf(stderr, "Usage: %s [instances] [frames]\n", argv[0]);
+    return 1;
+  }
+
+  GLFWwindow *window = createBenchContext(1024, 768);
+  if (window == NULL) {
+    return 1;
+  }
+
+  {
+    fred::Model model("../models/suzanne.obj");
+    fred::Texture albedo("../textures/results/suzanne_albedo_DXT5.DDS");
+    fred::Texture specular("../textures/results/suzanne_specular_DXT5.DDS");
+    fred::ShaderVariants standard("../shaders/standard.vert", "../shaders/standard.frag");
+    fred::Shader shader(standard, fred::SHADER_LIT);
+
+    // A square grid of suzannes in front of the camera
+    std::vector<fred::Asset> assets;
+    assets.reserve(instanceCount);
+    fred::Scene scene;
+    int side = (int)ceil(sqrt((double)instanceCount));
+    for (int i = 0; i < instanceCount; i++) {
+      assets.push_back(fred::Asset(model, albedo, specular, shader));
+      assets.back().transform.setPosition(glm::vec3((i % side - side / 2) * 3.0f, 0.0f, -(i / side) * 3.0f));
+    }
+    for (fred::Asset &asset : assets) {
+      scene.addAsset(asset);
+    }
+
+    glm::mat4 view = glm::lookAt(glm::vec3(0, side * 1.5f, side * 1.5f), glm::vec3(0, 0, -side * 1.5f), glm::vec3(0, 1, 0));
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1024.0f / 768.0f, 0.1f, side * 10.0f);
+
+    fred::setInstancingEnabled(false);
+    FrameResult single = measure(scene, view, projection, frames);
+    fred::setInstancingEnabled(true);
+    FrameResult instanced = measure(scene, view, projection, frames);
+
+    printf("%d instances, %d frames\n", instanceCount, frames);
+    printf("%-12s %12s %12s %12s\n", "path", "draw calls", "submit (ms)", "frame (ms)");
+    printf("%-12s %12d %12.3f %12.3f\n", "per asset", single.drawCalls, single.submitMs, single.frameMs);
+    printf("%-12s %12d %12.3f %12.3f\n", "instanced", instanced.drawCalls, instanced.submitMs, instanced.frameMs);
+  }
+
+  destroyBenchContext(window);
+  return 0;
+}
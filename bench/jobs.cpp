@@ -0,0 +1,322 @@
+// The job system from one thread up to N: a parallel for over a compute
+// kernel, lots of tiny jobs, and jobs that start jobs so the workers have to
+// steal. 1 thread is the plain loop, N is N - 1 workers and the calling
+// thread helping while it waits.
+// With --stress it checks the job system instead: every index of a parallel
+// for run exactly once, dependencies held back until they're done, nested
+// waits, threads that aren't workers pushing at the same time, full deques,
+// the main thread leaving long jobs to the workers while it waits on its own,
+// and starting and stopping. Build with FRED_SANITIZE_THREAD for that.
+// Usage: bench-jobs [--stress] [max threads]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "jobs.h"
+
+static const int ELEMENTS = 1 << 20;
+static const int TINY_JOBS = 20000;
+static const int TREE_DEPTH = 12; // 4096 leaves
+
+// Some floating point per element, enough that it's compute and not memory
+static void kernel(std::vector<float> &data, int begin, int end) {
+  for (int i = begin; i < end; i++) {
+    float x = data[i];
+    for (int k = 0; k < 8; k++) {
+      x = sqrtf(x * x + 1.0f) * 0.5f + sinf(x) * 0.25f;
+    }
+    data[i] = x;
+  }
+}
+
+// Binary tree of jobs, each leaf a bit of the kernel
+static void spawnTree(fred::JobSystem &system, std::vector<float> &data, int begin, int end, int depth,
+                      fred::JobCounter &counter) {
+  if (depth == 0) {
+    kernel(data, begin, end);
+    return;
+  }
+  int middle = begin + (end - begin) / 2;
+  system.run([&system, &data, middle, end, depth, &counter] {
+    spawnTree(system, data, middle, end, depth - 1, counter);
+  }, &counter, "Tree");
+  spawnTree(system, data, begin, middle, depth - 1, counter);
+}
+
+struct Timings {
+  double parallelForMs;
+  double tinyMs;
+  double treeMs;
+  uint64_t steals;
+};
+
+static Timings measure(int threads, int rounds) {
+  std::vector<float> data(ELEMENTS);
+  std::vector<double> forSamples, tinySamples, treeSamples;
+  std::unique_ptr<fred::JobSystem> system;
+  if (threads > 1) {
+    system.reset(new fred::JobSystem());
+    system->start(threads - 1);
+  }
+  for (int round = 0; round < rounds; round++) {
+    for (int i = 0; i < ELEMENTS; i++) {
+      data[i] = (float)(i % 1000) * 0.001f;
+    }
+    benchClock::time_point start = benchClock::now();
+    if (system) {
+      system->parallelFor(ELEMENTS, 4096, [&data](int begin, int end) { kernel(data, begin, end); });
+    } else {
+      kernel(data, 0, ELEMENTS);
+    }
+    forSamples.push_back(elapsedMs(start));
+
+    std::atomic<int> sum{0};
+    start = benchClock::now();
+    if (system) {
+      fred::JobCounter counter;
+      for (int i = 0; i < TINY_JOBS; i++) {
+        system->run([&sum] { sum.fetch_add(1, std::memory_order_relaxed); }, &counter, "Tiny");
+      }
+      system->wait(counter);
+    } else {
+      for (int i = 0; i < TINY_JOBS; i++) {
+        sum.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    tinySamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    if (system) {
+      // Started from a worker so the tree grows in its deque and the rest
+      // have to steal it
+      fred::JobCounter counter;
+      fred::JobSystem *workers = system.get();
+      workers->run([workers, &data, &counter] { spawnTree(*workers, data, 0, ELEMENTS, TREE_DEPTH, counter); },
+                   &counter, "Tree");
+      workers->wait(counter);
+    } else {
+      kernel(data, 0, ELEMENTS);
+    }
+    treeSamples.push_back(elapsedMs(start));
+  }
+
+  Timings timings;
+  timings.parallelForMs = median(forSamples);
+  timings.tinyMs = median(tinySamples);
+  timings.treeMs = median(treeSamples);
+  timings.steals = 0;
+  if (system) {
+    for (const fred::JobThreadStats &stats : system->getStats()) {
+      timings.steals += stats.steals;
+    }
+  }
+  return timings;
+}
+
+// Stress =================================================================== //
+
+static std::atomic<int> failures{0};
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+static void stressParallelFor(fred::JobSystem &system) {
+  const int counts[] = {1, 7, 100, 4095, 4096, 4097, 100000};
+  const int grains[] = {1, 3, 64, 5000};
+  for (int count : counts) {
+    for (int grain : grains) {
+      std::vector<std::atomic<int>> hits(count);
+      for (std::atomic<int> &hit : hits) {
+        hit.store(0, std::memory_order_relaxed);
+      }
+      system.parallelFor(count, grain, [&hits, grain](int begin, int end) {
+        check(end - begin <= grain && begin < end, "parallel for range size");
+        for (int i = begin; i < end; i++) {
+          hits[i].fetch_add(1, std::memory_order_relaxed);
+        }
+      });
+      bool once = true;
+      for (std::atomic<int> &hit : hits) {
+        once = once && hit.load(std::memory_order_relaxed) == 1;
+      }
+      check(once, "parallel for runs every index exactly once");
+    }
+  }
+}
+
+// Three stages, each held back on the one before it. Plain ints, so
+// ThreadSanitizer sees it if a stage ever runs early.
+static void stressDependencies(fred::JobSystem &system) {
+  for (int round = 0; round < 200; round++) {
+    const int width = 16;
+    int first[width] = {};
+    int second[width] = {};
+    int third = 0;
+    fred::JobCounter a, b, c;
+    for (int i = 0; i < width; i++) {
+      system.run([&first, i] { first[i] = i + 1; }, &a, "Stage 1");
+    }
+    for (int i = 0; i < width; i++) {
+      system.run([&first, &second, i] {
+        int sum = 0;
+        for (int j = 0; j < width; j++) {
+          sum += first[j];
+        }
+        second[i] = sum;
+      }, &b, "Stage 2", &a);
+    }
+    system.run([&second, &third] {
+      for (int i = 0; i < width; i++) {
+        third += second[i];
+      }
+    }, &c, "Stage 3", &b);
+    system.wait(c);
+    system.wait(b);
+    system.wait(a);
+    check(third == width * width * (width + 1) / 2, "dependent jobs see what came before");
+  }
+}
+
+// parallelFor inside jobs, so workers wait on counters while their own
+// deques are being stolen from
+static void stressNested(fred::JobSystem &system) {
+  std::atomic<int> total{0};
+  system.parallelFor(64, 1, [&system, &total](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      system.parallelFor(256, 16, [&total](int innerBegin, int innerEnd) {
+        total.fetch_add(innerEnd - innerBegin, std::memory_order_relaxed);
+      }, "Inner");
+    }
+  }, "Outer");
+  check(total.load() == 64 * 256, "nested parallel fors");
+}
+
+// More children than a deque holds, the rest go through the shared queue
+static void stressOverflow(fred::JobSystem &system) {
+  const int children = (int)fred::JobDeque::CAPACITY * 3;
+  std::atomic<int> ran{0};
+  fred::JobCounter counter;
+  system.run([&system, &ran, &counter, children] {
+    for (int i = 0; i < children; i++) {
+      system.run([&ran] { ran.fetch_add(1, std::memory_order_relaxed); }, &counter, "Child");
+    }
+  }, &counter, "Parent");
+  system.wait(counter);
+  check(ran.load() == children, "jobs past a full deque still run");
+}
+
+// Threads that aren't workers, all pushing and waiting at once
+static void stressExternal(fred::JobSystem &system) {
+  std::atomic<int> total{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&system, &total] {
+      for (int round = 0; round < 50; round++) {
+        fred::JobCounter counter;
+        for (int i = 0; i < 100; i++) {
+          system.run([&total] { total.fetch_add(1, std::memory_order_relaxed); }, &counter, "External");
+        }
+        system.wait(counter);
+        check(counter.isDone(), "counter done after waiting");
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  check(total.load() == 4 * 50 * 100, "jobs from threads that aren't workers");
+}
+
+// A long job kicked off from the main thread, then a parallel for waited on
+// there. The main thread helps with the parallel for but must leave the long
+// one to a worker, the way a game step overlaps the frame.
+static void stressLongJob(fred::JobSystem &system) {
+  for (int round = 0; round < 20; round++) {
+    std::thread::id main = std::this_thread::get_id();
+    std::atomic<int> ranOn{0}; // 1 a worker, 2 the main thread
+    fred::JobCounter step;
+    system.run([&ranOn, main] {
+      ranOn.store(std::this_thread::get_id() == main ? 2 : 1);
+      benchClock::time_point start = benchClock::now();
+      while (elapsedMs(start) < 2.0) {
+      }
+    }, &step, "Long");
+    std::atomic<int> total{0};
+    system.parallelFor(4096, 16, [&total](int begin, int end) {
+      total.fetch_add(end - begin, std::memory_order_relaxed);
+    });
+    check(ranOn.load() != 2, "the main thread never runs a long job while it waits on its own");
+    // Waiting on the long one itself is fine to help with
+    system.wait(step);
+    check(total.load() == 4096, "parallel for next to a long job");
+  }
+}
+
+static std::atomic<int> hookDepth{0};
+
+static void stressBegin(int thread, const char *name) {
+  hookDepth.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void stressEnd(int thread, const char *name) {
+  hookDepth.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static int stress(int maxThreads) {
+  for (int threads = 2; threads <= maxThreads; threads++) {
+    fred::JobSystem system;
+    system.setProfileHooks(stressBegin, stressEnd);
+    system.start(threads - 1);
+    stressParallelFor(system);
+    stressDependencies(system);
+    stressNested(system);
+    stressOverflow(system);
+    stressExternal(system);
+    stressLongJob(system);
+    system.stop();
+    check(hookDepth.load() == 0, "profile hooks balanced");
+    // And again after a restart
+    system.start(threads - 1);
+    stressNested(system);
+    system.stop();
+    printf("%d threads: %s\n", threads, failures == 0 ? "ok" : "FAILED");
+  }
+  return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  bool stressing = argc > 1 && strcmp(argv[1], "--stress") == 0;
+  int hardware = (int)std::thread::hardware_concurrency();
+  int maxThreads = argc > 1 + stressing ? atoi(argv[1 + stressing]) : std::max(hardware, 2);
+  if (maxThreads < 2) {
+    fprintf(stderr, "Usage: %s [--stress] [max threads]\n", argv[0]);
+    return 1;
+  }
+  if (stressing) {
+    return stress(maxThreads);
+  }
+
+  printf("%d elements, %d tiny jobs, %d hardware threads\n", ELEMENTS, TINY_JOBS, hardware);
+  printf("%8s %14s %9s %10s %9s %10s %9s %8s\n", "threads", "parallel for", "speedup", "tiny ms", "ns/job",
+         "tree ms", "speedup", "steals");
+  Timings serial = measure(1, 9);
+  for (int threads = 1; threads <= maxThreads; threads++) {
+    Timings timings = threads == 1 ? serial : measure(threads, 9);
+    printf("%8d %14.3f %8.2fx %10.3f %9.1f %10.3f %8.2fx %8llu\n", threads, timings.parallelForMs,
+           serial.parallelForMs / timings.parallelForMs, timings.tinyMs, timings.tinyMs * 1e6 / TINY_JOBS,
+           timings.treeMs, serial.treeMs / timings.treeMs, (unsigned long long)timings.steals);
+  }
+  return 0;
+}
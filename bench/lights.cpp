@@ -0,0 +1,89 @@
+// Building the clustered light grid for more and more lights, on one thread
+// and split over the job system, plus how many lights a fragment ends up
+// looping over compared to all of them
+// Usage: bench-lights [frames] [counts...]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bench.h"
+#include "lighting.h"
+
+static bool run(int count, int frames) {
+  srand(1234);
+  glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+  std::vector<fred::PointLight> lights(count);
+  for (fred::PointLight &light : lights) {
+    light.position = glm::vec3(rand() % 200 - 100, rand() % 10, rand() % 200 - 100);
+    light.radius = 4.0f + rand() % 8;
+  }
+
+  fred::LightGrid serial;
+  serial.parallel = false;
+  fred::LightGrid parallel;
+  std::vector<double> serialSamples, parallelSamples;
+  for (int frame = 0; frame < frames; frame++) {
+    // Orbiting so the lights land in different clusters every frame
+    float angle = frame * 0.02f;
+    glm::mat4 view = glm::lookAt(glm::vec3(cosf(angle) * 120.0f, 40.0f, sinf(angle) * 120.0f), glm::vec3(0.0f),
+                                 glm::vec3(0, 1, 0));
+
+    benchClock::time_point start = benchClock::now();
+    serial.build(lights, view, projection);
+    serialSamples.push_back(elapsedMs(start));
+
+    start = benchClock::now();
+    parallel.build(lights, view, projection);
+    parallelSamples.push_back(elapsedMs(start));
+
+    if (serial.clusters != parallel.clusters || serial.indices != parallel.indices) {
+      fprintf(stderr, "The parallel grid doesn't match the serial one!\n");
+      return false;
+    }
+  }
+
+  const fred::LightGridStats &stats = parallel.getStats();
+  int occupied = 0;
+  for (int cluster = 0; cluster < fred::CLUSTER_COUNT; cluster++) {
+    occupied += parallel.clusters[cluster * 2 + 1] > 0;
+  }
+  printf("%-8d %8d %12.3f %12.3f %8.1fx %10.1f %8d\n", count, stats.lights, median(serialSamples),
+         median(parallelSamples), median(serialSamples) / std::max(median(parallelSamples), 1e-6),
+         occupied > 0 ? (double)stats.indices / occupied : 0.0, stats.maxPerCluster);
+  if (stats.overflowed > 0) {
+    printf("         %d references past the index buffer were dropped\n", stats.overflowed);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 60;
+  std::vector<int> counts;
+  for (int i = 2; i < argc; i++) {
+    counts.push_back(atoi(argv[i]));
+  }
+  if (counts.empty()) {
+    counts = {64, 256, 1024, 4096};
+  }
+  if (frames < 1 || *std::min_element(counts.begin(), counts.end()) < 1) {
+    fprintf(stderr, "Usage: %s [frames] [counts...]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%d frames, %dx%dx%d clusters\n", frames, fred::CLUSTERS_X, fred::CLUSTERS_Y, fred::CLUSTERS_Z);
+  printf("%-8s %8s %12s %12s %9s %10s %8s\n", "lights", "in view", "serial (ms)", "jobs (ms)", "speedup",
+         "per lit", "worst");
+  for (int count : counts) {
+    if (!run(count, frames)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Model load time: Assimp import vs mapping a cooked .fmesh blob
+// Usage: bench-model-load [iterations] [models...]
+// Run from the build directory, defaults to the teapot and suzanne.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+
+static double median(std::vector<double> &samples) {
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+// glBufferData reads every byte, so fault the whole mapping in to be fair
+static unsigned int touch(const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  unsigned int sum = 0;
+  for (size_t i = 0; i < size; i += 64) {
+    sum += bytes[i];
+  }
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20;
+  std::vector<std::string> models;
+  for (int i = 2; i < argc; i++) {
+    models.push_back(argv[i]);
+  }
+  if (models.empty()) {
+    models.push_back("../models/teapot.obj");
+    models.push_back("../models/suzanne.obj");
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  typedef std::chrono::steady_clock clock;
+  printf("%-28s %12s %12s %9s\n", "model", "assimp (ms)", "cooked (ms)", "speedup");
+  for (const std::string &model : models) {
+    std::string base = model.substr(model.find_last_of("/\\") + 1);
+    std::string cookedPath = fred::cookedMeshPath(base); // Cook into the cwd
+
+    fred::MeshData cookSource;
+    if (!fred::importMesh(model.c_str(), cookSource) ||
+        !fred::writeCookedMesh(cookedPath.c_str(), cookSource, fred::VertexLayout())) {
+      fprintf(stderr, "Failed to cook %s\n", model.c_str());
+      return 1;
+    }
+
+    std::vector<double> assimpTimes;
+    std::vector<double> cookedTimes;
+    unsigned int sink = 0;
+    for (int i = 0; i < iterations; i++) {
+      clock::time_point start = clock::now();
+      fred::MeshData mesh;
+      std::vector<unsigned char> vertices;
+      fred::importMesh(model.c_str(), mesh);
+      fred::interleaveVertices(mesh, fred::VertexLayout(), vertices);
+      sink += vertices.size();
+      assimpTimes.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+
+      start = clock::now();
+      fred::CookedMesh cooked;
+      if (!fred::mapCookedMesh(cookedPath.c_str(), NULL, cooked)) {
+        fprintf(stderr, "Failed to map %s\n", cookedPath.c_str());
+        return 1;
+      }
+      sink += touch(cooked.vertices, cooked.verticesSize());
+      sink += touch(cooked.indices, cooked.indicesSize());
+      sink += touch(cooked.positions, cooked.positionsSize());
+      cookedTimes.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+    }
+    remove(cookedPath.c_str());
+
+    double assimpMs = median(assimpTimes);
+    double cookedMs = median(cookedTimes);
+    printf("%-28s %12.3f %12.3f %8.1fx\n", base.c_str(), assimpMs, cookedMs,
+           cookedMs > 0.0 ? assimpMs / cookedMs : 0.0);
+    if (sink == 0xdeadbeef) {
+      printf("\n"); // Keeps the optimiser from dropping the loads
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,129 @@
+// Software occlusion culling over a grid of walled rooms: rasterizing the
+// walls with the scalar path, with SIMD, and with SIMD over the job system,
+// then testing a box per object against the result
+// Usage: bench-occlusion [frames] [rooms per side]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bench.h"
+#include "culling.h"
+#include "occlusion.h"
+
+// Scalar code is free to get FMAs contracted in, so not bit for bit
+static bool sameDepth(const float *a, const float *b) {
+  for (int i = 0; i < fred::OCCLUSION_WIDTH * fred::OCCLUSION_HEIGHT; i++) {
+    if (fabsf(a[i] - b[i]) > 1e-5f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static glm::mat4 placeWall(const glm::vec3 &position, const glm::vec3 &scale) {
+  return glm::scale(glm::translate(glm::mat4(1.0f), position), scale);
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 120;
+  int side = argc > 2 ? atoi(argv[2]) : 16;
+  if (frames < 1 || side < 1) {
+    fprintf(stderr, "Usage: %s [frames] [rooms per side]\n", argv[0]);
+    return 1;
+  }
+
+  // Same layout as the indoor headless scene, a doorway in every wall
+  fred::MeshData cube;
+  fred::makeCubeMesh(cube);
+  fred::OccluderMesh wall;
+  fred::makeOccluder(cube, wall);
+  const float room = 12.0f;
+  const float door = 3.0f;
+  const float length = (room - door) * 0.5f;
+  const float origin = -side * room * 0.5f;
+  std::vector<glm::mat4> walls;
+  for (int line = 0; line <= side; line++) {
+    for (int i = 0; i < side; i++) {
+      float along = origin + (i + 0.5f) * room;
+      float across = origin + line * room;
+      for (int half = -1; half <= 1; half += 2) {
+        float offset = half * (door + length) * 0.5f;
+        walls.push_back(placeWall(glm::vec3(along + offset, 2.0f, across), glm::vec3(length, 4.0f, 0.3f)));
+        walls.push_back(placeWall(glm::vec3(across, 2.0f, along + offset), glm::vec3(0.3f, 4.0f, length)));
+      }
+    }
+  }
+  std::vector<fred::Aabb> boxes;
+  for (int i = 0; i < side * side; i++) {
+    glm::vec3 center = glm::vec3(origin + (i % side + 0.5f) * room, 1.0f, origin + (i / side + 0.5f) * room);
+    for (int j = 0; j < 9; j++) {
+      glm::vec3 position = center + glm::vec3((j % 3 - 1) * 3.0f, 0.0f, (j / 3 - 1) * 3.0f);
+      boxes.push_back({position - glm::vec3(1.0f), position + glm::vec3(1.0f)});
+    }
+  }
+
+  fred::OcclusionBuffer scalar;
+  scalar.simd = false;
+  scalar.parallel = false;
+  fred::OcclusionBuffer simd;
+  simd.parallel = false;
+  fred::OcclusionBuffer jobbed;
+  fred::OcclusionBuffer *buffers[3] = {&scalar, &simd, &jobbed};
+  std::vector<double> samples[3], testSamples;
+  double inFrustum = 0.0, hidden = 0.0, occluders = 0.0, triangles = 0.0;
+
+  glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+  for (int frame = 0; frame < frames; frame++) {
+    // Walking down the middle row of rooms, looking from side to side
+    glm::vec3 eye = glm::vec3(origin + 6.0f + frame * (side * room - 12.0f) / frames, 1.7f, 6.0f);
+    glm::vec3 forward = glm::vec3(1.0f, -0.05f, sinf(frame * 0.05f) * 0.5f);
+    glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + forward, glm::vec3(0, 1, 0));
+    fred::Frustum frustum = fred::Frustum::fromMatrix(viewProjection);
+
+    for (int i = 0; i < 3; i++) {
+      benchClock::time_point start = benchClock::now();
+      buffers[i]->begin(viewProjection);
+      for (const glm::mat4 &model : walls) {
+        if (frustum.test(fred::transformAabb(wall.bounds, model)) != fred::CullResult::Outside) {
+          buffers[i]->addOccluder(wall, model);
+        }
+      }
+      buffers[i]->rasterize();
+      samples[i].push_back(elapsedMs(start));
+    }
+    if (!sameDepth(scalar.getDepth(), simd.getDepth()) || !sameDepth(simd.getDepth(), jobbed.getDepth())) {
+      fprintf(stderr, "The SIMD or jobbed depth doesn't match the scalar one!\n");
+      return 1;
+    }
+    occluders += jobbed.getStats().occluders;
+    triangles += jobbed.getStats().triangles;
+
+    benchClock::time_point start = benchClock::now();
+    for (const fred::Aabb &box : boxes) {
+      if (frustum.test(box) == fred::CullResult::Outside) {
+        continue;
+      }
+      inFrustum++;
+      hidden += !jobbed.isVisible(box);
+    }
+    testSamples.push_back(elapsedMs(start));
+  }
+
+  printf("%d frames, %zu walls, %zu objects, %dx%d depth, %s\n", frames, walls.size(), boxes.size(),
+         fred::OCCLUSION_WIDTH, fred::OCCLUSION_HEIGHT, fred::OcclusionBuffer::getSimdName());
+  printf("%.1f occluders and %.0f triangles in view a frame\n", occluders / frames, triangles / frames);
+  printf("%-16s %10s\n", "", "median ms");
+  printf("%-16s %10.3f\n", "raster scalar", median(samples[0]));
+  printf("%-16s %10.3f\n", "raster SIMD", median(samples[1]));
+  printf("%-16s %10.3f (%d tasks)\n", "raster SIMD jobs", median(samples[2]), jobbed.getStats().tasks);
+  printf("%-16s %10.3f\n", "frustum + test", median(testSamples));
+  printf("%.1f of %.1f objects in the frustum hidden (%.1f%%)\n", hidden / frames, inFrustum / frames,
+         inFrustum > 0.0 ? 100.0 * hidden / inFrustum : 0.0);
+  return 0;
+}
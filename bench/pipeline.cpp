@@ -0,0 +1,140 @@
+// Frame time against the cost of the game update, stepping it on the calling
+// thread against on a worker while the frame gets built. The frame is the
+// CPU half of one: publishing the step, refitting the BVH and culling.
+// Usage: bench-pipeline [objects] [frames]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "bench.h"
+#include "culling.h"
+#include "simulation.h"
+
+// Springs pulling everything back to where it started, integrated substeps
+// times a step. That's the load.
+struct Springs {
+  std::vector<glm::vec3> rest;
+  std::vector<glm::vec3> velocities;
+  int substeps = 0;
+};
+
+static void stepSprings(const fred::SimulationState &previous, fred::SimulationState &next, float dt, void *user) {
+  Springs &springs = *(Springs *)user;
+  float h = springs.substeps > 0 ? dt / springs.substeps : dt;
+  for (size_t i = 0; i < next.transforms.size(); i++) {
+    glm::vec3 position = previous.transforms[i].position;
+    glm::vec3 velocity = springs.velocities[i];
+    for (int s = 0; s < springs.substeps; s++) {
+      glm::vec3 acceleration = (springs.rest[i] - position) * 4.0f - velocity * 0.05f;
+      velocity += acceleration * h;
+      position += velocity * h;
+    }
+    springs.velocities[i] = velocity;
+    next.transforms[i].position = position;
+    next.transforms[i].rotation = glm::angleAxis(glm::length(velocity) * dt, glm::vec3(0.0f, 1.0f, 0.0f)) *
+                                  previous.transforms[i].rotation;
+  }
+}
+
+struct Run {
+  std::vector<std::unique_ptr<fred::Transform>> transforms;
+  Springs springs;
+  fred::BoundsTree tree;
+  std::vector<int> proxies;
+  fred::Simulation simulation; // Last, so it goes first
+};
+
+static void setup(Run &run, int objectCount, int substeps, bool threaded) {
+  srand(1);
+  run.springs.substeps = substeps;
+  run.simulation.threaded = threaded;
+  run.simulation.setStep(stepSprings, &run.springs);
+  int side = (int)ceilf(sqrtf((float)objectCount));
+  for (int i = 0; i < objectCount; i++) {
+    glm::vec3 position = glm::vec3((i % side - side * 0.5f) * 3.0f, 0.0f, (i / side - side * 0.5f) * 3.0f);
+    run.transforms.push_back(std::unique_ptr<fred::Transform>(new fred::Transform()));
+    run.transforms.back()->setPosition(position);
+    run.simulation.track(*run.transforms.back());
+    run.springs.rest.push_back(position);
+    run.springs.velocities.push_back(glm::vec3(rand() % 100 - 50, rand() % 100 - 50, rand() % 100 - 50) * 0.02f);
+    run.proxies.push_back(run.tree.insert({position - glm::vec3(0.5f), position + glm::vec3(0.5f)}, (void *)(intptr_t)i));
+  }
+}
+
+// Median frame, and the median step on its own
+static void measure(Run &run, int frames, const fred::Frustum &frustum, double &frameMs, double &stepMs) {
+  const fred::Aabb unitBox = {glm::vec3(-0.5f), glm::vec3(0.5f)};
+  std::vector<double> frameSamples, stepSamples;
+  std::vector<void *> visible;
+  for (int frame = 0; frame < frames; frame++) {
+    benchClock::time_point start = benchClock::now();
+    run.simulation.publish();
+    // A step a frame, so both runs do the same steps whatever the clock says
+    run.simulation.advance(run.simulation.timestep);
+    for (size_t i = 0; i < run.transforms.size(); i++) {
+      run.tree.move(run.proxies[i], fred::transformAabb(unitBox, run.transforms[i]->getWorldMatrix()));
+    }
+    visible.clear();
+    run.tree.query(frustum, visible);
+    std::sort(visible.begin(), visible.end());
+    frameSamples.push_back(elapsedMs(start));
+    if (frame > 0) {
+      stepSamples.push_back(run.simulation.getStats().stepMs);
+    }
+  }
+  run.simulation.finish();
+  frameMs = median(frameSamples);
+  stepMs = median(stepSamples);
+}
+
+static bool sameState(const fred::SimulationState &a, const fred::SimulationState &b) {
+  if (a.step != b.step) {
+    return false;
+  }
+  for (size_t i = 0; i < a.transforms.size(); i++) {
+    if (a.transforms[i].position != b.transforms[i].position || a.transforms[i].rotation != b.transforms[i].rotation) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int objectCount = argc > 1 ? atoi(argv[1]) : 20000;
+  int frames = argc > 2 ? atoi(argv[2]) : 120;
+  if (objectCount < 1 || frames < 2) {
+    fprintf(stderr, "Usage: %s [objects] [frames]\n", argv[0]);
+    return 1;
+  }
+
+  glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 40.0f, 80.0f), glm::vec3(0.0f), glm::vec3(0, 1, 0));
+  fred::Frustum frustum = fred::Frustum::fromMatrix(projection * view);
+
+  printf("%d objects, %d frames, %u hardware threads\n", objectCount, frames, std::thread::hardware_concurrency());
+  printf("%10s %10s %12s %14s %10s\n", "substeps", "step ms", "serial ms", "pipelined ms", "speedup");
+  const int loads[] = {0, 4, 16, 32, 64, 128};
+  for (int substeps : loads) {
+    Run serial, pipelined;
+    setup(serial, objectCount, substeps, false);
+    setup(pipelined, objectCount, substeps, true);
+    double serialMs, pipelinedMs, stepMs, unused;
+    measure(serial, frames, frustum, serialMs, stepMs);
+    measure(pipelined, frames, frustum, pipelinedMs, unused);
+    if (!sameState(serial.simulation.getState(), pipelined.simulation.getState())) {
+      fprintf(stderr, "The threaded simulation didn't end up where the serial one did!\n");
+      return 1;
+    }
+    printf("%10d %10.3f %12.3f %14.3f %9.2fx\n", substeps, stepMs, serialMs, pipelinedMs, serialMs / pipelinedMs);
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Shader build time for the standard shaders down every path that makes a
+// program: plain files blocking and async through the resource cache, and a
+// variant. Each path runs with the shader cache off and then on. Exits
+// non-zero if any path leaves a program unbuilt, so it's also the check that
+// plain file shaders still get FrameData.
+// Usage: bench-shaders
+// Needs a GL 3.3 context, the window is hidden. Run from the build directory.
+
+#include <stdio.h>
+#include <memory>
+
+#include "bench.h"
+#include "engine.h"
+#include "resources.h"
+
+static const char *VERT = "../shaders/standard.vert";
+static const char *FRAG = "../shaders/standard.frag";
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+// Async loads stand in with the placeholder until their job is through
+static bool built(const fred::Shader &shader) {
+  return shader.shaderProgram != 0 && shader.shaderProgram != fred::placeholderProgram(false);
+}
+
+// Out of the resource cache and the variant registry, so the next run
+// builds again
+static void forget() {
+  fred::resources.clear();
+  fred::destroyShaderVariants();
+}
+
+static double blocking() {
+  benchClock::time_point start = benchClock::now();
+  std::shared_ptr<fred::Shader> shader = fred::resources.getShader(VERT, FRAG, "", fred::LoadMode::Blocking);
+  double ms = elapsedMs(start);
+  check(built(*shader), "getShader blocking builds standard.vert and standard.frag");
+  return ms;
+}
+
+static double async() {
+  benchClock::time_point start = benchClock::now();
+  std::shared_ptr<fred::Shader> shader = fred::resources.getShader(VERT, FRAG, "", fred::LoadMode::Async);
+  while (!shader->isLoaded()) {
+    fred::assetLoader.processUploads();
+  }
+  double ms = elapsedMs(start);
+  check(built(*shader), "getShader async builds standard.vert and standard.frag");
+  return ms;
+}
+
+static double variant() {
+  benchClock::time_point start = benchClock::now();
+  std::shared_ptr<fred::Shader> shader = fred::resources.getShaderVariant(VERT, FRAG, fred::SHADER_LIT);
+  double ms = elapsedMs(start);
+  check(built(*shader), "getShaderVariant builds standard.vert and standard.frag lit");
+  return ms;
+}
+
+int main(int argc, char **argv) {
+  GLFWwindow *window = createBenchContext(64, 64);
+  if (window == NULL) {
+    return 1;
+  }
+
+  printf("%-10s %12s %12s\n", "path", "cold (ms)", "cached (ms)");
+  double (*paths[3])() = {blocking, async, variant};
+  const char *names[3] = {"blocking", "async", "variant"};
+  for (int i = 0; i < 3; i++) {
+    // Once to fill the shader cache, then again out of it
+    setShaderCacheDirectory(NULL);
+    double cold = paths[i]();
+    forget();
+    setShaderCacheDirectory("shader_cache");
+    paths[i]();
+    forget();
+    double cached = paths[i]();
+    forget();
+    printf("%-10s %12.3f %12.3f\n", names[i], cold, cached);
+  }
+
+  fred::assetLoader.shutdown();
+  destroyBenchContext(window);
+  printf("%s\n", failures == 0 ? "ok" : "FAILED");
+  return failures == 0 ? 0 : 1;
+}
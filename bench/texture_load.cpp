@@ -0,0 +1,101 @@
+// Texture startup cost: SOIL2 decoding, flipping, mipping and compressing a
+// source image, the way loadTexture used to, against mapping a cooked .ftex
+// and handing each level to glCompressedTexImage2D
+// Usage: bench-texture-load [iterations] [textures...]
+// Run from the build directory, defaults to everything the demo loads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <SOIL2.h>
+
+#include "bench.h"
+#include "engine.h"
+#include "texture.h"
+
+// Both paths end in the driver, so wait for it before stopping the clock
+static void finish(GLuint texture) {
+  glFinish();
+  glDeleteTextures(1, &texture);
+  fred::glState.invalidate(); // The name can come straight back from glGenTextures
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10;
+  std::vector<std::string> textures;
+  for (int i = 2; i < argc; i++) {
+    textures.push_back(argv[i]);
+  }
+  if (textures.empty()) {
+    textures.push_back("../textures/texture.bmp");
+    textures.push_back("../textures/suzanne_albedo.png");
+    textures.push_back("../textures/suzanne_specular.png");
+    textures.push_back("../textures/teapot.png");
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  GLFWwindow *window = createBenchContext(64, 64);
+  if (window == NULL) {
+    return 1;
+  }
+
+  printf("%-24s %7s %12s %12s %9s\n", "texture", "format", "soil2 (ms)", "cooked (ms)", "speedup");
+  double soilTotal = 0.0;
+  double cookedTotal = 0.0;
+  for (const std::string &texture : textures) {
+    std::string base = texture.substr(texture.find_last_of("/\\") + 1);
+    std::string cookedPath = fred::cookedTexturePath(base); // Cook into the cwd
+
+    int width, height, channels;
+    unsigned char *image = SOIL_load_image(texture.c_str(), &width, &height, &channels, SOIL_LOAD_RGBA);
+    if (image == NULL ||
+        !fred::writeCookedTexture(cookedPath.c_str(), image, width, height, fred::guessTextureUsage(texture))) {
+      fprintf(stderr, "Failed to cook %s\n", texture.c_str());
+      SOIL_free_image_data(image);
+      destroyBenchContext(window);
+      return 1;
+    }
+    SOIL_free_image_data(image);
+
+    std::vector<double> soilTimes;
+    std::vector<double> cookedTimes;
+    const char *format = "?";
+    for (int i = 0; i < iterations; i++) {
+      benchClock::time_point start = benchClock::now();
+      GLuint soil = SOIL_load_OGL_texture(
+          texture.c_str(), SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID,
+          SOIL_FLAG_MIPMAPS | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_INVERT_Y);
+      finish(soil);
+      soilTimes.push_back(elapsedMs(start));
+
+      start = benchClock::now();
+      fred::CookedTexture cooked;
+      if (!fred::mapCookedTexture(cookedPath.c_str(), NULL, cooked)) {
+        fprintf(stderr, "Failed to map %s\n", cookedPath.c_str());
+        destroyBenchContext(window);
+        return 1;
+      }
+      finish(fred::uploadCookedTexture(cooked));
+      cookedTimes.push_back(elapsedMs(start));
+      static const char *formats[] = {"BC1", "BC3", "BC5"};
+      format = formats[(int)cooked.format()];
+    }
+    remove(cookedPath.c_str());
+
+    double soilMs = median(soilTimes);
+    double cookedMs = median(cookedTimes);
+    soilTotal += soilMs;
+    cookedTotal += cookedMs;
+    printf("%-24s %7s %12.3f %12.3f %8.1fx\n", base.c_str(), format, soilMs, cookedMs,
+           cookedMs > 0.0 ? soilMs / cookedMs : 0.0);
+  }
+  printf("%-24s %7s %12.3f %12.3f %8.1fx\n", "total", "", soilTotal, cookedTotal,
+         cookedTotal > 0.0 ? soilTotal / cookedTotal : 0.0);
+
+  destroyBenchContext(window);
+  return 0;
+}
@@ -0,0 +1,96 @@
+// Per frame transform cost for a mostly static scene graph, rebuilding every
+// matrix like the renderer used to against the cached, dirty flagged ones
+// Usage: bench-transforms [nodes] [frames] [moving percent]
+// CPU only, no GL context needed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "bench.h"
+#include "transform.h"
+
+static const int CHILDREN_PER_GROUP = 100;
+
+// The old Asset::getModelMatrix
+static glm::mat4 rebuildMatrix(const fred::Transform &transform) {
+  glm::mat4 rotationMatrix = glm::mat4_cast(transform.getRotation());
+  glm::mat4 translationMatrix = glm::translate(glm::mat4(1), transform.getPosition());
+  glm::mat4 scalingMatrix = glm::scale(glm::mat4(1), transform.getScale());
+  return translationMatrix * rotationMatrix * scalingMatrix;
+}
+
+int main(int argc, char **argv) {
+  int nodeCount = argc > 1 ? atoi(argv[1]) : 50000;
+  int frames = argc > 2 ? atoi(argv[2]) : 120;
+  int movingPercent = argc > 3 ? atoi(argv[3]) : 1;
+  if (nodeCount < 1 || frames < 1 || movingPercent < 0 || movingPercent > 100) {
+    fprintf(stderr, "Usage: %s [nodes] [frames] [moving percent]\n", argv[0]);
+    return 1;
+  }
+
+  // Groups of props under one parent each, a level's worth of static meshes
+  int groupCount = (nodeCount + CHILDREN_PER_GROUP - 1) / CHILDREN_PER_GROUP;
+  std::vector<std::unique_ptr<fred::Transform>> groups(groupCount);
+  std::vector<std::unique_ptr<fred::Transform>> nodes(nodeCount);
+  for (int i = 0; i < groupCount; i++) {
+    groups[i].reset(new fred::Transform());
+    groups[i]->setPosition(glm::vec3((i % 32) * 40.0f, 0.0f, (i / 32) * 40.0f));
+  }
+  for (int i = 0; i < nodeCount; i++) {
+    nodes[i].reset(new fred::Transform());
+    nodes[i]->setPosition(glm::vec3(i % 10 * 3.0f, 0.0f, i / 10 % 10 * 3.0f));
+    nodes[i]->setRotation(glm::quat(glm::vec3(0.0f, i * 0.1f, 0.0f)));
+    nodes[i]->setScale(glm::vec3(0.5f));
+    nodes[i]->setParent(groups[i / CHILDREN_PER_GROUP].get());
+  }
+
+  int moving = nodeCount * movingPercent / 100;
+  int movingGroups = moving / CHILDREN_PER_GROUP; // A moving group takes its children with it
+  std::vector<double> rebuildSamples, cachedSamples;
+  std::vector<glm::mat4> matrices(nodeCount);
+  glm::quat spin = glm::quat(glm::vec3(0.0f, glm::radians(1.0f), 0.0f));
+  float checksum = 0.0f;
+
+  for (int frame = 0; frame < frames; frame++) {
+    for (int i = 0; i < movingGroups; i++) {
+      groups[i * (groupCount / movingGroups)]->rotate(spin);
+    }
+    for (int i = 0; i < moving - movingGroups * CHILDREN_PER_GROUP; i++) {
+      nodes[i * (nodeCount / moving)]->rotate(spin);
+    }
+
+    // Everything every frame, parent then child
+    benchClock::time_point start = benchClock::now();
+    for (int i = 0; i < nodeCount; i++) {
+      matrices[i] = rebuildMatrix(*groups[i / CHILDREN_PER_GROUP]) * rebuildMatrix(*nodes[i]);
+    }
+    rebuildSamples.push_back(elapsedMs(start));
+    checksum += matrices[nodeCount - 1][3][0];
+
+    // What the renderer does now, only dirty subtrees do any math
+    start = benchClock::now();
+    for (int i = 0; i < nodeCount; i++) {
+      matrices[i] = nodes[i]->getWorldMatrix();
+    }
+    cachedSamples.push_back(elapsedMs(start));
+    checksum -= matrices[nodeCount - 1][3][0];
+  }
+
+  printf("%d nodes in %d groups, %d frames, %d moving per frame\n", nodeCount, groupCount, frames, moving);
+  printf("%-24s %12s\n", "path", "median (ms)");
+  printf("%-24s %12.3f\n", "rebuild every frame", median(rebuildSamples));
+  printf("%-24s %12.3f\n", "cached, dirty flags", median(cachedSamples));
+  // Both paths have to agree on where things are
+  if (fabsf(checksum) > 1e-2f * frames) {
+    fprintf(stderr, "Cached matrices don't match the rebuilt ones!\n");
+    return 1;
+  }
+  return 0;
+}
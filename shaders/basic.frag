@@ -1,14 +0,0 @@
-#version 330 core
-
-// Interpolated vals from vert shaders
-in vec2 UV;
-
-layout(location = 0) out vec3 color;
-
-// Values stay constant
-uniform sampler2D textureSampler;
-
-void main() {
-    color = texture(textureSampler, UV).rgb;
-    //color = vec3(1, 1, 1);
-}
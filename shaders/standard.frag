@@ -0,0 +1,131 @@
+#version 330 core
+
+// Variants, see standard.vert
+#ifdef DEPTH_ONLY
+#undef LIT
+#undef LIGHTMAPPED
+#endif
+
+#ifdef DEPTH_ONLY
+// Nothing to write, depth is all a shadow map wants
+void main() {
+}
+#else
+
+in vec2 UV;
+#ifdef LIT
+in vec3 position_cameraspace;
+in vec3 normal_cameraspace;
+#endif
+#ifdef LIGHTMAPPED
+in vec2 lightmapUV;
+#endif
+
+layout(location = 0) out vec3 color;
+
+uniform sampler2D albedoSampler;
+#ifdef LIGHTMAPPED
+// RGBM, the 8 is LIGHTMAP_RANGE in src/lightmap.h
+uniform sampler2D lightmapSampler;
+
+vec3 bakedLight() {
+  vec4 rgbm = texture(lightmapSampler, lightmapUV);
+  return rgbm.rgb * rgbm.a * 8.0;
+}
+#endif
+#ifdef LIT
+uniform sampler2D specularSampler;
+
+// FrameData, once per frame, goes in ahead of this with the defines. See
+// FRAME_DATA_GLSL in src/uniforms.cpp.
+
+// The light grid, see LightGrid in src/lighting.h
+uniform samplerBuffer lightData;      // Two texels a light, view space position and radius, color times power
+uniform usamplerBuffer lightClusters; // Offset into lightIndices and count
+uniform usamplerBuffer lightIndices;
+
+// A layer per cascade, see ShadowMaps in src/shadows.h
+uniform sampler2DArrayShadow shadowMap;
+
+vec3 materialDiffuseColor;
+vec3 materialSpecularColor;
+vec3 n;
+vec3 E;
+
+// One light arriving from direction l
+vec3 shade(vec3 l, vec3 radiance) {
+  float cosTheta = clamp(dot(n, l), 0, 1);
+  vec3 R = reflect(-l, n);
+  float cosAlpha = clamp(dot(E, R), 0, 1);
+  return (materialDiffuseColor * cosTheta + materialSpecularColor * pow(cosAlpha, 5)) * radiance;
+}
+
+// 1 lit, 0 in shadow. Nine bilinear compares, so a 4x4 texel footprint.
+float sunShadow() {
+  float depth = -position_cameraspace.z;
+  int cascade = 0;
+  while (cascade < 4 && depth > cascadeEnds[cascade]) {
+    cascade++;
+  }
+  if (cascade == 4) {
+    return 1.0; // Past the shadow distance
+  }
+  // Pushed out along the normal by a texel or so, that's what acne is made of
+  vec3 position = position_cameraspace + n * cascadeTexels[cascade] * 1.5;
+  vec3 coords = (shadowMatrices[cascade] * vec4(position, 1)).xyz;
+  vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+  float lit = 0.0;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, cascade, coords.z));
+    }
+  }
+  return lit / 9.0;
+}
+#endif
+
+void main() {
+#ifdef LIT
+  materialDiffuseColor = texture(albedoSampler, UV).rgb;
+  vec3 materialAmbientColor = vec3(0.1, 0.1, 0.1) * materialDiffuseColor;
+  materialSpecularColor = texture(specularSampler, UV).rgb;
+  n = normalize(normal_cameraspace);
+  E = normalize(-position_cameraspace);
+
+#ifdef LIGHTMAPPED
+  // The sun, its shadows and the bounce light are all in here already
+  color = materialDiffuseColor * bakedLight();
+#else
+  color = materialAmbientColor;
+  if (sunColor.rgb != vec3(0.0)) {
+    float shadow = sunDirection.w != 0.0 ? sunShadow() : 1.0;
+    color += shade(sunDirection.xyz, sunColor.rgb * shadow);
+  }
+#endif
+
+  // Only the lights that reach this fragment's cluster
+  ivec3 counts = ivec3(clusterCounts.xyz);
+  ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, log(-position_cameraspace.z) * clusterScale.z + clusterScale.w);
+  cluster = clamp(cluster, ivec3(0), counts - 1);
+  uvec2 range = texelFetch(lightClusters, cluster.x + counts.x * (cluster.y + counts.y * cluster.z)).rg;
+
+  for (uint i = 0u; i < range.y; i++) {
+    int light = int(texelFetch(lightIndices, int(range.x + i)).r);
+    vec4 positionRadius = texelFetch(lightData, light * 2);
+    vec3 lightColor = texelFetch(lightData, light * 2 + 1).rgb;
+
+    vec3 toLight = positionRadius.xyz - position_cameraspace;
+    float distanceSquared = max(dot(toLight, toLight), 1e-4);
+    // Inverse square, faded out to nothing at the radius
+    float window = clamp(1.0 - pow(distanceSquared / (positionRadius.w * positionRadius.w), 2.0), 0.0, 1.0);
+    float attenuation = window * window / distanceSquared;
+
+    color += shade(toLight * inversesqrt(distanceSquared), lightColor * attenuation);
+  }
+#elif defined(LIGHTMAPPED)
+  color = texture(albedoSampler, UV).rgb * bakedLight();
+#else
+  color = texture(albedoSampler, UV).rgb;
+#endif
+}
+#endif
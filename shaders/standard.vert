@@ -0,0 +1,73 @@
+#version 330 core
+
+// Variants, see ShaderFeature in src/variants.h. The #defines go in right
+// after #version.
+//   INSTANCED  model matrix from attributes 3 to 6 instead of ObjectData
+//   LIT        clustered point lights and the sun, needs normals
+//   DEPTH_ONLY positions only, for shadow maps. Anything shading related
+//              is ignored with it.
+//   LIGHTMAPPED baked light from a second set of UVs at location 7, see
+//              fred-bake. Stands in for the sun and ambient.
+#ifdef DEPTH_ONLY
+#undef LIT
+#undef LIGHTMAPPED
+#endif
+
+layout(location = 0) in vec3 vertexPosition_modelspace;
+#ifndef DEPTH_ONLY
+layout(location = 1) in vec2 vertexUV;
+#endif
+#ifdef LIT
+layout(location = 2) in vec3 vertexNormal_modelspace;
+#endif
+#ifdef INSTANCED
+layout(location = 3) in mat4 instanceModel; // Takes locations 3 to 6
+#endif
+#ifdef LIGHTMAPPED
+layout(location = 7) in vec2 vertexLightmapUV;
+#endif
+
+// To the frag shader
+#ifndef DEPTH_ONLY
+out vec2 UV;
+#endif
+#ifdef LIT
+out vec3 position_cameraspace;
+out vec3 normal_cameraspace;
+#endif
+#ifdef LIGHTMAPPED
+out vec2 lightmapUV;
+#endif
+
+// FrameData, once per frame, goes in ahead of this with the defines. See
+// FRAME_DATA_GLSL in src/uniforms.cpp.
+
+#ifndef INSTANCED
+// Once per draw, see ObjectUniforms in src/uniforms.h
+layout(std140) uniform ObjectData {
+    mat4 m;
+};
+#endif
+
+void main() {
+#ifdef INSTANCED
+    mat4 model = instanceModel;
+#else
+    mat4 model = m;
+#endif
+    vec4 vertexPosition_worldspace = model * vec4(vertexPosition_modelspace, 1);
+    gl_Position = vp * vertexPosition_worldspace;
+
+#ifdef LIT
+    // Lights come in view space, see LightGrid in src/lighting.h
+    position_cameraspace = (v * vertexPosition_worldspace).xyz;
+    normal_cameraspace = (v * model * vec4(vertexNormal_modelspace, 0)).xyz;
+#endif
+
+#ifndef DEPTH_ONLY
+    UV = vertexUV;
+#endif
+#ifdef LIGHTMAPPED
+    lightmapUV = vertexLightmapUV;
+#endif
+}
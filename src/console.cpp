@@ -0,0 +1,188 @@
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#include "console.h"
+#include "profiler.h"
+
+namespace fred {
+
+Console console;
+
+void LogBuffer::append(clog_log_level_e level, const char *message, int length) {
+  double time = profilerNow();
+  const char *end = message + length;
+  const char *line = message;
+  while (line < end) {
+    const char *newline = (const char *)memchr(line, '\n', end - line);
+    const char *lineEnd = newline != NULL ? newline : end;
+    // Empty lines are kept, they're in the output for a reason
+    size_t lineLength = lineEnd - line;
+    do {
+      size_t chunk = std::min(lineLength, sizeof(LogEntry::text) - 1);
+      appendLine(level, time, line, chunk);
+      line += chunk;
+      lineLength -= chunk;
+    } while (lineLength > 0);
+    line = lineEnd + 1;
+  }
+}
+
+void LogBuffer::appendLine(clog_log_level_e level, double time, const char *line, size_t length) {
+  uint64_t sequence = next.fetch_add(1, std::memory_order_acq_rel);
+  Slot &slot = slots[sequence % CAPACITY];
+
+  // Only a writer CAPACITY lines ahead or behind can be on the same slot
+  uint64_t published = slot.published.load(std::memory_order_acquire);
+  for (;;) {
+    if (published == WRITING) {
+      std::this_thread::yield();
+      published = slot.published.load(std::memory_order_acquire);
+      continue;
+    }
+    if (published > sequence + 1) {
+      return; // Lapped, a newer line already has the slot
+    }
+    if (slot.published.compare_exchange_weak(published, WRITING, std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+
+  uint64_t words[WORDS] = {};
+  memcpy(words, line, length); // Zeroed past the end, so always terminated
+  slot.level.store(level, std::memory_order_relaxed);
+  slot.time.store(time, std::memory_order_relaxed);
+  for (int i = 0; i < WORDS; i++) {
+    slot.text[i].store(words[i], std::memory_order_relaxed);
+  }
+  slot.published.store(sequence + 1, std::memory_order_release);
+}
+
+LogRead LogBuffer::read(uint64_t sequence, LogEntry &entry) const {
+  if (sequence >= end()) {
+    return LogRead::Pending;
+  }
+  const Slot &slot = slots[sequence % CAPACITY];
+  uint64_t published = slot.published.load(std::memory_order_acquire);
+  if (published != sequence + 1) {
+    // Either its writer hasn't got there yet or a newer line has
+    if (sequence < begin() || (published != WRITING && published > sequence + 1)) {
+      return LogRead::Gone;
+    }
+    return LogRead::Pending;
+  }
+
+  uint64_t words[WORDS];
+  entry.sequence = sequence;
+  entry.level = (clog_log_level_e)slot.level.load(std::memory_order_relaxed);
+  entry.time = slot.time.load(std::memory_order_relaxed);
+  for (int i = 0; i < WORDS; i++) {
+    words[i] = slot.text[i].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot.published.load(std::memory_order_relaxed) != published) {
+    return LogRead::Gone; // Rewritten while we were copying
+  }
+  memcpy(entry.text, words, sizeof(entry.text));
+  entry.text[sizeof(entry.text) - 1] = '\0';
+  return LogRead::Ok;
+}
+
+void Console::clogCallback(clog_log_level_e level, char *message, int length) {
+  console.buffer.append(level, message, length);
+}
+
+bool Console::passes(const LogEntry &entry) const {
+  return entry.sequence >= clearedBefore && showLevel[entry.level] && search.PassFilter(entry.text);
+}
+
+// Picks up where the last scan stopped, at most CAPACITY lines
+void Console::scan() {
+  uint64_t oldest = std::max(buffer.begin(), clearedBefore);
+  while (!visible.empty() && visible.front() < oldest) {
+    visible.pop_front();
+  }
+  scanned = std::max(scanned, oldest);
+
+  uint64_t end = buffer.end();
+  LogEntry entry;
+  for (; scanned < end; scanned++) {
+    LogRead result = buffer.read(scanned, entry);
+    if (result == LogRead::Pending) {
+      break; // Lines after it may be done, but they'd come out of order
+    }
+    if (result == LogRead::Ok && passes(entry)) {
+      visible.push_back(scanned);
+    }
+  }
+}
+
+void Console::refilter() {
+  visible.clear();
+  scanned = 0;
+  scan();
+}
+
+void Console::drawWindow() {
+  ImGui::Begin("Console");
+  if (ImGui::BeginPopup("Options")) {
+    ImGui::Checkbox("Auto-scroll", &autoScroll);
+    ImGui::EndPopup();
+  }
+  if (ImGui::Button("Options")) {
+    ImGui::OpenPopup("Options");
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Clear")) {
+    clearedBefore = buffer.end();
+    visible.clear();
+  }
+
+  const char *levelNames[] = {"Debug", "Info", "Warn", "Error", "Fatal"};
+  bool changed = false;
+  for (int i = 0; i <= CLOG_LEVEL_FATAL; i++) {
+    ImGui::SameLine();
+    if (ImGui::Checkbox(levelNames[i], &showLevel[i])) {
+      changed = true;
+    }
+  }
+  if (search.Draw("Search", 200.0f) || changed) {
+    refilter();
+  } else {
+    scan();
+  }
+  ImGui::Separator();
+
+  const ImVec4 levelColors[] = {ImVec4(0.6f, 0.6f, 0.6f, 1.0f), ImGui::GetStyleColorVec4(ImGuiCol_Text),
+                                ImVec4(1.0f, 0.8f, 0.3f, 1.0f), ImVec4(1.0f, 0.4f, 0.4f, 1.0f),
+                                ImVec4(1.0f, 0.2f, 0.2f, 1.0f)};
+  if (ImGui::BeginChild("ScrollingRegion", ImVec2(0, 0), ImGuiChildFlags_NavFlattened, ImGuiWindowFlags_HorizontalScrollbar)) {
+    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 1));
+    ImGuiListClipper clipper;
+    clipper.Begin((int)visible.size());
+    LogEntry entry;
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        // Overwritten since the scan, still takes up its row
+        if (buffer.read(visible[i], entry) != LogRead::Ok) {
+          ImGui::TextUnformatted("");
+          continue;
+        }
+        ImGui::PushStyleColor(ImGuiCol_Text, levelColors[entry.level]);
+        ImGui::Text("[%9.3f] %s", entry.time / 1000.0, entry.text);
+        ImGui::PopStyleColor();
+      }
+    }
+    clipper.End();
+    ImGui::PopStyleVar();
+
+    // Only follows new lines if it was already at the bottom
+    if (autoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) {
+      ImGui::SetScrollHereY(1.0f);
+    }
+  }
+  ImGui::EndChild();
+  ImGui::End();
+}
+
+} // namespace fred
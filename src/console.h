@@ -0,0 +1,96 @@
+#ifndef FRED_CONSOLE_H
+#define FRED_CONSOLE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <string>
+
+#include <clog/clog.h>
+#include <imgui.h>
+
+namespace fred {
+
+enum class LogRead { Ok, Pending, Gone };
+
+struct LogEntry {
+  uint64_t sequence; // Counts every line ever logged, gaps are lines that got overwritten
+  clog_log_level_e level;
+  double time;       // profilerNow
+  char text[256];    // Longer lines carry on in the next entry
+};
+
+// The last CAPACITY lines of clog output, oldest overwritten first. Any
+// thread can append without taking a lock: a line claims a slot with one
+// fetch_add and publishes it with a per slot sequence, seqlock style.
+// Reading a slot that's being rewritten under the reader just fails. A
+// writer lapped by CAPACITY lines while still copying loses its line.
+class LogBuffer {
+public:
+  static constexpr int CAPACITY = 4096;
+
+  // Splits on newlines, any thread
+  void append(clog_log_level_e level, const char *message, int length);
+  // Copies out line sequence. Pending while it's still being written, Gone
+  // once it's been overwritten or its writer lost it.
+  LogRead read(uint64_t sequence, LogEntry &entry) const;
+
+  // One past the last claimed line, some of those may still be being written
+  uint64_t end() const { return next.load(std::memory_order_acquire); }
+  // Oldest line that can still be in the buffer
+  uint64_t begin() const {
+    uint64_t last = end();
+    return last > CAPACITY ? last - CAPACITY : 0;
+  }
+
+private:
+  static constexpr int WORDS = sizeof(LogEntry::text) / sizeof(uint64_t);
+  static constexpr uint64_t WRITING = ~(uint64_t)0;
+
+  // Text is stored as relaxed atomic words so a torn read is a lost line
+  // rather than a data race
+  struct Slot {
+    std::atomic<uint64_t> published{0}; // sequence + 1, 0 when empty
+    std::atomic<int> level{0};
+    std::atomic<double> time{0.0};
+    std::atomic<uint64_t> text[WORDS];
+  };
+
+  std::atomic<uint64_t> next{0};
+  Slot slots[CAPACITY];
+
+  void appendLine(clog_log_level_e level, double time, const char *line, size_t length);
+};
+
+// The "Console" window. Keeps the sequences of the lines that pass the
+// filters and only those, updated with whatever got logged since last
+// frame, and draws them through a list clipper. Nothing per frame depends on
+// how much has been logged. GL thread.
+class Console {
+public:
+  LogBuffer buffer;
+
+  // The clog callback
+  static void clogCallback(clog_log_level_e level, char *message, int length);
+
+  // Inside an ImGui frame
+  void drawWindow();
+
+private:
+  std::deque<uint64_t> visible; // Lines passing the filters, oldest first
+  uint64_t scanned = 0;         // Lines before this have been filtered
+  uint64_t clearedBefore = 0;
+  bool showLevel[CLOG_LEVEL_FATAL + 1] = {true, true, true, true, true};
+  ImGuiTextFilter search;
+  bool autoScroll = true;
+
+  bool passes(const LogEntry &entry) const;
+  void refilter();
+  void scan();
+};
+
+extern Console console;
+
+} // namespace fred
+
+#endif
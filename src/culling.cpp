@@ -0,0 +1,388 @@
+#include "culling.h"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRED_CULLING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace fred {
+
+Aabb transformAabb(const Aabb &box, const glm::mat4 &transform) {
+  glm::vec3 center = (box.min + box.max) * 0.5f;
+  glm::vec3 extents = (box.max - box.min) * 0.5f;
+  glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+  glm::vec3 worldExtents = glm::abs(glm::vec3(transform[0])) * extents.x +
+                           glm::abs(glm::vec3(transform[1])) * extents.y +
+                           glm::abs(glm::vec3(transform[2])) * extents.z;
+  return {worldCenter - worldExtents, worldCenter + worldExtents};
+}
+
+// Frustum ================================================================== //
+
+Frustum Frustum::fromMatrix(const glm::mat4 &viewProjection) {
+  // Gribb and Hartmann, each plane is the last row plus or minus another one
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+  }
+  glm::vec4 planes[6] = {
+      rows[3] + rows[0], rows[3] - rows[0], // Left, right
+      rows[3] + rows[1], rows[3] - rows[1], // Bottom, top
+      rows[3] + rows[2], rows[3] - rows[2], // Near, far
+  };
+
+  Frustum frustum;
+  for (int i = 0; i < PLANE_COUNT; i++) {
+    glm::vec4 plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // Everything is in front of it
+    if (i < 6) {
+      float length = glm::length(glm::vec3(planes[i]));
+      plane = length > 0.0f ? planes[i] / length : planes[i];
+    }
+    frustum.planeX[i] = plane.x;
+    frustum.planeY[i] = plane.y;
+    frustum.planeZ[i] = plane.z;
+    frustum.planeW[i] = plane.w;
+  }
+  return frustum;
+}
+
+// Distance from the box center to the plane against the box's projected
+// radius. Past the plane by more than the radius is outside, less is straddling.
+CullResult Frustum::testScalar(const Aabb &box) const {
+  glm::vec3 center = (box.min + box.max) * 0.5f;
+  glm::vec3 extents = (box.max - box.min) * 0.5f;
+  CullResult result = CullResult::Inside;
+  for (int i = 0; i < 6; i++) {
+    float distance = planeX[i] * center.x + planeY[i] * center.y + planeZ[i] * center.z + planeW[i];
+    float radius = fabsf(planeX[i]) * extents.x + fabsf(planeY[i]) * extents.y + fabsf(planeZ[i]) * extents.z;
+    if (distance + radius < 0.0f) {
+      return CullResult::Outside;
+    }
+    if (distance - radius < 0.0f) {
+      result = CullResult::Intersects;
+    }
+  }
+  return result;
+}
+
+#ifdef FRED_CULLING_SSE
+CullResult Frustum::test(const Aabb &box) const {
+  __m128 half = _mm_set1_ps(0.5f);
+  __m128 centerX = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(box.min.x), _mm_set1_ps(box.max.x)), half);
+  __m128 centerY = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(box.min.y), _mm_set1_ps(box.max.y)), half);
+  __m128 centerZ = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(box.min.z), _mm_set1_ps(box.max.z)), half);
+  __m128 extentsX = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.x), _mm_set1_ps(box.min.x)), half);
+  __m128 extentsY = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.y), _mm_set1_ps(box.min.y)), half);
+  __m128 extentsZ = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(box.max.z), _mm_set1_ps(box.min.z)), half);
+  __m128 signBit = _mm_set1_ps(-0.0f);
+  __m128 zero = _mm_setzero_ps();
+
+  int outside = 0;
+  int intersects = 0;
+  for (int i = 0; i < PLANE_COUNT; i += 4) {
+    __m128 x = _mm_load_ps(planeX + i);
+    __m128 y = _mm_load_ps(planeY + i);
+    __m128 z = _mm_load_ps(planeZ + i);
+    __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, centerX), _mm_mul_ps(y, centerY)),
+                                 _mm_add_ps(_mm_mul_ps(z, centerZ), _mm_load_ps(planeW + i)));
+    __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signBit, x), extentsX),
+                                          _mm_mul_ps(_mm_andnot_ps(signBit, y), extentsY)),
+                               _mm_mul_ps(_mm_andnot_ps(signBit, z), extentsZ));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+    intersects |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+  }
+  if (outside != 0) {
+    return CullResult::Outside;
+  }
+  return intersects != 0 ? CullResult::Intersects : CullResult::Inside;
+}
+#else
+CullResult Frustum::test(const Aabb &box) const {
+  return testScalar(box);
+}
+#endif
+
+// BoundsTree =============================================================== //
+
+int BoundsTree::allocateNode() {
+  int node;
+  if (freeList != NULL_NODE) {
+    node = freeList;
+    freeList = nodes[node].parent;
+  } else {
+    node = (int)nodes.size();
+    nodes.push_back(Node());
+  }
+  nodes[node].userData = nullptr;
+  nodes[node].parent = NULL_NODE;
+  nodes[node].child1 = NULL_NODE;
+  nodes[node].child2 = NULL_NODE;
+  nodes[node].height = 0;
+  return node;
+}
+
+void BoundsTree::freeNode(int node) {
+  nodes[node].parent = freeList;
+  nodes[node].height = -1;
+  freeList = node;
+}
+
+int BoundsTree::insert(const Aabb &box, void *userData) {
+  int proxy = allocateNode();
+  glm::vec3 fat = glm::vec3(margin);
+  nodes[proxy].box = {box.min - fat, box.max + fat};
+  nodes[proxy].userData = userData;
+  insertLeaf(proxy);
+  proxyCount++;
+  return proxy;
+}
+
+void BoundsTree::remove(int proxy) {
+  removeLeaf(proxy);
+  freeNode(proxy);
+  proxyCount--;
+}
+
+bool BoundsTree::move(int proxy, const Aabb &box) {
+  if (nodes[proxy].box.contains(box)) {
+    return false;
+  }
+  removeLeaf(proxy);
+  glm::vec3 fat = glm::vec3(margin);
+  nodes[proxy].box = {box.min - fat, box.max + fat};
+  insertLeaf(proxy);
+  return true;
+}
+
+void BoundsTree::insertLeaf(int leaf) {
+  if (root == NULL_NODE) {
+    root = leaf;
+    nodes[root].parent = NULL_NODE;
+    return;
+  }
+
+  // Walk down to the cheapest sibling by the surface area heuristic
+  Aabb leafBox = nodes[leaf].box;
+  int index = root;
+  while (!nodes[index].isLeaf()) {
+    int child1 = nodes[index].child1;
+    int child2 = nodes[index].child2;
+
+    float area = nodes[index].box.surfaceArea();
+    float combinedArea = nodes[index].box.merge(leafBox).surfaceArea();
+    // Making a new parent here, versus pushing the leaf further down
+    float cost = 2.0f * combinedArea;
+    float inheritanceCost = 2.0f * (combinedArea - area);
+
+    float cost1 = leafBox.merge(nodes[child1].box).surfaceArea() + inheritanceCost;
+    if (!nodes[child1].isLeaf()) {
+      cost1 -= nodes[child1].box.surfaceArea();
+    }
+    float cost2 = leafBox.merge(nodes[child2].box).surfaceArea() + inheritanceCost;
+    if (!nodes[child2].isLeaf()) {
+      cost2 -= nodes[child2].box.surfaceArea();
+    }
+
+    if (cost < cost1 && cost < cost2) {
+      break;
+    }
+    index = cost1 < cost2 ? child1 : child2;
+  }
+
+  int sibling = index;
+  int oldParent = nodes[sibling].parent;
+  int newParent = allocateNode(); // Can reallocate nodes, indices only from here
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].box = leafBox.merge(nodes[sibling].box);
+  nodes[newParent].height = nodes[sibling].height + 1;
+  nodes[newParent].child1 = sibling;
+  nodes[newParent].child2 = leaf;
+  nodes[sibling].parent = newParent;
+  nodes[leaf].parent = newParent;
+  if (oldParent == NULL_NODE) {
+    root = newParent;
+  } else if (nodes[oldParent].child1 == sibling) {
+    nodes[oldParent].child1 = newParent;
+  } else {
+    nodes[oldParent].child2 = newParent;
+  }
+
+  // Refit and rebalance on the way back up
+  index = nodes[leaf].parent;
+  while (index != NULL_NODE) {
+    index = balance(index);
+    Node &node = nodes[index];
+    node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+    node.box = nodes[node.child1].box.merge(nodes[node.child2].box);
+    index = node.parent;
+  }
+}
+
+void BoundsTree::removeLeaf(int leaf) {
+  if (leaf == root) {
+    root = NULL_NODE;
+    return;
+  }
+
+  int parent = nodes[leaf].parent;
+  int grandParent = nodes[parent].parent;
+  int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+  freeNode(parent);
+
+  if (grandParent == NULL_NODE) {
+    root = sibling;
+    nodes[sibling].parent = NULL_NODE;
+    return;
+  }
+
+  if (nodes[grandParent].child1 == parent) {
+    nodes[grandParent].child1 = sibling;
+  } else {
+    nodes[grandParent].child2 = sibling;
+  }
+  nodes[sibling].parent = grandParent;
+
+  int index = grandParent;
+  while (index != NULL_NODE) {
+    index = balance(index);
+    Node &node = nodes[index];
+    node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+    node.box = nodes[node.child1].box.merge(nodes[node.child2].box);
+    index = node.parent;
+  }
+}
+
+// If one side of node is more than one level taller, rotate its root up into
+// node's place. Returns whichever node ends up at this spot.
+int BoundsTree::balance(int iA) {
+  Node *a = &nodes[iA];
+  if (a->isLeaf() || a->height < 2) {
+    return iA;
+  }
+
+  int iB = a->child1;
+  int iC = a->child2;
+  Node *b = &nodes[iB];
+  Node *c = &nodes[iC];
+  int heightDifference = c->height - b->height;
+
+  if (heightDifference > 1) {
+    // Rotate C up
+    int iF = c->child1;
+    int iG = c->child2;
+    Node *f = &nodes[iF];
+    Node *g = &nodes[iG];
+
+    c->child1 = iA;
+    c->parent = a->parent;
+    a->parent = iC;
+    if (c->parent == NULL_NODE) {
+      root = iC;
+    } else if (nodes[c->parent].child1 == iA) {
+      nodes[c->parent].child1 = iC;
+    } else {
+      nodes[c->parent].child2 = iC;
+    }
+
+    if (f->height > g->height) {
+      c->child2 = iF;
+      a->child2 = iG;
+      g->parent = iA;
+      a->box = b->box.merge(g->box);
+      c->box = a->box.merge(f->box);
+      a->height = 1 + std::max(b->height, g->height);
+      c->height = 1 + std::max(a->height, f->height);
+    } else {
+      c->child2 = iG;
+      a->child2 = iF;
+      f->parent = iA;
+      a->box = b->box.merge(f->box);
+      c->box = a->box.merge(g->box);
+      a->height = 1 + std::max(b->height, f->height);
+      c->height = 1 + std::max(a->height, g->height);
+    }
+    return iC;
+  }
+
+  if (heightDifference < -1) {
+    // Rotate B up
+    int iD = b->child1;
+    int iE = b->child2;
+    Node *d = &nodes[iD];
+    Node *e = &nodes[iE];
+
+    b->child1 = iA;
+    b->parent = a->parent;
+    a->parent = iB;
+    if (b->parent == NULL_NODE) {
+      root = iB;
+    } else if (nodes[b->parent].child1 == iA) {
+      nodes[b->parent].child1 = iB;
+    } else {
+      nodes[b->parent].child2 = iB;
+    }
+
+    if (d->height > e->height) {
+      b->child2 = iD;
+      a->child1 = iE;
+      e->parent = iA;
+      a->box = c->box.merge(e->box);
+      b->box = a->box.merge(d->box);
+      a->height = 1 + std::max(c->height, e->height);
+      b->height = 1 + std::max(a->height, d->height);
+    } else {
+      b->child2 = iE;
+      a->child1 = iD;
+      d->parent = iA;
+      a->box = c->box.merge(d->box);
+      b->box = a->box.merge(e->box);
+      a->height = 1 + std::max(c->height, d->height);
+      b->height = 1 + std::max(a->height, e->height);
+    }
+    return iB;
+  }
+
+  return iA;
+}
+
+void BoundsTree::query(const Frustum &frustum, std::vector<void *> &visible) const {
+  if (root == NULL_NODE) {
+    return;
+  }
+  stack.clear();
+  stack.push_back(root);
+  while (!stack.empty()) {
+    int index = stack.back();
+    stack.pop_back();
+    const Node &node = nodes[index];
+
+    CullResult result = frustum.test(node.box);
+    if (result == CullResult::Outside) {
+      continue;
+    }
+    if (result == CullResult::Inside) {
+      addSubtree(index, visible);
+    } else if (node.isLeaf()) {
+      visible.push_back(node.userData);
+    } else {
+      stack.push_back(node.child1);
+      stack.push_back(node.child2);
+    }
+  }
+}
+
+// Recursion depth is the tree height, which balancing keeps around log2(n)
+void BoundsTree::addSubtree(int index, std::vector<void *> &visible) const {
+  const Node &node = nodes[index];
+  if (node.isLeaf()) {
+    visible.push_back(node.userData);
+    return;
+  }
+  addSubtree(node.child1, visible);
+  addSubtree(node.child2, visible);
+}
+
+} // namespace fred
@@ -0,0 +1,104 @@
+#ifndef FRED_CULLING_H
+#define FRED_CULLING_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace fred {
+
+struct Aabb {
+  glm::vec3 min;
+  glm::vec3 max;
+
+  Aabb merge(const Aabb &other) const { return {glm::min(min, other.min), glm::max(max, other.max)}; }
+  bool contains(const Aabb &other) const {
+    return glm::all(glm::lessThanEqual(min, other.min)) && glm::all(glm::greaterThanEqual(max, other.max));
+  }
+  float surfaceArea() const {
+    glm::vec3 size = max - min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+};
+
+// Box through a transform, still axis aligned so it's a bit looser than the
+// original under rotation (Arvo's method)
+Aabb transformAabb(const Aabb &box, const glm::mat4 &transform);
+
+enum class CullResult {
+  Outside,
+  Intersects,
+  Inside,
+};
+
+// The six planes of a view frustum, normals pointing in. Stored as SoA and
+// padded to eight so the box test does four planes per SSE instruction.
+class Frustum {
+public:
+  static Frustum fromMatrix(const glm::mat4 &viewProjection);
+
+  CullResult test(const Aabb &box) const; // SSE when the compiler has it
+  CullResult testScalar(const Aabb &box) const;
+
+private:
+  static constexpr int PLANE_COUNT = 8; // 6 real, 2 that always pass
+  alignas(16) float planeX[PLANE_COUNT];
+  alignas(16) float planeY[PLANE_COUNT];
+  alignas(16) float planeZ[PLANE_COUNT];
+  alignas(16) float planeW[PLANE_COUNT];
+};
+
+// Dynamic AABB tree, the same idea as Box2D's b2DynamicTree. Leaves hold a
+// fattened box, so an object that moves a little never touches the tree, and
+// one that escapes it is pulled out and reinserted with the rest left alone.
+// Rotations keep it balanced. Proxy ids stay valid until remove().
+class BoundsTree {
+public:
+  float margin = 0.1f; // Added on every side of a leaf
+
+  int insert(const Aabb &box, void *userData);
+  void remove(int proxy);
+  // Returns true if the tree had to change
+  bool move(int proxy, const Aabb &box);
+
+  void *getUserData(int proxy) const { return nodes[proxy].userData; }
+  const Aabb &getFatBounds(int proxy) const { return nodes[proxy].box; }
+  int getHeight() const { return root == NULL_NODE ? 0 : nodes[root].height; }
+  int getProxyCount() const { return proxyCount; }
+
+  // Appends the user data of every leaf touching the frustum. Subtrees fully
+  // inside get added without testing their children.
+  void query(const Frustum &frustum, std::vector<void *> &visible) const;
+
+private:
+  static constexpr int NULL_NODE = -1;
+
+  struct Node {
+    Aabb box;
+    void *userData;
+    int parent; // Next free node when on the free list
+    int child1;
+    int child2;
+    int height; // Leaves are 0, free nodes -1
+
+    bool isLeaf() const { return child1 == NULL_NODE; }
+  };
+
+  std::vector<Node> nodes;
+  int root = NULL_NODE;
+  int freeList = NULL_NODE;
+  int proxyCount = 0;
+  mutable std::vector<int> stack; // Saves an allocation per query
+
+  int allocateNode();
+  void freeNode(int node);
+  void insertLeaf(int leaf);
+  void removeLeaf(int leaf);
+  int balance(int node);
+  void addSubtree(int node, std::vector<void *> &visible) const;
+};
+
+} // namespace fred
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -22,16 +24,14 @@
 #include <clog/clog.h>
 
 #include <SOIL2.h>
-#include <assimp/DefaultLogger.hpp>
-#include <assimp/Importer.hpp>
-#include <assimp/Logger.hpp>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
 
-#include "shader.h"
-
-constexpr int WIDTH = 1366;
-constexpr int HEIGHT = 768;
+#include "console.h"
+#include "culling.h"
+#include "engine.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "resources.h"
+#include "simplify.h"
 
 static void glfwErrorCallback(int e, const char *description) {
   clog_log(CLOG_LEVEL_ERROR, "GLFW Error %d: %s\n", e, description);
@@ -39,50 +39,44 @@ static void glfwErrorCallback(int e, const char *description) {
 
 namespace fred {
 
-static bool loadModel(const char *path, std::vector<unsigned short> &indices,
-                      std::vector<glm::vec3> &vertices,
-                      std::vector<glm::vec2> &uvs,
-                      std::vector<glm::vec3> &normals) {
-  clog_log(CLOG_LEVEL_DEBUG, "Loading model: %s\n", path);
-  Assimp::Importer importer;
-
-  const aiScene *scene = importer.ReadFile(
-      path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices |
-                aiProcess_SortByPType);
-  if (!scene) {
-    clog_log(CLOG_LEVEL_ERROR, "%s\n", importer.GetErrorString());
-    return false;
-  }
-  const aiMesh *mesh = scene->mMeshes[0];
-
-  vertices.reserve(mesh->mNumVertices);
-  for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    aiVector3D pos = mesh->mVertices[i];
-    vertices.push_back(glm::vec3(pos.x, pos.y, pos.z));
-  }
-
-  uvs.reserve(mesh->mNumVertices);
-  for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    aiVector3D UVW = mesh->mTextureCoords[0][i]; // Multiple UVs? Prepsterous!
-    uvs.push_back(glm::vec2(UVW.x, UVW.y));
+GLenum cookedTextureFormat(TextureFormat format) {
+  switch (format) {
+  case TextureFormat::BC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case TextureFormat::BC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  case TextureFormat::BC5:
+    return GL_COMPRESSED_RG_RGTC2;
   }
+  return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
 
-  normals.reserve(mesh->mNumVertices);
-  for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    aiVector3D normal = mesh->mNormals[i];
-    normals.push_back(glm::vec3(normal.x, normal.y, normal.z));
-  }
-  for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-    indices.push_back(mesh->mFaces[i].mIndices[0]);
-    indices.push_back(mesh->mFaces[i].mIndices[1]);
-    indices.push_back(mesh->mFaces[i].mIndices[2]);
+GLuint uploadCookedTexture(const CookedTexture &cooked) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glState.bindTexture(0, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)cooked.header->levelCount - 1);
+  GLenum format = cookedTextureFormat(cooked.format());
+  for (uint32_t i = 0; i < cooked.header->levelCount; i++) {
+    const CookedTextureLevel &level = cooked.levels[i];
+    glCompressedTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, (GLsizei)level.size,
+                           cooked.levelData(i));
   }
-
-  return true;
+  return texture;
 }
 
 GLuint loadTexture(const char *path) {
+  PROFILE_ZONE("Texture load");
   clog_log(CLOG_LEVEL_DEBUG, "Loading texture: %s\n", path);
+  CookedTexture cooked;
+  if (mapCookedTexture(cookedTexturePath(path).c_str(), path, cooked)) {
+    return uploadCookedTexture(cooked);
+  }
   GLuint texture = SOIL_load_OGL_texture(
       path, SOIL_LOAD_AUTO,
       SOIL_CREATE_NEW_ID,
@@ -94,183 +88,229 @@ GLuint loadTexture(const char *path) {
   return texture;
 }
 
-class Model {
-public:
-    std::vector<unsigned short> indices;
-    GLuint vertexBuffer;
-    GLuint uvBuffer;
-    GLuint normalBuffer;
-    GLuint elementBuffer;
-
-  Model(std::string modelPath) {
-    std::vector<glm::vec3> indexed_vertices;
-    std::vector<glm::vec2> indexed_uvs;
-    std::vector<glm::vec3> indexed_normals;
-
-    loadModel(modelPath.c_str(), indices, indexed_vertices, indexed_uvs, indexed_normals);
-
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3),
-               &indexed_vertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2),
-               &indexed_uvs[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3),
-               &indexed_normals[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &elementBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, elementBuffer);
-    glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(unsigned short),
-               &indices[0], GL_STATIC_DRAW);
-  }
-  ~Model() {
-    // glDeleteBuffers(4, vertexBuffer); // Chances that these are contiguous in memory is zero
-    glDeleteBuffers(1, &vertexBuffer);
-    glDeleteBuffers(1, &uvBuffer);
-    glDeleteBuffers(1, &normalBuffer);
-    glDeleteBuffers(1, &elementBuffer);
+GLuint loadLightmap(const char *path) {
+  PROFILE_ZONE("Lightmap load");
+  clog_log(CLOG_LEVEL_DEBUG, "Loading lightmap: %s\n", path);
+  GLuint texture = SOIL_load_OGL_texture(path, SOIL_LOAD_RGBA, SOIL_CREATE_NEW_ID, 0);
+  if (texture == 0) {
+    clog_log(CLOG_LEVEL_WARN, "Lightmap failed to load\n");
+    return 0;
   }
-};
+  // Charts are padded and dilated for bilinear, mips would bleed across them
+  glState.bindTexture(LIGHTMAP_UNIT, texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  return texture;
+}
 
-class Texture {
-public:
-  GLuint texture;
+Model::Model(std::string modelPath) {
+  load(modelPath, NULL);
+}
 
-  Texture(std::string texturePath) {
-    texture = loadTexture(texturePath.c_str());
-  }
-  ~Texture() {
-    glDeleteTextures(1, &texture);
+Model::Model(std::string modelPath, LoadMode mode) {
+  if (mode == LoadMode::Blocking) {
+    load(modelPath, NULL);
+    return;
   }
-};
+  // Borrowed, the destructor leaves them alone while pendingLoad is set
+  const Model &placeholder = placeholderModel();
+  subMeshes = placeholder.subMeshes;
+  layout = placeholder.layout;
+  vertexArray = placeholder.vertexArray;
+  vertexBuffer = placeholder.vertexBuffer;
+  elementBuffer = placeholder.elementBuffer;
+  instanceBuffer = placeholder.instanceBuffer;
+  positionBuffer = placeholder.positionBuffer;
+  depthVertexArray = placeholder.depthVertexArray;
+  bounds = placeholder.bounds;
+  uvDensity = placeholder.uvDensity;
+  pendingLoad = loadModelAsync(this, modelPath);
+}
 
-class Shader {
-public:
-  GLuint shaderProgram;
+Model::Model(std::string modelPath, VertexLayout requiredLayout) {
+  load(modelPath, &requiredLayout);
+}
 
-  Shader(std::string vertPath, std::string fragPath) {
-    shaderProgram = loadShaders(vertPath.c_str(), fragPath.c_str());
-  }
-  ~Shader() {
-    glDeleteProgram(shaderProgram);
+Model::Model(const MeshData &mesh) {
+  std::vector<unsigned char> vertices;
+  interleaveVertices(mesh, layout, vertices);
+  subMeshes = mesh.subMeshes;
+  lodSubMeshes = mesh.lodSubMeshes;
+  bounds = computeBounds(mesh.positions);
+  uvDensity = computeUvDensity(mesh);
+  createBuffers(vertices.data(), vertices.size(), mesh.indices.data(), mesh.indices.size(), mesh.positions.data(),
+                mesh.positions.size() * sizeof(glm::vec3));
+}
+
+void Model::load(const std::string &modelPath, const VertexLayout *requiredLayout) {
+  PROFILE_ZONE("Model load");
+  // Cooked blobs go straight from the page cache to the driver
+  CookedMesh cooked;
+  if (mapCookedMesh(cookedMeshPath(modelPath).c_str(), modelPath.c_str(), cooked)) {
+    if (requiredLayout == NULL || cooked.layout == *requiredLayout) {
+      layout = cooked.layout;
+      subMeshes.assign(cooked.subMeshes, cooked.subMeshes + cooked.header->subMeshCount);
+      lodSubMeshes.assign(cooked.subMeshes + cooked.header->subMeshCount,
+                          cooked.subMeshes + cooked.header->subMeshCount * (1 + cooked.header->lodCount));
+      bounds = cooked.header->bounds;
+      uvDensity = cooked.header->uvDensity;
+      createBuffers(cooked.vertices, cooked.verticesSize(), cooked.indices, cooked.indicesSize(), cooked.positions,
+                    cooked.positionsSize());
+      return;
+    }
+    clog_log(CLOG_LEVEL_WARN, "Cooked mesh for %s has a different vertex layout, importing instead\n", modelPath.c_str());
   }
-};
 
-class Asset {
-public:
-  std::vector<unsigned short> *indices;
-  GLuint *vertexBuffer;
-  GLuint *uvBuffer;
-  GLuint *normalBuffer;
-  GLuint *elementBuffer;
+  MeshData mesh;
+  importMesh(modelPath.c_str(), mesh);
+  // fred-cook does this ahead of time, uncooked models pay for it here
+  generateLods(mesh, LodGenerationSettings());
+  if (requiredLayout != NULL) {
+    layout = *requiredLayout;
+  }
+  std::vector<unsigned char> vertices;
+  interleaveVertices(mesh, layout, vertices);
+  subMeshes = mesh.subMeshes;
+  lodSubMeshes = mesh.lodSubMeshes;
+  bounds = computeBounds(mesh.positions);
+  uvDensity = computeUvDensity(mesh);
+  createBuffers(vertices.data(), vertices.size(), mesh.indices.data(), mesh.indices.size(), mesh.positions.data(),
+                mesh.positions.size() * sizeof(glm::vec3));
+}
 
-  GLuint matrixID;
-  GLuint viewMatrixID;
-  GLuint modelMatrixID;
+void Model::draw(int lod) const {
+  drawSubMeshes(vertexArray, 0, lod);
+}
 
-  GLuint albedoTextureID;
-  GLuint specularTextureID;
+void Model::drawInstanced(GLsizei instanceCount, int lod) const {
+  drawSubMeshes(vertexArray, instanceCount, lod);
+}
 
-  GLuint lightID;
-  GLuint lightColor;
-  GLuint lightPower;
+void Model::drawDepthInstanced(GLsizei instanceCount, int lod) const {
+  drawSubMeshes(depthVertexArray, instanceCount, lod);
+}
 
-  glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
-  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); // https://en.wikipedia.org/wiki/Quaternion
-  glm::vec3 scaling = glm::vec3(1.0f, 1.0f, 1.0f);
+const SubMesh *Model::getLodSubMeshes(int lod) const {
+  lod = std::min(lod, getLodCount() - 1);
+  return lod == 0 ? subMeshes.data() : &lodSubMeshes[(lod - 1) * subMeshes.size()];
+}
 
-  GLuint *albedoTexture;
-  GLuint *specularTexture;
+uint32_t Model::getTriangleCount(int lod) const {
+  const SubMesh *ranges = getLodSubMeshes(lod);
+  uint32_t triangles = 0;
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    triangles += ranges[i].indexCount / 3;
+  }
+  return triangles;
+}
 
-  GLuint *shaderProgram;
+// 0 instances is a plain draw
+void Model::drawSubMeshes(GLuint vertexArrayI, GLsizei instanceCount, int lod) const {
+  glState.bindVertexArray(vertexArrayI);
+  const SubMesh *ranges = getLodSubMeshes(lod);
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    const SubMesh &subMesh = ranges[i];
+    if (subMesh.indexCount == 0) {
+      continue; // Simplified away
+    }
+    GLenum indexType = subMesh.indexSize == sizeof(uint32_t) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    if (instanceCount == 0) {
+      glDrawElementsBaseVertex(GL_TRIANGLES, subMesh.indexCount, indexType,
+                               (void *)(uintptr_t)subMesh.indexOffset, subMesh.baseVertex);
+    } else {
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, subMesh.indexCount, indexType,
+                                        (void *)(uintptr_t)subMesh.indexOffset, instanceCount,
+                                        subMesh.baseVertex);
+    }
+  }
+}
 
-  Asset(Model &model, Texture &albedoTextureI, Texture &specularTextureI, Shader &shader) {
-    indices = &model.indices;
-    vertexBuffer = &model.vertexBuffer;
-    uvBuffer = &model.uvBuffer;
-    normalBuffer = &model.normalBuffer;
-    elementBuffer = &model.elementBuffer;
+void Model::createBuffers(const void *vertices, size_t verticesSize, const void *indices, size_t indicesSize,
+                          const glm::vec3 *positions, size_t positionsSize) {
+  glGenBuffers(1, &vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, verticesSize, vertices, GL_STATIC_DRAW);
 
-    albedoTexture = &albedoTextureI.texture;
-    specularTexture = &specularTextureI.texture;
+  // Not GL_ELEMENT_ARRAY_BUFFER, that would land in whatever VAO is bound
+  glGenBuffers(1, &elementBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, elementBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, indicesSize, indices, GL_STATIC_DRAW);
 
-    shaderProgram = &shader.shaderProgram;
+  glGenBuffers(1, &positionBuffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, positionBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, positionsSize, positions, GL_STATIC_DRAW);
 
-    matrixID = glGetUniformLocation(*shaderProgram, "mvp");
-    viewMatrixID = glGetUniformLocation(*shaderProgram, "v");
-    modelMatrixID = glGetUniformLocation(*shaderProgram, "m");
+  createVertexArray();
+}
 
-    albedoTextureID = glGetUniformLocation(*shaderProgram, "albedoSampler");
-    specularTextureID = glGetUniformLocation(*shaderProgram, "specularSampler");
+void Model::createVertexArray() {
+  glGenVertexArrays(1, &vertexArray);
+  glState.bindVertexArray(vertexArray);
 
-    lightID = glGetUniformLocation(*shaderProgram, "lightPosition_worldspace");
-    lightColor = glGetUniformLocation(*shaderProgram, "lightColor");
-    lightPower = glGetUniformLocation(*shaderProgram, "lightPower");
-  }
-};
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  // The VAO remembers the element buffer, so this has to happen while bound
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
 
-class Camera {
-public:
-  glm::vec3 position;
-  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  GLsizei stride = layout.stride();
 
-  float fov = glm::radians(60.0f);
-  float nearPlane = 0.1f;
-  float farPlane = 100.0f;
+  // Vertex Data
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)(uintptr_t)layout.positionOffset());
 
-  
-  Camera(glm::vec3 initPosition) {
-    position = initPosition;
-  }
-  Camera(glm::vec3 initPosition, glm::quat initRotation) {
-    position = initPosition;
-    rotation = initRotation;
-  }
-  Camera(glm::vec3 initPosition, glm::quat initRotation, float initFov) { 
-    position = initPosition;
-    rotation = initRotation;
-    fov = initFov;
-  }
-  Camera(glm::vec3 initPosition, glm::quat initRotation, float initFov, float initNearPlane, float initFarPlane) {
-    position = initPosition;
-    rotation = initRotation;
-    fov = initFov;
-    nearPlane = initNearPlane;
-    farPlane = initFarPlane;
-  }
-  void lookAt(glm::vec3 target) { // I think I lost it writing this
-    glm::mat4 lookAtMatrix = glm::lookAt(position, target, glm::vec3(0, 1, 0));
-    rotation = glm::conjugate(glm::quat(lookAtMatrix));
+  // UV Data
+  glEnableVertexAttribArray(1);
+  if (layout.uvFormat == UvFormat::Half) {
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *)(uintptr_t)layout.uvOffset());
+  } else {
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(uintptr_t)layout.uvOffset());
   }
-};
-
-class Scene {
-public:
-  std::vector<Asset*> assets;
-  std::vector<Camera*> cameras;
-  void (*renderCallback)() = NULL;
 
-  int activeCamera = 0;
+  // Normal Data, packed normals come out as a normalized vec4 and w is dropped
+  glEnableVertexAttribArray(2);
+  if (layout.normalFormat == NormalFormat::Packed1010102) {
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *)(uintptr_t)layout.normalOffset());
+  } else {
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void *)(uintptr_t)layout.normalOffset());
+  }
 
-  void addAsset(Asset &asset) {
-    assets.push_back(&asset);
+  // Lightmap UVs, only baked meshes have them. Past the instance matrix so
+  // the attributes everything else uses stay where they are.
+  if (layout.lightmapUvs) {
+    glEnableVertexAttribArray(7);
+    glVertexAttribPointer(7, 2, GL_FLOAT, GL_FALSE, stride, (void *)(uintptr_t)layout.lightmapUvOffset());
   }
-  void addCamera(Camera &camera) {
-    cameras.push_back(&camera);
+
+  // Instance data, a mat4 takes four attribute slots. Empty until a batch
+  // streams into it, shaders that don't read 3 to 6 never notice it.
+  glGenBuffers(1, &instanceBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  for (int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(3 + i, 1);
   }
-  void setRenderCallback(void (*callback)()) {
-    renderCallback = callback;
+
+  // Depth only, 12 bytes a vertex whatever the layout. Same indices and
+  // instance matrices.
+  glGenVertexArrays(1, &depthVertexArray);
+  glState.bindVertexArray(depthVertexArray);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
+  glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+  for (int i = 0; i < 4; i++) {
+    glEnableVertexAttribArray(3 + i);
+    glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(i * sizeof(glm::vec4)));
+    glVertexAttribDivisor(3 + i, 1);
   }
-};
+
+  glState.bindVertexArray(0);
+}
 
 GLFWwindow *window;
-GLuint vertexArrayID;
 GLuint frameBufferName = 0;
 GLuint renderedTexture;
 
@@ -289,41 +329,43 @@ float getUnscaledDeltaTime() {
 
 bool exitFlag = false;
 
-static bool shouldExit() {
+bool shouldExit() {
   return !(glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && glfwWindowShouldClose(window) == 0) || exitFlag;
 }
 
-std::string log;
-void appendLog(clog_log_level_e, char *message, int length) {
-  log.append(message);
-}
-
-static int initWindow() {
-  clog_set_append_newline(0);
-  clog_set_log_callback(appendLog, 1);
-  glfwSetErrorCallback(glfwErrorCallback);
-
-  if (!glfwInit()) {
-    clog_log(CLOG_LEVEL_ERROR, "GLFW went shitty time (failed to init)\n");
-    return 1;
-  }
-
-  glfwWindowHint(GLFW_SAMPLES, 4); // 4x Antialiasing
+static void contextHints() {
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // Loser MacOS is broken
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // New GL
+}
 
-  window = glfwCreateWindow(WIDTH, HEIGHT, "Fred", NULL, NULL);
-  if (window == NULL) {
-    clog_log(CLOG_LEVEL_ERROR, "Failed to open window.\n");
-    glfwTerminate();
-    return 1;
-  }
+int framebufferWidth = 1024;
+int framebufferHeight = 768;
+bool headless = false;
+static LightGrid lightGrid; // Built from the scene's lights in drawAssets
+static ShadowMaps shadowMaps; // The sun's, drawn ahead of everything else in drawAssets
+static OcclusionBuffer occlusionBuffer; // Occluders in view, rasterized on the CPU in drawAssets
 
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1); // V-Sync
+#if FRED_PROFILER
+// Jobs into the profiler's job lane, a row per thread. A job waiting on a
+// counter runs others meanwhile, so starts stack up.
+static thread_local std::vector<double> jobZoneStarts;
+
+static void beginJobZone(int thread, const char *name) {
+  jobZoneStarts.push_back(profilerNow());
+}
+
+static void endJobZone(int thread, const char *name) {
+  double start = jobZoneStarts.back();
+  jobZoneStarts.pop_back();
+  profiler.addJobZone(thread + 1, name, start, profilerNow());
+}
+#endif
 
+// GL side of init, shared by the window and headless paths. The scene always
+// goes into frameBufferName, the window only ever shows it through ImGui.
+static int initRenderer(int width, int height) {
   int version;
   if ((version = gladLoadGL(glfwGetProcAddress))) {
     clog_log(CLOG_LEVEL_DEBUG, "GL version: %d.%d\n", GLAD_VERSION_MAJOR(version),
@@ -333,19 +375,10 @@ static int initWindow() {
     return 1;
   }
 
-  IMGUI_CHECKVERSION();
-  ImGui::CreateContext();
-  ImGuiIO &io = ImGui::GetIO();
-  (void)io;
-  io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
-  io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
-  io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
-  io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
-
-  ImGui::StyleColorsDark();
-
-  ImGui_ImplGlfw_InitForOpenGL(window, true);
-  ImGui_ImplOpenGL3_Init("#version 330");
+#if FRED_PROFILER
+  jobs.setProfileHooks(beginJobZone, endJobZone);
+#endif
+  jobs.start(0);
 
   glEnable(GL_DEPTH_TEST); // Turn on the Z-buffer
   glDepthFunc(GL_LESS);    // Accept only the closest fragments
@@ -354,13 +387,16 @@ static int initWindow() {
 
   glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
+  framebufferWidth = width;
+  framebufferHeight = height;
+
   glGenFramebuffers(1, &frameBufferName);
   glBindFramebuffer(GL_FRAMEBUFFER, frameBufferName);
 
   glGenTextures(1, &renderedTexture);
 
   glBindTexture(GL_TEXTURE_2D, renderedTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1024, 768, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -368,7 +404,7 @@ static int initWindow() {
   GLuint depthRenderBuffer;
   glad_glGenRenderbuffers(1, &depthRenderBuffer);
   glBindRenderbuffer(GL_RENDERBUFFER, depthRenderBuffer);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 1024, 768);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderBuffer);
 
   glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
@@ -377,11 +413,53 @@ static int initWindow() {
   glDrawBuffers(1, drawBuffers);
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    return false;
+    clog_log(CLOG_LEVEL_ERROR, "Viewport framebuffer is incomplete\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int initWindow() {
+  clog_set_append_newline(0);
+  clog_set_log_callback(Console::clogCallback, 1);
+  glfwSetErrorCallback(glfwErrorCallback);
+
+  if (!glfwInit()) {
+    clog_log(CLOG_LEVEL_ERROR, "GLFW went shitty time (failed to init)\n");
+    return 1;
   }
 
-  glGenVertexArrays(1, &vertexArrayID);
-  glBindVertexArray(vertexArrayID);
+  glfwWindowHint(GLFW_SAMPLES, 4); // 4x Antialiasing
+  contextHints();
+
+  window = glfwCreateWindow(WIDTH, HEIGHT, "Fred", NULL, NULL);
+  if (window == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to open window.\n");
+    glfwTerminate();
+    return 1;
+  }
+
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(1); // V-Sync
+
+  if (initRenderer(1024, 768) != 0) {
+    return 1;
+  }
+
+  IMGUI_CHECKVERSION();
+  ImGui::CreateContext();
+  ImGuiIO &io = ImGui::GetIO();
+  (void)io;
+  io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
+  io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
+  io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
+  io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
+
+  ImGui::StyleColorsDark();
+
+  ImGui_ImplGlfw_InitForOpenGL(window, true);
+  ImGui_ImplOpenGL3_Init("#version 330");
 
   //float speed = 3.0f;
   //float mouseSpeed = 0.005f;
@@ -391,16 +469,918 @@ static int initWindow() {
   return 0;
 }
 
+int initHeadless(int width, int height) {
+  headless = true;
+  clog_set_append_newline(0);
+  glfwSetErrorCallback(glfwErrorCallback);
+
+  // A hidden window if there's a display to put it on
+  window = NULL;
+  if (glfwInit()) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    contextHints();
+    window = glfwCreateWindow(width, height, "Fred", NULL, NULL);
+    if (window == NULL) {
+      glfwTerminate();
+    }
+  }
+#ifdef GLFW_PLATFORM_NULL
+  // Otherwise no window system at all, Mesa's llvmpipe does surfaceless EGL
+  if (window == NULL) {
+    clog_log(CLOG_LEVEL_DEBUG, "No display, trying a surfaceless EGL context\n");
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (glfwInit()) {
+      contextHints();
+      glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+      window = glfwCreateWindow(width, height, "Fred", NULL, NULL);
+      if (window == NULL) {
+        glfwTerminate();
+      }
+    }
+  }
+#endif
+  if (window == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to create a headless GL context\n");
+    return 1;
+  }
+
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0); // Measuring the engine, not the display
+
+  return initRenderer(width, height);
+}
+
 void destroy() {
-  glDeleteVertexArrays(1, &vertexArrayID);
-  ImGui_ImplOpenGL3_Shutdown();
-  ImGui_ImplGlfw_Shutdown();
-  ImGui::DestroyContext();
+  resources.clear();
+  assetLoader.shutdown();
+  destroyPlaceholders();
+  destroyShaderVariants();
+  destroyDefaultDepthProgram();
+  lightGrid.destroy();
+  jobs.stop();
+  shadowMaps.destroy();
+  uniformRing.destroy();
+  if (!headless) {
+    ImGui_ImplOpenGL3_Shutdown();
+    ImGui_ImplGlfw_Shutdown();
+    ImGui::DestroyContext();
+  }
 
   glfwDestroyWindow(window);
   glfwTerminate();
 }
 
+bool instancingEnabled = true;
+RenderStats renderStats;
+
+void setInstancingEnabled(bool enabled) {
+  instancingEnabled = enabled;
+}
+bool getInstancingEnabled() {
+  return instancingEnabled;
+}
+
+bool cullingEnabled = true;
+
+void setCullingEnabled(bool enabled) {
+  cullingEnabled = enabled;
+}
+bool getCullingEnabled() {
+  return cullingEnabled;
+}
+
+bool occlusionEnabled = true;
+static bool occlusionActive = false; // This frame, there's something in the buffer
+
+void setOcclusionCullingEnabled(bool enabled) {
+  occlusionEnabled = enabled;
+}
+bool getOcclusionCullingEnabled() {
+  return occlusionEnabled;
+}
+ShadowMaps &getShadowMaps() {
+  return shadowMaps;
+}
+const RenderStats &getRenderStats() {
+  return renderStats;
+}
+
+static LodSettings lodSettings;
+static glm::vec3 lodEye;     // Camera position this frame
+static float lodScale = 1.0f; // projection[1][1], radius over distance to screen height fraction
+static float pixelsPerUnit = 1.0f; // Pixels a unit spans one unit in front of the camera
+
+LodSettings &getLodSettings() {
+  return lodSettings;
+}
+
+// Walks from the LOD last drawn towards whichever one the bounding sphere's
+// screen size asks for, only crossing a threshold once it's clear of it
+static int selectLod(const Aabb &world, int lodCount, int current) {
+  if (!lodSettings.enabled || lodCount < 2) {
+    return 0;
+  }
+  glm::vec3 center = (world.min + world.max) * 0.5f;
+  float radius = glm::length(world.max - world.min) * 0.5f;
+  float distance = glm::length(center - lodEye);
+  if (distance <= radius) {
+    return 0; // Inside it
+  }
+  float size = radius * lodScale / distance;
+  int lod = std::min(current, lodCount - 1);
+  float low = 1.0f - lodSettings.hysteresis;
+  float high = 1.0f + lodSettings.hysteresis;
+  while (lod < lodCount - 1 && size < lodSettings.screenSizes[lod] * low) {
+    lod++;
+  }
+  while (lod > 0 && size > lodSettings.screenSizes[lod - 1] * high) {
+    lod--;
+  }
+  return lod;
+}
+
+static void countTriangles(const Model *model, int lod, size_t instances) {
+  renderStats.triangles += model->getTriangleCount(lod) * instances;
+  renderStats.fullDetailTriangles += model->getTriangleCount(0) * instances;
+  renderStats.lodAssets[std::min(lod, model->getLodCount() - 1)] += instances;
+}
+
+// Most expensive state change in the highest bits, so sorting by key groups
+// draws by program, then textures, then vertex array. Everything sameBatch
+// compares is in there, or assets that could share a run end up interleaved
+// and split it. GL names are small integers so 12 bits each is plenty, 16
+// for vertex arrays since every model has its own, and a collision only
+// costs a state change.
+static uint64_t sortKey(GLuint program, GLuint albedoTexture, GLuint specularTexture, GLuint lightmapTexture,
+                        GLuint vertexArray) {
+  return (uint64_t)(program & 0xFFF) << 52 |
+         (uint64_t)(albedoTexture & 0xFFF) << 40 |
+         (uint64_t)(specularTexture & 0xFFF) << 28 |
+         (uint64_t)(lightmapTexture & 0xFFF) << 16 |
+         (uint64_t)(vertexArray & 0xFFFF);
+}
+
+static uint64_t sortKey(const Asset *asset) {
+  return sortKey(*asset->shaderProgram, *asset->albedoTexture, *asset->specularTexture,
+                 asset->lightmapTexture != NULL ? *asset->lightmapTexture : 0, asset->model->vertexArray);
+}
+
+struct QueuedDraw {
+  uint64_t sortKey;
+  int lod;        // Only the same LOD can share an instanced draw
+  uint32_t order; // Ties keep the order assets were added in
+  Asset *asset;
+
+  bool operator<(const QueuedDraw &other) const {
+    if (sortKey != other.sortKey) {
+      return sortKey < other.sortKey;
+    }
+    return lod != other.lod ? lod < other.lod : order < other.order;
+  }
+};
+
+// A single asset, or a batch of them sharing a model, textures and shader
+struct DrawRun {
+  size_t first; // Into the queue
+  size_t count;
+  size_t objectSlot; // Single assets only, into this frame's ObjectData
+};
+
+static bool sameBatch(const Asset *a, const Asset *b) {
+  return a->shader == b->shader && a->model == b->model && a->lod == b->lod &&
+         a->albedoTexture == b->albedoTexture && a->specularTexture == b->specularTexture &&
+         a->lightmapTexture == b->lightmapTexture;
+}
+
+// Render list ============================================================== //
+
+// What the submitter does, in order. The build works out every program,
+// texture, slot and matrix up front, so replaying one is nothing but GL.
+enum class RenderOp : uint8_t {
+  Draw,          // One object, data is its ObjectData slot
+  DrawInstanced, // count matrices from instanceMatrices[data] on
+  DrawDepth,     // The same, depth only, into whichever cascade is targeted
+  BeginCascade,  // Targets cascade data's layer and its FrameData slot
+  EndShadows,    // Back to the main pass, with the maps bound
+};
+
+struct RenderCommand {
+  RenderOp op;
+  int8_t lod;
+  GLuint program;
+  GLuint textures[3]; // Albedo, specular, lightmap, 0 when there's no lightmap
+  const Model *model;
+  uint32_t count;
+  uint32_t data;
+};
+
+// A frame's worth of commands and everything they point into, replayed by
+// submitRenderList. Building one issues no draws and changes no state, the
+// only GL it can get to is a shader variant compiling the first time it's
+// asked for, which is all that keeps the build on the GL thread.
+struct RenderList {
+  std::vector<RenderCommand> commands;
+  size_t shadowCommands = 0; // Leading ones, up to and including EndShadows
+  // FrameData, one more per shadow cascade, then every ObjectData slot, each
+  // at a bindable offset. One upload, so an orphan can't separate them.
+  std::vector<unsigned char> uniformData;
+  GLsizeiptr frameStride = 0;
+  GLsizeiptr objectStride = 0;
+  GLsizeiptr objectBase = 0;
+  std::vector<glm::mat4> instanceMatrices;
+
+  void clear() {
+    commands.clear();
+    shadowCommands = 0;
+    instanceMatrices.clear();
+  }
+};
+
+static RenderList renderList;
+
+static RenderCommand makeCommand(RenderOp op, GLuint program, const Model *model, int lod) {
+  RenderCommand command = {};
+  command.op = op;
+  command.lod = (int8_t)lod;
+  command.program = program;
+  command.model = model;
+  command.count = 1;
+  return command;
+}
+
+static void setTextures(RenderCommand &command, const GLuint *albedo, const GLuint *specular, const GLuint *lightmap) {
+  command.textures[0] = *albedo;
+  command.textures[1] = *specular;
+  command.textures[2] = lightmap != NULL ? *lightmap : 0;
+}
+
+static void emitAsset(const Asset *asset, size_t objectSlot) {
+  RenderCommand command = makeCommand(RenderOp::Draw, *asset->shaderProgram, asset->model, asset->lod);
+  setTextures(command, asset->albedoTexture, asset->specularTexture, asset->lightmapTexture);
+  command.data = objectSlot;
+  renderList.commands.push_back(command);
+  renderStats.drawCalls += asset->model->subMeshes.size();
+  countTriangles(asset->model, asset->lod, 1);
+}
+
+static void emitInstancedBatch(const QueuedDraw *batch, size_t count) {
+  const Asset *first = batch[0].asset;
+  RenderCommand command = makeCommand(RenderOp::DrawInstanced, first->shader->getInstancedProgram(), first->model,
+                                      first->lod);
+  setTextures(command, first->albedoTexture, first->specularTexture, first->lightmapTexture);
+  command.count = count;
+  command.data = renderList.instanceMatrices.size();
+  for (size_t i = 0; i < count; i++) {
+    renderList.instanceMatrices.push_back(batch[i].asset->getModelMatrix());
+  }
+  renderList.commands.push_back(command);
+  renderStats.drawCalls += first->model->subMeshes.size();
+  countTriangles(first->model, first->lod, count);
+  renderStats.instancedBatches++;
+  renderStats.instances += count;
+}
+
+// What the BVH last saw of an asset, so only the ones that moved get refit
+struct CullEntry {
+  Asset *asset; // NULL when free
+  Model *model;
+  uint32_t modelRevision; // Async loads swap the bounds under the same model
+  uint32_t transformRevision;
+  int proxy;
+  uint32_t order; // Index in scene.assets this frame
+  uint32_t lastFrame;
+};
+
+static BoundsTree cullTree;
+static std::vector<CullEntry> cullEntries; // Indexed by Asset::cullSlot
+static std::vector<int> freeCullEntries;
+static uint32_t cullFrame = 0;
+
+static Aabb worldBounds(const Asset *asset) {
+  return transformAabb({asset->model->bounds.min, asset->model->bounds.max}, asset->getModelMatrix());
+}
+
+// Brings the BVH in line with the scene. Anything new goes in, anything that
+// moved gets refit, anything that's gone is taken out.
+static void updateCulling(Scene &scene) {
+  cullFrame++;
+  for (size_t i = 0; i < scene.assets.size(); i++) {
+    Asset *asset = scene.assets[i];
+    int slot = asset->cullSlot;
+    // A copied asset comes with someone else's slot
+    if (slot < 0 || slot >= (int)cullEntries.size() || cullEntries[slot].asset != asset) {
+      if (freeCullEntries.empty()) {
+        slot = (int)cullEntries.size();
+        cullEntries.push_back(CullEntry());
+      } else {
+        slot = freeCullEntries.back();
+        freeCullEntries.pop_back();
+      }
+      CullEntry &entry = cullEntries[slot];
+      entry.asset = asset;
+      entry.model = asset->model;
+      entry.modelRevision = asset->model->revision;
+      entry.transformRevision = asset->transform.getRevision();
+      entry.proxy = cullTree.insert(worldBounds(asset), (void *)(intptr_t)slot);
+      asset->cullSlot = slot;
+      renderStats.refits++;
+    } else {
+      CullEntry &entry = cullEntries[slot];
+      if (entry.model != asset->model || entry.modelRevision != asset->model->revision ||
+          entry.transformRevision != asset->transform.getRevision()) {
+        entry.model = asset->model;
+        entry.modelRevision = asset->model->revision;
+        entry.transformRevision = asset->transform.getRevision();
+        if (cullTree.move(entry.proxy, worldBounds(asset))) {
+          renderStats.refits++;
+        }
+      }
+    }
+    cullEntries[slot].order = i;
+    cullEntries[slot].lastFrame = cullFrame;
+  }
+
+  for (size_t slot = 0; slot < cullEntries.size(); slot++) {
+    CullEntry &entry = cullEntries[slot];
+    if (entry.asset != NULL && entry.lastFrame != cullFrame) {
+      cullTree.remove(entry.proxy);
+      entry.asset = NULL;
+      freeCullEntries.push_back(slot);
+    }
+  }
+}
+
+// Tells the streamer how finely a draw samples its textures, from how much UV
+// a world unit holds and how big a unit is on screen at the closest point of
+// the bounding sphere. A model without UVs (or still loading) asks for nothing.
+static void requestTextures(const Model *model, const Aabb &world, const GLuint *albedo, const GLuint *specular) {
+  if (textureStreamer.isEmpty() || model->uvDensity <= 0.0f) {
+    return;
+  }
+  float modelRadius = glm::length(model->bounds.max - model->bounds.min) * 0.5f;
+  float radius = glm::length(world.max - world.min) * 0.5f;
+  if (modelRadius <= 0.0f || radius <= 0.0f) {
+    return;
+  }
+  float uvPerUnit = model->uvDensity * modelRadius / radius;
+  float distance = std::max(glm::length((world.min + world.max) * 0.5f - lodEye) - radius, 0.0f);
+  float uvPerPixel = uvPerUnit * distance / pixelsPerUnit;
+  textureStreamer.request(albedo, uvPerPixel);
+  textureStreamer.request(specular, uvPerPixel);
+}
+
+// Every occluder in the frustum into the software depth buffer. False if
+// there weren't any, nothing gets tested then.
+static bool drawOccluders(Scene &scene, const glm::mat4 &viewProjection) {
+  occlusionBuffer.begin(viewProjection);
+  Frustum frustum = Frustum::fromMatrix(viewProjection);
+  for (Asset *asset : scene.assets) {
+    if (asset->occluder == NULL) {
+      continue;
+    }
+    const glm::mat4 &model = asset->getModelMatrix();
+    if (frustum.test(transformAabb(asset->occluder->bounds, model)) == CullResult::Outside) {
+      continue;
+    }
+    occlusionBuffer.addOccluder(*asset->occluder, model);
+  }
+  if (occlusionBuffer.getStats().occluders == 0) {
+    return false;
+  }
+  occlusionBuffer.rasterize();
+  return true;
+}
+
+static bool isOccluded(const Aabb &world) {
+  if (!occlusionActive) {
+    return false;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  bool occluded = !occlusionBuffer.isVisible(world);
+  renderStats.occlusionMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  renderStats.occludedAssets += occluded;
+  return occluded;
+}
+
+static void queueDraw(std::vector<QueuedDraw> &queue, Asset *asset, uint32_t order) {
+  Aabb world = worldBounds(asset);
+  if (asset->occluder == NULL && isOccluded(world)) {
+    return;
+  }
+  asset->lod = selectLod(world, asset->model->getLodCount(), asset->lod);
+  requestTextures(asset->model, world, asset->albedoTexture, asset->specularTexture);
+  QueuedDraw draw;
+  draw.sortKey = sortKey(asset);
+  draw.lod = asset->lod;
+  draw.order = order;
+  draw.asset = asset;
+  queue.push_back(draw);
+}
+
+// Entities go through the same sort and batching, just from the pools. A
+// batch is one instanced draw, or an ObjectData slot per entity when the
+// shader can't instance or instancing is off.
+struct QueuedEntity {
+  uint64_t sortKey;
+  int lod;
+  uint32_t renderable; // Slots
+  uint32_t transform;
+
+  bool operator<(const QueuedEntity &other) const {
+    if (sortKey != other.sortKey) {
+      return sortKey < other.sortKey;
+    }
+    return lod != other.lod ? lod < other.lod : renderable < other.renderable;
+  }
+};
+
+struct EntityRun {
+  size_t first; // Into the entity queue
+  size_t count;
+  bool instanced;
+  size_t objectSlot; // First of count, when not instanced
+};
+
+static std::vector<QueuedEntity> entityQueue;
+static std::vector<EntityRun> entityRuns;
+
+static bool sameBatch(const RenderablePool &renderables, uint32_t a, uint32_t b) {
+  return renderables.shaders[a] == renderables.shaders[b] && renderables.models[a] == renderables.models[b] &&
+         renderables.lods[a] == renderables.lods[b] &&
+         renderables.albedoTextures[a] == renderables.albedoTextures[b] &&
+         renderables.specularTextures[a] == renderables.specularTextures[b];
+}
+
+// Runs the entity systems, culls and batches. Non-instanced runs take their
+// ObjectData slots from objectSlots onwards.
+static void queueEntities(EntityStore &entities, const glm::mat4 &viewProjection, size_t &objectSlots) {
+  entityQueue.clear();
+  entityRuns.clear();
+  RenderablePool &renderables = entities.renderables;
+  if (renderables.size() == 0) {
+    return;
+  }
+  {
+    PROFILE_ZONE("Entity systems");
+    entities.updateTransforms(viewProjection);
+    entities.updateBounds();
+  }
+
+  Frustum frustum = Frustum::fromMatrix(viewProjection);
+  for (uint32_t slot = 0; slot < renderables.size(); slot++) {
+    uint32_t entity = renderables.entityAt(slot);
+    uint32_t transform = entities.transforms.slotOf(entity);
+    if (transform == PoolIndex::NONE) {
+      continue;
+    }
+    renderStats.totalAssets++;
+    uint32_t bounds = entities.bounds.slotOf(entity);
+    if (cullingEnabled && bounds != PoolIndex::NONE &&
+        frustum.test(entities.bounds.world[bounds]) == CullResult::Outside) {
+      continue;
+    }
+    const Model *model = renderables.models[slot];
+    Aabb world = bounds != PoolIndex::NONE
+                     ? entities.bounds.world[bounds]
+                     : transformAabb({model->bounds.min, model->bounds.max}, entities.transforms.model[transform]);
+    if (isOccluded(world)) {
+      continue;
+    }
+    renderables.lods[slot] = selectLod(world, model->getLodCount(), renderables.lods[slot]);
+    requestTextures(model, world, renderables.albedoTextures[slot], renderables.specularTextures[slot]);
+    QueuedEntity draw;
+    // Entities have no lightmaps
+    draw.sortKey = sortKey(renderables.shaders[slot]->shaderProgram, *renderables.albedoTextures[slot],
+                           *renderables.specularTextures[slot], 0, model->vertexArray);
+    draw.lod = renderables.lods[slot];
+    draw.renderable = slot;
+    draw.transform = transform;
+    entityQueue.push_back(draw);
+  }
+  renderStats.visibleAssets += entityQueue.size();
+  std::sort(entityQueue.begin(), entityQueue.end());
+
+  size_t first = 0;
+  while (first < entityQueue.size()) {
+    uint32_t slot = entityQueue[first].renderable;
+    size_t last = first + 1;
+    while (last < entityQueue.size() && sameBatch(renderables, slot, entityQueue[last].renderable)) {
+      last++;
+    }
+    EntityRun run;
+    run.first = first;
+    run.count = last - first;
+    run.instanced = instancingEnabled && renderables.shaders[slot]->canInstance();
+    run.objectSlot = run.instanced ? 0 : objectSlots;
+    if (!run.instanced) {
+      objectSlots += run.count;
+    }
+    entityRuns.push_back(run);
+    first = last;
+  }
+}
+
+static void emitEntities(const EntityStore &entities) {
+  const RenderablePool &renderables = entities.renderables;
+  for (const EntityRun &run : entityRuns) {
+    uint32_t slot = entityQueue[run.first].renderable;
+    const Model *model = renderables.models[slot];
+    Shader *shader = renderables.shaders[slot];
+    int lod = renderables.lods[slot];
+
+    if (run.instanced) {
+      RenderCommand command = makeCommand(RenderOp::DrawInstanced, shader->getInstancedProgram(), model, lod);
+      setTextures(command, renderables.albedoTextures[slot], renderables.specularTextures[slot], NULL);
+      command.count = run.count;
+      command.data = renderList.instanceMatrices.size();
+      for (size_t i = 0; i < run.count; i++) {
+        renderList.instanceMatrices.push_back(entities.transforms.model[entityQueue[run.first + i].transform]);
+      }
+      renderList.commands.push_back(command);
+      renderStats.drawCalls += model->subMeshes.size();
+      renderStats.instancedBatches++;
+      renderStats.instances += run.count;
+    } else {
+      for (size_t i = 0; i < run.count; i++) {
+        RenderCommand command = makeCommand(RenderOp::Draw, shader->shaderProgram, model, lod);
+        setTextures(command, renderables.albedoTextures[slot], renderables.specularTextures[slot], NULL);
+        command.data = run.objectSlot + i;
+        renderList.commands.push_back(command);
+        renderStats.drawCalls += model->subMeshes.size();
+      }
+    }
+    countTriangles(model, lod, run.count);
+  }
+}
+
+// Shadows ================================================================== //
+
+// One instance in a cascade. Sorted so each program, model and LOD is one
+// instanced draw, textures don't matter to depth. Casters keep the LOD the
+// camera last picked for them, a shadow can't show more detail than that.
+struct ShadowCaster {
+  GLuint program;
+  Model *model;
+  int lod;
+  const glm::mat4 *matrix;
+
+  bool operator<(const ShadowCaster &other) const {
+    if (program != other.program) {
+      return program < other.program;
+    }
+    return model != other.model ? model < other.model : lod < other.lod;
+  }
+};
+
+static std::vector<ShadowCaster> shadowCasters;
+
+// FNV-1a, only ever compared against last frame's so it needn't be stable
+// from one run to the next
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+template <class T> static uint64_t hashValue(uint64_t hash, const T &value) {
+  return hashBytes(hash, &value, sizeof(value));
+}
+
+// Everything casting into a cascade, from the BVH and the entity bounds.
+// Returns a hash of whatever would change the cascade if it changed.
+static uint64_t gatherShadowCasters(Scene &scene, int cascade) {
+  shadowCasters.clear();
+  const Frustum &frustum = shadowMaps.getCasterFrustum(cascade);
+  uint64_t hash = 14695981039346656037ull;
+
+  static std::vector<void *> found;
+  found.clear();
+  cullTree.query(frustum, found);
+  // Same casters in the same order hash the same, whatever the tree did
+  std::sort(found.begin(), found.end());
+  for (void *slot : found) {
+    const CullEntry &entry = cullEntries[(intptr_t)slot];
+    Asset *asset = entry.asset;
+    ShadowCaster caster = {asset->shader->getDepthProgram(), asset->model, asset->lod, &asset->getModelMatrix()};
+    shadowCasters.push_back(caster);
+    hash = hashValue(hash, asset);
+    hash = hashValue(hash, caster.program);
+    hash = hashValue(hash, caster.lod);
+    hash = hashValue(hash, entry.model);
+    hash = hashValue(hash, entry.modelRevision);
+    hash = hashValue(hash, entry.transformRevision);
+  }
+
+  // Entity transforms have no revision, so the matrix itself goes in
+  EntityStore &entities = scene.entities;
+  const RenderablePool &renderables = entities.renderables;
+  for (uint32_t slot = 0; slot < renderables.size(); slot++) {
+    uint32_t entity = renderables.entityAt(slot);
+    uint32_t transform = entities.transforms.slotOf(entity);
+    if (transform == PoolIndex::NONE) {
+      continue;
+    }
+    uint32_t bounds = entities.bounds.slotOf(entity);
+    if (bounds != PoolIndex::NONE && frustum.test(entities.bounds.world[bounds]) == CullResult::Outside) {
+      continue;
+    }
+    ShadowCaster caster = {renderables.shaders[slot]->getDepthProgram(), renderables.models[slot],
+                           renderables.lods[slot], &entities.transforms.model[transform]};
+    shadowCasters.push_back(caster);
+    hash = hashValue(hash, entity);
+    hash = hashValue(hash, caster.program);
+    hash = hashValue(hash, caster.lod);
+    hash = hashValue(hash, caster.model);
+    hash = hashValue(hash, caster.model->revision);
+    hash = hashValue(hash, *caster.matrix);
+  }
+  return hash;
+}
+
+// Whatever gatherShadowCasters found, for the cascade that was just begun
+static void emitShadowCasters() {
+  ShadowStats &stats = shadowMaps.stats;
+  std::sort(shadowCasters.begin(), shadowCasters.end());
+  size_t first = 0;
+  while (first < shadowCasters.size()) {
+    const ShadowCaster &caster = shadowCasters[first];
+    size_t last = first + 1;
+    while (last < shadowCasters.size() && shadowCasters[last].program == caster.program &&
+           shadowCasters[last].model == caster.model && shadowCasters[last].lod == caster.lod) {
+      last++;
+    }
+    size_t count = last - first;
+    RenderCommand command = makeCommand(RenderOp::DrawDepth, caster.program, caster.model, caster.lod);
+    command.count = count;
+    command.data = renderList.instanceMatrices.size();
+    for (size_t i = 0; i < count; i++) {
+      renderList.instanceMatrices.push_back(*shadowCasters[first + i].matrix);
+    }
+    renderList.commands.push_back(command);
+    stats.drawCalls += caster.model->subMeshes.size();
+    stats.casters += count;
+    first = last;
+  }
+}
+
+// Every cascade whose casters or placement changed, each through its own
+// FrameData slot, then the maps get bound for the main pass
+static void emitShadows(Scene &scene) {
+  PROFILE_ZONE("Shadows");
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int cascade = 0; cascade < SHADOW_CASCADES; cascade++) {
+    uint64_t hash = gatherShadowCasters(scene, cascade);
+    if (!shadowMaps.needsDraw(cascade, hash)) {
+      continue;
+    }
+    RenderCommand begin = makeCommand(RenderOp::BeginCascade, 0, NULL, 0);
+    begin.data = cascade;
+    renderList.commands.push_back(begin);
+    emitShadowCasters();
+  }
+  renderList.commands.push_back(makeCommand(RenderOp::EndShadows, 0, NULL, 0));
+  renderList.shadowCommands = renderList.commands.size();
+  shadowMaps.stats.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Submitting =============================================================== //
+
+static void bindTextures(const RenderCommand &command) {
+  glState.bindTexture(0, command.textures[0]);
+  glState.bindTexture(1, command.textures[1]);
+  if (command.textures[2] != 0) {
+    glState.bindTexture(LIGHTMAP_UNIT, command.textures[2]);
+  }
+}
+
+static void replayCommands(const RenderList &list, size_t first, size_t last, GLintptr uniformBase) {
+  for (size_t i = first; i < last; i++) {
+    const RenderCommand &command = list.commands[i];
+    switch (command.op) {
+    case RenderOp::Draw:
+      glState.useProgram(command.program);
+      bindTextures(command);
+      // Point ObjectData at this object's slot, the matrices are already up there
+      glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORMS_BINDING, uniformRing.buffer,
+                        uniformBase + list.objectBase + command.data * list.objectStride, sizeof(ObjectUniforms));
+      // DRAWING HAPPENS HERE
+      command.model->draw(command.lod);
+      break;
+    case RenderOp::DrawInstanced:
+    case RenderOp::DrawDepth:
+      // Fresh storage every time so the driver never waits on last frame's draws
+      glBindBuffer(GL_ARRAY_BUFFER, command.model->instanceBuffer);
+      glBufferData(GL_ARRAY_BUFFER, command.count * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, command.count * sizeof(glm::mat4), &list.instanceMatrices[command.data]);
+      glState.useProgram(command.program);
+      if (command.op == RenderOp::DrawDepth) {
+        command.model->drawDepthInstanced(command.count, command.lod);
+      } else {
+        bindTextures(command);
+        command.model->drawInstanced(command.count, command.lod);
+      }
+      break;
+    case RenderOp::BeginCascade:
+      shadowMaps.beginDraw(command.data);
+      glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, uniformRing.buffer,
+                        uniformBase + (1 + command.data) * list.frameStride, sizeof(FrameUniforms));
+      break;
+    case RenderOp::EndShadows:
+      shadowMaps.endDraw();
+      shadowMaps.bind();
+      break;
+    }
+  }
+}
+
+// GL thread. One upload for all the uniform data, the light grid, then the
+// commands as they were built.
+static void submitRenderList(const RenderList &list) {
+  glState.resetStats();
+  glState.invalidate(); // ImGui has been at the bindings since last frame
+  uniformRing.beginFrame();
+
+  int uniformZone = profiler.beginZone("Uniform upload");
+  GLintptr uniformBase = uniformRing.upload(list.uniformData.data(), list.uniformData.size());
+  lightGrid.upload();
+  profiler.endZone(uniformZone);
+
+  if (list.shadowCommands > 0) {
+    PROFILE_ZONE("Shadows");
+    PROFILE_GPU_ZONE("Shadows");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    replayCommands(list, 0, list.shadowCommands, uniformBase);
+    shadowMaps.stats.cpuMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    renderStats.shadows = shadowMaps.stats;
+  }
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, uniformRing.buffer,
+                    uniformBase, sizeof(FrameUniforms));
+  PROFILE_ZONE("Draw loop");
+  replayCommands(list, list.shadowCommands, list.commands.size(), uniformBase);
+  glState.bindVertexArray(0);
+}
+
+// Building ================================================================= //
+
+// Culling, LODs, batching, the light grid, shadow casters and the uniform
+// data, everything the frame needs worked out before a single draw.
+// viewport is the size the frame is going to be drawn at.
+static void buildRenderList(Scene &scene, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix,
+                            int viewportWidth, int viewportHeight) {
+  renderStats = RenderStats();
+  renderList.clear();
+
+  static std::vector<QueuedDraw> queue;
+  queue.clear();
+  renderStats.totalAssets = scene.assets.size();
+  lodEye = glm::vec3(glm::inverse(viewMatrix)[3]);
+  lodScale = projectionMatrix[1][1];
+  pixelsPerUnit = lodScale * viewportHeight * 0.5f;
+  occlusionActive = false;
+  if (occlusionEnabled) {
+    PROFILE_ZONE("Occlusion");
+    occlusionActive = drawOccluders(scene, projectionMatrix * viewMatrix);
+    renderStats.occlusion = occlusionBuffer.getStats();
+    renderStats.occlusionMs = renderStats.occlusion.rasterMs;
+  }
+  bool sunShadows = scene.sun.intensity > 0.0f && scene.sun.castsShadows;
+  if (cullingEnabled || sunShadows) {
+    PROFILE_ZONE("Culling");
+    std::chrono::steady_clock::time_point cullStart = std::chrono::steady_clock::now();
+    updateCulling(scene); // Shadow casters come out of the BVH too
+    if (cullingEnabled) {
+      static std::vector<void *> visible;
+      visible.clear();
+      cullTree.query(Frustum::fromMatrix(projectionMatrix * viewMatrix), visible);
+      for (void *slot : visible) {
+        const CullEntry &entry = cullEntries[(intptr_t)slot];
+        queueDraw(queue, entry.asset, entry.order);
+      }
+    }
+    renderStats.cullingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+  }
+  if (!cullingEnabled) {
+    for (size_t i = 0; i < scene.assets.size(); i++) {
+      queueDraw(queue, scene.assets[i], i);
+    }
+  }
+  renderStats.visibleAssets = queue.size();
+
+  // Work the batches out up front so all the uniform data goes up in one go
+  static std::vector<DrawRun> runs;
+  runs.clear();
+  size_t objectSlots = 0;
+  {
+    PROFILE_ZONE("Sort and batch");
+    std::sort(queue.begin(), queue.end());
+    size_t first = 0;
+    while (first < queue.size()) {
+      Asset *firstAsset = queue[first].asset;
+      size_t last = first + 1;
+      if (instancingEnabled && firstAsset->shader->canInstance()) {
+        while (last < queue.size() && sameBatch(firstAsset, queue[last].asset)) {
+          last++;
+        }
+      }
+      DrawRun run;
+      run.first = first;
+      run.count = last - first;
+      run.objectSlot = run.count == 1 ? objectSlots++ : 0;
+      runs.push_back(run);
+      first = last;
+    }
+  }
+  queueEntities(scene.entities, projectionMatrix * viewMatrix, objectSlots);
+  lightGrid.build(scene.lights, viewMatrix, projectionMatrix);
+  renderStats.lights = lightGrid.getStats();
+  if (sunShadows) {
+    std::chrono::steady_clock::time_point fitStart = std::chrono::steady_clock::now();
+    shadowMaps.fit(scene.sun, viewMatrix, projectionMatrix);
+    shadowMaps.stats.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fitStart).count();
+  }
+
+  GLsizeiptr frameStride = uniformRing.alignSize(sizeof(FrameUniforms));
+  GLsizeiptr objectStride = uniformRing.alignSize(sizeof(ObjectUniforms));
+  GLsizeiptr objectBase = frameStride * (sunShadows ? 1 + SHADOW_CASCADES : 1);
+  std::vector<unsigned char> &uniformData = renderList.uniformData;
+  uniformData.resize(objectBase + objectSlots * objectStride);
+  renderList.frameStride = frameStride;
+  renderList.objectStride = objectStride;
+  renderList.objectBase = objectBase;
+
+  FrameUniforms *frame = (FrameUniforms *)uniformData.data();
+  frame->view = viewMatrix;
+  frame->projection = projectionMatrix;
+  frame->viewProjection = projectionMatrix * viewMatrix;
+  frame->clusterScale = lightGrid.getClusterScale(viewportWidth, viewportHeight);
+  frame->clusterCounts = glm::vec4(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, 0);
+  if (scene.sun.intensity > 0.0f) {
+    shadowMaps.fillUniforms(*frame, scene.sun, viewMatrix);
+  } else {
+    frame->sunDirection = glm::vec4(0.0f);
+    frame->sunColor = glm::vec4(0.0f);
+  }
+  if (sunShadows) {
+    // Depth only shaders just read vp
+    for (int cascade = 0; cascade < SHADOW_CASCADES; cascade++) {
+      FrameUniforms *cascadeFrame = (FrameUniforms *)&uniformData[(1 + cascade) * frameStride];
+      *cascadeFrame = *frame;
+      cascadeFrame->viewProjection = shadowMaps.getViewProjection(cascade);
+    }
+  }
+
+  for (const DrawRun &run : runs) {
+    if (run.count == 1) {
+      ObjectUniforms *object = (ObjectUniforms *)&uniformData[objectBase + run.objectSlot * objectStride];
+      object->model = queue[run.first].asset->getModelMatrix();
+    }
+  }
+  for (const EntityRun &run : entityRuns) {
+    if (run.instanced) {
+      continue;
+    }
+    for (size_t i = 0; i < run.count; i++) {
+      ObjectUniforms *object = (ObjectUniforms *)&uniformData[objectBase + (run.objectSlot + i) * objectStride];
+      object->model = scene.entities.transforms.model[entityQueue[run.first + i].transform];
+    }
+  }
+
+  // Casters keep the LODs the main view just picked
+  if (sunShadows) {
+    emitShadows(scene);
+  }
+  PROFILE_ZONE("Emit draws");
+  for (const DrawRun &run : runs) {
+    if (run.count > 1) {
+      emitInstancedBatch(&queue[run.first], run.count);
+    } else {
+      emitAsset(queue[run.first].asset, run.objectSlot);
+    }
+  }
+  emitEntities(scene.entities);
+}
+
+void drawAssets(Scene &scene, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix) {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  {
+    PROFILE_ZONE("Render list");
+    buildRenderList(scene, viewMatrix, projectionMatrix, viewport[2], viewport[3]);
+  }
+  std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+  {
+    PROFILE_ZONE("Submit");
+    submitRenderList(renderList);
+  }
+  renderStats.commands = renderList.commands.size();
+  renderStats.buildMs = std::chrono::duration<double, std::milli>(built - start).count();
+  renderStats.submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - built).count();
+}
+
 /*void imguiMat4Table(glm::mat4 matrix, const char *name) {*/
 /*  if (ImGui::BeginTable(name, 4)) {*/
 /*    for (int i = 0; i < 4; i++) {*/
@@ -413,7 +1393,93 @@ void destroy() {
 /*  }*/
 /*}*/
 
-void render(Scene scene) {
+// The sun and its shadow maps, for the Renderer window
+static void drawShadowSettings(Scene &scene) {
+  ImGui::SeparatorText("Sun");
+  DirectionalLight &sun = scene.sun;
+  ImGui::DragFloat3("Direction", &sun.direction[0], 0.01f);
+  ImGui::ColorEdit3("Color", &sun.color[0]);
+  ImGui::DragFloat("Intensity", &sun.intensity, 0.01f, 0.0f, 100.0f);
+  ImGui::Checkbox("Casts shadows", &sun.castsShadows);
+  if (sun.intensity <= 0.0f || !sun.castsShadows) {
+    return;
+  }
+  ImGui::Checkbox("Cache cascades", &shadowMaps.caching);
+  ImGui::DragFloat("Shadow distance", &shadowMaps.distance, 0.5f, 1.0f, 1000.0f);
+  ImGui::SliderFloat("Split lambda", &shadowMaps.splitLambda, 0.0f, 1.0f);
+  int resolutionIndex = 0;
+  while ((512 << resolutionIndex) < shadowMaps.resolution && resolutionIndex < 3) {
+    resolutionIndex++;
+  }
+  if (ImGui::Combo("Resolution", &resolutionIndex, "512\0" "1024\0" "2048\0" "4096\0")) {
+    shadowMaps.resolution = 512 << resolutionIndex;
+  }
+
+  const ShadowStats &shadows = renderStats.shadows;
+  ImGui::Text("Cascades: %d of %d drawn, %d casters in %d draw calls", shadows.cascadesDrawn, SHADOW_CASCADES,
+              shadows.casters, shadows.drawCalls);
+  // What the pass costs against the whole frame, from the profiler. GPU
+  // results turn up a few frames late.
+  const ProfileFrame *frame = profiler.getFrame(0);
+  if (frame != NULL && frame->cpuMs > 0.0) {
+    double cpuMs = sumZoneMs(frame->cpuZones, "Shadows");
+    ImGui::Text("Shadow pass CPU: %.3f ms, %.1f%% of the frame", cpuMs, 100.0 * cpuMs / frame->cpuMs);
+  }
+  for (int framesAgo = 0; framesAgo <= Profiler::FRAMES_IN_FLIGHT; framesAgo++) {
+    frame = profiler.getFrame(framesAgo);
+    if (frame != NULL && frame->gpuReady && frame->gpuMs > 0.0) {
+      double gpuMs = sumZoneMs(frame->gpuZones, "Shadows");
+      ImGui::Text("Shadow pass GPU: %.3f ms, %.1f%% of the frame", gpuMs, 100.0 * gpuMs / frame->gpuMs);
+      break;
+    }
+  }
+}
+
+static void drawLodSettings() {
+  ImGui::SeparatorText("LOD");
+  ImGui::Checkbox("Mesh LODs", &lodSettings.enabled);
+  for (int i = 0; i < MAX_LODS - 1; i++) {
+    char label[32];
+    snprintf(label, sizeof(label), "LOD %d below", i + 1);
+    ImGui::SliderFloat(label, &lodSettings.screenSizes[i], 0.0f, 1.0f);
+  }
+  ImGui::SliderFloat("Hysteresis", &lodSettings.hysteresis, 0.0f, 0.5f);
+  // Off draws everything at LOD 0, so both numbers match
+  int saved = renderStats.fullDetailTriangles - renderStats.triangles;
+  ImGui::Text("Triangles: %d of %d at full detail, %.1f%% fewer", renderStats.triangles,
+              renderStats.fullDetailTriangles,
+              renderStats.fullDetailTriangles > 0 ? 100.0f * saved / renderStats.fullDetailTriangles : 0.0f);
+  ImGui::Text("Assets per LOD: %d, %d, %d, %d", renderStats.lodAssets[0], renderStats.lodAssets[1],
+              renderStats.lodAssets[2], renderStats.lodAssets[3]);
+}
+
+// The fixed step update, for the Renderer window. Its steps are running while
+// this draws, so only what the worker doesn't read gets touched.
+static void drawSimulationSettings(Simulation &simulation) {
+  ImGui::SeparatorText("Simulation");
+  ImGui::Checkbox("Threaded", &simulation.threaded);
+  ImGui::SameLine();
+  ImGui::Checkbox("Interpolate", &simulation.interpolate);
+  float rate = 1.0f / simulation.timestep;
+  if (ImGui::DragFloat("Steps per second", &rate, 1.0f, 1.0f, 1000.0f, "%.0f")) {
+    simulation.timestep = 1.0f / rate;
+  }
+  const SimulationStats &stats = simulation.getStats();
+  ImGui::Text("%d steps in %.3f ms, waited %.3f ms for them, %d dropped so far", stats.steps, stats.stepMs,
+              stats.waitMs, stats.droppedSteps);
+}
+
+// Whatever the steps kicked off last frame came to, into the scene before
+// anything looks at it
+static void publishSimulation(Scene &scene) {
+  if (scene.simulation != NULL) {
+    PROFILE_ZONE("Simulation");
+    scene.simulation->publish();
+  }
+}
+
+void render(Scene &scene) {
+  profiler.beginFrame();
   static ImVec2 viewportSize = ImVec2(1024, 768);
   static ImVec2 viewportPosition = ImVec2(0, 0);
   static ImVec2 viewportSizeOld = viewportSize;
@@ -436,11 +1502,16 @@ void render(Scene scene) {
   double currentTime = glfwGetTime();
   deltaTime = float(currentTime - lastTime);
   lastTime = currentTime;
-
-  ImGui_ImplOpenGL3_NewFrame();
-  ImGui_ImplGlfw_NewFrame();
-  ImGui::NewFrame();
-  ImGuizmo::BeginFrame();
+  publishSimulation(scene);
+
+  int uiZone = profiler.beginZone("UI");
+  {
+    PROFILE_ZONE("ImGui new frame");
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui_ImplGlfw_NewFrame();
+    ImGui::NewFrame();
+    ImGuizmo::BeginFrame();
+  }
 
   static ImGuiDockNodeFlags dockspaceFlags = ImGuiDockNodeFlags_PassthruCentralNode;
   ImGuiWindowFlags windowFlags = ImGuiWindowFlags_MenuBar | ImGuiWindowFlags_NoDocking;
@@ -493,9 +1564,13 @@ void render(Scene scene) {
       ImGuiID dock_id_right = ImGui::DockBuilderSplitNode(dockspace_id, ImGuiDir_Right, 0.3f, nullptr, &dockspace_id);
 
       ImGui::DockBuilderDockWindow("Console", dock_id_down);
+      ImGui::DockBuilderDockWindow("Profiler", dock_id_down);
       ImGui::DockBuilderDockWindow("User Render Callback", dock_id_left);
       ImGui::DockBuilderDockWindow("Viewport", ImGui::DockBuilderGetCentralNode(dockspace_id)->ID);
       ImGui::DockBuilderDockWindow("Asset Information", dock_id_right);
+      ImGui::DockBuilderDockWindow("Renderer", dock_id_right);
+      ImGui::DockBuilderDockWindow("Resources", dock_id_right);
+      ImGui::DockBuilderDockWindow("Streaming", dock_id_right);
       ImGui::DockBuilderFinish(dockspace_id);
     }
   }
@@ -504,70 +1579,28 @@ void render(Scene scene) {
   Camera *currentCamera = scene.cameras[scene.activeCamera];
 
   // Compute the V and P for the MVP
-  glm::mat4 viewMatrix = glm::inverse(glm::translate(glm::mat4(1), currentCamera->position) * (mat4_cast(currentCamera->rotation)));
-  glm::mat4 projectionMatrix = glm::perspective(currentCamera->fov, (float)viewportSize.x / (float)viewportSize.y, currentCamera->nearPlane, currentCamera->farPlane);
-
-  for (int i = 0; i < scene.assets.size(); i++) {
-    Asset *currentAsset = scene.assets[i];
-
-    glUseProgram(*currentAsset->shaderProgram);
-
-    // Send mega sigma MVP to the vertex shader (transformations for the win)
-    glm::mat4 rotationMatrix = mat4_cast(currentAsset->rotation);
-    glm::mat4 translationMatrix = glm::translate(glm::mat4(1), currentAsset->position);
-    glm::mat4 scalingMatrix = glm::scale(glm::mat4(1), currentAsset->scaling);
-    glm::mat4 modelMatrix = translationMatrix * rotationMatrix * scalingMatrix;
-
-    glm::mat4 mvp = projectionMatrix * viewMatrix * modelMatrix;
-
-    glUniformMatrix4fv(currentAsset->matrixID, 1, GL_FALSE, &mvp[0][0]);
-    glUniformMatrix4fv(currentAsset->modelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
-    glUniformMatrix4fv(currentAsset->viewMatrixID, 1, GL_FALSE, &viewMatrix[0][0]);
-
-    glm::vec3 lightPos = glm::vec3(4, 4, 4);
-    glm::vec3 lightColor = glm::vec3(1, 1, 1);
-    float lightPower = 50;
-    glUniform3f(currentAsset->lightID, lightPos.x, lightPos.y, lightPos.z);
-    glUniform3f(currentAsset->lightColor, lightColor.x, lightColor.y, lightColor.z);
-    glUniform1f(currentAsset->lightPower, lightPower);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, *currentAsset->albedoTexture);
-    // Set sampler texture
-    glUniform1i(currentAsset->albedoTextureID, 0);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, *currentAsset->specularTexture);
-    glUniform1i(currentAsset->specularTextureID, 1);
-
-    // DRAWING HAPPENS HERE
-    // Vertex Data
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, *currentAsset->vertexBuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-
-    // UV Data
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, *currentAsset->uvBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void *)0);
-
-    // Normal Data
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, *currentAsset->normalBuffer);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void *)0);
-
-    // Index buffer
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *currentAsset->elementBuffer);
-
-    glDrawElements(GL_TRIANGLES, currentAsset->indices->size(), GL_UNSIGNED_SHORT,
-                   (void *)0);
-
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
+  glm::mat4 viewMatrix = currentCamera->getViewMatrix();
+  glm::mat4 projectionMatrix = currentCamera->getProjectionMatrix((float)viewportSize.x / (float)viewportSize.y);
+
+  {
+    PROFILE_ZONE("Asset uploads");
+    PROFILE_GPU_ZONE("Asset uploads");
+    assetLoader.processUploads();
+    resources.update();
+    textureStreamer.update();
+  }
+  // The next frame's steps, on a worker until the next publish
+  if (scene.simulation != NULL) {
+    scene.simulation->advance(getDeltaTime());
+  }
+  {
+    PROFILE_ZONE("Scene");
+    PROFILE_GPU_ZONE("Scene");
+    drawAssets(scene, viewMatrix, projectionMatrix);
   }
 
   if (scene.renderCallback != NULL) {
+    PROFILE_ZONE("User render callback");
     scene.renderCallback();
   }
 
@@ -579,45 +1612,14 @@ void render(Scene scene) {
   ImGui::End();
   ImGui::PopStyleVar();
 
-  ImGui::Begin("Console");
-  bool autoScroll = true;
-  if(ImGui::BeginPopup("Options")) {
-    ImGui::Checkbox("Auto-scroll", &autoScroll);
-    ImGui::EndPopup();
-  }
-
-  if (ImGui::Button("Options")) {
-    ImGui::OpenPopup("Options");
-  }
-  ImGui::Separator();
-
-  const float footerHeightToReserve = ImGui::GetStyle().ItemSpacing.y + ImGui::GetFrameHeightWithSpacing();
-  if (ImGui::BeginChild("ScrollingRegion", ImVec2(0, 0), ImGuiChildFlags_NavFlattened, ImGuiWindowFlags_HorizontalScrollbar)) {
-    if (ImGui::BeginPopupContextWindow()) {
-      if (ImGui::Selectable("Clear")) {
-        log = "";
-        ImGui::EndPopup();
-      }
-      ImGui::EndChild();
-      ImGui::Separator();
-    }
-    ImGui::Text("%s", log.c_str());
-    static std::string oldLog = log;
-    if (oldLog != log && autoScroll) {
-      ImGui::SetScrollHereY(1.0f);
-      oldLog = log;
-    }
-    ImGui::EndChild();
-  }
-
-  ImGui::End();
+  console.drawWindow();
 
   ImGui::Begin("Asset Information");
   static int assetNum = 0;
   ImGui::Text("Select asset ID");
   for (int i = 0; i < scene.assets.size(); i++) {
-    char index[4]; // Probably never will need more than 3 digits of precision
-    sprintf(index, "%d", i);
+    char index[16]; // The bench scenes go well past 3 digits
+    snprintf(index, sizeof(index), "%d", i);
     if (ImGui::RadioButton(index, assetNum == i)) {
       assetNum = i;
     }
@@ -638,93 +1640,166 @@ void render(Scene scene) {
   if (ImGui::RadioButton("Scale", currentGizmoOperation == ImGuizmo::SCALE)) {
     currentGizmoOperation = ImGuizmo::SCALE;
   }
-  ImGui::DragFloat3("Translate", &currentAsset->position[0], 0.01);
-  ImGui::DragFloat4("Rotate", &currentAsset->rotation[0], 0.01);
-  ImGui::DragFloat3("Scale", &currentAsset->scaling[0], 0.01);
+  Transform &transform = currentAsset->transform;
+  glm::vec3 position = transform.getPosition();
+  glm::quat rotation = transform.getRotation();
+  glm::vec3 scaling = transform.getScale();
+  if (ImGui::DragFloat3("Translate", &position[0], 0.01)) {
+    transform.setPosition(position);
+  }
+  if (ImGui::DragFloat4("Rotate", &rotation[0], 0.01)) {
+    transform.setRotation(rotation);
+  }
+  if (ImGui::DragFloat3("Scale", &scaling[0], 0.01)) {
+    transform.setScale(scaling);
+  }
 
-  glm::mat4 rotationMatrix = mat4_cast(currentAsset->rotation);
-  glm::mat4 translationMatrix = glm::translate(glm::mat4(1), currentAsset->position);
-  glm::mat4 scalingMatrix = glm::scale(glm::mat4(1), currentAsset->scaling);
-  glm::mat4 modelMatrix = translationMatrix * rotationMatrix * scalingMatrix;
+  // The gizmo works in world space, the transform is relative to its parent
+  glm::mat4 modelMatrix = currentAsset->getModelMatrix();
 
   ImGuizmo::SetRect(viewportPosition.x, viewportPosition.y, viewportSize.x, viewportSize.y);
   ImGuizmo::Manipulate((const float *)&viewMatrix, (const float *)&projectionMatrix, currentGizmoOperation, currentGizmoMode, (float *)&modelMatrix, NULL, NULL);
-  glm::vec3 shitAngles;
-  ImGuizmo::DecomposeMatrixToComponents((float *)&modelMatrix, &currentAsset->position[0], (float *)&shitAngles, &currentAsset->scaling[0]);
-  currentAsset->rotation = glm::quat(glm::radians(shitAngles));
+  if (ImGuizmo::IsUsing()) {
+    if (transform.getParent() != NULL) {
+      modelMatrix = glm::inverse(transform.getParent()->getWorldMatrix()) * modelMatrix;
+    }
+    glm::vec3 shitAngles;
+    ImGuizmo::DecomposeMatrixToComponents((float *)&modelMatrix, &position[0], (float *)&shitAngles, &scaling[0]);
+    transform.setPosition(position);
+    transform.setRotation(glm::quat(glm::radians(shitAngles)));
+    transform.setScale(scaling);
+  }
   ImGui::End();
 
+  ImGui::Begin("Renderer");
+  ImGui::Checkbox("Instancing", &instancingEnabled);
+  ImGui::Checkbox("Frustum culling", &cullingEnabled);
+  ImGui::Text("Visible: %d of %d assets", renderStats.visibleAssets, renderStats.totalAssets);
+  ImGui::Text("Entities: %d, %d renderable", (int)scene.entities.getCount(), (int)scene.entities.renderables.size());
+  ImGui::Text("Culling: %.3f ms, %d refits, BVH height %d", renderStats.cullingMs, renderStats.refits, cullTree.getHeight());
+  ImGui::Checkbox("Occlusion culling", &occlusionEnabled);
+  ImGui::SameLine();
+  ImGui::Checkbox("Parallel##occlusion", &occlusionBuffer.parallel);
+  const OcclusionStats &occlusion = renderStats.occlusion;
+  ImGui::Text("Occlusion: %d hidden, %.3f ms (%s, %d occluders, %d triangles over %d tasks)",
+              renderStats.occludedAssets, renderStats.occlusionMs, OcclusionBuffer::getSimdName(), occlusion.occluders,
+              occlusion.triangles, occlusion.tasks);
+  const LightGridStats &lights = renderStats.lights;
+  ImGui::Text("Lights: %d of %d in view, %d cluster entries, at most %d in one", lights.lights,
+              (int)scene.lights.size(), lights.indices, lights.maxPerCluster);
+  ImGui::Text("Light grid: %.3f ms over %d tasks%s", lights.buildMs, lights.tasks, lights.overflowed > 0 ? ", overflowing!" : "");
+  drawShadowSettings(scene);
+  drawLodSettings();
+  ImGui::Text("Draw calls: %d", renderStats.drawCalls);
+  ImGui::Text("Instanced: %d assets in %d batches", renderStats.instances, renderStats.instancedBatches);
+  ImGui::Text("Render list: %d commands, built in %.3f ms, submitted in %.3f ms", renderStats.commands,
+              renderStats.buildMs, renderStats.submitMs);
+  if (scene.simulation != NULL) {
+    drawSimulationSettings(*scene.simulation);
+  }
+  ImGui::Text("Uniform data: %.1f KiB (%d orphans so far)", uniformRing.bytesThisFrame / 1024.0f, uniformRing.orphans);
+  ShaderCacheStats shaderCache = getShaderCacheStats();
+  ImGui::Text("Shader cache: %d hits, %d misses, %.1f ms", shaderCache.hits, shaderCache.misses, shaderCache.milliseconds);
+  ImGui::SeparatorText("Loading");
+  LoaderStats loaderStats = assetLoader.getStats();
+  ImGui::Text("%d decoding, %d uploading, %d done", loaderStats.decoding, loaderStats.uploading, loaderStats.completed);
+  ImGui::Text("Uploaded %.1f KiB in %.2f ms", loaderStats.bytesThisFrame / 1024.0f, loaderStats.msThisFrame);
+  ImGui::DragScalar("Upload budget (ms)", ImGuiDataType_Double, &assetLoader.budgetMs, 0.05f);
+  ImGui::SeparatorText("Jobs");
+  std::vector<JobThreadStats> jobStats = jobs.getStats();
+  for (size_t i = 0; i < jobStats.size(); i++) {
+    // The last slot is the main thread and anything else helping out
+    char label[32] = "Main";
+    if (i + 1 < jobStats.size()) {
+      snprintf(label, sizeof(label), "Worker %d", (int)i);
+    }
+    ImGui::Text("%s: %llu jobs, %llu stolen, slept %llu times", label, (unsigned long long)jobStats[i].jobs,
+                (unsigned long long)jobStats[i].steals, (unsigned long long)jobStats[i].sleeps);
+  }
+  ImGui::SeparatorText("State changes");
+  if (ImGui::BeginTable("State changes", 3)) {
+    ImGui::TableSetupColumn("State");
+    ImGui::TableSetupColumn("Issued");
+    ImGui::TableSetupColumn("Skipped");
+    ImGui::TableHeadersRow();
+    const char *names[] = {"Programs", "Textures", "Vertex arrays", "Uniforms"};
+    const StateCounter *counters[] = {&glState.stats.programs, &glState.stats.textures,
+                                      &glState.stats.vertexArrays, &glState.stats.uniforms};
+    for (int i = 0; i < 4; i++) {
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", names[i]);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", counters[i]->issued);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", counters[i]->skipped);
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+
+  resources.drawWindow();
+  textureStreamer.drawWindow();
+  profiler.drawWindow();
+  profiler.endZone(uiZone);
+
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   glViewport(0, 0, WIDTH, HEIGHT);
 
-  ImGui::Render();
-  ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-  ImGui::UpdatePlatformWindows();
-  ImGui::RenderPlatformWindowsDefault();
-  glfwMakeContextCurrent(window);
+  {
+    PROFILE_ZONE("ImGui render");
+    PROFILE_GPU_ZONE("ImGui");
+    ImGui::Render();
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    ImGui::UpdatePlatformWindows();
+    ImGui::RenderPlatformWindowsDefault();
+    glfwMakeContextCurrent(window);
+  }
 
   // Swap buffers
-  glfwSwapBuffers(window);
-  glfwPollEvents();
-}
-
-} // namespace fred
-
-// Userspace ================================================================ //
-
-fred::Scene scene;
-
-void renderCallback() {
-  ImGui::Begin("User Render Callback");
-  ImGui::Text("Frametime (ms): %f", fred::getUnscaledDeltaTime() * 1000);
-  ImGui::Text("FPS: %f", 1/fred::getUnscaledDeltaTime());
-  ImGui::SeparatorText("Camera");
-  fred::Camera *currentCamera = scene.cameras[scene.activeCamera];
-  glm::vec3 rotationEuler = glm::degrees(eulerAngles(currentCamera->rotation));
-  ImGui::DragFloat3("Translate", (float*)&currentCamera->position, 0.01f);
-  ImGui::DragFloat3("Rotate", (float*)&rotationEuler);
-  float fovDeg = glm::degrees(currentCamera->fov);
-  ImGui::DragFloat("FOV", (float*)&fovDeg);
-  currentCamera->fov = glm::radians(fovDeg);
-  currentCamera->rotation = glm::quat(glm::radians(rotationEuler));
-  ImGui::End();
+  {
+    PROFILE_ZONE("Swap");
+    glfwSwapBuffers(window);
+  }
+  {
+    PROFILE_ZONE("Poll events");
+    glfwPollEvents();
+  }
+  profiler.endFrame();
 }
 
-int main() {
-  fred::initWindow();
-  fred::Model coneModel("../models/model.obj");
-  fred::Model suzanneMod("../models/suzanne.obj");
-  fred::Texture buffBlackGuy("../textures/results/texture_BMP_DXT5_3.DDS");
-  fred::Texture suzanneTexAlb("../textures/results/suzanne_albedo_DXT5.DDS");
-  fred::Texture suzanneTexSpec("../textures/results/suzanne_specular_DXT5.DDS");
-  fred::Shader basicShader("../shaders/basic.vert", "../shaders/basic.frag");
-  fred::Shader basicLitShader("../shaders/basic_lit.vert", "../shaders/basic_lit.frag");
-  fred::Asset cone(coneModel, buffBlackGuy, buffBlackGuy, basicShader);
-  fred::Asset suzanne(suzanneMod, suzanneTexAlb, suzanneTexSpec, basicLitShader);
-
-  fred::Camera mainCamera(glm::vec3(4, 3, 3));
-  mainCamera.lookAt(glm::vec3(0, 0, 0));
-
-  scene = fred::Scene();
-
-  scene.addCamera(mainCamera);
-
-  scene.addAsset(cone);
-  scene.addAsset(suzanne);
-
-  scene.setRenderCallback(renderCallback);
+void renderHeadless(Scene &scene) {
+  profiler.beginFrame();
+  static double lastTime = glfwGetTime();
+  double currentTime = glfwGetTime();
+  deltaTime = float(currentTime - lastTime);
+  lastTime = currentTime;
+  publishSimulation(scene);
 
-  fred::setDeltaTimeMultiplier(20.0f);
+  glBindFramebuffer(GL_FRAMEBUFFER, frameBufferName);
+  glViewport(0, 0, framebufferWidth, framebufferHeight);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  while (!fred::shouldExit()) {
-    fred::render(scene);
-    cone.position.x += 0.01 * fred::getDeltaTime();
-    glm::vec3 eulerAngles = glm::eulerAngles(suzanne.rotation);
-    eulerAngles.x += glm::radians(1.0f) * fred::getDeltaTime();
-    suzanne.rotation = glm::quat(eulerAngles);
+  Camera *currentCamera = scene.cameras[scene.activeCamera];
+  glm::mat4 viewMatrix = currentCamera->getViewMatrix();
+  glm::mat4 projectionMatrix = currentCamera->getProjectionMatrix((float)framebufferWidth / (float)framebufferHeight);
+  {
+    PROFILE_ZONE("Asset uploads");
+    assetLoader.processUploads();
+    resources.update();
+    textureStreamer.update();
+  }
+  // The next frame's steps, on a worker until the next publish
+  if (scene.simulation != NULL) {
+    scene.simulation->advance(getDeltaTime());
+  }
+  {
+    PROFILE_ZONE("Scene");
+    PROFILE_GPU_ZONE("Scene");
+    drawAssets(scene, viewMatrix, projectionMatrix);
   }
 
-  fred::destroy();
-
-  return 0;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  profiler.endFrame();
 }
+
+} // namespace fred
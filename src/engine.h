@@ -0,0 +1,466 @@
+#ifndef FRED_ENGINE_H
+#define FRED_ENGINE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "entities.h"
+#include "glstate.h"
+#include "lighting.h"
+#include "loader.h"
+#include "mesh.h"
+#include "occlusion.h"
+#include "shader.h"
+#include "shadows.h"
+#include "simulation.h"
+#include "streaming.h"
+#include "texture.h"
+#include "transform.h"
+#include "uniforms.h"
+#include "variants.h"
+
+constexpr int WIDTH = 1366;
+constexpr int HEIGHT = 768;
+
+namespace fred {
+
+// Takes the cooked .ftex next to path if there's an up to date one, SOIL2
+// decodes and compresses path itself otherwise
+GLuint loadTexture(const char *path);
+// Every level of a mapped .ftex straight to glCompressedTexImage2D
+GLuint uploadCookedTexture(const CookedTexture &cooked);
+GLenum cookedTextureFormat(TextureFormat format);
+// fred-bake output, as is. No flipping, compression or color mangling, any
+// of those would wreck the RGBM.
+GLuint loadLightmap(const char *path);
+
+class Model {
+public:
+    std::vector<SubMesh> subMeshes; // Ranges into the shared buffers below
+    std::vector<SubMesh> lodSubMeshes; // A set like subMeshes per LOD past 0, see generateLods
+    VertexLayout layout;
+    GLuint vertexArray;   // Owns all the attribute setup, bind and draw
+    GLuint vertexBuffer;  // Interleaved, see layout
+    GLuint elementBuffer; // Mixed 16 and 32 bit indices, see subMeshes
+    GLuint instanceBuffer; // Per instance model matrices, attributes 3 to 6
+    GLuint positionBuffer;   // Just the positions again, for depth only passes
+    GLuint depthVertexArray; // Positions and instance matrices, nothing else
+    MeshBounds bounds; // Model space, for culling
+    float uvDensity = 0.0f; // For texture streaming, see computeUvDensity
+    uint32_t revision = 0; // Bumped whenever the fields above get swapped out
+    std::shared_ptr<LoadJob> pendingLoad; // Set while the placeholder is standing in
+
+  // Takes whatever layout the cooked blob has, or the default one
+  Model(std::string modelPath);
+  // Async returns straight away with the placeholder cube in place
+  Model(std::string modelPath, LoadMode mode);
+  // Only uses a cooked blob if it was cooked with this layout
+  Model(std::string modelPath, VertexLayout requiredLayout);
+  // Procedural geometry, default layout
+  explicit Model(const MeshData &mesh);
+  ~Model() {
+    if (pendingLoad) {
+      pendingLoad->cancelled = true;
+      return; // Everything below is the placeholder's
+    }
+    glDeleteVertexArrays(1, &vertexArray);
+    glDeleteVertexArrays(1, &depthVertexArray);
+    glDeleteBuffers(1, &vertexBuffer);
+    glDeleteBuffers(1, &elementBuffer);
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteBuffers(1, &positionBuffer);
+  }
+
+  // One bind for the whole model then a cheap draw per submesh. LODs past
+  // getLodCount draw the last one.
+  void draw(int lod = 0) const;
+  // Same again, instanceCount times, reading matrices from instanceBuffer
+  void drawInstanced(GLsizei instanceCount, int lod = 0) const;
+  // Through depthVertexArray, always instanced
+  void drawDepthInstanced(GLsizei instanceCount, int lod = 0) const;
+
+  int getLodCount() const { return subMeshes.empty() ? 1 : 1 + (int)(lodSubMeshes.size() / subMeshes.size()); }
+  uint32_t getTriangleCount(int lod = 0) const;
+
+  bool isLoaded() const { return !pendingLoad; }
+
+private:
+  friend class ModelLoadJob;
+
+  void load(const std::string &modelPath, const VertexLayout *requiredLayout);
+  // positions is vertexCount of them, tightly packed for the depth pass
+  void createBuffers(const void *vertices, size_t verticesSize, const void *indices, size_t indicesSize,
+                     const glm::vec3 *positions, size_t positionsSize);
+  // Attribute setup over vertexBuffer, positionBuffer and elementBuffer,
+  // makes instanceBuffer
+  void createVertexArray();
+  const SubMesh *getLodSubMeshes(int lod) const;
+  void drawSubMeshes(GLuint vertexArrayI, GLsizei instanceCount, int lod) const;
+};
+
+class Texture {
+public:
+  GLuint texture;
+  std::shared_ptr<LoadJob> pendingLoad; // Set while the placeholder is standing in
+  bool streamed = false; // Levels come and go, see TextureStreamer
+
+  Texture(std::string texturePath) {
+    texture = loadTexture(texturePath.c_str());
+  }
+  // Async binds a checkerboard until the real thing is up
+  Texture(std::string texturePath, LoadMode mode) {
+    if (mode == LoadMode::Blocking) {
+      texture = loadTexture(texturePath.c_str());
+      return;
+    }
+    texture = placeholderTexture();
+    pendingLoad = loadTextureAsync(this, texturePath);
+  }
+  ~Texture() {
+    if (pendingLoad) {
+      pendingLoad->cancelled = true;
+      return;
+    }
+    if (streamed) {
+      textureStreamer.remove(this);
+    }
+    glDeleteTextures(1, &texture);
+  }
+
+  bool isLoaded() const { return !pendingLoad; }
+};
+
+// Baked lighting for the assets fred-bake wrote lightmap UVs for, drawn with
+// a LIGHTMAPPED shader variant
+class Lightmap {
+public:
+  GLuint texture;
+
+  Lightmap(std::string lightmapPath) {
+    texture = loadLightmap(lightmapPath.c_str());
+  }
+  ~Lightmap() {
+    glDeleteTextures(1, &texture);
+  }
+};
+
+class Shader {
+public:
+  GLuint shaderProgram;
+  // Optional, same fragment shader with the model matrix as an attribute
+  GLuint instancedShaderProgram = 0;
+  std::shared_ptr<LoadJob> pendingLoad; // Set while the placeholder is standing in
+  // Variant shaders own no programs, the ShaderVariants does
+  ShaderVariants *variants = NULL;
+  uint32_t features = 0; // Without SHADER_INSTANCED, the renderer adds that
+  GLuint depthShaderProgram = 0; // Owned by variants, see getDepthProgram
+
+  // Uniforms all come from the blocks in uniforms.h, nothing to look up
+  Shader(std::string vertPath, std::string fragPath) {
+    load(vertPath, fragPath, "");
+  }
+  Shader(std::string vertPath, std::string fragPath, std::string instancedVertPath) {
+    load(vertPath, fragPath, instancedVertPath);
+  }
+  // Async draws flat magenta until both programs are compiled. An empty
+  // instancedVertPath means no instanced program.
+  Shader(std::string vertPath, std::string fragPath, std::string instancedVertPath, LoadMode mode) {
+    if (mode == LoadMode::Blocking) {
+      load(vertPath, fragPath, instancedVertPath);
+      return;
+    }
+    shaderProgram = placeholderProgram(false);
+    if (!instancedVertPath.empty()) {
+      instancedShaderProgram = placeholderProgram(true);
+    }
+    pendingLoad = loadShaderAsync(this, vertPath, fragPath, instancedVertPath);
+  }
+  // One variant, built now unless it was precompiled. The instanced one is
+  // left until a batch needs it.
+  Shader(ShaderVariants &variantsI, uint32_t featuresI) {
+    variants = &variantsI;
+    features = featuresI & ~SHADER_INSTANCED;
+    shaderProgram = variants->get(features);
+  }
+  ~Shader() {
+    if (pendingLoad) {
+      pendingLoad->cancelled = true;
+      return;
+    }
+    if (variants != NULL) {
+      return;
+    }
+    glState.forgetProgram(shaderProgram);
+    glDeleteProgram(shaderProgram);
+    if (instancedShaderProgram != 0) {
+      glState.forgetProgram(instancedShaderProgram);
+      glDeleteProgram(instancedShaderProgram);
+    }
+  }
+
+  bool isLoaded() const { return !pendingLoad; }
+
+  bool canInstance() const { return instancedShaderProgram != 0 || variants != NULL; }
+  GLuint getInstancedProgram() {
+    if (instancedShaderProgram == 0 && variants != NULL) {
+      instancedShaderProgram = variants->get(features | SHADER_INSTANCED);
+    }
+    return instancedShaderProgram;
+  }
+  // Instanced, positions only, for shadow maps. Variant shaders get their own
+  // DEPTH_ONLY variant, anything else the built in one.
+  GLuint getDepthProgram() {
+    if (depthShaderProgram == 0 && variants != NULL) {
+      depthShaderProgram = variants->get((features & ~SHADER_SHADING_FEATURES) | SHADER_DEPTH_ONLY | SHADER_INSTANCED);
+    }
+    return depthShaderProgram != 0 ? depthShaderProgram : defaultDepthProgram();
+  }
+
+private:
+  // Both programs in one batch so the driver can compile them side by side.
+  // FrameData goes in as the defines, same as for variants.
+  void load(const std::string &vertPath, const std::string &fragPath, const std::string &instancedVertPath) {
+    ShaderProgramFiles files[2] = {{vertPath.c_str(), fragPath.c_str(), FRAME_DATA_GLSL, 0},
+                                   {instancedVertPath.c_str(), fragPath.c_str(), FRAME_DATA_GLSL, 0}};
+    loadShaderPrograms(files, instancedVertPath.empty() ? 1 : 2);
+    shaderProgram = files[0].program;
+    if (shaderProgram != 0) {
+      setupProgramInterface(shaderProgram);
+    }
+    if (files[1].program != 0) {
+      instancedShaderProgram = files[1].program;
+      setupProgramInterface(instancedShaderProgram);
+    }
+  }
+};
+
+class Asset {
+public:
+  Model *model;
+
+  Transform transform;
+
+  GLuint *albedoTexture;
+  GLuint *specularTexture;
+  GLuint *lightmapTexture = NULL; // Only for LIGHTMAPPED shaders, see setLightmap
+  const OccluderMesh *occluder = NULL; // Hides other assets, see setOccluder
+
+  GLuint *shaderProgram;
+  Shader *shader;
+
+  int cullSlot = -1; // The renderer's, so it can find what it knows about this asset
+  int lod = 0;       // The renderer's too, what it was last drawn at
+
+  // Keep cached resources alive for as long as the asset, empty when it was
+  // made from references
+  std::shared_ptr<Model> modelHandle;
+  std::shared_ptr<Texture> albedoHandle;
+  std::shared_ptr<Texture> specularHandle;
+  std::shared_ptr<Shader> shaderHandle;
+  std::shared_ptr<Lightmap> lightmapHandle;
+  std::shared_ptr<OccluderMesh> occluderHandle;
+
+  Asset(Model &modelI, Texture &albedoTextureI, Texture &specularTextureI, Shader &shaderI) {
+    model = &modelI;
+
+    albedoTexture = &albedoTextureI.texture;
+    specularTexture = &specularTextureI.texture;
+
+    shader = &shaderI;
+    shaderProgram = &shaderI.shaderProgram;
+  }
+  Asset(std::shared_ptr<Model> modelI, std::shared_ptr<Texture> albedoTextureI,
+        std::shared_ptr<Texture> specularTextureI, std::shared_ptr<Shader> shaderI)
+      : Asset(*modelI, *albedoTextureI, *specularTextureI, *shaderI) {
+    modelHandle = modelI;
+    albedoHandle = albedoTextureI;
+    specularHandle = specularTextureI;
+    shaderHandle = shaderI;
+  }
+
+  // The model has to be one fred-bake wrote lightmap UVs into. The lightmap
+  // has the sun and all bounce light, Scene::lights still add their direct
+  // light on top, so keep the lights given to fred-bake --light in there.
+  void setLightmap(Lightmap &lightmap) {
+    lightmapTexture = &lightmap.texture;
+  }
+  void setLightmap(std::shared_ptr<Lightmap> lightmap) {
+    setLightmap(*lightmap);
+    lightmapHandle = lightmap;
+  }
+
+  // Model space, moves with the asset. Walls and the like, the asset itself
+  // never gets occlusion culled once it has one.
+  void setOccluder(const OccluderMesh &occluderI) {
+    occluder = &occluderI;
+  }
+  void setOccluder(std::shared_ptr<OccluderMesh> occluderI) {
+    setOccluder(*occluderI);
+    occluderHandle = occluderI;
+  }
+
+  // Cached, only rebuilt after the transform or one of its parents changes
+  const glm::mat4 &getModelMatrix() const {
+    return transform.getWorldMatrix();
+  }
+};
+
+class Camera {
+public:
+  glm::vec3 position;
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+
+  float fov = glm::radians(60.0f);
+  float nearPlane = 0.1f;
+  float farPlane = 100.0f;
+
+  
+  Camera(glm::vec3 initPosition) {
+    position = initPosition;
+  }
+  Camera(glm::vec3 initPosition, glm::quat initRotation) {
+    position = initPosition;
+    rotation = initRotation;
+  }
+  Camera(glm::vec3 initPosition, glm::quat initRotation, float initFov) { 
+    position = initPosition;
+    rotation = initRotation;
+    fov = initFov;
+  }
+  Camera(glm::vec3 initPosition, glm::quat initRotation, float initFov, float initNearPlane, float initFarPlane) {
+    position = initPosition;
+    rotation = initRotation;
+    fov = initFov;
+    nearPlane = initNearPlane;
+    farPlane = initFarPlane;
+  }
+  void lookAt(glm::vec3 target) { // I think I lost it writing this
+    glm::mat4 lookAtMatrix = glm::lookAt(position, target, glm::vec3(0, 1, 0));
+    rotation = glm::conjugate(glm::quat(lookAtMatrix));
+  }
+
+  glm::mat4 getViewMatrix() const {
+    return glm::inverse(glm::translate(glm::mat4(1), position) * mat4_cast(rotation));
+  }
+  glm::mat4 getProjectionMatrix(float aspectRatio) const {
+    return glm::perspective(fov, aspectRatio, nearPlane, farPlane);
+  }
+};
+
+class Scene {
+public:
+  std::vector<Asset*> assets;
+  std::vector<Camera*> cameras;
+  // Only the LIT shaders use them, through a clustered grid so each
+  // fragment only loops over the ones that can reach it
+  std::vector<PointLight> lights;
+  // Off until it's given an intensity. Casts cascaded shadow maps.
+  DirectionalLight sun;
+  // Drawn alongside the assets, for when there are too many of them for
+  // an Asset each
+  EntityStore entities;
+  void (*renderCallback)() = NULL;
+  // Stepped by render, see Simulation
+  Simulation *simulation = NULL;
+
+  int activeCamera = 0;
+
+  void addAsset(Asset &asset) {
+    assets.push_back(&asset);
+  }
+  // Moves with parent from now on, see Transform::setParent
+  void addAsset(Asset &asset, Asset &parent) {
+    asset.transform.setParent(&parent.transform);
+    assets.push_back(&asset);
+  }
+  void addLight(const PointLight &light) {
+    lights.push_back(light);
+  }
+  void addCamera(Camera &camera) {
+    cameras.push_back(&camera);
+  }
+  void setRenderCallback(void (*callback)()) {
+    renderCallback = callback;
+  }
+  void setSimulation(Simulation &simulationI) {
+    simulation = &simulationI;
+  }
+};
+
+// Reset at the start of every drawAssets, glState.stats too
+struct RenderStats {
+  int drawCalls = 0;        // glDraw* calls, one per submesh
+  int instancedBatches = 0; // Groups of assets drawn with one instanced draw
+  int instances = 0;        // Assets that went through an instanced draw
+  int totalAssets = 0;      // In the scene, entities with a renderable included
+  int visibleAssets = 0;    // Made it through frustum and occlusion culling
+  int refits = 0;           // Assets that moved far enough to change the BVH
+  double cullingMs = 0.0;   // BVH update plus the frustum query
+  int occludedAssets = 0;   // In the frustum but behind an occluder
+  double occlusionMs = 0.0; // Rasterizing the occluders plus testing against them
+  OcclusionStats occlusion;
+  int triangles = 0;          // Submitted by the main pass, instances included
+  int fullDetailTriangles = 0; // What that would have been with every LOD at 0
+  int lodAssets[MAX_LODS] = {}; // Visible assets at each LOD
+  LightGridStats lights;
+  ShadowStats shadows;
+  int commands = 0;        // In the render list
+  double buildMs = 0.0;    // Everything up to the render list, no GL
+  double submitMs = 0.0;   // Replaying it
+};
+
+extern GLFWwindow *window;
+
+int initWindow();
+// No visible window and no UI, for benchmarks and CI. Falls back to a
+// surfaceless EGL context when there's no display at all.
+int initHeadless(int width, int height);
+void destroy();
+bool shouldExit();
+void render(Scene &scene);
+// Just the scene into the offscreen framebuffer, no ImGui, no swap
+void renderHeadless(Scene &scene);
+// The 3D part of render, into whatever framebuffer is bound. Builds the
+// frame's render list on the CPU, then replays it.
+void drawAssets(Scene &scene, const glm::mat4 &viewMatrix, const glm::mat4 &projectionMatrix);
+
+// Assets sharing a model, textures and shader get drawn in one go
+void setInstancingEnabled(bool enabled);
+bool getInstancingEnabled();
+// Skips assets outside the camera frustum, tested through a BVH
+void setCullingEnabled(bool enabled);
+bool getCullingEnabled();
+// Skips assets and entities hidden behind occluders, see Asset::setOccluder.
+// Does nothing while no asset in view has one.
+void setOcclusionCullingEnabled(bool enabled);
+bool getOcclusionCullingEnabled();
+// The sun's, settings and all
+ShadowMaps &getShadowMaps();
+
+// Picks a LOD per asset from how much of the screen its bounding sphere
+// covers. An asset only moves to a coarser LOD once it's hysteresis below
+// the threshold, and back once it's hysteresis above, so one sitting on a
+// threshold doesn't flicker between the two.
+struct LodSettings {
+  bool enabled = true;
+  // Screen height fractions, below screenSizes[i] LOD i + 1 gets used
+  float screenSizes[MAX_LODS - 1] = {0.3f, 0.15f, 0.07f};
+  float hysteresis = 0.15f; // Fraction of the threshold
+};
+LodSettings &getLodSettings();
+const RenderStats &getRenderStats();
+
+void setDeltaTimeMultiplier(float mult);
+float getDeltaTime();
+float getUnscaledDeltaTime();
+
+} // namespace fred
+
+#endif
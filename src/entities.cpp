@@ -0,0 +1,341 @@
+#include "entities.h"
+
+#include "engine.h"
+
+#if defined(__AVX__)
+#define FRED_ENTITIES_AVX 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRED_ENTITIES_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace fred {
+
+// Pools ==================================================================== //
+
+uint32_t PoolIndex::addSlot(uint32_t entity) {
+  if (entity >= slots.size()) {
+    slots.resize(entity + 1, NONE);
+  }
+  if (slots[entity] == NONE) {
+    slots[entity] = entities.size();
+    entities.push_back(entity);
+  }
+  return slots[entity];
+}
+
+uint32_t PoolIndex::removeSlot(uint32_t entity) {
+  uint32_t slot = slotOf(entity);
+  if (slot == NONE) {
+    return NONE;
+  }
+  uint32_t moved = entities.back();
+  entities[slot] = moved;
+  slots[moved] = slot;
+  entities.pop_back();
+  slots[entity] = NONE;
+  return slot;
+}
+
+// A new slot is always one past the end
+template <class T> static void put(std::vector<T> &array, uint32_t slot, const T &value) {
+  if (slot == array.size()) {
+    array.push_back(value);
+  } else {
+    array[slot] = value;
+  }
+}
+
+void TransformPool::add(uint32_t entity, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale) {
+  uint32_t slot = addSlot(entity);
+  put(positionX, slot, position.x);
+  put(positionY, slot, position.y);
+  put(positionZ, slot, position.z);
+  put(rotationX, slot, rotation.x);
+  put(rotationY, slot, rotation.y);
+  put(rotationZ, slot, rotation.z);
+  put(rotationW, slot, rotation.w);
+  put(scaleX, slot, scale.x);
+  put(scaleY, slot, scale.y);
+  put(scaleZ, slot, scale.z);
+  put(model, slot, glm::mat4(1.0f));
+  put(modelViewProjection, slot, glm::mat4(1.0f));
+}
+
+void TransformPool::remove(uint32_t entity) {
+  uint32_t slot = removeSlot(entity);
+  if (slot == NONE) {
+    return;
+  }
+  swapRemove(positionX, slot);
+  swapRemove(positionY, slot);
+  swapRemove(positionZ, slot);
+  swapRemove(rotationX, slot);
+  swapRemove(rotationY, slot);
+  swapRemove(rotationZ, slot);
+  swapRemove(rotationW, slot);
+  swapRemove(scaleX, slot);
+  swapRemove(scaleY, slot);
+  swapRemove(scaleZ, slot);
+  swapRemove(model, slot);
+  swapRemove(modelViewProjection, slot);
+}
+
+void TransformPool::setPosition(uint32_t slot, const glm::vec3 &position) {
+  positionX[slot] = position.x;
+  positionY[slot] = position.y;
+  positionZ[slot] = position.z;
+}
+
+void TransformPool::setRotation(uint32_t slot, const glm::quat &rotation) {
+  rotationX[slot] = rotation.x;
+  rotationY[slot] = rotation.y;
+  rotationZ[slot] = rotation.z;
+  rotationW[slot] = rotation.w;
+}
+
+void TransformPool::setScale(uint32_t slot, const glm::vec3 &scale) {
+  scaleX[slot] = scale.x;
+  scaleY[slot] = scale.y;
+  scaleZ[slot] = scale.z;
+}
+
+void RenderablePool::add(uint32_t entity, Model &model, Texture &albedo, Texture &specular, Shader &shader) {
+  uint32_t slot = addSlot(entity);
+  put(models, slot, &model);
+  put(albedoTextures, slot, &albedo.texture);
+  put(specularTextures, slot, &specular.texture);
+  put(shaders, slot, &shader);
+  put(modelRevisions, slot, model.revision);
+  put(lods, slot, (uint8_t)0);
+}
+
+void RenderablePool::remove(uint32_t entity) {
+  uint32_t slot = removeSlot(entity);
+  if (slot == NONE) {
+    return;
+  }
+  swapRemove(models, slot);
+  swapRemove(albedoTextures, slot);
+  swapRemove(specularTextures, slot);
+  swapRemove(shaders, slot);
+  swapRemove(modelRevisions, slot);
+  swapRemove(lods, slot);
+}
+
+void BoundsPool::add(uint32_t entity, const Aabb &bounds) {
+  uint32_t slot = addSlot(entity);
+  put(local, slot, bounds);
+  put(world, slot, bounds);
+}
+
+void BoundsPool::remove(uint32_t entity) {
+  uint32_t slot = removeSlot(entity);
+  if (slot == NONE) {
+    return;
+  }
+  swapRemove(local, slot);
+  swapRemove(world, slot);
+}
+
+// Transform kernels ======================================================== //
+
+// Same matrix as glm's translate * mat4_cast * scale, the rotation part
+// written out so the kernels below can do it lane by lane
+static void computeRange(TransformPool &pool, const glm::mat4 &viewProjection, size_t first, size_t last) {
+  for (size_t i = first; i < last; i++) {
+    float x = pool.rotationX[i], y = pool.rotationY[i], z = pool.rotationZ[i], w = pool.rotationW[i];
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+    glm::mat4 &model = pool.model[i];
+    model[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * pool.scaleX[i];
+    model[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * pool.scaleY[i];
+    model[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * pool.scaleZ[i];
+    model[3] = glm::vec4(pool.positionX[i], pool.positionY[i], pool.positionZ[i], 1.0f);
+    pool.modelViewProjection[i] = viewProjection * model;
+  }
+}
+
+#ifdef FRED_ENTITIES_SSE
+struct SseLanes {
+  typedef __m128 Vec;
+  static constexpr size_t WIDTH = 4;
+
+  static Vec load(const float *values) { return _mm_loadu_ps(values); }
+  static Vec set(float value) { return _mm_set1_ps(value); }
+  static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  static Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+  // A register per row, a lane per entity, into one column of each matrix
+  static void storeColumn(glm::mat4 *matrices, int column, Vec x, Vec y, Vec z, Vec w) {
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(&matrices[0][column][0], x);
+    _mm_storeu_ps(&matrices[1][column][0], y);
+    _mm_storeu_ps(&matrices[2][column][0], z);
+    _mm_storeu_ps(&matrices[3][column][0], w);
+  }
+};
+#endif
+
+#ifdef FRED_ENTITIES_AVX
+struct AvxLanes {
+  typedef __m256 Vec;
+  static constexpr size_t WIDTH = 8;
+
+  static Vec load(const float *values) { return _mm256_loadu_ps(values); }
+  static Vec set(float value) { return _mm256_set1_ps(value); }
+  static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  // No 8 wide transpose worth having, two 4x4 ones instead
+  static void storeColumn(glm::mat4 *matrices, int column, Vec x, Vec y, Vec z, Vec w) {
+    SseLanes::storeColumn(matrices, column, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y),
+                          _mm256_castps256_ps128(z), _mm256_castps256_ps128(w));
+    SseLanes::storeColumn(matrices + 4, column, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                          _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(w, 1));
+  }
+};
+#endif
+
+// computeRange again, WIDTH entities per iteration. Returns where it
+// stopped, the last few are left for the scalar loop.
+template <class L> static size_t computeLanes(TransformPool &pool, const glm::mat4 &viewProjection) {
+  typedef typename L::Vec Vec;
+  Vec zero = L::set(0.0f);
+  Vec one = L::set(1.0f);
+  Vec two = L::set(2.0f);
+  Vec vp[4][4];
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      vp[column][row] = L::set(viewProjection[column][row]);
+    }
+  }
+
+  size_t count = pool.size();
+  size_t i = 0;
+  for (; i + L::WIDTH <= count; i += L::WIDTH) {
+    Vec x = L::load(&pool.rotationX[i]), y = L::load(&pool.rotationY[i]);
+    Vec z = L::load(&pool.rotationZ[i]), w = L::load(&pool.rotationW[i]);
+    Vec xx = L::mul(x, x), yy = L::mul(y, y), zz = L::mul(z, z);
+    Vec xy = L::mul(x, y), xz = L::mul(x, z), yz = L::mul(y, z);
+    Vec wx = L::mul(w, x), wy = L::mul(w, y), wz = L::mul(w, z);
+    Vec scaleX = L::load(&pool.scaleX[i]), scaleY = L::load(&pool.scaleY[i]), scaleZ = L::load(&pool.scaleZ[i]);
+
+    // model[column][row], the w row is 0 0 0 1 for everyone
+    Vec model[4][3];
+    model[0][0] = L::mul(L::sub(one, L::mul(two, L::add(yy, zz))), scaleX);
+    model[0][1] = L::mul(L::mul(two, L::add(xy, wz)), scaleX);
+    model[0][2] = L::mul(L::mul(two, L::sub(xz, wy)), scaleX);
+    model[1][0] = L::mul(L::mul(two, L::sub(xy, wz)), scaleY);
+    model[1][1] = L::mul(L::sub(one, L::mul(two, L::add(xx, zz))), scaleY);
+    model[1][2] = L::mul(L::mul(two, L::add(yz, wx)), scaleY);
+    model[2][0] = L::mul(L::mul(two, L::add(xz, wy)), scaleZ);
+    model[2][1] = L::mul(L::mul(two, L::sub(yz, wx)), scaleZ);
+    model[2][2] = L::mul(L::sub(one, L::mul(two, L::add(xx, yy))), scaleZ);
+    model[3][0] = L::load(&pool.positionX[i]);
+    model[3][1] = L::load(&pool.positionY[i]);
+    model[3][2] = L::load(&pool.positionZ[i]);
+
+    glm::mat4 *models = &pool.model[i];
+    glm::mat4 *mvps = &pool.modelViewProjection[i];
+    for (int column = 0; column < 4; column++) {
+      L::storeColumn(models, column, model[column][0], model[column][1], model[column][2], column == 3 ? one : zero);
+      Vec mvp[4];
+      for (int row = 0; row < 4; row++) {
+        mvp[row] = L::add(L::add(L::mul(vp[0][row], model[column][0]), L::mul(vp[1][row], model[column][1])),
+                          L::mul(vp[2][row], model[column][2]));
+        if (column == 3) {
+          mvp[row] = L::add(mvp[row], vp[3][row]);
+        }
+      }
+      L::storeColumn(mvps, column, mvp[0], mvp[1], mvp[2], mvp[3]);
+    }
+  }
+  return i;
+}
+
+void TransformPool::computeMatrices(const glm::mat4 &viewProjection) {
+  size_t done = 0;
+#if defined(FRED_ENTITIES_AVX)
+  done = computeLanes<AvxLanes>(*this, viewProjection);
+#elif defined(FRED_ENTITIES_SSE)
+  done = computeLanes<SseLanes>(*this, viewProjection);
+#endif
+  computeRange(*this, viewProjection, done, size());
+}
+
+void TransformPool::computeMatricesScalar(const glm::mat4 &viewProjection) {
+  computeRange(*this, viewProjection, 0, size());
+}
+
+const char *TransformPool::getSimdName() {
+#if defined(FRED_ENTITIES_AVX)
+  return "AVX";
+#elif defined(FRED_ENTITIES_SSE)
+  return "SSE";
+#else
+  return "scalar";
+#endif
+}
+
+// Store ==================================================================== //
+
+Entity EntityStore::create() {
+  Entity entity;
+  if (freeIndices.empty()) {
+    entity.index = generations.size();
+    generations.push_back(0);
+  } else {
+    entity.index = freeIndices.back();
+    freeIndices.pop_back();
+  }
+  entity.generation = generations[entity.index];
+  return entity;
+}
+
+void EntityStore::destroy(Entity entity) {
+  if (!isAlive(entity)) {
+    return;
+  }
+  transforms.remove(entity.index);
+  renderables.remove(entity.index);
+  bounds.remove(entity.index);
+  generations[entity.index]++; // Old handles stop matching
+  freeIndices.push_back(entity.index);
+}
+
+bool EntityStore::isAlive(Entity entity) const {
+  return entity.index < generations.size() && generations[entity.index] == entity.generation;
+}
+
+Entity EntityStore::createRenderable(Model &model, Texture &albedo, Texture &specular, Shader &shader,
+                                     const glm::vec3 &position) {
+  Entity entity = create();
+  transforms.add(entity.index, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+  renderables.add(entity.index, model, albedo, specular, shader);
+  bounds.add(entity.index, {model.bounds.min, model.bounds.max});
+  return entity;
+}
+
+void EntityStore::updateBounds() {
+  for (uint32_t slot = 0; slot < renderables.size(); slot++) {
+    const Model *model = renderables.models[slot];
+    if (renderables.modelRevisions[slot] != model->revision) {
+      renderables.modelRevisions[slot] = model->revision;
+      uint32_t boundsSlot = bounds.slotOf(renderables.entityAt(slot));
+      if (boundsSlot != PoolIndex::NONE) {
+        bounds.local[boundsSlot] = {model->bounds.min, model->bounds.max};
+      }
+    }
+  }
+  for (uint32_t slot = 0; slot < bounds.size(); slot++) {
+    uint32_t transform = transforms.slotOf(bounds.entityAt(slot));
+    bounds.world[slot] = transform != PoolIndex::NONE ? transformAabb(bounds.local[slot], transforms.model[transform])
+                                                      : bounds.local[slot];
+  }
+}
+
+} // namespace fred
@@ -0,0 +1,146 @@
+#ifndef FRED_ENTITIES_H
+#define FRED_ENTITIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "culling.h"
+
+namespace fred {
+
+class Model;
+class Texture;
+class Shader;
+
+// Stays unique after destroy, the generation goes up every time the index
+// is reused
+struct Entity {
+  uint32_t index = 0;
+  uint32_t generation = 0;
+};
+
+// Which dense slot each entity's component is in, a sparse set. Pools keep
+// their arrays in slot order and fill a removed slot with the last one, so
+// systems only ever walk packed arrays.
+class PoolIndex {
+public:
+  static constexpr uint32_t NONE = ~0u;
+
+  uint32_t slotOf(uint32_t entity) const { return entity < slots.size() ? slots[entity] : NONE; }
+  uint32_t entityAt(uint32_t slot) const { return entities[slot]; }
+  bool has(uint32_t entity) const { return slotOf(entity) != NONE; }
+  size_t size() const { return entities.size(); }
+
+protected:
+  // New slot at the end, the pool pushes its data after
+  uint32_t addSlot(uint32_t entity);
+  // The pool moves its last element into the returned slot and pops,
+  // NONE if the entity didn't have one
+  uint32_t removeSlot(uint32_t entity);
+
+  template <class T> static void swapRemove(std::vector<T> &array, uint32_t slot) {
+    array[slot] = array.back();
+    array.pop_back();
+  }
+
+private:
+  std::vector<uint32_t> slots;    // Entity index to slot
+  std::vector<uint32_t> entities; // Slot to entity index
+};
+
+// Local position, rotation and scale, one array per component so the
+// kernels load four or eight entities at once. No hierarchy, that's what
+// Transform is for.
+class TransformPool : public PoolIndex {
+public:
+  std::vector<float> positionX, positionY, positionZ;
+  std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+  std::vector<float> scaleX, scaleY, scaleZ;
+  // Written by computeMatrices, in slot order
+  std::vector<glm::mat4> model;
+  std::vector<glm::mat4> modelViewProjection;
+
+  void add(uint32_t entity, const glm::vec3 &position, const glm::quat &rotation, const glm::vec3 &scale);
+  void remove(uint32_t entity);
+
+  glm::vec3 getPosition(uint32_t slot) const { return glm::vec3(positionX[slot], positionY[slot], positionZ[slot]); }
+  glm::quat getRotation(uint32_t slot) const {
+    return glm::quat(rotationW[slot], rotationX[slot], rotationY[slot], rotationZ[slot]);
+  }
+  glm::vec3 getScale(uint32_t slot) const { return glm::vec3(scaleX[slot], scaleY[slot], scaleZ[slot]); }
+  void setPosition(uint32_t slot, const glm::vec3 &position);
+  void setRotation(uint32_t slot, const glm::quat &rotation);
+  void setScale(uint32_t slot, const glm::vec3 &scale);
+
+  // Model and model-view-projection matrices for every slot in one pass.
+  // AVX or SSE when the compiler has them, eight or four entities at a time.
+  void computeMatrices(const glm::mat4 &viewProjection);
+  void computeMatricesScalar(const glm::mat4 &viewProjection);
+  // "AVX", "SSE" or "scalar", whichever computeMatrices got built with
+  static const char *getSimdName();
+};
+
+// What to draw an entity with. Pointers into the resources like Asset's, so
+// async loads swap in under them.
+class RenderablePool : public PoolIndex {
+public:
+  std::vector<Model *> models;
+  std::vector<GLuint *> albedoTextures;
+  std::vector<GLuint *> specularTextures;
+  std::vector<Shader *> shaders;
+  std::vector<uint32_t> modelRevisions; // Model::revision the bounds were last taken at
+  std::vector<uint8_t> lods;            // The renderer's, what each was last drawn at
+
+  void add(uint32_t entity, Model &model, Texture &albedo, Texture &specular, Shader &shader);
+  void remove(uint32_t entity);
+};
+
+// Model space bounds and the world space ones updateBounds makes from them
+class BoundsPool : public PoolIndex {
+public:
+  std::vector<Aabb> local;
+  std::vector<Aabb> world;
+
+  void add(uint32_t entity, const Aabb &bounds);
+  void remove(uint32_t entity);
+};
+
+// Entities are just an index into the pools. Anything with a transform and
+// a renderable gets drawn with the scene, anything with bounds as well gets
+// frustum culled.
+class EntityStore {
+public:
+  TransformPool transforms;
+  RenderablePool renderables;
+  BoundsPool bounds;
+
+  Entity create();
+  // Takes every component with it
+  void destroy(Entity entity);
+  bool isAlive(Entity entity) const;
+  size_t getCount() const { return generations.size() - freeIndices.size(); }
+
+  // All three components, bounds from the model. They follow the model if
+  // it's still loading.
+  Entity createRenderable(Model &model, Texture &albedo, Texture &specular, Shader &shader,
+                          const glm::vec3 &position = glm::vec3(0.0f));
+
+  // Systems, in this order once a frame
+  void updateTransforms(const glm::mat4 &viewProjection) { transforms.computeMatrices(viewProjection); }
+  // Picks up model bounds that changed under a renderable, then world bounds
+  // for everything with a transform
+  void updateBounds();
+
+private:
+  std::vector<uint32_t> generations;
+  std::vector<uint32_t> freeIndices;
+};
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,108 @@
+#include "glstate.h"
+
+#include <string.h>
+
+namespace fred {
+
+StateCache glState;
+
+void StateCache::invalidate() {
+  currentProgram = UNKNOWN;
+  currentVertexArray = UNKNOWN;
+  activeTextureUnit = UNKNOWN;
+  for (int i = 0; i < MAX_TEXTURE_UNITS; i++) {
+    boundTextures[i] = UNKNOWN;
+  }
+}
+
+void StateCache::useProgram(GLuint program) {
+  if (program == currentProgram) {
+    stats.programs.skipped++;
+    return;
+  }
+  glUseProgram(program);
+  currentProgram = program;
+  stats.programs.issued++;
+}
+
+void StateCache::bindTexture(GLuint unit, GLuint texture, GLenum target) {
+  if (unit < MAX_TEXTURE_UNITS && boundTextures[unit] == texture) {
+    stats.textures.skipped++;
+    return;
+  }
+  if (unit != activeTextureUnit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeTextureUnit = unit;
+  }
+  glBindTexture(target, texture);
+  if (unit < MAX_TEXTURE_UNITS) {
+    boundTextures[unit] = texture;
+  }
+  stats.textures.issued++;
+}
+
+void StateCache::bindVertexArray(GLuint vertexArray) {
+  if (vertexArray == currentVertexArray) {
+    stats.vertexArrays.skipped++;
+    return;
+  }
+  glBindVertexArray(vertexArray);
+  currentVertexArray = vertexArray;
+  stats.vertexArrays.issued++;
+}
+
+bool StateCache::uniformChanged(GLint location, const void *data, size_t size) {
+  if (location < 0 || currentProgram == UNKNOWN) {
+    return location >= 0; // -1 is a no-op for GL anyway
+  }
+  // New entries start zeroed, which is also what linking sets every uniform to
+  uint64_t key = (uint64_t)currentProgram << 32 | (uint32_t)location;
+  UniformValue &cached = uniforms[key];
+  if (memcmp(cached.data, data, size) == 0) {
+    stats.uniforms.skipped++;
+    return false;
+  }
+  memcpy(cached.data, data, size);
+  stats.uniforms.issued++;
+  return true;
+}
+
+void StateCache::uniform1i(GLint location, GLint value) {
+  if (uniformChanged(location, &value, sizeof(value))) {
+    glUniform1i(location, value);
+  }
+}
+
+void StateCache::uniform1f(GLint location, GLfloat value) {
+  if (uniformChanged(location, &value, sizeof(value))) {
+    glUniform1f(location, value);
+  }
+}
+
+void StateCache::uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z) {
+  GLfloat value[3] = {x, y, z};
+  if (uniformChanged(location, value, sizeof(value))) {
+    glUniform3f(location, x, y, z);
+  }
+}
+
+void StateCache::uniformMatrix4fv(GLint location, const GLfloat *value) {
+  if (uniformChanged(location, value, 16 * sizeof(GLfloat))) {
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+  }
+}
+
+void StateCache::forgetProgram(GLuint program) {
+  for (auto it = uniforms.begin(); it != uniforms.end();) {
+    if ((GLuint)(it->first >> 32) == program) {
+      it = uniforms.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (currentProgram == program) {
+    currentProgram = UNKNOWN;
+  }
+}
+
+} // namespace fred
@@ -0,0 +1,71 @@
+#ifndef FRED_GLSTATE_H
+#define FRED_GLSTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+#include <glad/gl.h>
+
+namespace fred {
+
+struct StateCounter {
+  int issued = 0;  // Made it to the driver
+  int skipped = 0; // Already set, dropped
+};
+
+struct StateStats {
+  StateCounter programs;
+  StateCounter textures;
+  StateCounter vertexArrays;
+  StateCounter uniforms;
+};
+
+// Shadows the bits of GL state the renderer touches so redundant calls never
+// reach the driver. Anything that changes bindings behind its back (ImGui)
+// means invalidate() has to be called before the cache is trusted again.
+class StateCache {
+public:
+  StateStats stats;
+
+  void invalidate();
+  void resetStats() { stats = StateStats(); }
+
+  void useProgram(GLuint program);
+  // A unit is assumed to only ever be used with the one target
+  void bindTexture(GLuint unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+  void bindVertexArray(GLuint vertexArray);
+
+  // Uniform values live in the program object, so these go against whatever
+  // program was last set with useProgram and survive invalidate()
+  void uniform1i(GLint location, GLint value);
+  void uniform1f(GLint location, GLfloat value);
+  void uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z);
+  void uniformMatrix4fv(GLint location, const GLfloat *value);
+  // Names get reused, so call this before a program is deleted
+  void forgetProgram(GLuint program);
+
+private:
+  static constexpr GLuint UNKNOWN = 0xFFFFFFFF;
+  static constexpr int MAX_TEXTURE_UNITS = 16;
+
+  struct UniformValue {
+    GLfloat data[16];
+  };
+
+  GLuint currentProgram = UNKNOWN;
+  GLuint currentVertexArray = UNKNOWN;
+  GLuint activeTextureUnit = UNKNOWN;
+  GLuint boundTextures[MAX_TEXTURE_UNITS] = {
+      UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+      UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN};
+  std::unordered_map<uint64_t, UniformValue> uniforms; // program << 32 | location
+
+  bool uniformChanged(GLint location, const void *data, size_t size);
+};
+
+extern StateCache glState;
+
+} // namespace fred
+
+#endif
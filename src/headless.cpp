@@ -0,0 +1,607 @@
+#include "headless.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <clog/clog.h>
+
+#include "engine.h"
+#include "profiler.h"
+
+namespace fred {
+
+// Canned scenes ============================================================ //
+// Paths are relative to the build directory, same as the demo in main.cpp.
+
+// Everything a scene owns. Assets point into the rest, so nothing moves once
+// the scene is built.
+struct BenchScene {
+  std::vector<std::unique_ptr<Model>> models;
+  std::vector<std::unique_ptr<Texture>> textures;
+  std::vector<std::unique_ptr<Shader>> shaders;
+  std::vector<std::unique_ptr<OccluderMesh>> occluders;
+  std::vector<Asset> assets;
+  std::unique_ptr<Camera> camera;
+  Scene scene;
+  void (*update)(BenchScene &bench, int frame) = NULL;
+
+  Model *model(const char *path) {
+    models.push_back(std::unique_ptr<Model>(new Model(path)));
+    return models.back().get();
+  }
+  Model *model(const MeshData &mesh) {
+    models.push_back(std::unique_ptr<Model>(new Model(mesh)));
+    return models.back().get();
+  }
+  OccluderMesh *occluder(const MeshData &mesh) {
+    occluders.push_back(std::unique_ptr<OccluderMesh>(new OccluderMesh()));
+    makeOccluder(mesh, *occluders.back());
+    return occluders.back().get();
+  }
+  Texture *texture(const char *path) {
+    textures.push_back(std::unique_ptr<Texture>(new Texture(path)));
+    return textures.back().get();
+  }
+  Shader *shader(uint32_t features) {
+    ShaderVariants &standard = shaderVariants("../shaders/standard.vert", "../shaders/standard.frag");
+    shaders.push_back(std::unique_ptr<Shader>(new Shader(standard, features)));
+    return shaders.back().get();
+  }
+  // Call once every asset is in, the scene keeps pointers into assets
+  void finish() {
+    scene.addCamera(*camera);
+    if (scene.lights.empty()) {
+      // The one light everything used to be lit by
+      PointLight light;
+      light.position = glm::vec3(4, 4, 4);
+      scene.addLight(light);
+    }
+    for (Asset &asset : assets) {
+      scene.addAsset(asset);
+    }
+  }
+};
+
+static void orbitCamera(Camera &camera, int frame, float radius, float height) {
+  float angle = frame * 0.01f;
+  camera.position = glm::vec3(cosf(angle) * radius, height, sinf(angle) * radius);
+  camera.lookAt(glm::vec3(0, 0, 0));
+}
+
+// The userspace demo, two assets
+static void updateDemo(BenchScene &bench, int frame) {
+  bench.assets[0].transform.setPosition(glm::vec3(sinf(frame * 0.02f), 0.0f, 0.0f));
+  bench.assets[1].transform.setRotation(glm::quat(glm::vec3(frame * glm::radians(1.0f), 0.0f, 0.0f)));
+}
+
+static void buildDemo(BenchScene &bench) {
+  Model *cone = bench.model("../models/model.obj");
+  Model *suzanne = bench.model("../models/suzanne.obj");
+  Texture *buffBlackGuy = bench.texture("../textures/texture.bmp");
+  Texture *suzanneAlbedo = bench.texture("../textures/suzanne_albedo.png");
+  Texture *suzanneSpecular = bench.texture("../textures/suzanne_specular.png");
+  Shader *basic = bench.shader(0);
+  Shader *basicLit = bench.shader(SHADER_LIT);
+
+  bench.assets.push_back(Asset(*cone, *buffBlackGuy, *buffBlackGuy, *basic));
+  bench.assets.push_back(Asset(*suzanne, *suzanneAlbedo, *suzanneSpecular, *basicLit));
+  bench.camera.reset(new Camera(glm::vec3(4, 3, 3)));
+  bench.camera->lookAt(glm::vec3(0, 0, 0));
+  bench.update = updateDemo;
+}
+
+// 10k identical suzannes, all on screen, the instancing path
+static void updateCrowd(BenchScene &bench, int frame) {
+  orbitCamera(*bench.camera, frame, 200.0f, 120.0f);
+}
+
+static void buildCrowd(BenchScene &bench) {
+  Model *suzanne = bench.model("../models/suzanne.obj");
+  Texture *albedo = bench.texture("../textures/suzanne_albedo.png");
+  Texture *specular = bench.texture("../textures/suzanne_specular.png");
+  Shader *basicLit = bench.shader(SHADER_LIT);
+
+  const int side = 100;
+  bench.assets.reserve(side * side);
+  for (int i = 0; i < side * side; i++) {
+    bench.assets.push_back(Asset(*suzanne, *albedo, *specular, *basicLit));
+    bench.assets.back().transform.setPosition(glm::vec3((i % side - side / 2) * 3.0f, 0.0f, (i / side - side / 2) * 3.0f));
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 1000.0f));
+  bench.update = updateCrowd;
+}
+
+// 2k spinning assets over every model, texture and shader combination, so
+// there's lots of state to sort and every transform changes every frame
+static void updateMixed(BenchScene &bench, int frame) {
+  orbitCamera(*bench.camera, frame, 90.0f, 40.0f);
+  glm::quat spin = glm::quat(glm::vec3(0.0f, glm::radians(2.0f), 0.0f));
+  for (Asset &asset : bench.assets) {
+    asset.transform.rotate(spin);
+  }
+}
+
+static void buildMixed(BenchScene &bench) {
+  Model *models[] = {bench.model("../models/model.obj"), bench.model("../models/suzanne.obj"),
+                     bench.model("../models/teapot.obj")};
+  Texture *textures[] = {bench.texture("../textures/texture.bmp"),
+                         bench.texture("../textures/suzanne_albedo.png"),
+                         bench.texture("../textures/teapot.png")};
+  Shader *shaders[] = {bench.shader(0), bench.shader(SHADER_LIT)};
+
+  const int count = 2000;
+  const int side = 45;
+  bench.assets.reserve(count);
+  for (int i = 0; i < count; i++) {
+    bench.assets.push_back(Asset(*models[i % 3], *textures[i / 3 % 3], *textures[i / 9 % 3], *shaders[i / 27 % 2]));
+    Asset &asset = bench.assets.back();
+    asset.transform.setPosition(glm::vec3((i % side - side / 2) * 2.5f, 0.0f, (i / side - side / 2) * 2.5f));
+    asset.transform.setRotation(glm::quat(glm::vec3(0.0f, i * 0.1f, 0.0f)));
+    asset.transform.setScale(glm::vec3(0.5f));
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 500.0f));
+  bench.update = updateMixed;
+}
+
+// 100k cones over a big field with a camera skimming across it, so almost
+// everything is outside the frustum. Culling cost dominates.
+static void updateCity(BenchScene &bench, int frame) {
+  Camera &camera = *bench.camera;
+  camera.position = glm::vec3(-600.0f + frame * 2.0f, 8.0f, 0.0f);
+  camera.lookAt(camera.position + glm::vec3(1.0f, -0.1f, 0.3f));
+}
+
+static void buildCity(BenchScene &bench) {
+  Model *cone = bench.model("../models/model.obj");
+  Texture *texture = bench.texture("../textures/texture.bmp");
+  Shader *basic = bench.shader(0);
+
+  const int side = 316; // Just shy of 100k
+  bench.assets.reserve(side * side);
+  for (int i = 0; i < side * side; i++) {
+    bench.assets.push_back(Asset(*cone, *texture, *texture, *basic));
+    bench.assets.back().transform.setPosition(glm::vec3((i % side - side / 2) * 4.0f, 0.0f, (i / side - side / 2) * 4.0f));
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 200.0f));
+  bench.update = updateCity;
+}
+
+// 100k spinning cones as entities rather than assets, the transform kernel
+// and the pools under load
+static void updateSwarm(BenchScene &bench, int frame) {
+  orbitCamera(*bench.camera, frame, 400.0f, 150.0f);
+  glm::quat spin = glm::quat(glm::vec3(0.0f, glm::radians(2.0f), 0.0f));
+  TransformPool &transforms = bench.scene.entities.transforms;
+  for (uint32_t slot = 0; slot < transforms.size(); slot++) {
+    transforms.setRotation(slot, spin * transforms.getRotation(slot));
+  }
+}
+
+static void buildSwarm(BenchScene &bench) {
+  Model *cone = bench.model("../models/model.obj");
+  Texture *texture = bench.texture("../textures/texture.bmp");
+  Shader *basic = bench.shader(0);
+
+  const int side = 316;
+  for (int i = 0; i < side * side; i++) {
+    glm::vec3 position = glm::vec3((i % side - side / 2) * 2.5f, 0.0f, (i / side - side / 2) * 2.5f);
+    bench.scene.entities.createRenderable(*cone, *texture, *texture, *basic, position);
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 1500.0f));
+  bench.update = updateSwarm;
+}
+
+// 2.5k suzannes under 512 coloured lights wandering between them, the
+// clustered light grid and the lit fragment loop
+static void updateLights(BenchScene &bench, int frame) {
+  orbitCamera(*bench.camera, frame, 90.0f, 35.0f);
+  std::vector<PointLight> &lights = bench.scene.lights;
+  for (size_t i = 0; i < lights.size(); i++) {
+    float angle = frame * 0.01f + i * 2.399f; // Golden angle apart
+    float distance = 5.0f + (i % 64) * 1.1f;
+    lights[i].position = glm::vec3(cosf(angle) * distance, 1.5f + sinf(frame * 0.03f + i) * 1.0f, sinf(angle) * distance);
+  }
+}
+
+static void buildLights(BenchScene &bench) {
+  Model *suzanne = bench.model("../models/suzanne.obj");
+  Texture *albedo = bench.texture("../textures/suzanne_albedo.png");
+  Texture *specular = bench.texture("../textures/suzanne_specular.png");
+  Shader *basicLit = bench.shader(SHADER_LIT);
+
+  const int side = 50;
+  bench.assets.reserve(side * side);
+  for (int i = 0; i < side * side; i++) {
+    bench.assets.push_back(Asset(*suzanne, *albedo, *specular, *basicLit));
+    bench.assets.back().transform.setPosition(glm::vec3((i % side - side / 2) * 3.0f, 0.0f, (i / side - side / 2) * 3.0f));
+  }
+  const glm::vec3 colors[] = {glm::vec3(1.0f, 0.3f, 0.2f), glm::vec3(0.2f, 1.0f, 0.3f), glm::vec3(0.3f, 0.4f, 1.0f),
+                              glm::vec3(1.0f, 0.9f, 0.6f)};
+  for (int i = 0; i < 512; i++) {
+    PointLight light;
+    light.color = colors[i % 4];
+    light.power = 10.0f;
+    light.radius = 8.0f;
+    bench.scene.addLight(light);
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 300.0f));
+  bench.update = updateLights;
+}
+
+// 2.5k suzannes standing still under the sun with a few teapots bobbing
+// between them and the camera creeping over the top. Most cascades come out
+// of the cache, the moving teapots keep some of them being redrawn.
+static void updateShadows(BenchScene &bench, int frame) {
+  Camera &camera = *bench.camera;
+  camera.position = glm::vec3(-60.0f + frame * 0.1f, 12.0f, -20.0f);
+  camera.lookAt(camera.position + glm::vec3(1.0f, -0.4f, 0.8f));
+  for (size_t i = 2500; i < bench.assets.size(); i++) {
+    Transform &transform = bench.assets[i].transform;
+    glm::vec3 position = transform.getPosition();
+    position.y = 1.5f + sinf(frame * 0.05f + i) * 1.0f;
+    transform.setPosition(position);
+  }
+}
+
+static void buildShadows(BenchScene &bench) {
+  Model *suzanne = bench.model("../models/suzanne.obj");
+  Model *teapot = bench.model("../models/teapot.obj");
+  Texture *albedo = bench.texture("../textures/suzanne_albedo.png");
+  Texture *specular = bench.texture("../textures/suzanne_specular.png");
+  Texture *teapotTexture = bench.texture("../textures/teapot.png");
+  Shader *basicLit = bench.shader(SHADER_LIT);
+
+  const int side = 50;
+  bench.assets.reserve(side * side + 64);
+  for (int i = 0; i < side * side; i++) {
+    bench.assets.push_back(Asset(*suzanne, *albedo, *specular, *basicLit));
+    bench.assets.back().transform.setPosition(glm::vec3((i % side - side / 2) * 3.0f, 0.0f, (i / side - side / 2) * 3.0f));
+  }
+  for (int i = 0; i < 64; i++) {
+    bench.assets.push_back(Asset(*teapot, *teapotTexture, *teapotTexture, *basicLit));
+    Asset &asset = bench.assets.back();
+    asset.transform.setPosition(glm::vec3((i % 8 - 4) * 12.0f + 1.5f, 1.5f, (i / 8 - 4) * 12.0f + 1.5f));
+    asset.transform.setScale(glm::vec3(0.3f));
+  }
+  bench.scene.sun.intensity = 0.8f;
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 300.0f));
+  bench.update = updateShadows;
+}
+
+// 16x16 rooms with a doorway in the middle of every wall and 9 suzannes in
+// each, the camera walking down one row of them. The walls are occluders, so
+// the rooms either side should never get drawn.
+static void updateIndoor(BenchScene &bench, int frame) {
+  Camera &camera = *bench.camera;
+  camera.position = glm::vec3(-90.0f + frame * 0.3f, 1.7f, 6.0f);
+  camera.lookAt(camera.position + glm::vec3(1.0f, -0.05f, sinf(frame * 0.02f) * 0.5f));
+}
+
+static void buildIndoor(BenchScene &bench) {
+  MeshData cube;
+  makeCubeMesh(cube);
+  Model *wall = bench.model(cube);
+  OccluderMesh *wallOccluder = bench.occluder(cube);
+  Model *suzanne = bench.model("../models/suzanne.obj");
+  Texture *wallTexture = bench.texture("../textures/texture.bmp");
+  Texture *albedo = bench.texture("../textures/suzanne_albedo.png");
+  Texture *specular = bench.texture("../textures/suzanne_specular.png");
+  Shader *basicLit = bench.shader(SHADER_LIT);
+
+  const int side = 16;
+  const float room = 12.0f;
+  const float door = 3.0f;
+  const float length = (room - door) * 0.5f; // Of each half of a wall
+  const float origin = -side * room * 0.5f;
+  bench.assets.reserve((side + 1) * side * 4 + side * side * 9);
+  for (int line = 0; line <= side; line++) {
+    for (int i = 0; i < side; i++) {
+      float along = origin + (i + 0.5f) * room;
+      float across = origin + line * room;
+      for (int half = -1; half <= 1; half += 2) {
+        float offset = half * (door + length) * 0.5f;
+        // One running along x, one along z
+        for (int axis = 0; axis < 2; axis++) {
+          bench.assets.push_back(Asset(*wall, *wallTexture, *wallTexture, *basicLit));
+          Asset &asset = bench.assets.back();
+          asset.setOccluder(*wallOccluder);
+          if (axis == 0) {
+            asset.transform.setPosition(glm::vec3(along + offset, 2.0f, across));
+            asset.transform.setScale(glm::vec3(length, 4.0f, 0.3f));
+          } else {
+            asset.transform.setPosition(glm::vec3(across, 2.0f, along + offset));
+            asset.transform.setScale(glm::vec3(0.3f, 4.0f, length));
+          }
+        }
+      }
+    }
+  }
+  for (int i = 0; i < side * side; i++) {
+    glm::vec3 center = glm::vec3(origin + (i % side + 0.5f) * room, 1.0f, origin + (i / side + 0.5f) * room);
+    for (int j = 0; j < 9; j++) {
+      bench.assets.push_back(Asset(*suzanne, *albedo, *specular, *basicLit));
+      bench.assets.back().transform.setPosition(center + glm::vec3((j % 3 - 1) * 3.0f, 0.0f, (j / 3 - 1) * 3.0f));
+    }
+  }
+  bench.camera.reset(new Camera(glm::vec3(0, 0, 0), glm::quat(1, 0, 0, 0), glm::radians(60.0f), 0.1f, 300.0f));
+  bench.update = updateIndoor;
+}
+
+struct SceneEntry {
+  const char *name;
+  void (*build)(BenchScene &bench);
+};
+
+static const SceneEntry sceneEntries[] = {
+    {"demo", buildDemo},
+    {"crowd", buildCrowd},
+    {"mixed", buildMixed},
+    {"city", buildCity},
+    {"swarm", buildSwarm},
+    {"lights", buildLights},
+    {"shadows", buildShadows},
+    {"indoor", buildIndoor},
+};
+
+// Options ================================================================== //
+
+static bool usage(const char *name) {
+  fprintf(stderr, "Usage: %s --headless [--frames N] [--warmup N] [--scene NAME] [--output PATH] [--no-lod]"
+                  " [--no-occlusion]\n", name);
+  fprintf(stderr, "Scenes:");
+  for (const SceneEntry &entry : sceneEntries) {
+    fprintf(stderr, " %s", entry.name);
+  }
+  fprintf(stderr, "\n");
+  return false;
+}
+
+bool parseHeadlessArgs(int argc, char **argv, HeadlessOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--headless") == 0) {
+      options.enabled = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+      options.frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+      options.warmupFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--scene") == 0 && hasValue) {
+      options.scene = argv[++i];
+    } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+      options.output = argv[++i];
+    } else if (strcmp(argv[i], "--no-lod") == 0) {
+      options.lods = false;
+    } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+      options.occlusion = false;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (options.frames < 1 || options.warmupFrames < 0) {
+    return usage(argv[0]);
+  }
+  return true;
+}
+
+// Results ================================================================== //
+
+struct Summary {
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+};
+
+// Nearest rank percentiles
+static Summary summarize(std::vector<double> samples) {
+  Summary summary;
+  if (samples.empty()) {
+    return summary;
+  }
+  std::sort(samples.begin(), samples.end());
+  for (double sample : samples) {
+    summary.mean += sample;
+  }
+  summary.mean /= samples.size();
+  size_t count = samples.size();
+  summary.p50 = samples[(size_t)ceil(0.50 * count) - 1];
+  summary.p95 = samples[(size_t)ceil(0.95 * count) - 1];
+  summary.p99 = samples[(size_t)ceil(0.99 * count) - 1];
+  summary.max = samples.back();
+  return summary;
+}
+
+static void writeJsonString(FILE *file, const char *text) {
+  fputc('"', file);
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', file);
+    }
+    if ((unsigned char)*c >= 0x20) {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+static void writeJsonSummary(FILE *file, const char *name, const Summary &summary, bool last) {
+  fprintf(file, "  \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+          name, summary.mean, summary.p50, summary.p95, summary.p99, summary.max, last ? "" : ",");
+}
+
+// Run ====================================================================== //
+
+int runHeadless(const HeadlessOptions &options) {
+  const SceneEntry *entry = NULL;
+  for (const SceneEntry &candidate : sceneEntries) {
+    if (options.scene == candidate.name) {
+      entry = &candidate;
+    }
+  }
+  if (entry == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Unknown scene \"%s\"\n", options.scene.c_str());
+    return 1;
+  }
+
+  if (initHeadless(options.width, options.height) != 0) {
+    return 1;
+  }
+  const char *renderer = (const char *)glGetString(GL_RENDERER);
+  const char *version = (const char *)glGetString(GL_VERSION);
+
+  // Compiles stay out of the measured frames
+  precompileShaderVariants("../shaders/variants.txt");
+
+  int exitCode = 0;
+  {
+    BenchScene bench;
+    entry->build(bench);
+    bench.finish();
+    getLodSettings().enabled = options.lods;
+    setOcclusionCullingEnabled(options.occlusion);
+
+    std::vector<GLuint> queries(options.frames);
+    glGenQueries(options.frames, queries.data());
+
+    std::vector<double> cpuMs;
+    std::vector<double> frameMs;
+    double drawCalls = 0.0;
+    double visibleAssets = 0.0;
+    double triangles = 0.0;
+    double fullDetailTriangles = 0.0;
+    double cullingMs = 0.0;
+    double occludedAssets = 0.0;
+    double occlusionMs = 0.0;
+    double shadowMs = 0.0;
+    double cascadesDrawn = 0.0;
+
+    for (int frame = 0; frame < options.warmupFrames + options.frames; frame++) {
+      int measured = frame - options.warmupFrames;
+      bench.update(bench, frame);
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      if (measured >= 0) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[measured]);
+      }
+      renderHeadless(bench.scene);
+      if (measured >= 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+      }
+      double submitted = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      // Waiting every frame keeps frames from piling up in the driver, so
+      // runs compare from one commit to the next
+      glFinish();
+      double finished = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+      if (measured >= 0) {
+        cpuMs.push_back(submitted);
+        frameMs.push_back(finished);
+        drawCalls += getRenderStats().drawCalls;
+        visibleAssets += getRenderStats().visibleAssets;
+        triangles += getRenderStats().triangles;
+        fullDetailTriangles += getRenderStats().fullDetailTriangles;
+        cullingMs += getRenderStats().cullingMs;
+        occludedAssets += getRenderStats().occludedAssets;
+        occlusionMs += getRenderStats().occlusionMs;
+        shadowMs += getRenderStats().shadows.cpuMs;
+        cascadesDrawn += getRenderStats().shadows.cascadesDrawn;
+      }
+    }
+
+    std::vector<double> gpuMs(options.frames);
+    for (int i = 0; i < options.frames; i++) {
+      GLuint64 elapsed = 0;
+      glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+      gpuMs[i] = elapsed / 1e6;
+    }
+    glDeleteQueries(options.frames, queries.data());
+
+    Summary cpu = summarize(cpuMs);
+    Summary frameTime = summarize(frameMs);
+    Summary gpu = summarize(gpuMs);
+
+    // The shadow pass on the GPU, from whatever frames the profiler still has
+    double shadowGpuMs = 0.0;
+    double profiledGpuMs = 0.0;
+    for (int framesAgo = 0; framesAgo < options.frames; framesAgo++) {
+      const ProfileFrame *frame = profiler.getFrame(framesAgo);
+      if (frame == NULL) {
+        break;
+      }
+      if (frame->gpuReady) {
+        shadowGpuMs += sumZoneMs(frame->gpuZones, "Shadows");
+        profiledGpuMs += frame->gpuMs;
+      }
+    }
+
+    FILE *file = fopen(options.output.c_str(), "w");
+    if (file == NULL) {
+      clog_log(CLOG_LEVEL_ERROR, "Failed to open \"%s\" for writing\n", options.output.c_str());
+      exitCode = 1;
+    } else {
+      fprintf(file, "{\n");
+      fprintf(file, "  \"scene\": ");
+      writeJsonString(file, entry->name);
+      fprintf(file, ",\n  \"renderer\": ");
+      writeJsonString(file, renderer != NULL ? renderer : "unknown");
+      fprintf(file, ",\n  \"gl_version\": ");
+      writeJsonString(file, version != NULL ? version : "unknown");
+      fprintf(file, ",\n  \"width\": %d,\n  \"height\": %d,\n", options.width, options.height);
+      fprintf(file, "  \"frames\": %d,\n  \"warmup_frames\": %d,\n", options.frames, options.warmupFrames);
+      fprintf(file, "  \"assets\": %d,\n", (int)bench.scene.assets.size());
+      fprintf(file, "  \"lights\": %d,\n", (int)bench.scene.lights.size());
+      fprintf(file, "  \"visible_assets\": %.1f,\n", visibleAssets / options.frames);
+      fprintf(file, "  \"draw_calls\": %.1f,\n", drawCalls / options.frames);
+      fprintf(file, "  \"lods\": %s,\n", options.lods ? "true" : "false");
+      fprintf(file, "  \"triangles\": %.1f,\n", triangles / options.frames);
+      fprintf(file, "  \"full_detail_triangles\": %.1f,\n", fullDetailTriangles / options.frames);
+      fprintf(file, "  \"culling_ms\": %.4f,\n", cullingMs / options.frames);
+      fprintf(file, "  \"occlusion\": %s,\n", options.occlusion ? "true" : "false");
+      fprintf(file, "  \"occluded_assets\": %.1f,\n", occludedAssets / options.frames);
+      fprintf(file, "  \"occlusion_ms\": %.4f,\n", occlusionMs / options.frames);
+      if (bench.scene.sun.intensity > 0.0f && bench.scene.sun.castsShadows) {
+        fprintf(file, "  \"shadow_cascades_drawn\": %.2f,\n", cascadesDrawn / options.frames);
+        fprintf(file, "  \"shadow_cpu_ms\": %.4f,\n", shadowMs / options.frames);
+        fprintf(file, "  \"shadow_cpu_share\": %.4f,\n", cpu.mean > 0.0 ? shadowMs / options.frames / cpu.mean : 0.0);
+        fprintf(file, "  \"shadow_gpu_share\": %.4f,\n", profiledGpuMs > 0.0 ? shadowGpuMs / profiledGpuMs : 0.0);
+      }
+      writeJsonSummary(file, "cpu_ms", cpu, false);
+      writeJsonSummary(file, "frame_ms", frameTime, false);
+      writeJsonSummary(file, "gpu_ms", gpu, true);
+      fprintf(file, "}\n");
+      fclose(file);
+    }
+
+    printf("%s: %d frames on %s\n", entry->name, options.frames, renderer != NULL ? renderer : "unknown");
+    printf("%-8s %10s %10s %10s %10s\n", "", "mean", "p50", "p95", "p99");
+    printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", "cpu", cpu.mean, cpu.p50, cpu.p95, cpu.p99);
+    printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", "frame", frameTime.mean, frameTime.p50, frameTime.p95, frameTime.p99);
+    printf("%-8s %10.3f %10.3f %10.3f %10.3f\n", "gpu", gpu.mean, gpu.p50, gpu.p95, gpu.p99);
+    printf("%.1f draw calls, %.1f of %d assets visible\n", drawCalls / options.frames,
+           visibleAssets / options.frames, (int)bench.scene.assets.size());
+    printf("%.0f of %.0f triangles with LODs %s\n", triangles / options.frames, fullDetailTriangles / options.frames,
+           options.lods ? "on" : "off");
+    if (options.occlusion) {
+      printf("%.1f assets occluded, %.3f ms rasterizing and testing\n", occludedAssets / options.frames,
+             occlusionMs / options.frames);
+    }
+    if (bench.scene.sun.intensity > 0.0f && bench.scene.sun.castsShadows) {
+      printf("Shadows: %.2f cascades drawn a frame, %.3f ms CPU (%.1f%%), %.1f%% of GPU time\n",
+             cascadesDrawn / options.frames, shadowMs / options.frames,
+             cpu.mean > 0.0 ? 100.0 * shadowMs / options.frames / cpu.mean : 0.0,
+             profiledGpuMs > 0.0 ? 100.0 * shadowGpuMs / profiledGpuMs : 0.0);
+    }
+  }
+
+  destroy();
+  return exitCode;
+}
+
+} // namespace fred
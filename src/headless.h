@@ -0,0 +1,29 @@
+#ifndef FRED_HEADLESS_H
+#define FRED_HEADLESS_H
+
+#include <string>
+
+namespace fred {
+
+// fred --headless [--frames N] [--warmup N] [--scene NAME] [--output PATH]
+struct HeadlessOptions {
+  bool enabled = false; // --headless was given
+  int frames = 300;     // Measured ones, after the warmup
+  int warmupFrames = 30;
+  int width = 1280;
+  int height = 720;
+  bool lods = true;     // --no-lod draws everything at full detail
+  bool occlusion = true; // --no-occlusion turns occlusion culling off
+  std::string scene = "demo";
+  std::string output = "fred-bench.json";
+};
+
+// False and a usage message on bad arguments
+bool parseHeadlessArgs(int argc, char **argv, HeadlessOptions &options);
+// Renders one of the canned scenes and writes the timings as JSON. Returns
+// the process exit code.
+int runHeadless(const HeadlessOptions &options);
+
+} // namespace fred
+
+#endif
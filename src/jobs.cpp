@@ -0,0 +1,359 @@
+#include "jobs.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace fred {
+
+JobSystem jobs;
+
+struct Job {
+  std::function<void()> function;
+  JobCounter *counter;
+  const char *name;
+};
+
+// Yields before a thread with nothing to do goes to sleep
+static const int IDLE_SPINS = 64;
+
+// Which system's worker this thread is, if any
+static thread_local const JobSystem *currentSystem = NULL;
+static thread_local int currentThread = -1;
+
+bool JobCounter::isDone() {
+  if (pending.load(std::memory_order_acquire) != 0) {
+    return false;
+  }
+  // The last job out may still hold the lock
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending.load(std::memory_order_relaxed) == 0;
+}
+
+// Deque ==================================================================== //
+
+// Chase-Lev, after Le et al., "Correct and Efficient Work-Stealing for Weak
+// Memory Models", with seq_cst loads and stores where the paper has seq_cst
+// fences. Same code on x86 and ThreadSanitizer can follow it, it can't
+// follow fences.
+bool JobDeque::push(Job *job) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= CAPACITY) {
+    return false;
+  }
+  slots[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+  bottom.store(b + 1, std::memory_order_release);
+  return true;
+}
+
+Job *JobDeque::pop() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_seq_cst);
+  if (t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed); // Was empty
+    return NULL;
+  }
+  Job *job = slots[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (t == b) {
+    // The last one, a thief could be after it too
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      job = NULL;
+    }
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+Job *JobDeque::steal() {
+  int64_t t = top.load(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_seq_cst);
+  if (t >= b) {
+    return NULL;
+  }
+  Job *job = slots[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+    return NULL; // Lost it to the owner or another thief
+  }
+  return job;
+}
+
+// Workers ================================================================== //
+
+void JobSystem::start(int workerCount) {
+  std::lock_guard<std::mutex> lock(startMutex);
+  if (isRunning()) {
+    return;
+  }
+  if (workerCount <= 0) {
+    workerCount = (int)std::thread::hardware_concurrency() - 1;
+    workerCount = workerCount < 1 ? 1 : workerCount;
+  }
+  stopping = false;
+  // Every deque is there before anyone goes looking in them
+  for (int i = 0; i < workerCount; i++) {
+    workers.emplace_back(new Worker());
+  }
+  for (int i = 0; i < workerCount; i++) {
+    workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+  }
+  running.store(true, std::memory_order_release);
+}
+
+void JobSystem::stop() {
+  std::lock_guard<std::mutex> lock(startMutex);
+  if (!isRunning()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> sleepLock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::unique_ptr<Worker> &worker : workers) {
+    worker->thread.join();
+  }
+  running.store(false, std::memory_order_release);
+  workers.clear();
+}
+
+int JobSystem::getThreadIndex() const {
+  return currentSystem == this ? currentThread : -1;
+}
+
+void JobSystem::setProfileHooks(JobProfileHook begin, JobProfileHook end) {
+  beginHook.store(begin, std::memory_order_relaxed);
+  endHook.store(end, std::memory_order_relaxed);
+}
+
+std::vector<JobThreadStats> JobSystem::getStats() const {
+  std::vector<JobThreadStats> stats(workers.size() + 1);
+  for (size_t i = 0; i <= workers.size(); i++) {
+    const ThreadCounters &counters = i < workers.size() ? workers[i]->counters : otherCounters;
+    stats[i].jobs = counters.jobs.load(std::memory_order_relaxed);
+    stats[i].steals = counters.steals.load(std::memory_order_relaxed);
+    stats[i].sleeps = counters.sleeps.load(std::memory_order_relaxed);
+  }
+  return stats;
+}
+
+void JobSystem::push(Job *job) {
+  // Counted before it can be found, so a waking worker never sees it go negative
+  queued.fetch_add(1);
+  int thread = getThreadIndex();
+  if (thread < 0 || !workers[thread]->deque.push(job)) {
+    std::lock_guard<std::mutex> lock(sharedMutex);
+    shared.push_back(job);
+    sharedCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  // queued goes up before sleeping is read and a worker bumps sleeping
+  // before it reads queued, so one of the two always sees the other
+  if (sleeping.load() > 0) {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wake.notify_one();
+  }
+}
+
+Job *JobSystem::stealFrom(int thread) {
+  // Start somewhere different each time so thieves spread out
+  static thread_local uint32_t random =
+      (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+  random ^= random << 13;
+  random ^= random >> 17;
+  random ^= random << 5;
+  int count = (int)workers.size();
+  int first = (int)(random % count);
+  for (int i = 0; i < count; i++) {
+    int victim = (first + i) % count;
+    if (victim == thread) {
+      continue;
+    }
+    Job *job = workers[victim]->deque.steal();
+    if (job != NULL) {
+      countersFor(thread).steals.fetch_add(1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+  return NULL;
+}
+
+// Oldest first, or with a counter the oldest counted on it
+Job *JobSystem::takeShared(const JobCounter *counter) {
+  if (sharedCount.load(std::memory_order_relaxed) == 0) {
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(sharedMutex);
+  for (std::deque<Job *>::iterator i = shared.begin(); i != shared.end(); ++i) {
+    if (counter == NULL || (*i)->counter == counter) {
+      Job *job = *i;
+      shared.erase(i);
+      sharedCount.fetch_sub(1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+  return NULL;
+}
+
+// Own deque first, newest first, then the shared queue, then someone else's
+Job *JobSystem::find(int thread) {
+  Job *job = thread >= 0 ? workers[thread]->deque.pop() : NULL;
+  if (job == NULL) {
+    job = takeShared(NULL);
+  }
+  if (job == NULL) {
+    job = stealFrom(thread);
+  }
+  if (job != NULL) {
+    queued.fetch_sub(1);
+  }
+  return job;
+}
+
+void JobSystem::execute(Job *job, int thread) {
+  // Loaded once so a hook changing mid job can't leave a zone open
+  JobProfileHook begin = beginHook.load(std::memory_order_relaxed);
+  JobProfileHook end = endHook.load(std::memory_order_relaxed);
+  if (begin != NULL) {
+    begin(thread, job->name);
+  }
+  job->function();
+  if (end != NULL) {
+    end(thread, job->name);
+  }
+  countersFor(thread).jobs.fetch_add(1, std::memory_order_relaxed);
+  JobCounter *counter = job->counter;
+  delete job;
+  if (counter != NULL) {
+    finish(*counter);
+  }
+}
+
+void JobSystem::finish(JobCounter &counter) {
+  std::vector<Job *> released;
+  {
+    // Under the lock so a waiter can't see 0 and let the counter go while
+    // it's still being touched here
+    std::lock_guard<std::mutex> lock(counter.mutex);
+    if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      released.swap(counter.held);
+      counter.done.notify_all();
+    }
+  }
+  for (Job *job : released) {
+    push(job);
+  }
+}
+
+void JobSystem::workerLoop(int thread) {
+  currentSystem = this;
+  currentThread = thread;
+  int idle = 0;
+  for (;;) {
+    Job *job = find(thread);
+    if (job != NULL) {
+      execute(job, thread);
+      idle = 0;
+      continue;
+    }
+    if (++idle < IDLE_SPINS) {
+      std::this_thread::yield();
+      continue;
+    }
+    idle = 0;
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    if (stopping && queued.load() == 0) {
+      return; // Stopping and drained
+    }
+    sleeping.fetch_add(1);
+    workers[thread]->counters.sleeps.fetch_add(1, std::memory_order_relaxed);
+    wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+    sleeping.fetch_sub(1);
+  }
+}
+
+// Jobs ===================================================================== //
+
+void JobSystem::run(std::function<void()> function, JobCounter *counter, const char *name, JobCounter *after) {
+  if (!isRunning()) {
+    start(0);
+  }
+  Job *job = new Job{std::move(function), counter, name};
+  if (counter != NULL) {
+    counter->pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (after != NULL) {
+    // Same lock the last of after's jobs takes, so it's either held here and
+    // released by that job or after is already done
+    std::lock_guard<std::mutex> lock(after->mutex);
+    if (after->pending.load(std::memory_order_relaxed) > 0) {
+      after->held.push_back(job);
+      return;
+    }
+  }
+  push(job);
+}
+
+void JobSystem::wait(JobCounter &counter) {
+  int thread = getThreadIndex();
+  int idle = 0;
+  while (counter.pending.load(std::memory_order_acquire) != 0) {
+    Job *job = NULL;
+    if (thread >= 0) {
+      job = find(thread);
+    } else if (isRunning()) {
+      // Off the workers only its own jobs, or the main thread waiting on a
+      // parallel for could pick up something long like the game step and
+      // run it in the middle of the frame
+      job = takeShared(&counter);
+      if (job != NULL) {
+        queued.fetch_sub(1);
+      }
+    }
+    if (job != NULL) {
+      execute(job, thread);
+      idle = 0;
+      continue;
+    }
+    if (++idle < IDLE_SPINS) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Nothing to help with, sleep until it's done or more work might be in
+    std::unique_lock<std::mutex> lock(counter.mutex);
+    counter.done.wait_for(lock, std::chrono::milliseconds(1),
+                          [&counter] { return counter.pending.load(std::memory_order_relaxed) == 0; });
+    idle = 0;
+  }
+  // The last job out holds this until it's done with the counter
+  std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+// Hands the top half off and carries on with the bottom, so the pieces left
+// for thieves are the big ones
+void JobSystem::split(int begin, int end, int grain, const std::function<void(int, int)> &function,
+                      JobCounter &counter, const char *name) {
+  while (end - begin > grain) {
+    int middle = begin + (end - begin) / 2;
+    run([this, middle, end, grain, &function, &counter, name] { split(middle, end, grain, function, counter, name); },
+        &counter, name);
+    end = middle;
+  }
+  function(begin, end);
+}
+
+void JobSystem::parallelFor(int count, int grain, const std::function<void(int begin, int end)> &function,
+                            const char *name) {
+  if (count <= 0) {
+    return;
+  }
+  grain = std::max(grain, 1);
+  if (count <= grain) {
+    function(0, count);
+    return;
+  }
+  JobCounter counter;
+  split(0, count, grain, function, counter, name);
+  wait(counter);
+}
+
+} // namespace fred
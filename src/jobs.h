@@ -0,0 +1,156 @@
+#ifndef FRED_JOBS_H
+#define FRED_JOBS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fred {
+
+struct Job;
+
+// How many jobs run with it haven't finished yet. Wait on it, or hold other
+// jobs back until it's done. Has to outlive its jobs, wait before it goes.
+class JobCounter {
+public:
+  JobCounter() = default;
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool isDone();
+
+private:
+  friend class JobSystem;
+  std::atomic<int> pending{0};
+  std::mutex mutex; // Taken by the last job out, and to hold jobs back
+  std::condition_variable done;
+  std::vector<Job *> held; // Run once pending hits 0
+};
+
+// Per thread, the last slot is every thread that isn't a worker
+struct JobThreadStats {
+  uint64_t jobs = 0;   // Run on this thread
+  uint64_t steals = 0; // Of those, taken from another worker's deque
+  uint64_t sleeps = 0; // Times it ran out of work and went to sleep
+};
+
+// Called around every job on whichever thread runs it. thread is the worker
+// index, -1 off the workers. Has to be safe to call from any thread.
+typedef void (*JobProfileHook)(int thread, const char *name);
+
+// Chase-Lev deque of jobs. Only the owning worker pushes and pops, at the
+// bottom, anyone can steal from the top. Fixed size, push fails when full.
+class JobDeque {
+public:
+  static constexpr int64_t CAPACITY = 4096;
+
+  bool push(Job *job);
+  Job *pop();
+  Job *steal();
+
+private:
+  // Own cache lines, thieves hammer top while the owner works on bottom
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::atomic<Job *> slots[CAPACITY];
+};
+
+// Short CPU jobs over a worker per core. Each worker has its own deque and
+// takes from the bottom of it, so jobs a job starts run hot in the same
+// cache. Out of work it takes from the shared queue, then steals from the
+// top of someone else's deque. Threads that aren't workers push to the
+// shared queue, and anything waiting on a counter runs jobs meanwhile
+// rather than blocking. Workers take any job while they wait, other threads
+// only the jobs counted on what they're waiting for, so the main thread
+// helps with its own parallel fors but never ends up running a long job
+// someone kicked off to overlap with the frame.
+//
+// No GL in jobs, and nothing that blocks for long either, a blocked job
+// holds a core. File IO stays on the asset loader's own pool.
+class JobSystem {
+public:
+  JobSystem() = default;
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+  ~JobSystem() { stop(); }
+
+  // 0 picks one less than the core count, at least one. run starts it with
+  // 0 if nothing did before.
+  void start(int workerCount);
+  // Finishes whatever is queued, then joins the workers
+  void stop();
+  bool isRunning() const { return running.load(std::memory_order_acquire); }
+  int getWorkerCount() const { return (int)workers.size(); }
+
+  // counter, if there is one, counts the job until it's finished. after, if
+  // there is one, holds the job back until that counter is done.
+  void run(std::function<void()> function, JobCounter *counter = NULL, const char *name = "Job",
+           JobCounter *after = NULL);
+  // Runs jobs until counter is done, off the workers only counter's own
+  void wait(JobCounter &counter);
+  // function(begin, end) over [0, count) in ranges of at most grain, back
+  // once they're all done. The calling thread takes the first range.
+  void parallelFor(int count, int grain, const std::function<void(int begin, int end)> &function,
+                   const char *name = "Parallel for");
+
+  // Either can be NULL. Set them before starting, or between frames.
+  void setProfileHooks(JobProfileHook begin, JobProfileHook end);
+  // The calling thread's worker index in this system, -1 if it isn't one
+  int getThreadIndex() const;
+  // A slot per worker and one more for everyone else
+  std::vector<JobThreadStats> getStats() const;
+
+private:
+  struct ThreadCounters {
+    std::atomic<uint64_t> jobs{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> sleeps{0};
+  };
+  struct Worker {
+    JobDeque deque;
+    ThreadCounters counters;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<bool> running{false};
+  std::mutex startMutex;
+
+  std::deque<Job *> shared; // From threads that aren't workers, and full deques
+  std::mutex sharedMutex;
+  std::atomic<int> sharedCount{0};
+
+  // Jobs sitting in a deque or the shared queue, workers sleep when it's 0
+  std::atomic<int> queued{0};
+  std::atomic<int> sleeping{0};
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  ThreadCounters otherCounters;
+  std::atomic<JobProfileHook> beginHook{NULL};
+  std::atomic<JobProfileHook> endHook{NULL};
+
+  ThreadCounters &countersFor(int thread) { return thread >= 0 ? workers[thread]->counters : otherCounters; }
+  void push(Job *job);
+  Job *takeShared(const JobCounter *counter);
+  Job *find(int thread);
+  Job *stealFrom(int thread);
+  void execute(Job *job, int thread);
+  void finish(JobCounter &counter);
+  void split(int begin, int end, int grain, const std::function<void(int, int)> &function, JobCounter &counter,
+             const char *name);
+  void workerLoop(int thread);
+};
+
+extern JobSystem jobs;
+
+} // namespace fred
+
+#endif
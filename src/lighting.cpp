@@ -0,0 +1,270 @@
+#include "lighting.h"
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#include <clog/clog.h>
+
+#include "glstate.h"
+#include "jobs.h"
+#include "profiler.h"
+#include "uniforms.h"
+
+namespace fred {
+
+// Small enough that handing them out as jobs costs more than the work
+static constexpr int PARALLEL_MIN_LIGHTS = 16;
+// Near slices hold most of the references, smaller tasks even that out
+static constexpr int SLICES_PER_TASK = 2;
+
+static const GLuint lightUnits[3] = {LIGHT_DATA_UNIT, LIGHT_CLUSTERS_UNIT, LIGHT_INDICES_UNIT};
+
+// Setup ==================================================================== //
+
+void LightGrid::setProjection(const glm::mat4 &projectionI) {
+  projection = projectionI;
+  // Straight out of glm::perspective's third and fourth columns
+  nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+
+  // View space direction through a point in NDC, scaled to a depth of one
+  glm::mat4 inverseProjection = glm::inverse(projection);
+  auto ray = [&](float x, float y) {
+    glm::vec4 point = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec3 direction = glm::vec3(point) / point.w;
+    return direction / -direction.z;
+  };
+
+  for (int x = 0; x <= CLUSTERS_X; x++) {
+    float ndc = -1.0f + 2.0f * x / CLUSTERS_X;
+    planesX[x] = glm::normalize(glm::cross(ray(ndc, -1.0f), ray(ndc, 1.0f)));
+  }
+  for (int y = 0; y <= CLUSTERS_Y; y++) {
+    float ndc = -1.0f + 2.0f * y / CLUSTERS_Y;
+    planesY[y] = glm::normalize(glm::cross(ray(1.0f, ndc), ray(-1.0f, ndc)));
+  }
+  for (int z = 0; z <= CLUSTERS_Z; z++) {
+    sliceDepths[z] = nearPlane * powf(farPlane / nearPlane, (float)z / CLUSTERS_Z);
+  }
+
+  clusterBounds.resize(CLUSTER_COUNT);
+  for (int z = 0; z < CLUSTERS_Z; z++) {
+    for (int y = 0; y < CLUSTERS_Y; y++) {
+      for (int x = 0; x < CLUSTERS_X; x++) {
+        float left = -1.0f + 2.0f * x / CLUSTERS_X;
+        float right = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+        float bottom = -1.0f + 2.0f * y / CLUSTERS_Y;
+        float top = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+        glm::vec3 corners[4] = {ray(left, bottom), ray(right, bottom), ray(left, top), ray(right, top)};
+        Aabb box = {corners[0] * sliceDepths[z], corners[0] * sliceDepths[z]};
+        for (const glm::vec3 &corner : corners) {
+          for (int end = 0; end < 2; end++) {
+            glm::vec3 point = corner * sliceDepths[z + end];
+            box.min = glm::min(box.min, point);
+            box.max = glm::max(box.max, point);
+          }
+        }
+        clusterBounds[x + CLUSTERS_X * (y + CLUSTERS_Y * z)] = box;
+      }
+    }
+  }
+}
+
+int LightGrid::sliceOf(float depth) const {
+  if (depth <= nearPlane) {
+    return 0;
+  }
+  int slice = (int)floorf(logf(depth / nearPlane) / logf(farPlane / nearPlane) * CLUSTERS_Z);
+  return std::min(std::max(slice, 0), CLUSTERS_Z - 1);
+}
+
+glm::vec4 LightGrid::getClusterScale(float viewportWidth, float viewportHeight) const {
+  // slice = log(depth) * z + w, the same sums as sliceOf
+  float depthScale = CLUSTERS_Z / logf(farPlane / nearPlane);
+  return glm::vec4(CLUSTERS_X / viewportWidth, CLUSTERS_Y / viewportHeight, depthScale,
+                   -logf(nearPlane) * depthScale);
+}
+
+// Build ==================================================================== //
+
+void LightGrid::build(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projectionI) {
+  PROFILE_ZONE("Light grid");
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (projectionI != projection) {
+    setProjection(projectionI);
+  }
+  stats = LightGridStats();
+
+  static bool warned = false;
+  if (lights.size() > MAX_LIGHTS && !warned) {
+    clog_log(CLOG_LEVEL_WARN, "%d lights in the scene, only the first %d get drawn\n", (int)lights.size(), MAX_LIGHTS);
+    warned = true;
+  }
+
+  // Into view space, and the tile and slice ranges each one could touch.
+  // Each side of a tile is a plane through the eye, so a tile is out of
+  // range once the sphere is more than its radius past one of them.
+  bounds.clear();
+  lightData.clear();
+  for (size_t i = 0; i < lights.size() && i < MAX_LIGHTS; i++) {
+    const PointLight &light = lights[i];
+    LightBounds range;
+    range.center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    range.radius = light.radius;
+    float depth = -range.center.z;
+    if (depth + light.radius < nearPlane || depth - light.radius > farPlane) {
+      continue;
+    }
+    range.minZ = sliceOf(depth - light.radius);
+    range.maxZ = sliceOf(depth + light.radius);
+    range.minX = 0;
+    while (range.minX < CLUSTERS_X && glm::dot(planesX[range.minX + 1], range.center) > light.radius) {
+      range.minX++;
+    }
+    range.maxX = CLUSTERS_X - 1;
+    while (range.maxX >= 0 && glm::dot(planesX[range.maxX], range.center) < -light.radius) {
+      range.maxX--;
+    }
+    range.minY = 0;
+    while (range.minY < CLUSTERS_Y && glm::dot(planesY[range.minY + 1], range.center) > light.radius) {
+      range.minY++;
+    }
+    range.maxY = CLUSTERS_Y - 1;
+    while (range.maxY >= 0 && glm::dot(planesY[range.maxY], range.center) < -light.radius) {
+      range.maxY--;
+    }
+    if (range.minX > range.maxX || range.minY > range.maxY) {
+      continue; // Off to the side
+    }
+    bounds.push_back(range);
+    lightData.push_back(glm::vec4(range.center, light.radius));
+    lightData.push_back(glm::vec4(light.color * light.power, 0.0f));
+  }
+  stats.lights = bounds.size();
+
+  int taskCount = 1;
+  if (parallel && bounds.size() >= PARALLEL_MIN_LIGHTS) {
+    taskCount = CLUSTERS_Z / SLICES_PER_TASK;
+  }
+  tasks.resize(taskCount);
+  for (int i = 0; i < taskCount; i++) {
+    tasks[i].firstSlice = CLUSTERS_Z * i / taskCount;
+    tasks[i].endSlice = CLUSTERS_Z * (i + 1) / taskCount;
+  }
+  stats.tasks = taskCount;
+
+  clusters.resize(CLUSTER_COUNT * 2);
+  jobs.parallelFor(taskCount, 1, [this](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      assign(tasks[i]);
+    }
+  }, "Light assignment");
+
+  // Every task's offsets are into its own list, stitch them together
+  indices.clear();
+  for (Task &task : tasks) {
+    uint32_t base = indices.size();
+    uint32_t room = MAX_LIGHT_INDICES - base;
+    int first = task.firstSlice * CLUSTERS_X * CLUSTERS_Y;
+    int end = task.endSlice * CLUSTERS_X * CLUSTERS_Y;
+    for (int cluster = first; cluster < end; cluster++) {
+      uint32_t offset = clusters[cluster * 2];
+      uint32_t count = clusters[cluster * 2 + 1];
+      uint32_t kept = offset >= room ? 0 : std::min(count, room - offset);
+      stats.overflowed += count - kept;
+      stats.maxPerCluster = std::max(stats.maxPerCluster, (int)kept);
+      clusters[cluster * 2] = base + offset;
+      clusters[cluster * 2 + 1] = kept;
+    }
+    indices.insert(indices.end(), task.indices.begin(),
+                   task.indices.begin() + std::min((uint32_t)task.indices.size(), room));
+  }
+  stats.indices = indices.size();
+  stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Every light against just the clusters in its range, then a counting sort
+// per slice so each cluster's lights end up contiguous and in light order
+void LightGrid::assign(Task &task) {
+  task.indices.clear();
+  for (int z = task.firstSlice; z < task.endSlice; z++) {
+    int sliceFirst = z * CLUSTERS_X * CLUSTERS_Y;
+    uint32_t counts[CLUSTERS_X * CLUSTERS_Y] = {};
+    task.hits.clear();
+    for (uint32_t i = 0; i < bounds.size(); i++) {
+      const LightBounds &light = bounds[i];
+      if (z < light.minZ || z > light.maxZ) {
+        continue;
+      }
+      for (int y = light.minY; y <= light.maxY; y++) {
+        for (int x = light.minX; x <= light.maxX; x++) {
+          // The ranges are loose at the corners, the sphere against the box isn't
+          int tile = x + CLUSTERS_X * y;
+          const Aabb &box = clusterBounds[sliceFirst + tile];
+          glm::vec3 offsetToBox = light.center - glm::clamp(light.center, box.min, box.max);
+          if (glm::dot(offsetToBox, offsetToBox) <= light.radius * light.radius) {
+            task.hits.push_back((uint32_t)tile << 16 | i);
+            counts[tile]++;
+          }
+        }
+      }
+    }
+
+    uint32_t offset = task.indices.size();
+    for (int tile = 0; tile < CLUSTERS_X * CLUSTERS_Y; tile++) {
+      clusters[(sliceFirst + tile) * 2] = offset;
+      clusters[(sliceFirst + tile) * 2 + 1] = counts[tile];
+      uint32_t count = counts[tile];
+      counts[tile] = offset; // Now where the next one goes
+      offset += count;
+    }
+    task.indices.resize(offset);
+    for (uint32_t hit : task.hits) {
+      task.indices[counts[hit >> 16]++] = (uint16_t)(hit & 0xFFFF);
+    }
+  }
+}
+
+// GL ======================================================================= //
+
+void LightGrid::upload() {
+  if (buffers[0] == 0) {
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; i++) {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+      glState.bindTexture(lightUnits[i], textures[i], GL_TEXTURE_BUFFER);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+  }
+
+  const void *data[3] = {lightData.data(), clusters.data(), indices.data()};
+  GLsizeiptr sizes[3] = {(GLsizeiptr)(lightData.size() * sizeof(glm::vec4)),
+                         (GLsizeiptr)(clusters.size() * sizeof(uint32_t)),
+                         (GLsizeiptr)(indices.size() * sizeof(uint16_t))};
+  for (int i = 0; i < 3; i++) {
+    // Fresh storage every frame like the instance buffers, and never empty
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max(sizes[i], (GLsizeiptr)16), NULL, GL_STREAM_DRAW);
+    if (sizes[i] > 0) {
+      glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+    }
+    glState.bindTexture(lightUnits[i], textures[i], GL_TEXTURE_BUFFER);
+  }
+}
+
+void LightGrid::destroy() {
+  if (buffers[0] != 0) {
+    glDeleteTextures(3, textures);
+    glDeleteBuffers(3, buffers);
+  }
+  for (int i = 0; i < 3; i++) {
+    buffers[i] = 0;
+    textures[i] = 0;
+  }
+}
+
+} // namespace fred
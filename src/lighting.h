@@ -0,0 +1,114 @@
+#ifndef FRED_LIGHTING_H
+#define FRED_LIGHTING_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "culling.h"
+
+namespace fred {
+
+// Falls off with distance squared like the old single light did, then gets
+// windowed down to nothing at radius so it only lands in the clusters it
+// actually reaches
+struct PointLight {
+  glm::vec3 position = glm::vec3(0.0f);
+  glm::vec3 color = glm::vec3(1.0f);
+  float power = 50.0f;
+  float radius = 20.0f;
+};
+
+// The view frustum in froxels, screen tiles by depth slices. Slices are
+// spaced exponentially so they stay roughly cube shaped all the way out.
+constexpr int CLUSTERS_X = 16;
+constexpr int CLUSTERS_Y = 9;
+constexpr int CLUSTERS_Z = 24;
+constexpr int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+// Indices are 16 bit (so are the ones the build sorts by), and 64k texels is all GL 3.3 promises a texture buffer
+constexpr int MAX_LIGHTS = 4096;
+constexpr int MAX_LIGHT_INDICES = 65536;
+
+struct LightGridStats {
+  int lights = 0;           // Made it into the grid, in front of the camera
+  int indices = 0;          // Light references over every cluster
+  int maxPerCluster = 0;    // Worst case loop in the fragment shader
+  int overflowed = 0;       // References dropped for going past MAX_LIGHT_INDICES
+  int tasks = 0;            // Slice ranges the assignment was split into
+  double buildMs = 0.0;
+};
+
+// Which lights touch which cluster, built on the CPU every frame and read
+// by the lit shaders through three texture buffers:
+//   lightData     RGBA32F, two texels per light, view space position and
+//                 radius then color times power
+//   lightClusters RG32UI, offset into lightIndices and count per cluster
+//   lightIndices  R16UI, into lightData
+// Assignment is split by depth slice over the job system, each range of
+// slices is a contiguous range of clusters so nothing is shared.
+class LightGrid {
+public:
+  bool parallel = true;
+
+  // Written by build, what upload sends
+  std::vector<glm::vec4> lightData;
+  std::vector<uint32_t> clusters; // Offset and count per cluster, x fastest then y then z
+  std::vector<uint16_t> indices;
+
+  LightGrid() = default;
+  LightGrid(const LightGrid &) = delete;
+  LightGrid &operator=(const LightGrid &) = delete;
+
+  // CPU only, perspective projections only. Cluster bounds are only worked
+  // out again when the projection changes.
+  void build(const std::vector<PointLight> &lights, const glm::mat4 &view, const glm::mat4 &projection);
+  // GL thread, streams the buffers and binds them to their texture units
+  void upload();
+  // GL thread, before the context goes
+  void destroy();
+
+  // For FrameUniforms, fragment coordinates and view depth to a cluster
+  glm::vec4 getClusterScale(float viewportWidth, float viewportHeight) const;
+  const LightGridStats &getStats() const { return stats; }
+
+private:
+  // A light in view space and the range of clusters it could touch
+  struct LightBounds {
+    glm::vec3 center;
+    float radius;
+    int minX, maxX, minY, maxY, minZ, maxZ;
+  };
+  // What one task produced, offsets in clusters are into its own indices
+  struct Task {
+    int firstSlice;
+    int endSlice;
+    std::vector<uint16_t> indices;
+    std::vector<uint32_t> hits; // Scratch, tile << 16 | light for one slice
+  };
+
+  glm::mat4 projection = glm::mat4(0.0f);
+  float nearPlane = 0.1f;
+  float farPlane = 100.0f;
+  // Through the view space origin, pointing towards +x and +y
+  glm::vec3 planesX[CLUSTERS_X + 1];
+  glm::vec3 planesY[CLUSTERS_Y + 1];
+  float sliceDepths[CLUSTERS_Z + 1];
+  std::vector<Aabb> clusterBounds;
+
+  std::vector<LightBounds> bounds;
+  std::vector<Task> tasks;
+  LightGridStats stats;
+
+  GLuint buffers[3] = {0, 0, 0};
+  GLuint textures[3] = {0, 0, 0};
+
+  void setProjection(const glm::mat4 &projectionI);
+  int sliceOf(float depth) const;
+  void assign(Task &task);
+};
+
+} // namespace fred
+
+#endif
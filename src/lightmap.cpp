@@ -0,0 +1,411 @@
+#include "lightmap.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+#include <clog/clog.h>
+
+namespace fred {
+
+void meshTriangles(const MeshData &mesh, std::vector<uint32_t> &triangles) {
+  triangles.clear();
+  for (const SubMesh &subMesh : mesh.subMeshes) {
+    const unsigned char *indices = &mesh.indices[subMesh.indexOffset];
+    for (uint32_t i = 0; i < subMesh.indexCount; i++) {
+      uint32_t index;
+      if (subMesh.indexSize == sizeof(uint16_t)) {
+        uint16_t shortIndex;
+        memcpy(&shortIndex, indices + i * sizeof(uint16_t), sizeof(shortIndex));
+        index = shortIndex;
+      } else {
+        memcpy(&index, indices + i * sizeof(uint32_t), sizeof(index));
+      }
+      triangles.push_back(subMesh.baseVertex + index);
+    }
+  }
+}
+
+// Charts =================================================================== //
+
+struct Chart {
+  size_t mesh;
+  uint32_t subMesh;
+  glm::vec3 axisU; // Projection, world units
+  glm::vec3 axisV;
+  glm::vec2 min;
+  glm::vec2 max;
+  // Placed, in texels with the padding included
+  int x, y, width, height;
+};
+
+// Exact positions, so vertices split by Assimp for a UV or normal seam still
+// count as connected
+struct PositionHash {
+  size_t operator()(const glm::vec3 &position) const {
+    uint32_t bits[3];
+    memcpy(bits, &position, sizeof(bits));
+    return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+  }
+};
+
+// Flood fills triangles into charts, each one connected, in one submesh and
+// within chartAngle of the triangle it started from so the projection can't
+// fold over itself. triangleCharts comes back indexed by triangle.
+static void buildCharts(const MeshData &mesh, size_t meshIndex, const std::vector<uint32_t> &triangles,
+                        float cosAngle, std::vector<Chart> &charts, std::vector<uint32_t> &triangleCharts) {
+  size_t triangleCount = triangles.size() / 3;
+
+  std::vector<uint32_t> subMeshOf(triangleCount);
+  size_t triangle = 0;
+  for (uint32_t s = 0; s < mesh.subMeshes.size(); s++) {
+    for (uint32_t i = 0; i < mesh.subMeshes[s].indexCount / 3; i++) {
+      subMeshOf[triangle++] = s;
+    }
+  }
+
+  std::vector<glm::vec3> normals(triangleCount);
+  std::vector<float> areas(triangleCount);
+  for (size_t t = 0; t < triangleCount; t++) {
+    const glm::vec3 &a = mesh.positions[triangles[t * 3]];
+    glm::vec3 cross = glm::cross(mesh.positions[triangles[t * 3 + 1]] - a, mesh.positions[triangles[t * 3 + 2]] - a);
+    float length = glm::length(cross);
+    areas[t] = length * 0.5f;
+    normals[t] = length > 1e-12f ? cross / length : glm::vec3(0.0f);
+  }
+
+  // Edges between welded positions, sorted so triangles sharing one sit together
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> welds;
+  std::vector<uint32_t> weldOf(mesh.positions.size());
+  for (size_t v = 0; v < mesh.positions.size(); v++) {
+    weldOf[v] = welds.emplace(mesh.positions[v], (uint32_t)welds.size()).first->second;
+  }
+  std::vector<std::pair<uint64_t, uint32_t>> edges;
+  edges.reserve(triangles.size());
+  for (size_t t = 0; t < triangleCount; t++) {
+    for (int corner = 0; corner < 3; corner++) {
+      uint64_t a = weldOf[triangles[t * 3 + corner]];
+      uint64_t b = weldOf[triangles[t * 3 + (corner + 1) % 3]];
+      edges.push_back(std::make_pair(std::min(a, b) << 32 | std::max(a, b), (uint32_t)t));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  std::vector<std::vector<uint32_t>> neighbours(triangleCount);
+  for (size_t first = 0; first < edges.size();) {
+    size_t last = first + 1;
+    while (last < edges.size() && edges[last].first == edges[first].first) {
+      last++;
+    }
+    for (size_t i = first; i < last; i++) {
+      for (size_t j = first; j < last; j++) {
+        if (i != j) {
+          neighbours[edges[i].second].push_back(edges[j].second);
+        }
+      }
+    }
+    first = last;
+  }
+
+  // Biggest triangles seed first, they decide which way the big flat bits face
+  std::vector<uint32_t> seeds(triangleCount);
+  for (size_t t = 0; t < triangleCount; t++) {
+    seeds[t] = (uint32_t)t;
+  }
+  std::sort(seeds.begin(), seeds.end(), [&](uint32_t a, uint32_t b) { return areas[a] > areas[b]; });
+
+  const uint32_t NONE = ~0u;
+  triangleCharts.assign(triangleCount, NONE);
+  std::vector<uint32_t> queue;
+  for (uint32_t seed : seeds) {
+    if (triangleCharts[seed] != NONE) {
+      continue;
+    }
+    uint32_t chartIndex = (uint32_t)charts.size();
+    Chart chart;
+    chart.mesh = meshIndex;
+    chart.subMesh = subMeshOf[seed];
+    glm::vec3 normal = normals[seed] != glm::vec3(0.0f) ? normals[seed] : glm::vec3(0, 1, 0);
+    glm::vec3 helper = fabsf(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    chart.axisU = glm::normalize(glm::cross(helper, normal));
+    chart.axisV = glm::cross(normal, chart.axisU);
+    chart.min = glm::vec2(INFINITY);
+    chart.max = glm::vec2(-INFINITY);
+
+    queue.clear();
+    queue.push_back(seed);
+    triangleCharts[seed] = chartIndex;
+    for (size_t head = 0; head < queue.size(); head++) {
+      uint32_t t = queue[head];
+      for (int corner = 0; corner < 3; corner++) {
+        const glm::vec3 &position = mesh.positions[triangles[t * 3 + corner]];
+        glm::vec2 projected(glm::dot(position, chart.axisU), glm::dot(position, chart.axisV));
+        chart.min = glm::min(chart.min, projected);
+        chart.max = glm::max(chart.max, projected);
+      }
+      for (uint32_t next : neighbours[t]) {
+        if (triangleCharts[next] == NONE && subMeshOf[next] == chart.subMesh &&
+            glm::dot(normals[next], normal) >= cosAngle) {
+          triangleCharts[next] = chartIndex;
+          queue.push_back(next);
+        }
+      }
+    }
+    charts.push_back(chart);
+  }
+}
+
+// Shelves, tallest charts first. False if they don't all fit.
+static bool packCharts(std::vector<Chart> &charts, int size, int padding, float density) {
+  for (Chart &chart : charts) {
+    glm::vec2 extent = (chart.max - chart.min) * density;
+    // One more texel than the extent so every chart gets at least one center
+    chart.width = (int)ceilf(extent.x) + 1 + 2 * padding;
+    chart.height = (int)ceilf(extent.y) + 1 + 2 * padding;
+  }
+  std::vector<Chart *> order(charts.size());
+  for (size_t i = 0; i < charts.size(); i++) {
+    order[i] = &charts[i];
+  }
+  std::sort(order.begin(), order.end(), [](const Chart *a, const Chart *b) { return a->height > b->height; });
+
+  int x = 0, y = 0, shelfHeight = 0;
+  for (Chart *chart : order) {
+    if (x + chart->width > size) {
+      x = 0;
+      y += shelfHeight;
+      shelfHeight = 0;
+    }
+    if (chart->width > size || y + chart->height > size) {
+      return false;
+    }
+    chart->x = x;
+    chart->y = y;
+    x += chart->width;
+    shelfHeight = std::max(shelfHeight, chart->height);
+  }
+  return true;
+}
+
+bool generateLightmapUvs(std::vector<MeshData> &meshes, const LightmapAtlasSettings &settings,
+                         LightmapAtlasStats &stats) {
+  stats = LightmapAtlasStats();
+  float cosAngle = cosf(settings.chartAngle * 3.14159265f / 180.0f);
+  std::vector<Chart> charts;
+  std::vector<std::vector<uint32_t>> triangles(meshes.size());
+  std::vector<std::vector<uint32_t>> triangleCharts(meshes.size());
+  for (size_t m = 0; m < meshes.size(); m++) {
+    meshTriangles(meshes[m], triangles[m]);
+    buildCharts(meshes[m], m, triangles[m], cosAngle, charts, triangleCharts[m]);
+    stats.verticesBefore += (int)meshes[m].positions.size();
+  }
+  stats.charts = (int)charts.size();
+
+  float density = settings.texelsPerUnit;
+  while (!packCharts(charts, settings.size, settings.padding, density)) {
+    density *= 0.9f;
+    if (density < 1.0f) {
+      clog_log(CLOG_LEVEL_ERROR, "%d charts don't fit a %d texel lightmap\n", stats.charts, settings.size);
+      return false;
+    }
+  }
+  stats.texelsPerUnit = density;
+  double used = 0.0;
+  for (const Chart &chart : charts) {
+    used += (double)chart.width * chart.height;
+  }
+  stats.coverage = (float)(used / ((double)settings.size * settings.size));
+
+  // Rebuilt a submesh at a time so each one's vertices stay contiguous, with
+  // a vertex per chart it's in. Triangles keep their order.
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const MeshData &source = meshes[m];
+    MeshData baked;
+    std::unordered_map<uint64_t, uint32_t> remap;
+    size_t triangle = 0;
+    for (const SubMesh &sourceSubMesh : source.subMeshes) {
+      remap.clear();
+      SubMesh subMesh;
+      subMesh.baseVertex = (uint32_t)baked.positions.size();
+      subMesh.indexCount = sourceSubMesh.indexCount;
+      std::vector<uint32_t> indices;
+      indices.reserve(sourceSubMesh.indexCount);
+      for (uint32_t i = 0; i < sourceSubMesh.indexCount / 3; i++, triangle++) {
+        uint32_t chartIndex = triangleCharts[m][triangle];
+        const Chart &chart = charts[chartIndex];
+        for (int corner = 0; corner < 3; corner++) {
+          uint32_t vertex = triangles[m][triangle * 3 + corner];
+          uint64_t key = (uint64_t)chartIndex << 32 | vertex;
+          auto found = remap.find(key);
+          if (found == remap.end()) {
+            const glm::vec3 &position = source.positions[vertex];
+            glm::vec2 projected(glm::dot(position, chart.axisU), glm::dot(position, chart.axisV));
+            glm::vec2 texel = glm::vec2(chart.x + settings.padding + 0.5f, chart.y + settings.padding + 0.5f) +
+                              (projected - chart.min) * density;
+            found = remap.emplace(key, (uint32_t)(baked.positions.size() - subMesh.baseVertex)).first;
+            baked.positions.push_back(position);
+            baked.uvs.push_back(source.uvs[vertex]);
+            baked.normals.push_back(source.normals[vertex]);
+            baked.lightmapUvs.push_back(texel / (float)settings.size);
+          }
+          indices.push_back(found->second);
+        }
+      }
+      subMesh.vertexCount = (uint32_t)(baked.positions.size() - subMesh.baseVertex);
+      subMesh.indexSize = subMesh.vertexCount <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+      // Same alignment rule as importMesh
+      baked.indices.resize((baked.indices.size() + subMesh.indexSize - 1) & ~(size_t)(subMesh.indexSize - 1), 0);
+      subMesh.indexOffset = baked.indices.size();
+      baked.indices.resize(baked.indices.size() + indices.size() * subMesh.indexSize);
+      unsigned char *out = &baked.indices[subMesh.indexOffset];
+      for (uint32_t index : indices) {
+        if (subMesh.indexSize == sizeof(uint16_t)) {
+          uint16_t shortIndex = (uint16_t)index;
+          memcpy(out, &shortIndex, sizeof(shortIndex));
+        } else {
+          memcpy(out, &index, sizeof(index));
+        }
+        out += subMesh.indexSize;
+      }
+      baked.subMeshes.push_back(subMesh);
+    }
+    stats.verticesAfter += (int)baked.positions.size();
+    meshes[m] = std::move(baked);
+  }
+  return true;
+}
+
+// Texels =================================================================== //
+
+// Twice the signed area of abc, positive when counter clockwise
+static float edgeFunction(const glm::vec2 &a, const glm::vec2 &b, const glm::vec2 &c) {
+  return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+static void setTexel(LightmapTexel &texel, const glm::vec3 *positions, const glm::vec3 *normals,
+                     const glm::vec3 &faceNormal, const glm::vec3 &weights) {
+  texel.position = positions[0] * weights.x + positions[1] * weights.y + positions[2] * weights.z;
+  glm::vec3 normal = normals[0] * weights.x + normals[1] * weights.y + normals[2] * weights.z;
+  float length = glm::length(normal);
+  texel.normal = length > 1e-6f ? normal / length : faceNormal;
+  texel.covered = true;
+}
+
+void rasterizeLightmap(const std::vector<MeshData> &meshes, int size, std::vector<LightmapTexel> &texels) {
+  texels.assign((size_t)size * size, LightmapTexel());
+  std::vector<uint32_t> triangles;
+  // Centers first for every triangle, then edges, so a texel a triangle
+  // really covers never loses out to one that just grazes it
+  for (int pass = 0; pass < 2; pass++) {
+    for (const MeshData &mesh : meshes) {
+      meshTriangles(mesh, triangles);
+      for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+        glm::vec3 positions[3], normals[3];
+        glm::vec2 corners[3];
+        for (int corner = 0; corner < 3; corner++) {
+          uint32_t vertex = triangles[t + corner];
+          positions[corner] = mesh.positions[vertex];
+          normals[corner] = mesh.normals[vertex];
+          corners[corner] = mesh.lightmapUvs[vertex] * (float)size;
+        }
+        float area = edgeFunction(corners[0], corners[1], corners[2]);
+        if (fabsf(area) < 1e-12f) {
+          continue;
+        }
+        glm::vec3 faceNormal = glm::normalize(glm::cross(positions[1] - positions[0], positions[2] - positions[0]));
+
+        glm::vec2 low = glm::min(corners[0], glm::min(corners[1], corners[2]));
+        glm::vec2 high = glm::max(corners[0], glm::max(corners[1], corners[2]));
+        int minX = std::max((int)floorf(low.x - 1.0f), 0), maxX = std::min((int)ceilf(high.x + 1.0f), size - 1);
+        int minY = std::max((int)floorf(low.y - 1.0f), 0), maxY = std::min((int)ceilf(high.y + 1.0f), size - 1);
+        for (int y = minY; y <= maxY; y++) {
+          for (int x = minX; x <= maxX; x++) {
+            LightmapTexel &texel = texels[(size_t)y * size + x];
+            glm::vec2 center(x + 0.5f, y + 0.5f);
+            glm::vec3 weights(edgeFunction(corners[1], corners[2], center), edgeFunction(corners[2], corners[0], center),
+                              edgeFunction(corners[0], corners[1], center));
+            weights /= area;
+            bool inside = weights.x >= 0.0f && weights.y >= 0.0f && weights.z >= 0.0f;
+            if (pass == 0) {
+              if (inside) {
+                setTexel(texel, positions, normals, faceNormal, weights);
+              }
+              continue;
+            }
+            if (texel.covered) {
+              continue;
+            }
+            // Closest point on the nearest edge, if it's within the texel
+            float best = 0.75f * 0.75f;
+            bool found = false;
+            for (int edge = 0; edge < 3; edge++) {
+              const glm::vec2 &a = corners[edge];
+              const glm::vec2 &b = corners[(edge + 1) % 3];
+              glm::vec2 ab = b - a;
+              float along = glm::clamp(glm::dot(center - a, ab) / std::max(glm::dot(ab, ab), 1e-12f), 0.0f, 1.0f);
+              glm::vec2 offset = center - (a + ab * along);
+              float distanceSquared = glm::dot(offset, offset);
+              if (distanceSquared < best) {
+                best = distanceSquared;
+                weights = glm::vec3(0.0f);
+                weights[edge] = 1.0f - along;
+                weights[(edge + 1) % 3] = along;
+                found = true;
+              }
+            }
+            if (found) {
+              setTexel(texel, positions, normals, faceNormal, weights);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void dilateLightmap(std::vector<glm::vec3> &colors, std::vector<bool> &covered, int size, int passes) {
+  std::vector<bool> next;
+  for (int pass = 0; pass < passes; pass++) {
+    next = covered;
+    for (int y = 0; y < size; y++) {
+      for (int x = 0; x < size; x++) {
+        size_t index = (size_t)y * size + x;
+        if (covered[index]) {
+          continue;
+        }
+        glm::vec3 sum(0.0f);
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            int nx = x + dx, ny = y + dy;
+            if (nx >= 0 && ny >= 0 && nx < size && ny < size && covered[(size_t)ny * size + nx]) {
+              sum += colors[(size_t)ny * size + nx];
+              count++;
+            }
+          }
+        }
+        if (count > 0) {
+          colors[index] = sum / (float)count;
+          next[index] = true;
+        }
+      }
+    }
+    covered.swap(next);
+  }
+}
+
+void encodeLightmapRgbm(const std::vector<glm::vec3> &colors, std::vector<unsigned char> &rgbm) {
+  rgbm.resize(colors.size() * 4);
+  for (size_t i = 0; i < colors.size(); i++) {
+    glm::vec3 color = glm::max(colors[i] / LIGHTMAP_RANGE, glm::vec3(0.0f));
+    float multiplier = glm::clamp(std::max(color.x, std::max(color.y, color.z)), 1e-6f, 1.0f);
+    multiplier = ceilf(multiplier * 255.0f) / 255.0f;
+    color = glm::min(color / multiplier, glm::vec3(1.0f));
+    rgbm[i * 4 + 0] = (unsigned char)(color.x * 255.0f + 0.5f);
+    rgbm[i * 4 + 1] = (unsigned char)(color.y * 255.0f + 0.5f);
+    rgbm[i * 4 + 2] = (unsigned char)(color.z * 255.0f + 0.5f);
+    rgbm[i * 4 + 3] = (unsigned char)(multiplier * 255.0f + 0.5f);
+  }
+}
+
+} // namespace fred
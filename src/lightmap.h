@@ -0,0 +1,66 @@
+#ifndef FRED_LIGHTMAP_H
+#define FRED_LIGHTMAP_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+namespace fred {
+
+// The range RGBM lightmaps are stored over. rgb * a * LIGHTMAP_RANGE is the
+// irradiance, the LIGHTMAPPED shaders decode it the same way.
+constexpr float LIGHTMAP_RANGE = 8.0f;
+
+struct LightmapAtlasSettings {
+  int size = 1024;             // Square, in texels
+  float texelsPerUnit = 16.0f; // Where the density starts, lowered until every chart fits
+  int padding = 2;             // Empty texels around each chart, dilation fills them in
+  float chartAngle = 30.0f;    // Degrees a triangle's normal can be off its chart's
+};
+
+struct LightmapAtlasStats {
+  int charts = 0;
+  int verticesBefore = 0; // Vertices on a chart edge get split
+  int verticesAfter = 0;
+  float texelsPerUnit = 0.0f; // What it ended up at
+  float coverage = 0.0f;      // Of the atlas, charts and their padding
+};
+
+// Splits every mesh into roughly planar charts, projects each one flat and
+// packs them all into one atlas, then writes lightmapUvs. Vertices shared by
+// two charts are duplicated, so vertices, indices and submesh ranges all get
+// rebuilt. Meshes are in world space, a level is authored in place. False if
+// nothing fits even at a texel per unit.
+bool generateLightmapUvs(std::vector<MeshData> &meshes, const LightmapAtlasSettings &settings,
+                         LightmapAtlasStats &stats);
+
+// Where a texel of the atlas lands in the world
+struct LightmapTexel {
+  glm::vec3 position;
+  glm::vec3 normal;
+  bool covered = false;
+};
+
+// Every triangle rasterized into the atlas, texel centers first then any
+// texel a triangle edge passes through, so thin triangles still get some.
+// texels is size * size, row y is v = (y + 0.5) / size.
+void rasterizeLightmap(const std::vector<MeshData> &meshes, int size, std::vector<LightmapTexel> &texels);
+
+// Pushes colors from covered texels out into the empty ones around them, a
+// texel per pass, so bilinear filtering at a chart's edge doesn't pull in
+// black. covered is updated to match.
+void dilateLightmap(std::vector<glm::vec3> &colors, std::vector<bool> &covered, int size, int passes);
+
+// Irradiance to RGBM bytes, 4 per texel, ready for an image writer
+void encodeLightmapRgbm(const std::vector<glm::vec3> &colors, std::vector<unsigned char> &rgbm);
+
+// Triangles as vertex indices with baseVertex already added, for walking a
+// MeshData without caring about its index sizes
+void meshTriangles(const MeshData &mesh, std::vector<uint32_t> &triangles);
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,701 @@
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+#include <clog/clog.h>
+
+#include <SOIL2.h>
+
+#include "engine.h"
+#include "loader.h"
+#include "profiler.h"
+#include "simplify.h"
+#include "streaming.h"
+
+// EXT_texture_compression_s3tc, everywhere in practice but not core
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace fred {
+
+AssetLoader assetLoader;
+
+// Smallest piece of a buffer a model uploads in one go, so it still gets
+// somewhere with the byte budget at 0 or nearly spent
+static const size_t MIN_UPLOAD_CHUNK = 64 << 10;
+
+static std::atomic<bool> shuttingDown{false};
+
+void AssetLoader::submit(std::shared_ptr<LoadJob> job) {
+  if (!pool.isRunning()) {
+    shuttingDown = false;
+    pool.start(workerCount);
+  }
+  decoding++;
+  pool.submit([this, job] {
+    if (!job->cancelled && !shuttingDown) {
+      job->decode();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    decoded.push_back(job);
+    decoding--;
+  });
+}
+
+void AssetLoader::processUploads() {
+  double start = profilerNow();
+  size_t bytesLeft = budgetBytes;
+  bool first = true;
+  for (;;) {
+    std::shared_ptr<LoadJob> job;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (decoded.empty()) {
+        break;
+      }
+      job = decoded.front();
+    }
+
+    bool done = true;
+    if (job->cancelled) {
+      job->discard();
+    } else {
+      // First step of the frame always goes through, however big it is
+      if (!first && (bytesLeft == 0 || profilerNow() - start > budgetMs)) {
+        break;
+      }
+      first = false;
+      done = job->upload(bytesLeft);
+    }
+    if (done) {
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded.pop_front();
+      completed++;
+    }
+  }
+  bytesThisFrame = budgetBytes - bytesLeft;
+  msThisFrame = profilerNow() - start;
+}
+
+void AssetLoader::shutdown() {
+  shuttingDown = true;
+  pool.stop(); // Whatever was still queued skips its decode
+  for (std::shared_ptr<LoadJob> &job : decoded) {
+    job->discard();
+  }
+  decoded.clear();
+  decoding = 0;
+}
+
+LoaderStats AssetLoader::getStats() {
+  LoaderStats stats;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.uploading = decoded.size();
+  }
+  stats.decoding = decoding;
+  stats.completed = completed;
+  stats.bytesThisFrame = bytesThisFrame;
+  stats.msThisFrame = msThisFrame;
+  return stats;
+}
+
+// Staging ================================================================== //
+
+static GLuint pixelUnpackBuffer = 0;
+
+// Orphaning every time means an upload still in flight never holds up the
+// next one
+void stagePixels(const void *data, size_t size) {
+  if (pixelUnpackBuffer == 0) {
+    glGenBuffers(1, &pixelUnpackBuffer);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelUnpackBuffer);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (mapped != NULL) {
+    memcpy(mapped, data, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  } else {
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, data);
+  }
+}
+
+// Models =================================================================== //
+
+class ModelLoadJob : public LoadJob {
+public:
+  Model *model;
+  std::string path;
+
+  ModelLoadJob(Model *model, const std::string &path) : model(model), path(path) {}
+
+  void decode() override {
+    // Same choice as Model::load, a cooked blob if there is an up to date one
+    if (mapCookedMesh(cookedMeshPath(path).c_str(), path.c_str(), cooked)) {
+      layout = cooked.layout;
+      subMeshes.assign(cooked.subMeshes, cooked.subMeshes + cooked.header->subMeshCount);
+      lodSubMeshes.assign(cooked.subMeshes + cooked.header->subMeshCount,
+                          cooked.subMeshes + cooked.header->subMeshCount * (1 + cooked.header->lodCount));
+      bounds = cooked.header->bounds;
+      uvDensity = cooked.header->uvDensity;
+      vertexData = (const unsigned char *)cooked.vertices;
+      vertexSize = cooked.verticesSize();
+      indexData = (const unsigned char *)cooked.indices;
+      indexSize = cooked.indicesSize();
+      positionData = (const unsigned char *)cooked.positions;
+      positionSize = cooked.positionsSize();
+      return;
+    }
+    if (!importMesh(path.c_str(), mesh)) {
+      failed = true;
+      return;
+    }
+    generateLods(mesh, LodGenerationSettings());
+    interleaveVertices(mesh, layout, vertices);
+    subMeshes = mesh.subMeshes;
+    lodSubMeshes = mesh.lodSubMeshes;
+    bounds = computeBounds(mesh.positions);
+    uvDensity = computeUvDensity(mesh);
+    vertexData = vertices.data();
+    vertexSize = vertices.size();
+    indexData = mesh.indices.data();
+    indexSize = mesh.indices.size();
+    positionData = (const unsigned char *)mesh.positions.data();
+    positionSize = mesh.positions.size() * sizeof(glm::vec3);
+  }
+
+  // Buffers get their storage up front then fill a budget's worth at a time.
+  // They're bound to GL_COPY_WRITE_BUFFER so no VAO picks them up on the way.
+  bool upload(size_t &budgetBytes) override {
+    if (failed) {
+      clog_log(CLOG_LEVEL_WARN, "Model failed to load: %s\n", path.c_str());
+      return true;
+    }
+    // Vertices, indices, then the positions for depth passes
+    GLuint *buffers[3] = {&vertexBuffer, &elementBuffer, &positionBuffer};
+    const unsigned char *data[3] = {vertexData, indexData, positionData};
+    size_t sizes[3] = {vertexSize, indexSize, positionSize};
+    if (vertexBuffer == 0) {
+      for (int i = 0; i < 3; i++) {
+        glGenBuffers(1, buffers[i]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, *buffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizes[i], NULL, GL_STATIC_DRAW);
+      }
+    }
+
+    size_t total = sizes[0] + sizes[1] + sizes[2];
+    if (uploaded < total) {
+      // One chunk into whichever buffer uploaded has got to
+      int i = 0;
+      size_t offset = uploaded;
+      while (offset >= sizes[i]) {
+        offset -= sizes[i];
+        i++;
+      }
+      size_t chunk = std::min(sizes[i] - offset, std::max(budgetBytes, MIN_UPLOAD_CHUNK));
+      glBindBuffer(GL_COPY_WRITE_BUFFER, *buffers[i]);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, offset, chunk, data[i] + offset);
+      uploaded += chunk;
+      budgetBytes -= std::min(budgetBytes, chunk);
+      if (uploaded < total) {
+        return false;
+      }
+    }
+
+    model->layout = layout;
+    model->subMeshes = subMeshes;
+    model->lodSubMeshes = lodSubMeshes;
+    model->bounds = bounds;
+    model->uvDensity = uvDensity;
+    model->vertexBuffer = vertexBuffer;
+    model->elementBuffer = elementBuffer;
+    model->positionBuffer = positionBuffer;
+    model->createVertexArray();
+    model->revision++;
+    vertexBuffer = elementBuffer = positionBuffer = 0; // The model's now
+    model->pendingLoad.reset();
+    return true;
+  }
+
+  void discard() override {
+    glDeleteBuffers(1, &vertexBuffer);
+    glDeleteBuffers(1, &elementBuffer);
+    glDeleteBuffers(1, &positionBuffer);
+    vertexBuffer = elementBuffer = positionBuffer = 0;
+  }
+
+private:
+  CookedMesh cooked;
+  MeshData mesh;
+  std::vector<unsigned char> vertices;
+
+  VertexLayout layout;
+  std::vector<SubMesh> subMeshes;
+  std::vector<SubMesh> lodSubMeshes;
+  MeshBounds bounds;
+  float uvDensity = 0.0f;
+  const unsigned char *vertexData = nullptr;
+  size_t vertexSize = 0;
+  const unsigned char *indexData = nullptr;
+  size_t indexSize = 0;
+  const unsigned char *positionData = nullptr;
+  size_t positionSize = 0;
+
+  GLuint vertexBuffer = 0;
+  GLuint elementBuffer = 0;
+  GLuint positionBuffer = 0;
+  size_t uploaded = 0; // Vertices, indices then positions, in bytes
+};
+
+std::shared_ptr<LoadJob> loadModelAsync(Model *model, const std::string &path) {
+  clog_log(CLOG_LEVEL_DEBUG, "Queueing model: %s\n", path.c_str());
+  std::shared_ptr<LoadJob> job = std::make_shared<ModelLoadJob>(model, path);
+  assetLoader.submit(job);
+  return job;
+}
+
+// Textures ================================================================= //
+
+// DDS files are already block compressed, they go up as they are. Anything
+// else is decoded to RGBA8 with the mip chain built here, the blocking path's
+// runtime DXT compression is too slow to do per load.
+
+struct TextureLevel {
+  int width;
+  int height;
+  size_t offset; // Into TextureLoadJob::pixels, or the cooked file
+  size_t size;
+};
+
+// Flips the first rows rows of a DXT block, the only part of it that's image
+// when the level is less than 4 pixels tall
+static void flipDxtBlock(unsigned char *block, GLenum format, int rows) {
+  unsigned char *color = block;
+  if (format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
+    // 4 bits of alpha per pixel, 2 bytes a row
+    for (int i = 0; i < rows / 2; i++) {
+      std::swap(block[i * 2], block[(rows - 1 - i) * 2]);
+      std::swap(block[i * 2 + 1], block[(rows - 1 - i) * 2 + 1]);
+    }
+    color = block + 8;
+  } else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+    // Two endpoints then 3 bit indices, 12 bits a row
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) {
+      indices |= (uint64_t)block[2 + i] << (8 * i);
+    }
+    uint64_t flipped = indices;
+    for (int i = 0; i < rows; i++) {
+      uint64_t row = (indices >> (12 * i)) & 0xFFF;
+      flipped &= ~((uint64_t)0xFFF << (12 * (rows - 1 - i)));
+      flipped |= row << (12 * (rows - 1 - i));
+    }
+    for (int i = 0; i < 6; i++) {
+      block[2 + i] = (unsigned char)(flipped >> (8 * i));
+    }
+    color = block + 8;
+  }
+  // Two 565 endpoints then a byte of 2 bit indices per row
+  for (int i = 0; i < rows / 2; i++) {
+    std::swap(color[4 + i], color[4 + rows - 1 - i]);
+  }
+}
+
+class TextureLoadJob : public LoadJob {
+public:
+  Texture *texture;
+  std::string path;
+
+  // Decided here on the GL thread, the worker can't look at the streamer
+  TextureLoadJob(Texture *texture, const std::string &path)
+      : texture(texture), path(path), streamTail(textureStreamer.enabled ? textureStreamer.tailSize : 0) {}
+
+  void decode() override {
+    if (mapCooked()) {
+      return;
+    }
+    MappedFile file;
+    if (!file.open(path.c_str())) {
+      failed = true;
+      return;
+    }
+    if (!decodeDds(file) && !decodeImage(file)) {
+      failed = true;
+    }
+  }
+
+  // A level per step, each one staged through the PBO
+  bool upload(size_t &budgetBytes) override {
+    if (failed) {
+      clog_log(CLOG_LEVEL_WARN, "Texture failed to load: %s\n", path.c_str());
+      return true;
+    }
+    if (newTexture == 0) {
+      glGenTextures(1, &newTexture);
+      glState.bindTexture(0, newTexture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, firstLevel + (GLint)levels.size() - 1);
+    }
+
+    const TextureLevel &level = levels[nextLevel];
+    const unsigned char *source = cooked ? cooked->file.data : pixels.data();
+    stagePixels(source + level.offset, level.size);
+    glState.bindTexture(0, newTexture);
+    GLint glLevel = firstLevel + nextLevel;
+    if (compressed) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, glLevel, format, level.width, level.height, 0, level.size, (void *)0);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, glLevel, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Or ImGui's font upload reads from it
+    budgetBytes -= std::min(budgetBytes, level.size);
+    if (++nextLevel < (int)levels.size()) {
+      return false;
+    }
+
+    texture->texture = newTexture;
+    newTexture = 0;
+    texture->pendingLoad.reset();
+    if (firstLevel > 0) {
+      textureStreamer.add(texture, path, std::move(cooked), firstLevel);
+    }
+    return true;
+  }
+
+  void discard() override {
+    glDeleteTextures(1, &newTexture);
+    newTexture = 0;
+  }
+
+private:
+  bool compressed = false;
+  GLenum format = GL_RGBA8;
+  // Levels come straight out of the mapping when there is one. Streamed
+  // textures hand it on to the TextureStreamer once their tail is up.
+  std::unique_ptr<CookedTexture> cooked;
+  uint32_t streamTail; // 0 loads every level
+  int firstLevel = 0;  // GL level of levels[0]
+  std::vector<unsigned char> pixels; // Every level back to back
+  std::vector<TextureLevel> levels;
+
+  GLuint newTexture = 0;
+  int nextLevel = 0;
+
+  // Already compressed and flipped, nothing to decode. The pages get
+  // faulted in here so the main thread's copy into the PBO doesn't stall.
+  bool mapCooked() {
+    std::unique_ptr<CookedTexture> mapped(new CookedTexture());
+    if (!mapCookedTexture(cookedTexturePath(path).c_str(), path.c_str(), *mapped)) {
+      return false;
+    }
+    cooked = std::move(mapped);
+    firstLevel = streamTail > 0 ? TextureStreamer::getTailLevel(*cooked, streamTail) : 0;
+    volatile unsigned char sink = 0;
+    for (size_t i = cooked->levels[firstLevel].offset; i < cooked->file.size; i += 4096) {
+      sink = sink + cooked->file.data[i];
+    }
+    for (uint32_t i = firstLevel; i < cooked->header->levelCount; i++) {
+      const CookedTextureLevel &level = cooked->levels[i];
+      levels.push_back({(int)level.width, (int)level.height, (size_t)level.offset, (size_t)level.size});
+    }
+    format = cookedTextureFormat(cooked->format());
+    compressed = true;
+    return true;
+  }
+
+  // DXT1/3/5 only, anything else goes through decodeImage
+  bool decodeDds(const MappedFile &file) {
+    if (file.size < 128 || memcmp(file.data, "DDS ", 4) != 0) {
+      return false;
+    }
+    uint32_t header[31];
+    memcpy(header, file.data + 4, sizeof(header));
+    int height = header[2];
+    int width = header[3];
+    int mipCount = header[6] > 0 ? header[6] : 1;
+    uint32_t fourCC = header[20];
+    int blockSize = 16;
+    if (fourCC == 0x31545844) { // "DXT1"
+      format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+      blockSize = 8;
+    } else if (fourCC == 0x33545844) { // "DXT3"
+      format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+    } else if (fourCC == 0x35545844) { // "DXT5"
+      format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    } else {
+      return false;
+    }
+
+    size_t offset = 128;
+    for (int i = 0; i < mipCount && width > 0 && height > 0; i++) {
+      int blocksX = (width + 3) / 4;
+      int blocksY = (height + 3) / 4;
+      size_t size = (size_t)blocksX * blocksY * blockSize;
+      if (offset + size > file.size) {
+        break; // Truncated, keep the levels we have
+      }
+      TextureLevel level = {width, height, pixels.size(), size};
+      pixels.resize(pixels.size() + size);
+      // Block rows in reverse and each block flipped, same as SOIL_FLAG_INVERT_Y
+      size_t rowSize = (size_t)blocksX * blockSize;
+      for (int y = 0; y < blocksY; y++) {
+        unsigned char *row = &pixels[level.offset + (blocksY - 1 - y) * rowSize];
+        memcpy(row, file.data + offset + y * rowSize, rowSize);
+        for (int x = 0; x < blocksX; x++) {
+          flipDxtBlock(row + x * blockSize, format, std::min(height, 4));
+        }
+      }
+      levels.push_back(level);
+      offset += size;
+      width /= 2;
+      height /= 2;
+    }
+    if (levels.empty()) {
+      return false;
+    }
+    compressed = true;
+    return true;
+  }
+
+  bool decodeImage(const MappedFile &file) {
+    int width, height, channels;
+    unsigned char *image = SOIL_load_image_from_memory(file.data, (int)file.size, &width, &height, &channels, SOIL_LOAD_RGBA);
+    if (image == NULL) {
+      return false;
+    }
+    size_t rowSize = (size_t)width * 4;
+    TextureLevel level = {width, height, 0, rowSize * height};
+    pixels.resize(level.size);
+    for (int y = 0; y < height; y++) {
+      memcpy(&pixels[(height - 1 - y) * rowSize], image + y * rowSize, rowSize);
+    }
+    SOIL_free_image_data(image);
+    levels.push_back(level);
+
+    // Box filtered mips, edge texels repeat on odd sizes
+    while (level.width > 1 || level.height > 1) {
+      TextureLevel next = {std::max(level.width / 2, 1), std::max(level.height / 2, 1), pixels.size(), 0};
+      next.size = (size_t)next.width * next.height * 4;
+      pixels.resize(pixels.size() + next.size);
+      const unsigned char *src = &pixels[level.offset];
+      unsigned char *dst = &pixels[next.offset];
+      for (int y = 0; y < next.height; y++) {
+        int y0 = std::min(y * 2, level.height - 1);
+        int y1 = std::min(y * 2 + 1, level.height - 1);
+        for (int x = 0; x < next.width; x++) {
+          int x0 = std::min(x * 2, level.width - 1);
+          int x1 = std::min(x * 2 + 1, level.width - 1);
+          for (int c = 0; c < 4; c++) {
+            int sum = src[(y0 * level.width + x0) * 4 + c] + src[(y0 * level.width + x1) * 4 + c] +
+                      src[(y1 * level.width + x0) * 4 + c] + src[(y1 * level.width + x1) * 4 + c];
+            dst[(y * next.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+          }
+        }
+      }
+      levels.push_back(next);
+      level = next;
+    }
+    return true;
+  }
+};
+
+std::shared_ptr<LoadJob> loadTextureAsync(Texture *texture, const std::string &path) {
+  clog_log(CLOG_LEVEL_DEBUG, "Queueing texture: %s\n", path.c_str());
+  std::shared_ptr<LoadJob> job = std::make_shared<TextureLoadJob>(texture, path);
+  assetLoader.submit(job);
+  return job;
+}
+
+// Shaders ================================================================== //
+
+class ShaderLoadJob : public LoadJob {
+public:
+  Shader *shader;
+  std::string vertPath;
+  std::string fragPath;
+  std::string instancedVertPath; // Empty for none
+
+  ShaderLoadJob(Shader *shader, const std::string &vertPath, const std::string &fragPath,
+                const std::string &instancedVertPath)
+      : shader(shader), vertPath(vertPath), fragPath(fragPath), instancedVertPath(instancedVertPath) {}
+
+  ~ShaderLoadJob() {
+    free(vertCode);
+    free(fragCode);
+    free(instancedVertCode);
+  }
+
+  void decode() override {
+    vertCode = readShaderFile(vertPath.c_str());
+    fragCode = readShaderFile(fragPath.c_str());
+    if (!instancedVertPath.empty()) {
+      instancedVertCode = readShaderFile(instancedVertPath.c_str());
+      failed = instancedVertCode == NULL;
+    }
+    failed = failed || vertCode == NULL || fragCode == NULL;
+  }
+
+  // Compiling is the expensive part, so one program per step
+  bool upload(size_t &) override {
+    if (!failed && program == 0) {
+      program = compile(vertCode, vertPath);
+    } else if (!failed && instancedVertCode != NULL && instancedProgram == 0) {
+      instancedProgram = compile(instancedVertCode, instancedVertPath);
+    }
+    if (failed) {
+      clog_log(CLOG_LEVEL_WARN, "Shader failed to load: %s\n", vertPath.c_str());
+      discard();
+      return true;
+    }
+    if (instancedVertCode != NULL && instancedProgram == 0) {
+      return false;
+    }
+
+    shader->shaderProgram = program;
+    if (instancedVertCode != NULL) {
+      shader->instancedShaderProgram = instancedProgram;
+    }
+    program = instancedProgram = 0;
+    shader->pendingLoad.reset();
+    return true;
+  }
+
+  void discard() override {
+    glDeleteProgram(program);
+    glDeleteProgram(instancedProgram);
+    program = instancedProgram = 0;
+  }
+
+private:
+  char *vertCode = NULL;
+  char *fragCode = NULL;
+  char *instancedVertCode = NULL;
+
+  GLuint program = 0;
+  GLuint instancedProgram = 0;
+
+  // FrameData goes in as the defines, same as for Shader::load
+  GLuint compile(const char *code, const std::string &name) {
+    ShaderProgramSource source = {code, fragCode, name.c_str(), fragPath.c_str(), FRAME_DATA_GLSL, 0};
+    buildShaderPrograms(&source, 1);
+    GLuint compiled = source.program;
+    if (compiled == 0) {
+      failed = true;
+      return 0;
+    }
+    setupProgramInterface(compiled);
+    return compiled;
+  }
+};
+
+std::shared_ptr<LoadJob> loadShaderAsync(Shader *shader, const std::string &vertPath, const std::string &fragPath,
+                                         const std::string &instancedVertPath) {
+  clog_log(CLOG_LEVEL_DEBUG, "Queueing shader: %s\n", vertPath.c_str());
+  std::shared_ptr<LoadJob> job = std::make_shared<ShaderLoadJob>(shader, vertPath, fragPath, instancedVertPath);
+  assetLoader.submit(job);
+  return job;
+}
+
+// Placeholders ============================================================= //
+
+static Model *placeholderCube = NULL;
+static GLuint placeholderTextureName = 0;
+static GLuint placeholderPrograms[2] = {0, 0};
+
+const Model &placeholderModel() {
+  if (placeholderCube == NULL) {
+    MeshData mesh;
+    makeCubeMesh(mesh);
+    placeholderCube = new Model(mesh);
+  }
+  return *placeholderCube;
+}
+
+GLuint placeholderTexture() {
+  if (placeholderTextureName == 0) {
+    // 8x8 grey checkerboard, obviously not the real thing
+    unsigned char pixels[8 * 8 * 4];
+    for (int i = 0; i < 8 * 8; i++) {
+      unsigned char shade = ((i % 8) + (i / 8)) % 2 == 0 ? 96 : 160;
+      pixels[i * 4 + 0] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = shade;
+      pixels[i * 4 + 3] = 255;
+    }
+    glGenTextures(1, &placeholderTextureName);
+    glState.bindTexture(0, placeholderTextureName);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 8, 8, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  }
+  return placeholderTextureName;
+}
+
+static const char *placeholderVertexCode =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 vertexPosition_modelspace;\n"
+    "layout(location = 2) in vec3 vertexNormal_modelspace;\n"
+    "layout(location = 3) in mat4 instanceModel;\n"
+    "layout(std140) uniform ObjectData {\n"
+    "    mat4 m;\n"
+    "};\n"
+    "out vec3 normal_worldspace;\n"
+    "void main() {\n"
+    "#ifdef INSTANCED\n"
+    "    mat4 model = instanceModel;\n"
+    "#else\n"
+    "    mat4 model = m;\n"
+    "#endif\n"
+    "    gl_Position = vp * model * vec4(vertexPosition_modelspace, 1);\n"
+    "    normal_worldspace = mat3(model) * vertexNormal_modelspace;\n"
+    "}\n";
+
+static const char *placeholderFragmentCode =
+    "#version 330 core\n"
+    "in vec3 normal_worldspace;\n"
+    "layout(location = 0) out vec3 color;\n"
+    "void main() {\n"
+    "    float light = 0.5 + 0.3 * normalize(normal_worldspace).y;\n"
+    "    color = vec3(0.8, 0.3, 0.8) * light;\n"
+    "}\n";
+
+GLuint placeholderProgram(bool instanced) {
+  GLuint &program = placeholderPrograms[instanced ? 1 : 0];
+  if (program == 0) {
+    // FrameData comes in with the defines
+    std::string defines = std::string(instanced ? "#define INSTANCED\n" : "") + FRAME_DATA_GLSL;
+    ShaderProgramSource source = {placeholderVertexCode, placeholderFragmentCode, "placeholder.vert",
+                                  "placeholder.frag", defines.c_str(), 0};
+    buildShaderPrograms(&source, 1);
+    program = source.program;
+    setupProgramInterface(program);
+  }
+  return program;
+}
+
+void destroyPlaceholders() {
+  delete placeholderCube;
+  placeholderCube = NULL;
+  glDeleteTextures(1, &placeholderTextureName);
+  placeholderTextureName = 0;
+  for (GLuint &program : placeholderPrograms) {
+    if (program != 0) {
+      glState.forgetProgram(program);
+      glDeleteProgram(program);
+      program = 0;
+    }
+  }
+  glDeleteBuffers(1, &pixelUnpackBuffer);
+  pixelUnpackBuffer = 0;
+}
+
+} // namespace fred
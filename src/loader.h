@@ -0,0 +1,103 @@
+#ifndef FRED_LOADER_H
+#define FRED_LOADER_H
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <glad/gl.h>
+
+#include "threadpool.h"
+
+namespace fred {
+
+class Model;
+class Texture;
+class Shader;
+
+// Blocking loads are done by the time the constructor returns. Async ones
+// hand the object back straight away with a placeholder in it, the real data
+// gets swapped in a few frames later.
+enum class LoadMode { Blocking, Async };
+
+// One async load. decode() runs on a worker and does the file I/O and
+// parsing, upload() then runs on the GL thread a step at a time. Whoever owns
+// the resource sets cancelled when it goes away, the job must not touch it
+// after that.
+class LoadJob {
+public:
+  std::atomic<bool> cancelled{false};
+  bool failed = false; // Decode went wrong, the placeholder stays
+
+  virtual ~LoadJob() {}
+  virtual void decode() = 0;
+  // Takes what it copies out of budgetBytes, true once everything is up.
+  // Has to copy something even with budgetBytes at 0, it's only called then
+  // for the first step of a frame.
+  virtual bool upload(size_t &budgetBytes) = 0;
+  // GL thread, frees whatever the job made that never got handed over
+  virtual void discard() {}
+};
+
+struct LoaderStats {
+  int decoding = 0;          // Submitted, not decoded yet
+  int uploading = 0;         // Decoded, waiting on the GL thread
+  int completed = 0;         // Since startup, failures included
+  size_t bytesThisFrame = 0; // Copied towards the GPU by the last processUploads
+  double msThisFrame = 0.0;  // Spent in it
+};
+
+// Worker pool for decodes plus the GL thread side that finishes them. Uploads
+// go oldest first and stop for the frame once either budget is spent, but
+// always make some progress so a big texture can't stall forever.
+class AssetLoader {
+public:
+  double budgetMs = 2.0;
+  size_t budgetBytes = 8 << 20;
+  int workerCount = 0; // 0 is one less than the core count
+
+  // Workers start on the first submit
+  void submit(std::shared_ptr<LoadJob> job);
+  // GL thread, once a frame
+  void processUploads();
+  // GL thread, waits for the workers and drops anything unfinished
+  void shutdown();
+
+  LoaderStats getStats();
+
+private:
+  ThreadPool pool;
+  std::mutex mutex;
+  std::deque<std::shared_ptr<LoadJob>> decoded; // Guarded by mutex
+  std::atomic<int> decoding{0};
+  int completed = 0;
+  size_t bytesThisFrame = 0;
+  double msThisFrame = 0.0;
+};
+
+extern AssetLoader assetLoader;
+
+// Start async loads into resources that already have their placeholder in
+std::shared_ptr<LoadJob> loadModelAsync(Model *model, const std::string &path);
+std::shared_ptr<LoadJob> loadTextureAsync(Texture *texture, const std::string &path);
+std::shared_ptr<LoadJob> loadShaderAsync(Shader *shader, const std::string &vertPath, const std::string &fragPath,
+                                         const std::string &instancedVertPath);
+
+// GL thread. Copies data into a fresh PBO and leaves it bound to
+// GL_PIXEL_UNPACK_BUFFER, so the glTexImage that follows reads from offset 0
+// and returns without waiting for the copy to the texture. Unbind it after.
+void stagePixels(const void *data, size_t size);
+
+// Stand-ins while async loads are in flight, made on first use. GL thread,
+// never delete them, destroyPlaceholders() does.
+const Model &placeholderModel();
+GLuint placeholderTexture();
+GLuint placeholderProgram(bool instanced);
+void destroyPlaceholders();
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,93 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <imgui.h>
+
+#include "engine.h"
+#include "headless.h"
+#include "resources.h"
+
+// Userspace ================================================================ //
+
+fred::Scene scene;
+fred::Simulation simulation;
+int coneIndex;
+int suzanneIndex;
+
+// Fixed step, on a worker. Everything it moves goes through the states.
+void simulate(const fred::SimulationState &previous, fred::SimulationState &next, float dt, void *user) {
+  next.transforms[coneIndex].position.x += 0.2f * dt;
+  glm::vec3 eulerAngles = glm::eulerAngles(previous.transforms[suzanneIndex].rotation);
+  eulerAngles.x += glm::radians(20.0f) * dt;
+  next.transforms[suzanneIndex].rotation = glm::quat(eulerAngles);
+}
+
+void renderCallback() {
+  ImGui::Begin("User Render Callback");
+  ImGui::Text("Frametime (ms): %f", fred::getUnscaledDeltaTime() * 1000);
+  ImGui::Text("FPS: %f", 1/fred::getUnscaledDeltaTime());
+  ImGui::SeparatorText("Camera");
+  fred::Camera *currentCamera = scene.cameras[scene.activeCamera];
+  glm::vec3 rotationEuler = glm::degrees(eulerAngles(currentCamera->rotation));
+  ImGui::DragFloat3("Translate", (float*)&currentCamera->position, 0.01f);
+  ImGui::DragFloat3("Rotate", (float*)&rotationEuler);
+  float fovDeg = glm::degrees(currentCamera->fov);
+  ImGui::DragFloat("FOV", (float*)&fovDeg);
+  currentCamera->fov = glm::radians(fovDeg);
+  currentCamera->rotation = glm::quat(glm::radians(rotationEuler));
+  ImGui::End();
+}
+
+int main(int argc, char **argv) {
+  fred::HeadlessOptions headlessOptions;
+  if (!fred::parseHeadlessArgs(argc, argv, headlessOptions)) {
+    return 1;
+  }
+  if (headlessOptions.enabled) {
+    return fred::runHeadless(headlessOptions);
+  }
+
+  fred::initWindow();
+  fred::precompileShaderVariants("../shaders/variants.txt");
+  // Placeholders until the workers and the upload budget get through these.
+  // The cone uses the same texture twice, it's only loaded once.
+  const char *coneTexture = "../textures/texture.bmp";
+  fred::Asset cone(fred::resources.getModel("../models/model.obj"),
+                   fred::resources.getTexture(coneTexture), fred::resources.getTexture(coneTexture),
+                   fred::resources.getShaderVariant("../shaders/standard.vert", "../shaders/standard.frag", 0));
+  fred::Asset suzanne(fred::resources.getModel("../models/suzanne.obj"),
+                      fred::resources.getTexture("../textures/suzanne_albedo.png"),
+                      fred::resources.getTexture("../textures/suzanne_specular.png"),
+                      fred::resources.getShaderVariant("../shaders/standard.vert", "../shaders/standard.frag", fred::SHADER_LIT));
+
+  fred::Camera mainCamera(glm::vec3(4, 3, 3));
+  mainCamera.lookAt(glm::vec3(0, 0, 0));
+
+  scene = fred::Scene();
+
+  scene.addCamera(mainCamera);
+
+  scene.addAsset(cone);
+  scene.addAsset(suzanne);
+
+  fred::PointLight light;
+  light.position = glm::vec3(4, 4, 4);
+  scene.addLight(light);
+  scene.sun.intensity = 0.6f;
+
+  scene.setRenderCallback(renderCallback);
+
+  coneIndex = simulation.track(cone.transform);
+  suzanneIndex = simulation.track(suzanne.transform);
+  simulation.setStep(simulate);
+  scene.setSimulation(simulation);
+
+  while (!fred::shouldExit()) {
+    fred::render(scene);
+  }
+
+  simulation.finish();
+  fred::destroy();
+
+  return 0;
+}
@@ -0,0 +1,490 @@
+#include "mesh.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include <clog/clog.h>
+#include <glm/gtc/packing.hpp>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace fred {
+
+size_t MeshData::indexCount() const {
+  size_t count = 0;
+  for (const SubMesh &subMesh : subMeshes) {
+    count += subMesh.indexCount;
+  }
+  for (const SubMesh &subMesh : lodSubMeshes) {
+    count += subMesh.indexCount;
+  }
+  return count;
+}
+
+void makeCubeMesh(MeshData &mesh) {
+  uint32_t baseVertex = mesh.positions.size();
+  uint64_t indexOffset = mesh.indices.size();
+  for (int face = 0; face < 6; face++) {
+    int axis = face / 2;
+    float sign = face % 2 == 0 ? 1.0f : -1.0f;
+    glm::vec3 normal(0.0f);
+    normal[axis] = sign;
+    glm::vec3 u(0.0f), v(0.0f);
+    u[(axis + 1) % 3] = sign;
+    v[(axis + 2) % 3] = 1.0f;
+    uint16_t base = mesh.positions.size() - baseVertex;
+    glm::vec2 corners[4] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (const glm::vec2 &corner : corners) {
+      mesh.positions.push_back(0.5f * normal + (corner.x - 0.5f) * u + (corner.y - 0.5f) * v);
+      mesh.uvs.push_back(corner);
+      mesh.normals.push_back(normal);
+    }
+    uint16_t indices[6] = {base, (uint16_t)(base + 1), (uint16_t)(base + 2),
+                           base, (uint16_t)(base + 2), (uint16_t)(base + 3)};
+    mesh.indices.insert(mesh.indices.end(), (unsigned char *)indices, (unsigned char *)(indices + 6));
+  }
+  SubMesh subMesh = {indexOffset, 36, sizeof(uint16_t), baseVertex, 24};
+  mesh.subMeshes.push_back(subMesh);
+}
+
+MeshBounds computeBounds(const std::vector<glm::vec3> &positions) {
+  MeshBounds bounds;
+  bounds.min = glm::vec3(0.0f);
+  bounds.max = glm::vec3(0.0f);
+  bounds.center = glm::vec3(0.0f);
+  bounds.radius = 0.0f;
+  if (positions.empty()) {
+    return bounds;
+  }
+  bounds.min = positions[0];
+  bounds.max = positions[0];
+  for (const glm::vec3 &position : positions) {
+    bounds.min = glm::min(bounds.min, position);
+    bounds.max = glm::max(bounds.max, position);
+  }
+  // Not the tightest sphere, but stable and only one more pass
+  bounds.center = (bounds.min + bounds.max) * 0.5f;
+  float radiusSquared = 0.0f;
+  for (const glm::vec3 &position : positions) {
+    glm::vec3 offset = position - bounds.center;
+    radiusSquared = glm::max(radiusSquared, glm::dot(offset, offset));
+  }
+  bounds.radius = sqrtf(radiusSquared);
+  return bounds;
+}
+
+float computeUvDensity(const MeshData &mesh) {
+  if (mesh.uvs.size() != mesh.positions.size()) {
+    return 0.0f;
+  }
+  double uvArea = 0.0;
+  double surfaceArea = 0.0;
+  for (const SubMesh &subMesh : mesh.subMeshes) {
+    const unsigned char *indices = mesh.indices.data() + subMesh.indexOffset;
+    for (uint32_t i = 0; i + 2 < subMesh.indexCount; i += 3) {
+      uint32_t corner[3];
+      for (int k = 0; k < 3; k++) {
+        if (subMesh.indexSize == sizeof(uint16_t)) {
+          uint16_t index;
+          memcpy(&index, indices + (i + k) * sizeof(uint16_t), sizeof(index));
+          corner[k] = subMesh.baseVertex + index;
+        } else {
+          uint32_t index;
+          memcpy(&index, indices + (i + k) * sizeof(uint32_t), sizeof(index));
+          corner[k] = subMesh.baseVertex + index;
+        }
+      }
+      glm::vec3 edge1 = mesh.positions[corner[1]] - mesh.positions[corner[0]];
+      glm::vec3 edge2 = mesh.positions[corner[2]] - mesh.positions[corner[0]];
+      glm::vec2 uv1 = mesh.uvs[corner[1]] - mesh.uvs[corner[0]];
+      glm::vec2 uv2 = mesh.uvs[corner[2]] - mesh.uvs[corner[0]];
+      surfaceArea += glm::length(glm::cross(edge1, edge2)) * 0.5;
+      uvArea += fabsf(uv1.x * uv2.y - uv1.y * uv2.x) * 0.5;
+    }
+  }
+  return surfaceArea > 0.0 ? (float)sqrt(uvArea / surfaceArea) : 0.0f;
+}
+
+template <typename Index>
+static void appendIndices(const aiMesh *aMesh, std::vector<unsigned char> &indices) {
+  size_t offset = indices.size();
+  indices.resize(offset + aMesh->mNumFaces * 3 * sizeof(Index));
+  Index *out = (Index *)&indices[offset];
+  for (unsigned int i = 0; i < aMesh->mNumFaces; i++) {
+    *out++ = (Index)aMesh->mFaces[i].mIndices[0];
+    *out++ = (Index)aMesh->mFaces[i].mIndices[1];
+    *out++ = (Index)aMesh->mFaces[i].mIndices[2];
+  }
+}
+
+bool importMesh(const char *path, MeshData &mesh) {
+  clog_log(CLOG_LEVEL_DEBUG, "Loading model: %s\n", path);
+  Assimp::Importer importer;
+
+  const aiScene *scene = importer.ReadFile(
+      path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices |
+                aiProcess_SortByPType);
+  if (!scene) {
+    clog_log(CLOG_LEVEL_ERROR, "%s\n", importer.GetErrorString());
+    return false;
+  }
+
+  // Node transforms are ignored, every mesh lands in model space as is
+  for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+    const aiMesh *aMesh = scene->mMeshes[m];
+    if (aMesh->mPrimitiveTypes != aiPrimitiveType_TRIANGLE) {
+      continue; // SortByPType split the points and lines out, we don't draw them
+    }
+
+    SubMesh subMesh;
+    subMesh.baseVertex = (uint32_t)mesh.positions.size();
+    subMesh.vertexCount = aMesh->mNumVertices;
+    subMesh.indexCount = aMesh->mNumFaces * 3;
+    subMesh.indexSize = aMesh->mNumVertices <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+    // 32 bit ranges have to be 4 byte aligned, pad after any odd 16 bit one
+    mesh.indices.resize((mesh.indices.size() + subMesh.indexSize - 1) & ~(size_t)(subMesh.indexSize - 1), 0);
+    subMesh.indexOffset = mesh.indices.size();
+
+    for (unsigned int i = 0; i < aMesh->mNumVertices; i++) {
+      aiVector3D pos = aMesh->mVertices[i];
+      mesh.positions.push_back(glm::vec3(pos.x, pos.y, pos.z));
+    }
+
+    for (unsigned int i = 0; i < aMesh->mNumVertices; i++) {
+      if (!aMesh->HasTextureCoords(0)) {
+        mesh.uvs.push_back(glm::vec2(0.0f, 0.0f));
+        continue;
+      }
+      aiVector3D UVW = aMesh->mTextureCoords[0][i]; // Multiple UVs? Prepsterous!
+      mesh.uvs.push_back(glm::vec2(UVW.x, UVW.y));
+    }
+
+    for (unsigned int i = 0; i < aMesh->mNumVertices; i++) {
+      if (!aMesh->HasNormals()) {
+        mesh.normals.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+        continue;
+      }
+      aiVector3D normal = aMesh->mNormals[i];
+      mesh.normals.push_back(glm::vec3(normal.x, normal.y, normal.z));
+    }
+
+    if (subMesh.indexSize == sizeof(uint16_t)) {
+      appendIndices<uint16_t>(aMesh, mesh.indices);
+    } else {
+      appendIndices<uint32_t>(aMesh, mesh.indices);
+    }
+    mesh.subMeshes.push_back(subMesh);
+  }
+
+  if (mesh.subMeshes.empty()) {
+    clog_log(CLOG_LEVEL_ERROR, "%s has no triangle meshes\n", path);
+    return false;
+  }
+  return true;
+}
+
+void interleaveVertices(const MeshData &mesh, const VertexLayout &layout,
+                        std::vector<unsigned char> &vertices) {
+  const uint32_t stride = layout.stride();
+  vertices.assign(mesh.positions.size() * stride, 0);
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    unsigned char *vertex = &vertices[i * stride];
+    memcpy(vertex + layout.positionOffset(), &mesh.positions[i], sizeof(glm::vec3));
+
+    if (layout.uvFormat == UvFormat::Half) {
+      uint32_t uv = glm::packHalf2x16(mesh.uvs[i]); // x in the low half, like GL wants
+      memcpy(vertex + layout.uvOffset(), &uv, sizeof(uv));
+    } else {
+      memcpy(vertex + layout.uvOffset(), &mesh.uvs[i], sizeof(glm::vec2));
+    }
+
+    if (layout.normalFormat == NormalFormat::Packed1010102) {
+      uint32_t normal = glm::packSnorm3x10_1x2(glm::vec4(glm::normalize(mesh.normals[i]), 0.0f));
+      memcpy(vertex + layout.normalOffset(), &normal, sizeof(normal));
+    } else {
+      memcpy(vertex + layout.normalOffset(), &mesh.normals[i], sizeof(glm::vec3));
+    }
+
+    if (layout.lightmapUvs && i < mesh.lightmapUvs.size()) {
+      memcpy(vertex + layout.lightmapUvOffset(), &mesh.lightmapUvs[i], sizeof(glm::vec2));
+    }
+  }
+}
+
+// MappedFile =============================================================== //
+
+#ifdef _WIN32
+bool MappedFile::open(const char *path) {
+  close();
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    CloseHandle(file);
+    return false;
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  fileHandle = file;
+  mappingHandle = mapping;
+  data = (const unsigned char *)view;
+  size = (size_t)fileSize.QuadPart;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data != nullptr) {
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mappingHandle);
+    CloseHandle((HANDLE)fileHandle);
+  }
+  data = nullptr;
+  size = 0;
+  fileHandle = nullptr;
+  mappingHandle = nullptr;
+}
+#else
+bool MappedFile::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *view = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // The mapping keeps its own reference
+  if (view == MAP_FAILED) {
+    return false;
+  }
+  data = (const unsigned char *)view;
+  size = (size_t)fileStat.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (data != nullptr) {
+    munmap((void *)data, size);
+  }
+  data = nullptr;
+  size = 0;
+}
+#endif
+
+// Cooked meshes ============================================================ //
+
+std::string cookedMeshPath(const std::string &sourcePath) {
+  size_t dot = sourcePath.find_last_of('.');
+  size_t slash = sourcePath.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return sourcePath + COOKED_MESH_EXTENSION;
+  }
+  return sourcePath.substr(0, dot) + COOKED_MESH_EXTENSION;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + COOKED_MESH_ALIGNMENT - 1) & ~(COOKED_MESH_ALIGNMENT - 1);
+}
+
+static bool writeSection(FILE *file, uint64_t offset, const void *data,
+                         size_t size) {
+  if (fseek(file, (long)offset, SEEK_SET) != 0) {
+    return false;
+  }
+  return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+// One past the largest index in the range, so under vertexCount means every
+// index is inside the submesh
+static uint32_t indexBound(const MeshData &mesh, const SubMesh &subMesh) {
+  const unsigned char *indices = &mesh.indices[subMesh.indexOffset];
+  uint32_t bound = 0;
+  for (uint32_t i = 0; i < subMesh.indexCount; i++) {
+    uint32_t index;
+    if (subMesh.indexSize == sizeof(uint16_t)) {
+      uint16_t shortIndex;
+      memcpy(&shortIndex, indices + i * sizeof(uint16_t), sizeof(shortIndex));
+      index = shortIndex;
+    } else {
+      memcpy(&index, indices + i * sizeof(uint32_t), sizeof(index));
+    }
+    bound = std::max(bound, index + 1);
+  }
+  return bound;
+}
+
+bool writeCookedMesh(const char *path, const MeshData &mesh, const VertexLayout &layout) {
+  std::vector<unsigned char> vertices;
+  interleaveVertices(mesh, layout, vertices);
+
+  CookedMeshHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COOKED_MESH_MAGIC, sizeof(header.magic));
+  header.version = COOKED_MESH_VERSION;
+  header.vertexCount = (uint32_t)mesh.positions.size();
+  header.indexCount = (uint32_t)mesh.indexCount();
+  header.uvFormat = (uint32_t)layout.uvFormat;
+  header.normalFormat = (uint32_t)layout.normalFormat;
+  header.lightmapUvs = layout.lightmapUvs ? 1 : 0;
+  header.vertexStride = layout.stride();
+  header.subMeshCount = (uint32_t)mesh.subMeshes.size();
+  header.lodCount = (uint32_t)mesh.lodCount() - 1;
+  header.uvDensity = computeUvDensity(mesh);
+  header.bounds = computeBounds(mesh.positions);
+  header.indicesSize = mesh.indices.size();
+
+  header.subMeshesOffset = alignOffset(sizeof(header));
+  std::vector<SubMesh> subMeshes = mesh.subMeshes;
+  subMeshes.insert(subMeshes.end(), mesh.lodSubMeshes.begin(), mesh.lodSubMeshes.end());
+  header.verticesOffset = alignOffset(header.subMeshesOffset + subMeshes.size() * sizeof(SubMesh));
+  header.indicesOffset = alignOffset(header.verticesOffset + vertices.size());
+  header.positionsOffset = alignOffset(header.indicesOffset + mesh.indices.size());
+  header.indexBoundsOffset = alignOffset(header.positionsOffset + mesh.positions.size() * sizeof(glm::vec3));
+  header.fileSize = header.indexBoundsOffset + subMeshes.size() * sizeof(uint32_t);
+
+  // Checked here once so loading doesn't have to read every index
+  std::vector<uint32_t> indexBounds(subMeshes.size());
+  for (size_t i = 0; i < subMeshes.size(); i++) {
+    indexBounds[i] = indexBound(mesh, subMeshes[i]);
+    if (indexBounds[i] > subMeshes[i].vertexCount) {
+      clog_log(CLOG_LEVEL_ERROR, "Mesh for \"%s\" has an index past its submesh's vertices\n", path);
+      return false;
+    }
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to open \"%s\" for writing\n", path);
+    return false;
+  }
+  // Sections are padded with zeros by seeking past the end, no gaps to fill
+  bool ok = writeSection(file, 0, &header, sizeof(header)) &&
+            writeSection(file, header.subMeshesOffset, subMeshes.data(), subMeshes.size() * sizeof(SubMesh)) &&
+            writeSection(file, header.verticesOffset, vertices.data(), vertices.size()) &&
+            writeSection(file, header.indicesOffset, mesh.indices.data(), mesh.indices.size()) &&
+            writeSection(file, header.positionsOffset, mesh.positions.data(),
+                         mesh.positions.size() * sizeof(glm::vec3)) &&
+            writeSection(file, header.indexBoundsOffset, indexBounds.data(), indexBounds.size() * sizeof(uint32_t));
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to write cooked mesh \"%s\"\n", path);
+    remove(path);
+  }
+  return ok;
+}
+
+static bool sectionInBounds(uint64_t offset, uint64_t size, uint64_t fileSize) {
+  return offset % COOKED_MESH_ALIGNMENT == 0 && offset <= fileSize && size <= fileSize - offset;
+}
+
+bool mapCookedMesh(const char *path, const char *sourcePath, CookedMesh &mesh) {
+  struct stat cookedStat;
+  if (stat(path, &cookedStat) != 0) {
+    return false; // Not cooked, not an error
+  }
+  struct stat sourceStat;
+  if (sourcePath != NULL && stat(sourcePath, &sourceStat) == 0 &&
+      sourceStat.st_mtime > cookedStat.st_mtime) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked mesh \"%s\" is older than its source, ignoring it\n", path);
+    return false;
+  }
+
+  if (!mesh.file.open(path)) {
+    clog_log(CLOG_LEVEL_WARN, "Failed to map cooked mesh \"%s\"\n", path);
+    return false;
+  }
+
+  const CookedMeshHeader *header = (const CookedMeshHeader *)mesh.file.data;
+  if (mesh.file.size < sizeof(CookedMeshHeader) ||
+      memcmp(header->magic, COOKED_MESH_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != COOKED_MESH_VERSION ||
+      header->fileSize != mesh.file.size) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked mesh \"%s\" is invalid or out of date, recook it\n", path);
+    mesh.file.close();
+    return false;
+  }
+
+  VertexLayout layout;
+  layout.uvFormat = (UvFormat)header->uvFormat;
+  layout.normalFormat = (NormalFormat)header->normalFormat;
+  layout.lightmapUvs = header->lightmapUvs != 0;
+  if (header->uvFormat > (uint32_t)UvFormat::Half ||
+      header->normalFormat > (uint32_t)NormalFormat::Packed1010102 || header->lightmapUvs > 1 ||
+      header->vertexStride != layout.stride()) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked mesh \"%s\" has an unknown vertex layout\n", path);
+    mesh.file.close();
+    return false;
+  }
+
+  uint64_t fileSize = mesh.file.size;
+  uint64_t subMeshCount = (uint64_t)header->subMeshCount * (1 + (uint64_t)header->lodCount);
+  if (header->lodCount >= MAX_LODS ||
+      !sectionInBounds(header->subMeshesOffset, subMeshCount * sizeof(SubMesh), fileSize) ||
+      !sectionInBounds(header->verticesOffset, (uint64_t)header->vertexCount * header->vertexStride, fileSize) ||
+      !sectionInBounds(header->indicesOffset, header->indicesSize, fileSize) ||
+      !sectionInBounds(header->positionsOffset, (uint64_t)header->vertexCount * sizeof(glm::vec3), fileSize) ||
+      !sectionInBounds(header->indexBoundsOffset, subMeshCount * sizeof(uint32_t), fileSize)) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked mesh \"%s\" is truncated\n", path);
+    mesh.file.close();
+    return false;
+  }
+
+  // Bad ranges or indices would have the GPU reading past the end of the
+  // buffers. The cooker found each range's largest index, so checking that
+  // stands in for reading them all.
+  const SubMesh *subMeshes = (const SubMesh *)(mesh.file.data + header->subMeshesOffset);
+  const uint32_t *indexBounds = (const uint32_t *)(mesh.file.data + header->indexBoundsOffset);
+  for (uint64_t i = 0; i < subMeshCount; i++) {
+    const SubMesh &subMesh = subMeshes[i];
+    if ((subMesh.indexSize != sizeof(uint16_t) && subMesh.indexSize != sizeof(uint32_t)) ||
+        subMesh.indexOffset % subMesh.indexSize != 0 ||
+        subMesh.indexOffset > header->indicesSize ||
+        (uint64_t)subMesh.indexCount * subMesh.indexSize > header->indicesSize - subMesh.indexOffset ||
+        (uint64_t)subMesh.baseVertex + subMesh.vertexCount > header->vertexCount ||
+        indexBounds[i] > subMesh.vertexCount) {
+      clog_log(CLOG_LEVEL_WARN, "Cooked mesh \"%s\" has a bad submesh range\n", path);
+      mesh.file.close();
+      return false;
+    }
+  }
+
+  mesh.header = header;
+  mesh.layout = layout;
+  mesh.subMeshes = subMeshes;
+  mesh.vertices = mesh.file.data + header->verticesOffset;
+  mesh.indices = mesh.file.data + header->indicesOffset;
+  mesh.positions = (const glm::vec3 *)(mesh.file.data + header->positionsOffset);
+  clog_log(CLOG_LEVEL_DEBUG, "Mapped cooked mesh: %s\n", path);
+  return true;
+}
+
+} // namespace fred
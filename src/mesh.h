@@ -0,0 +1,191 @@
+#ifndef FRED_MESH_H
+#define FRED_MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace fred {
+
+// One Assimp mesh inside a merged vertex/index buffer pair. Indices are
+// relative to baseVertex, so anything under 65537 vertices gets 16 bit ones.
+// Fixed size fields since this goes into the cooked blob as is.
+struct SubMesh {
+  uint64_t indexOffset; // Bytes into the index buffer
+  uint32_t indexCount;
+  uint32_t indexSize;   // 2 or 4 bytes
+  uint32_t baseVertex;
+  uint32_t vertexCount;
+};
+
+// CPU side copy of a model, straight out of Assimp. Every submesh shares the
+// vertex arrays and the index buffer, see the SubMesh ranges.
+struct MeshData {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec2> lightmapUvs; // Empty unless fred-bake made some
+  std::vector<unsigned char> indices; // Mixed 16 and 32 bit, per SubMesh
+  std::vector<SubMesh> subMeshes;
+  // Simplified copies of subMeshes, a whole set per LOD from 1 down. Same
+  // vertices, just fewer of them indexed, see generateLods.
+  std::vector<SubMesh> lodSubMeshes;
+
+  size_t indexCount() const; // All of them, LODs included
+  int lodCount() const { return subMeshes.empty() ? 1 : 1 + (int)(lodSubMeshes.size() / subMeshes.size()); }
+};
+
+// LOD 0 is the mesh as authored
+constexpr int MAX_LODS = 4;
+
+bool importMesh(const char *path, MeshData &mesh);
+// Unit cube around the origin, four vertices a face so the normals stay flat.
+// Appends to mesh as one more submesh.
+void makeCubeMesh(MeshData &mesh);
+
+// Model space bounds, worked out once at import or cook time. Floats only, so
+// it goes into the cooked blob as is.
+struct MeshBounds {
+  glm::vec3 min; // AABB
+  glm::vec3 max;
+  glm::vec3 center; // Sphere, centered on the AABB
+  float radius;
+};
+
+MeshBounds computeBounds(const std::vector<glm::vec3> &positions);
+// UV units per model space unit, the square root of LOD 0's total UV area
+// over its surface area. Texture streaming works out mip levels from it.
+// 0 without UVs.
+float computeUvDensity(const MeshData &mesh);
+
+// Interleaved vertex layout ================================================ //
+// Positions are always 3 floats, UVs and normals can be squashed down to cut
+// vertex bandwidth. Compact is 20 bytes a vertex instead of 32. Baked meshes
+// carry a second set of UVs into the lightmap atlas after the normal.
+
+enum class UvFormat : uint32_t {
+  Float, // 2x GL_FLOAT
+  Half,  // 2x GL_HALF_FLOAT
+};
+
+enum class NormalFormat : uint32_t {
+  Float,         // 3x GL_FLOAT
+  Packed1010102, // GL_INT_2_10_10_10_REV, normalized
+};
+
+struct VertexLayout {
+  UvFormat uvFormat = UvFormat::Float;
+  NormalFormat normalFormat = NormalFormat::Float;
+  bool lightmapUvs = false; // Always 2 floats, half isn't enough for a big atlas
+
+  static VertexLayout compact() {
+    VertexLayout layout;
+    layout.uvFormat = UvFormat::Half;
+    layout.normalFormat = NormalFormat::Packed1010102;
+    return layout;
+  }
+
+  uint32_t uvSize() const { return uvFormat == UvFormat::Half ? 2 * sizeof(uint16_t) : sizeof(glm::vec2); }
+  uint32_t normalSize() const { return normalFormat == NormalFormat::Packed1010102 ? sizeof(uint32_t) : sizeof(glm::vec3); }
+
+  uint32_t positionOffset() const { return 0; }
+  uint32_t uvOffset() const { return sizeof(glm::vec3); }
+  uint32_t normalOffset() const { return uvOffset() + uvSize(); }
+  uint32_t lightmapUvOffset() const { return normalOffset() + normalSize(); }
+  uint32_t stride() const { return lightmapUvOffset() + (lightmapUvs ? sizeof(glm::vec2) : 0); }
+
+  bool operator==(const VertexLayout &other) const {
+    return uvFormat == other.uvFormat && normalFormat == other.normalFormat && lightmapUvs == other.lightmapUvs;
+  }
+  bool operator!=(const VertexLayout &other) const { return !(*this == other); }
+};
+
+void interleaveVertices(const MeshData &mesh, const VertexLayout &layout,
+                        std::vector<unsigned char> &vertices);
+
+// Cooked mesh blob ========================================================= //
+// Everything the GPU buffers want, in the order they want it. The file is
+// mmapped and the sections go straight to glBufferData, no parsing involved.
+// Anything that would need a pass over the data at load, the depth pass's
+// positions and checking indices, is done by the cooker and written out.
+// Bump the version whenever the layout changes, old blobs get ignored.
+
+constexpr char COOKED_MESH_MAGIC[4] = {'F', 'M', 'S', 'H'};
+constexpr uint32_t COOKED_MESH_VERSION = 8;
+constexpr uint64_t COOKED_MESH_ALIGNMENT = 16;
+constexpr const char *COOKED_MESH_EXTENSION = ".fmesh";
+
+struct CookedMeshHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t uvFormat;     // UvFormat
+  uint32_t normalFormat; // NormalFormat
+  uint32_t lightmapUvs;  // 1 if the vertices have them
+  uint32_t vertexStride;
+  uint32_t subMeshCount;
+  uint32_t lodCount;     // Past LOD 0, each another subMeshCount SubMeshes
+  float uvDensity;       // See computeUvDensity
+  uint32_t reserved;
+  MeshBounds bounds;
+  uint64_t indicesSize;    // In bytes, index sizes are mixed
+  // Byte offsets from the start of the file
+  uint64_t subMeshesOffset;   // SubMesh[subMeshCount * (1 + lodCount)], LOD 0 first
+  uint64_t verticesOffset;    // Interleaved, vertexStride * vertexCount
+  uint64_t indicesOffset;     // See the SubMesh ranges
+  uint64_t positionsOffset;   // vec3 * vertexCount, tightly packed for depth passes
+  uint64_t indexBoundsOffset; // uint32_t per SubMesh, one past its largest index
+  uint64_t fileSize;
+};
+
+class MappedFile {
+public:
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { close(); }
+
+  bool open(const char *path);
+  void close();
+
+private:
+#ifdef _WIN32
+  void *fileHandle = nullptr;
+  void *mappingHandle = nullptr;
+#endif
+};
+
+// Non owning views into a mapped blob, valid for as long as file is
+class CookedMesh {
+public:
+  MappedFile file;
+  const CookedMeshHeader *header = nullptr;
+  VertexLayout layout;
+
+  const SubMesh *subMeshes = nullptr; // LOD 0, then the rest straight after
+  const void *vertices = nullptr;
+  const void *indices = nullptr;
+  const glm::vec3 *positions = nullptr;
+
+  size_t verticesSize() const { return (size_t)header->vertexCount * header->vertexStride; }
+  size_t indicesSize() const { return header->indicesSize; }
+  size_t positionsSize() const { return (size_t)header->vertexCount * sizeof(glm::vec3); }
+};
+
+// models/teapot.obj -> models/teapot.fmesh
+std::string cookedMeshPath(const std::string &sourcePath);
+
+bool writeCookedMesh(const char *path, const MeshData &mesh, const VertexLayout &layout);
+// sourcePath is optional, if given a blob older than its source is rejected
+bool mapCookedMesh(const char *path, const char *sourcePath, CookedMesh &mesh);
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,433 @@
+#include "occlusion.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "jobs.h"
+
+#if defined(__AVX__)
+#define FRED_OCCLUSION_AVX 1
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRED_OCCLUSION_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace fred {
+
+// Below this the tiles aren't worth handing out
+static constexpr int PARALLEL_MIN_TRIANGLES = 256;
+
+void makeOccluder(const MeshData &mesh, OccluderMesh &occluder, int lod) {
+  int lodCount = mesh.lodCount();
+  lod = lod < 0 || lod >= lodCount ? lodCount - 1 : lod;
+  const SubMesh *subMeshes = lod == 0 ? mesh.subMeshes.data() : &mesh.lodSubMeshes[(lod - 1) * mesh.subMeshes.size()];
+
+  // Only the vertices that LOD still uses
+  occluder.positions.clear();
+  occluder.indices.clear();
+  std::vector<uint32_t> remap(mesh.positions.size(), UINT32_MAX);
+  for (size_t i = 0; i < mesh.subMeshes.size(); i++) {
+    const SubMesh &subMesh = subMeshes[i];
+    const unsigned char *indices = mesh.indices.data() + subMesh.indexOffset;
+    for (uint32_t j = 0; j < subMesh.indexCount; j++) {
+      uint32_t index;
+      if (subMesh.indexSize == sizeof(uint16_t)) {
+        uint16_t shortIndex;
+        memcpy(&shortIndex, indices + j * sizeof(uint16_t), sizeof(uint16_t));
+        index = shortIndex;
+      } else {
+        memcpy(&index, indices + j * sizeof(uint32_t), sizeof(uint32_t));
+      }
+      index += subMesh.baseVertex;
+      if (remap[index] == UINT32_MAX) {
+        remap[index] = occluder.positions.size();
+        occluder.positions.push_back(mesh.positions[index]);
+      }
+      occluder.indices.push_back(remap[index]);
+    }
+  }
+
+  MeshBounds bounds = computeBounds(occluder.positions);
+  occluder.bounds = {bounds.min, bounds.max};
+}
+
+// Rasterizing ============================================================== //
+
+struct ScalarLanes {
+  typedef float Vec;
+  typedef bool Mask;
+  static constexpr int WIDTH = 1;
+
+  static Vec load(const float *values) { return *values; }
+  static void store(float *values, Vec value) { *values = value; }
+  static Vec set(float value) { return value; }
+  static Vec centers() { return 0.5f; }
+  static Vec add(Vec a, Vec b) { return a + b; }
+  static Vec mul(Vec a, Vec b) { return a * b; }
+  static Vec min(Vec a, Vec b) { return a < b ? a : b; }
+  static Mask inside(Vec a, Vec b, Vec c) { return a >= 0.0f && b >= 0.0f && c >= 0.0f; }
+  static Mask greaterEqual(Vec a, Vec b) { return a >= b; }
+  static Vec select(Mask mask, Vec a, Vec b) { return mask ? a : b; }
+  static bool any(Mask mask) { return mask; }
+};
+
+#ifdef FRED_OCCLUSION_SSE
+struct SseLanes {
+  typedef __m128 Vec;
+  typedef __m128 Mask;
+  static constexpr int WIDTH = 4;
+
+  static Vec load(const float *values) { return _mm_loadu_ps(values); }
+  static void store(float *values, Vec value) { _mm_storeu_ps(values, value); }
+  static Vec set(float value) { return _mm_set1_ps(value); }
+  static Vec centers() { return _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); }
+  static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+  static Vec min(Vec a, Vec b) { return _mm_min_ps(a, b); }
+  static Mask inside(Vec a, Vec b, Vec c) {
+    Vec zero = _mm_setzero_ps();
+    return _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)), _mm_cmpge_ps(c, zero));
+  }
+  static Mask greaterEqual(Vec a, Vec b) { return _mm_cmpge_ps(a, b); }
+  // No blendv before SSE 4.1
+  static Vec select(Mask mask, Vec a, Vec b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+  static bool any(Mask mask) { return _mm_movemask_ps(mask) != 0; }
+};
+#endif
+
+#ifdef FRED_OCCLUSION_AVX
+struct AvxLanes {
+  typedef __m256 Vec;
+  typedef __m256 Mask;
+  static constexpr int WIDTH = 8;
+
+  static Vec load(const float *values) { return _mm256_loadu_ps(values); }
+  static void store(float *values, Vec value) { _mm256_storeu_ps(values, value); }
+  static Vec set(float value) { return _mm256_set1_ps(value); }
+  static Vec centers() { return _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f); }
+  static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+  static Vec min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+  static Mask inside(Vec a, Vec b, Vec c) {
+    Vec zero = _mm256_setzero_ps();
+    return _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_GE_OQ), _mm256_cmp_ps(b, zero, _CMP_GE_OQ)),
+                         _mm256_cmp_ps(c, zero, _CMP_GE_OQ));
+  }
+  static Mask greaterEqual(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+  static Vec select(Mask mask, Vec a, Vec b) { return _mm256_blendv_ps(b, a, mask); }
+  static bool any(Mask mask) { return _mm256_movemask_ps(mask) != 0; }
+};
+#endif
+
+// One triangle over a rectangle of pixels, every row starting on a multiple
+// of WIDTH. Tiles start on one too, so rows never spill into the next tile.
+template <class L>
+static void rasterizeLanes(const OcclusionTriangle &triangle, float *depth, int minX, int maxX, int minY, int maxY) {
+  typedef typename L::Vec Vec;
+  Vec centers = L::centers();
+  Vec edgeA[3];
+  for (int i = 0; i < 3; i++) {
+    edgeA[i] = L::set(triangle.edgeA[i]);
+  }
+  Vec depthA = L::set(triangle.depthA);
+  minX -= minX % L::WIDTH;
+
+  for (int y = minY; y <= maxY; y++) {
+    float centerY = y + 0.5f;
+    Vec edgeRow[3];
+    for (int i = 0; i < 3; i++) {
+      edgeRow[i] = L::set(triangle.edgeB[i] * centerY + triangle.edgeC[i]);
+    }
+    Vec depthRow = L::set(triangle.depthB * centerY + triangle.depthC);
+    float *row = depth + y * OCCLUSION_WIDTH;
+    for (int x = minX; x <= maxX; x += L::WIDTH) {
+      Vec centerX = L::add(L::set((float)x), centers);
+      Vec edge0 = L::add(L::mul(edgeA[0], centerX), edgeRow[0]);
+      Vec edge1 = L::add(L::mul(edgeA[1], centerX), edgeRow[1]);
+      Vec edge2 = L::add(L::mul(edgeA[2], centerX), edgeRow[2]);
+      Vec z = L::add(L::mul(depthA, centerX), depthRow);
+      Vec existing = L::load(row + x);
+      L::store(row + x, L::select(L::inside(edge0, edge1, edge2), L::min(existing, z), existing));
+    }
+  }
+}
+
+// Whether any of count depths is at or behind boxDepth
+template <class L> static bool anyFarther(const float *depth, int count, float boxDepth) {
+  typename L::Vec limit = L::set(boxDepth);
+  int x = 0;
+  for (; x + L::WIDTH <= count; x += L::WIDTH) {
+    if (L::any(L::greaterEqual(L::load(depth + x), limit))) {
+      return true;
+    }
+  }
+  for (; x < count; x++) {
+    if (depth[x] >= boxDepth) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *OcclusionBuffer::getSimdName() {
+#if defined(FRED_OCCLUSION_AVX)
+  return "AVX";
+#elif defined(FRED_OCCLUSION_SSE)
+  return "SSE";
+#else
+  return "scalar";
+#endif
+}
+
+void OcclusionBuffer::begin(const glm::mat4 &viewProjectionI) {
+  viewProjection = viewProjectionI;
+  depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+  blockMax.assign(OCCLUSION_BLOCKS_X * OCCLUSION_BLOCKS_Y, 1.0f);
+  triangles.clear();
+  for (std::vector<uint32_t> &bin : bins) {
+    bin.clear();
+  }
+  stats = OcclusionStats();
+}
+
+void OcclusionBuffer::addOccluder(const OccluderMesh &mesh, const glm::mat4 &model) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  glm::mat4 modelViewProjection = viewProjection * model;
+  clipPositions.resize(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); i++) {
+    clipPositions[i] = modelViewProjection * glm::vec4(mesh.positions[i], 1.0f);
+  }
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    addTriangle(clipPositions[mesh.indices[i]], clipPositions[mesh.indices[i + 1]], clipPositions[mesh.indices[i + 2]]);
+  }
+  stats.occluders++;
+  stats.rasterMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void OcclusionBuffer::addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c) {
+  // Entirely past one side, near is dealt with below
+  for (int axis = 0; axis < 3; axis++) {
+    if (a[axis] > a.w && b[axis] > b.w && c[axis] > c.w) {
+      return;
+    }
+    if (axis < 2 && a[axis] < -a.w && b[axis] < -b.w && c[axis] < -c.w) {
+      return;
+    }
+  }
+  const glm::vec4 *vertices[3] = {&a, &b, &c};
+  float distances[3]; // To the near plane, z >= -w is in front of it
+  int inFront = 0;
+  for (int i = 0; i < 3; i++) {
+    distances[i] = vertices[i]->z + vertices[i]->w;
+    inFront += distances[i] >= 0.0f;
+  }
+  if (inFront == 3) {
+    setupTriangle(a, b, c);
+    return;
+  }
+  if (inFront == 0) {
+    return;
+  }
+
+  // Sutherland-Hodgman against the one plane, a triangle or a quad comes out
+  glm::vec4 polygon[4];
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    int next = (i + 1) % 3;
+    if (distances[i] >= 0.0f) {
+      polygon[count++] = *vertices[i];
+    }
+    if ((distances[i] >= 0.0f) != (distances[next] >= 0.0f)) {
+      float t = distances[i] / (distances[i] - distances[next]);
+      polygon[count++] = *vertices[i] + (*vertices[next] - *vertices[i]) * t;
+    }
+  }
+  for (int i = 1; i + 1 < count; i++) {
+    setupTriangle(polygon[0], polygon[i], polygon[i + 1]);
+  }
+}
+
+void OcclusionBuffer::setupTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c) {
+  const glm::vec4 *clip[3] = {&a, &b, &c};
+  float x[3], y[3], z[3];
+  for (int i = 0; i < 3; i++) {
+    float inverseW = 1.0f / clip[i]->w;
+    x[i] = (clip[i]->x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    y[i] = (clip[i]->y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+    z[i] = clip[i]->z * inverseW;
+  }
+  // Twice the signed area, counter clockwise is positive
+  float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+  if (!(area > 0.0f)) {
+    return; // Back facing, edge on or NaN
+  }
+
+  // Clamped as floats first, a vertex way off screen doesn't fit in an int
+  OcclusionTriangle triangle;
+  float lowX = std::min(std::min(x[0], x[1]), x[2]);
+  float highX = std::max(std::max(x[0], x[1]), x[2]);
+  float lowY = std::min(std::min(y[0], y[1]), y[2]);
+  float highY = std::max(std::max(y[0], y[1]), y[2]);
+  triangle.minX = (int)std::max(floorf(lowX), 0.0f);
+  triangle.maxX = (int)std::min(floorf(highX), (float)(OCCLUSION_WIDTH - 1));
+  triangle.minY = (int)std::max(floorf(lowY), 0.0f);
+  triangle.maxY = (int)std::min(floorf(highY), (float)(OCCLUSION_HEIGHT - 1));
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+    return;
+  }
+
+  // Edge i runs from vertex i to the next, positive on its left
+  for (int i = 0; i < 3; i++) {
+    int next = (i + 1) % 3;
+    triangle.edgeA[i] = y[i] - y[next];
+    triangle.edgeB[i] = x[next] - x[i];
+    triangle.edgeC[i] = -(triangle.edgeA[i] * x[i] + triangle.edgeB[i] * y[i]);
+  }
+  // NDC z is linear in screen space, no perspective correction needed
+  triangle.depthA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+  triangle.depthB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+  triangle.depthC = z[0] - triangle.depthA * x[0] - triangle.depthB * y[0];
+
+  uint32_t index = triangles.size();
+  triangles.push_back(triangle);
+  for (int tileY = triangle.minY / OCCLUSION_TILE_HEIGHT; tileY <= triangle.maxY / OCCLUSION_TILE_HEIGHT; tileY++) {
+    for (int tileX = triangle.minX / OCCLUSION_TILE_WIDTH; tileX <= triangle.maxX / OCCLUSION_TILE_WIDTH; tileX++) {
+      bins[tileY * OCCLUSION_TILES_X + tileX].push_back(index);
+    }
+  }
+  stats.triangles++;
+}
+
+void OcclusionBuffer::rasterizeTile(int tile) {
+  int firstX = tile % OCCLUSION_TILES_X * OCCLUSION_TILE_WIDTH;
+  int firstY = tile / OCCLUSION_TILES_X * OCCLUSION_TILE_HEIGHT;
+  int lastX = firstX + OCCLUSION_TILE_WIDTH - 1;
+  int lastY = firstY + OCCLUSION_TILE_HEIGHT - 1;
+  for (uint32_t index : bins[tile]) {
+    const OcclusionTriangle &triangle = triangles[index];
+    int minX = std::max(triangle.minX, firstX), maxX = std::min(triangle.maxX, lastX);
+    int minY = std::max(triangle.minY, firstY), maxY = std::min(triangle.maxY, lastY);
+#if defined(FRED_OCCLUSION_AVX)
+    if (simd) {
+      rasterizeLanes<AvxLanes>(triangle, depth.data(), minX, maxX, minY, maxY);
+      continue;
+    }
+#elif defined(FRED_OCCLUSION_SSE)
+    if (simd) {
+      rasterizeLanes<SseLanes>(triangle, depth.data(), minX, maxX, minY, maxY);
+      continue;
+    }
+#endif
+    rasterizeLanes<ScalarLanes>(triangle, depth.data(), minX, maxX, minY, maxY);
+  }
+
+  // Blocks never straddle tiles
+  for (int blockY = firstY / OCCLUSION_BLOCK_SIZE; blockY <= lastY / OCCLUSION_BLOCK_SIZE; blockY++) {
+    for (int blockX = firstX / OCCLUSION_BLOCK_SIZE; blockX <= lastX / OCCLUSION_BLOCK_SIZE; blockX++) {
+      float furthest = -1.0f;
+      for (int y = blockY * OCCLUSION_BLOCK_SIZE; y < (blockY + 1) * OCCLUSION_BLOCK_SIZE; y++) {
+        const float *row = &depth[y * OCCLUSION_WIDTH + blockX * OCCLUSION_BLOCK_SIZE];
+        for (int x = 0; x < OCCLUSION_BLOCK_SIZE; x++) {
+          furthest = std::max(furthest, row[x]);
+        }
+      }
+      blockMax[blockY * OCCLUSION_BLOCKS_X + blockX] = furthest;
+    }
+  }
+}
+
+void OcclusionBuffer::rasterize() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  // Empty tiles are already cleared, blocks and all
+  int tiles[OCCLUSION_TILE_COUNT];
+  int tileCount = 0;
+  for (int tile = 0; tile < OCCLUSION_TILE_COUNT; tile++) {
+    if (!bins[tile].empty()) {
+      tiles[tileCount++] = tile;
+    }
+  }
+
+  // A tile a job, same as the light grid's slices
+  stats.tasks = 1;
+  if (parallel && tileCount > 1 && (int)triangles.size() >= PARALLEL_MIN_TRIANGLES) {
+    stats.tasks = tileCount;
+  }
+  if (stats.tasks == 1) {
+    for (int i = 0; i < tileCount; i++) {
+      rasterizeTile(tiles[i]);
+    }
+  } else {
+    jobs.parallelFor(tileCount, 1, [this, &tiles](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        rasterizeTile(tiles[i]);
+      }
+    }, "Occlusion tiles");
+  }
+  stats.rasterMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Testing ================================================================== //
+
+bool OcclusionBuffer::isVisible(const Aabb &box) const {
+  if (depth.empty()) {
+    return true;
+  }
+  float lowX = INFINITY, highX = -INFINITY, lowY = INFINITY, highY = -INFINITY;
+  float nearest = INFINITY;
+  for (int i = 0; i < 8; i++) {
+    glm::vec3 corner = glm::vec3(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y,
+                                 i & 4 ? box.max.z : box.min.z);
+    glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+    if (clip.w <= 0.0f || clip.z < -clip.w) {
+      return true; // Camera's inside it or it crosses the near plane
+    }
+    float inverseW = 1.0f / clip.w;
+    float x = (clip.x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+    float y = (clip.y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+    lowX = std::min(lowX, x);
+    highX = std::max(highX, x);
+    lowY = std::min(lowY, y);
+    highY = std::max(highY, y);
+    nearest = std::min(nearest, clip.z * inverseW);
+  }
+  if (highX < 0.0f || lowX >= OCCLUSION_WIDTH || highY < 0.0f || lowY >= OCCLUSION_HEIGHT) {
+    return true; // Frustum culling's call, not ours
+  }
+
+  // Every pixel the rectangle touches, not just the ones whose centers it covers
+  int minX = (int)std::max(floorf(lowX), 0.0f);
+  int maxX = (int)std::min(floorf(highX), (float)(OCCLUSION_WIDTH - 1));
+  int minY = (int)std::max(floorf(lowY), 0.0f);
+  int maxY = (int)std::min(floorf(highY), (float)(OCCLUSION_HEIGHT - 1));
+  for (int blockY = minY / OCCLUSION_BLOCK_SIZE; blockY <= maxY / OCCLUSION_BLOCK_SIZE; blockY++) {
+    for (int blockX = minX / OCCLUSION_BLOCK_SIZE; blockX <= maxX / OCCLUSION_BLOCK_SIZE; blockX++) {
+      if (blockMax[blockY * OCCLUSION_BLOCKS_X + blockX] < nearest) {
+        continue; // All of it is in front
+      }
+      int firstX = std::max(minX, blockX * OCCLUSION_BLOCK_SIZE);
+      int lastX = std::min(maxX, (blockX + 1) * OCCLUSION_BLOCK_SIZE - 1);
+      int firstY = std::max(minY, blockY * OCCLUSION_BLOCK_SIZE);
+      int lastY = std::min(maxY, (blockY + 1) * OCCLUSION_BLOCK_SIZE - 1);
+      for (int y = firstY; y <= lastY; y++) {
+        const float *row = &depth[y * OCCLUSION_WIDTH + firstX];
+#if defined(FRED_OCCLUSION_AVX)
+        bool farther = anyFarther<AvxLanes>(row, lastX - firstX + 1, nearest);
+#elif defined(FRED_OCCLUSION_SSE)
+        bool farther = anyFarther<SseLanes>(row, lastX - firstX + 1, nearest);
+#else
+        bool farther = anyFarther<ScalarLanes>(row, lastX - firstX + 1, nearest);
+#endif
+        if (farther) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+} // namespace fred
@@ -0,0 +1,106 @@
+#ifndef FRED_OCCLUSION_H
+#define FRED_OCCLUSION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "mesh.h"
+
+namespace fred {
+
+// Triangles an asset hides things behind, kept on the CPU. Gets drawn as if
+// solid and back faces are skipped, so it should be closed and sit inside
+// whatever is actually drawn or things poking out past it get culled.
+struct OccluderMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices; // Triangle list, counter clockwise
+  Aabb bounds;
+};
+
+// From one LOD of a mesh, every submesh merged. -1 is the coarsest it has,
+// run generateLods first for a cheap one.
+void makeOccluder(const MeshData &mesh, OccluderMesh &occluder, int lod = -1);
+
+// Low resolution depth, tiles of it across the screen. Aspect ratio doesn't
+// matter, everything goes through the same projection as the real frame.
+constexpr int OCCLUSION_WIDTH = 256;
+constexpr int OCCLUSION_HEIGHT = 128;
+constexpr int OCCLUSION_TILE_WIDTH = 64; // A multiple of 8 so AVX rows never leave their tile
+constexpr int OCCLUSION_TILE_HEIGHT = 32;
+constexpr int OCCLUSION_TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+constexpr int OCCLUSION_TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+constexpr int OCCLUSION_TILE_COUNT = OCCLUSION_TILES_X * OCCLUSION_TILES_Y;
+// Max depth per block, so a hidden box mostly gets away with a few compares
+constexpr int OCCLUSION_BLOCK_SIZE = 8;
+constexpr int OCCLUSION_BLOCKS_X = OCCLUSION_WIDTH / OCCLUSION_BLOCK_SIZE;
+constexpr int OCCLUSION_BLOCKS_Y = OCCLUSION_HEIGHT / OCCLUSION_BLOCK_SIZE;
+
+struct OcclusionStats {
+  int occluders = 0; // Drawn into the buffer, the ones in view
+  int triangles = 0; // Of theirs that survived clipping and back face culling
+  int tasks = 0;     // Tiles went out over this many
+  double rasterMs = 0.0; // Transforming, binning and rasterizing
+};
+
+// OcclusionBuffer's, one screen space triangle. Edge functions and a depth
+// plane over pixel coordinates, set up once at binning so every tile it lands
+// in can use them.
+struct OcclusionTriangle {
+  float edgeA[3], edgeB[3], edgeC[3]; // Inside is all three >= 0
+  float depthA, depthB, depthC;       // z = depthA * x + depthB * y + depthC
+  int minX, maxX, minY, maxY;         // Pixels, clamped to the screen
+};
+
+// A software depth buffer for occlusion culling, in the spirit of Intel's
+// masked occlusion culling but a lot simpler. Every frame the occluders are
+// transformed, clipped to the near plane and binned into screen tiles on the
+// calling thread, then the tiles are rasterized over the job system, SIMD a
+// row of pixels at a time. Nothing is shared between tiles. Boxes are then
+// tested against it on whatever thread wants to, it's read only by then.
+//
+// Depth is NDC z, 1 is empty. A box is hidden when every pixel its screen
+// rectangle touches has something nearer than its nearest corner.
+class OcclusionBuffer {
+public:
+  bool parallel = true;
+  bool simd = true; // Off rasterizes with the scalar path, for benchmarks
+
+  OcclusionBuffer() = default;
+  OcclusionBuffer(const OcclusionBuffer &) = delete;
+  OcclusionBuffer &operator=(const OcclusionBuffer &) = delete;
+
+  // Clears it for a new frame seen through viewProjection
+  void begin(const glm::mat4 &viewProjection);
+  // Transforms, clips and bins. mesh has to outlive rasterize().
+  void addOccluder(const OccluderMesh &mesh, const glm::mat4 &model);
+  void rasterize();
+
+  // False only if it's certainly hidden. Anything crossing the near plane or
+  // off the edge of the screen counts as visible.
+  bool isVisible(const Aabb &box) const;
+
+  const float *getDepth() const { return depth.data(); } // Bottom row first
+  const OcclusionStats &getStats() const { return stats; }
+  static const char *getSimdName();
+
+private:
+  glm::mat4 viewProjection = glm::mat4(1.0f);
+  std::vector<float> depth;    // OCCLUSION_WIDTH * OCCLUSION_HEIGHT, rows bottom up
+  std::vector<float> blockMax; // Furthest depth in each block
+  std::vector<OcclusionTriangle> triangles;
+  std::vector<uint32_t> bins[OCCLUSION_TILE_COUNT]; // Into triangles
+  std::vector<glm::vec4> clipPositions; // Scratch, one occluder's
+  OcclusionStats stats;
+
+  // Near plane clipping, then setupTriangle on whatever is left
+  void addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+  void setupTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+  void rasterizeTile(int tile);
+};
+
+} // namespace fred
+
+#endif
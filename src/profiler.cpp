@@ -0,0 +1,387 @@
+#include "profiler.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include <imgui.h>
+#include <clog/clog.h>
+
+namespace fred {
+
+Profiler profiler;
+
+double profilerNow() {
+  static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// GL_TIMESTAMP ticks in nanoseconds on the GPU's own clock, this lines it up
+// with profilerNow. Redone now and then so the two don't drift apart.
+void Profiler::calibrateGpuClock() {
+  GLint64 gpuNow = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  gpuClockOffset = profilerNow() - gpuNow / 1e6;
+  lastCalibration = frameIndex;
+}
+
+void Profiler::beginFrame() {
+  frameIndex++;
+  inFrame = enabled;
+  cpuDepth = 0;
+  gpuDepth = 0;
+
+  ProfileFrame *frame = currentFrame();
+  frame->index = frameIndex;
+  frame->start = profilerNow();
+  frame->cpuMs = 0.0;
+  frame->gpuMs = 0.0;
+  frame->gpuReady = false;
+  frame->cpuZones.clear();
+  frame->gpuZones.clear();
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    frame->jobZones.clear();
+    if (enabled) {
+      frame->jobZones.swap(pendingJobZones);
+    }
+    pendingJobZones.clear();
+    jobFrame = enabled ? frame : NULL;
+  }
+
+  // This pool was last used FRAMES_IN_FLIGHT frames ago, its results should
+  // be in by now
+  GpuFrame &gpuFrame = gpuFrames[frameIndex % FRAMES_IN_FLIGHT];
+  if (gpuFrame.pending) {
+    collectGpuFrame(gpuFrame);
+  }
+  gpuFrame.frameIndex = frameIndex;
+  gpuFrame.usedQueries = 0;
+  gpuFrame.zones.clear();
+
+  if (enabled && (lastCalibration == 0 || frameIndex - lastCalibration >= 600)) {
+    calibrateGpuClock();
+  }
+}
+
+void Profiler::endFrame() {
+  if (!inFrame) {
+    return;
+  }
+  ProfileFrame *frame = currentFrame();
+  frame->cpuMs = profilerNow() - frame->start;
+  gpuFrames[frameIndex % FRAMES_IN_FLIGHT].pending = !gpuFrames[frameIndex % FRAMES_IN_FLIGHT].zones.empty();
+  inFrame = false;
+  std::lock_guard<std::mutex> lock(jobMutex);
+  jobFrame = NULL;
+}
+
+int Profiler::beginZone(const char *name) {
+  if (!inFrame) {
+    return -1;
+  }
+  ProfileZone zone;
+  zone.name = name;
+  zone.start = profilerNow();
+  zone.end = -1.0;
+  zone.depth = cpuDepth++;
+  std::vector<ProfileZone> &zones = currentFrame()->cpuZones;
+  zones.push_back(zone);
+  return (int)zones.size() - 1;
+}
+
+void Profiler::endZone(int zone) {
+  std::vector<ProfileZone> &zones = currentFrame()->cpuZones;
+  // Anything straddling a frame boundary is dropped
+  if (zone < 0 || !inFrame || zone >= (int)zones.size() || zones[zone].end >= 0.0) {
+    return;
+  }
+  zones[zone].end = profilerNow();
+  cpuDepth--;
+}
+
+void Profiler::addJobZone(int thread, const char *name, double start, double end) {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  ProfileZone zone;
+  zone.name = name;
+  zone.start = start;
+  zone.end = end;
+  zone.depth = thread;
+  (jobFrame != NULL ? jobFrame->jobZones : pendingJobZones).push_back(zone);
+}
+
+int Profiler::allocateQuery(GpuFrame &gpuFrame) {
+  if (gpuFrame.usedQueries == (int)gpuFrame.queries.size()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    gpuFrame.queries.push_back(query);
+  }
+  return gpuFrame.usedQueries++;
+}
+
+int Profiler::beginGpuZone(const char *name) {
+  if (!inFrame) {
+    return -1;
+  }
+  GpuFrame &gpuFrame = gpuFrames[frameIndex % FRAMES_IN_FLIGHT];
+  GpuZoneQueries zone;
+  zone.name = name;
+  zone.depth = gpuDepth++;
+  zone.beginQuery = allocateQuery(gpuFrame);
+  zone.endQuery = -1;
+  // Timestamps rather than GL_TIME_ELAPSED, elapsed queries can't nest
+  glQueryCounter(gpuFrame.queries[zone.beginQuery], GL_TIMESTAMP);
+  gpuFrame.zones.push_back(zone);
+  return (int)gpuFrame.zones.size() - 1;
+}
+
+void Profiler::endGpuZone(int zone) {
+  GpuFrame &gpuFrame = gpuFrames[frameIndex % FRAMES_IN_FLIGHT];
+  if (zone < 0 || !inFrame || zone >= (int)gpuFrame.zones.size() || gpuFrame.zones[zone].endQuery >= 0) {
+    return;
+  }
+  int query = allocateQuery(gpuFrame);
+  glQueryCounter(gpuFrame.queries[query], GL_TIMESTAMP);
+  gpuFrame.zones[zone].endQuery = query;
+  gpuDepth--;
+}
+
+void Profiler::collectGpuFrame(GpuFrame &gpuFrame) {
+  gpuFrame.pending = false;
+  // Timestamps land in order, if the last one is there they all are
+  GLint available = 0;
+  glGetQueryObjectiv(gpuFrame.queries[gpuFrame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) {
+    droppedGpuFrames++;
+    return;
+  }
+
+  ProfileFrame &frame = history[gpuFrame.frameIndex % HISTORY];
+  if (frame.index != gpuFrame.frameIndex) {
+    return; // Already overwritten
+  }
+  double first = DBL_MAX;
+  double last = -DBL_MAX;
+  for (const GpuZoneQueries &queries : gpuFrame.zones) {
+    if (queries.endQuery < 0) {
+      continue;
+    }
+    GLuint64 begin = 0;
+    GLuint64 end = 0;
+    glGetQueryObjectui64v(gpuFrame.queries[queries.beginQuery], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(gpuFrame.queries[queries.endQuery], GL_QUERY_RESULT, &end);
+    ProfileZone zone;
+    zone.name = queries.name;
+    zone.start = begin / 1e6 + gpuClockOffset;
+    zone.end = end / 1e6 + gpuClockOffset;
+    zone.depth = queries.depth;
+    frame.gpuZones.push_back(zone);
+    first = zone.start < first ? zone.start : first;
+    last = zone.end > last ? zone.end : last;
+  }
+  frame.gpuMs = frame.gpuZones.empty() ? 0.0 : last - first;
+  frame.gpuReady = true;
+}
+
+const ProfileFrame *Profiler::getFrame(int framesAgo) const {
+  // The current frame is still being recorded, 0 is the one before it
+  uint64_t index = frameIndex - 1 - framesAgo;
+  if (framesAgo < 0 || framesAgo >= HISTORY - 1 || frameIndex < 1 + (uint64_t)framesAgo) {
+    return NULL;
+  }
+  const ProfileFrame *frame = &history[index % HISTORY];
+  return frame->index == index ? frame : NULL;
+}
+
+double sumZoneMs(const std::vector<ProfileZone> &zones, const char *name) {
+  double ms = 0.0;
+  for (const ProfileZone &zone : zones) {
+    if (strcmp(zone.name, name) == 0 && zone.end >= zone.start) {
+      ms += zone.end - zone.start;
+    }
+  }
+  return ms;
+}
+
+// Export =================================================================== //
+
+// Job zones go on a thread per depth, from thread up
+static void writeTraceEvents(FILE *file, const std::vector<ProfileZone> &zones, int thread, bool threadPerDepth,
+                             bool &first) {
+  for (const ProfileZone &zone : zones) {
+    if (zone.end < zone.start) {
+      continue;
+    }
+    // Names are literals from our own code, nothing to escape
+    fprintf(file, "%s\n    {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+            first ? "" : ",", zone.name, threadPerDepth ? thread + zone.depth : thread, zone.start * 1000.0,
+            (zone.end - zone.start) * 1000.0);
+    first = false;
+  }
+}
+
+bool Profiler::exportChromeTrace(const char *path) const {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to open \"%s\" for writing\n", path);
+    return false;
+  }
+  fprintf(file, "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [\n");
+  fprintf(file, "    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+  fprintf(file, "    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}");
+  bool first = false;
+  int frames = 0;
+  int jobThreads = 0;
+  for (int framesAgo = HISTORY - 2; framesAgo >= 0; framesAgo--) {
+    const ProfileFrame *frame = getFrame(framesAgo);
+    if (frame == NULL) {
+      continue;
+    }
+    writeTraceEvents(file, frame->cpuZones, 1, false, first);
+    writeTraceEvents(file, frame->gpuZones, 2, false, first);
+    writeTraceEvents(file, frame->jobZones, 3, true, first);
+    for (const ProfileZone &zone : frame->jobZones) {
+      jobThreads = zone.depth + 1 > jobThreads ? zone.depth + 1 : jobThreads;
+    }
+    frames++;
+  }
+  for (int i = 0; i < jobThreads; i++) {
+    fprintf(file, ",\n    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+            3 + i);
+    if (i == 0) {
+      fprintf(file, "\"Jobs on the main thread\"}}");
+    } else {
+      fprintf(file, "\"Job worker %d\"}}", i - 1);
+    }
+  }
+  fprintf(file, "\n  ]\n}\n");
+  bool ok = fclose(file) == 0;
+  if (ok) {
+    clog_log(CLOG_LEVEL_INFO, "Wrote %d frames of profile to %s\n", frames, path);
+  } else {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to write \"%s\"\n", path);
+  }
+  return ok;
+}
+
+// UI ======================================================================= //
+
+static ImU32 zoneColor(const char *name) {
+  // Same name, same color, frame to frame
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c != '\0'; c++) {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  return ImColor::HSV((hash % 360) / 360.0f, 0.5f, 0.75f);
+}
+
+// One lane of the flame graph, a row per depth. Returns the lane's height.
+static float drawZoneLane(const std::vector<ProfileZone> &zones, double frameStart, double span, ImVec2 origin, float width) {
+  ImDrawList *drawList = ImGui::GetWindowDrawList();
+  float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+  int maxDepth = 0;
+  for (const ProfileZone &zone : zones) {
+    if (zone.end < zone.start) {
+      continue;
+    }
+    // Jobs can start in the frame before
+    float x0 = origin.x + (float)(std::max(zone.start - frameStart, 0.0) / span) * width;
+    float x1 = origin.x + (float)((zone.end - frameStart) / span) * width;
+    x1 = x1 - x0 < 1.0f ? x0 + 1.0f : x1;
+    float y0 = origin.y + zone.depth * rowHeight;
+    ImVec2 min = ImVec2(x0, y0);
+    ImVec2 max = ImVec2(x1, y0 + rowHeight - 1.0f);
+    drawList->AddRectFilled(min, max, zoneColor(zone.name));
+    drawList->PushClipRect(min, max, true);
+    drawList->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32(0, 0, 0, 255), zone.name);
+    drawList->PopClipRect();
+    if (ImGui::IsMouseHoveringRect(min, max)) {
+      ImGui::SetTooltip("%s: %.3f ms", zone.name, zone.end - zone.start);
+    }
+    maxDepth = zone.depth > maxDepth ? zone.depth : maxDepth;
+  }
+  return zones.empty() ? rowHeight : (maxDepth + 1) * rowHeight;
+}
+
+void Profiler::drawWindow() {
+  ImGui::Begin("Profiler");
+  static bool paused = false;
+  static ProfileFrame shownFrame;
+  ImGui::Checkbox("Enabled", &enabled);
+  ImGui::SameLine();
+  ImGui::Checkbox("Pause", &paused);
+  ImGui::SameLine();
+  if (ImGui::Button("Export trace")) {
+    exportChromeTrace("fred-trace.json");
+  }
+  ImGui::SameLine();
+  ImGui::Text("%d GPU frames dropped", droppedGpuFrames);
+
+  // Rolling history, oldest on the left
+  static float cpuHistory[HISTORY];
+  static float gpuHistory[HISTORY];
+  int historyCount = 0;
+  float historyMax = 0.0f;
+  for (int framesAgo = HISTORY - 2; framesAgo >= 0; framesAgo--) {
+    const ProfileFrame *frame = getFrame(framesAgo);
+    if (frame == NULL) {
+      continue;
+    }
+    cpuHistory[historyCount] = (float)frame->cpuMs;
+    gpuHistory[historyCount] = (float)frame->gpuMs;
+    historyMax = frame->cpuMs > historyMax ? (float)frame->cpuMs : historyMax;
+    historyMax = frame->gpuMs > historyMax ? (float)frame->gpuMs : historyMax;
+    historyCount++;
+  }
+  char overlay[32];
+  snprintf(overlay, sizeof(overlay), "CPU %.2f ms", historyCount > 0 ? cpuHistory[historyCount - 1] : 0.0f);
+  ImGui::PlotLines("##cpu", cpuHistory, historyCount, 0, overlay, 0.0f, historyMax, ImVec2(-1, 50));
+  snprintf(overlay, sizeof(overlay), "GPU %.2f ms", historyCount > 0 ? gpuHistory[historyCount - 1] : 0.0f);
+  ImGui::PlotLines("##gpu", gpuHistory, historyCount, 0, overlay, 0.0f, historyMax, ImVec2(-1, 50));
+
+  // Newest frame with its GPU half in, unless paused
+  if (!paused) {
+    for (int framesAgo = 0; framesAgo < HISTORY - 1; framesAgo++) {
+      const ProfileFrame *frame = getFrame(framesAgo);
+      if (frame == NULL) {
+        break;
+      }
+      if (frame->gpuReady) {
+        shownFrame = *frame;
+        break;
+      }
+    }
+  }
+
+  ImGui::SeparatorText("Frame");
+  ImGui::Text("Frame %llu: CPU %.3f ms, GPU %.3f ms", (unsigned long long)shownFrame.index, shownFrame.cpuMs, shownFrame.gpuMs);
+  double span = shownFrame.cpuMs;
+  for (const ProfileZone &zone : shownFrame.gpuZones) {
+    span = zone.end - shownFrame.start > span ? zone.end - shownFrame.start : span;
+  }
+  if (span > 0.0) {
+    float width = ImGui::GetContentRegionAvail().x;
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::TextDisabled("CPU");
+    origin.y += ImGui::GetTextLineHeightWithSpacing();
+    float height = drawZoneLane(shownFrame.cpuZones, shownFrame.start, span, origin, width);
+    ImGui::SetCursorScreenPos(ImVec2(origin.x, origin.y + height));
+    ImGui::TextDisabled("GPU");
+    origin.y += height + ImGui::GetTextLineHeightWithSpacing();
+    height = drawZoneLane(shownFrame.gpuZones, shownFrame.start, span, origin, width);
+    ImGui::SetCursorScreenPos(ImVec2(origin.x, origin.y + height));
+    if (!shownFrame.jobZones.empty()) {
+      // A row per thread rather than per depth, the main thread on top
+      ImGui::TextDisabled("Jobs");
+      origin.y += height + ImGui::GetTextLineHeightWithSpacing();
+      height = drawZoneLane(shownFrame.jobZones, shownFrame.start, span, origin, width);
+      ImGui::SetCursorScreenPos(ImVec2(origin.x, origin.y + height));
+    }
+    ImGui::Dummy(ImVec2(width, 0.0f));
+  }
+  ImGui::End();
+}
+
+} // namespace fred
@@ -0,0 +1,148 @@
+#ifndef FRED_PROFILER_H
+#define FRED_PROFILER_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+#include <glad/gl.h>
+
+// Build with -DFRED_PROFILER=0 and every zone macro compiles to nothing.
+// Otherwise a disabled profiler costs one branch per zone.
+#ifndef FRED_PROFILER
+#define FRED_PROFILER 1
+#endif
+
+namespace fred {
+
+// Names have to outlive the profiler, string literals only
+struct ProfileZone {
+  const char *name;
+  double start; // ms since the profiler started, GPU zones mapped onto the CPU clock
+  double end;
+  int depth;
+};
+
+struct ProfileFrame {
+  uint64_t index = 0;
+  double start = 0.0;
+  double cpuMs = 0.0;
+  double gpuMs = 0.0;    // Only once gpuReady is set, a few frames after the CPU side
+  bool gpuReady = false;
+  std::vector<ProfileZone> cpuZones;
+  std::vector<ProfileZone> gpuZones;
+  std::vector<ProfileZone> jobZones; // depth is the thread, 0 off the workers and worker i at i + 1
+};
+
+// Hierarchical CPU and GPU zones, main thread only, plus job zones from any
+// thread through addJobZone. GPU zones are a pair of GL_TIMESTAMP queries
+// from a per frame pool. Pools are reused FRAMES_IN_FLIGHT frames later, so
+// results are read once the GPU is done with them and nothing ever waits on
+// it. A frame whose results still aren't there by then loses its GPU zones
+// instead.
+class Profiler {
+public:
+  static constexpr int FRAMES_IN_FLIGHT = 4;
+  static constexpr int HISTORY = 300;
+
+  bool enabled = true;
+  int droppedGpuFrames = 0;
+
+  void beginFrame();
+  void endFrame();
+
+  // Returns a handle for the matching end, -1 if nothing was recorded
+  int beginZone(const char *name);
+  void endZone(int zone);
+  int beginGpuZone(const char *name);
+  void endGpuZone(int zone);
+  // Any thread. One that ends between frames goes into the next one.
+  void addJobZone(int thread, const char *name, double start, double end);
+
+  // 0 is the last finished frame, NULL past the end of the history
+  const ProfileFrame *getFrame(int framesAgo) const;
+  // Every frame in the history as Chrome trace events (chrome://tracing or
+  // ui.perfetto.dev), CPU, GPU and each job thread as separate threads
+  bool exportChromeTrace(const char *path) const;
+
+  // The "Profiler" window, inside an ImGui frame
+  void drawWindow();
+
+private:
+  struct GpuZoneQueries {
+    const char *name;
+    int depth;
+    int beginQuery; // Into GpuFrame::queries
+    int endQuery;
+  };
+  struct GpuFrame {
+    uint64_t frameIndex = 0;
+    bool pending = false;
+    std::vector<GLuint> queries;
+    int usedQueries = 0;
+    std::vector<GpuZoneQueries> zones;
+  };
+
+  ProfileFrame history[HISTORY];
+  GpuFrame gpuFrames[FRAMES_IN_FLIGHT];
+  uint64_t frameIndex = 0;
+  bool inFrame = false;
+  int cpuDepth = 0;
+  int gpuDepth = 0;
+  double gpuClockOffset = 0.0; // CPU ms minus GPU ms
+  std::mutex jobMutex;
+  ProfileFrame *jobFrame = NULL; // Where job zones go, guarded by jobMutex
+  std::vector<ProfileZone> pendingJobZones; // Ended between frames, same
+  uint64_t lastCalibration = 0;
+
+  ProfileFrame *currentFrame() { return &history[frameIndex % HISTORY]; }
+  int allocateQuery(GpuFrame &gpuFrame);
+  void calibrateGpuClock();
+  void collectGpuFrame(GpuFrame &gpuFrame);
+};
+
+extern Profiler profiler;
+
+// Milliseconds on the profiler's clock
+double profilerNow();
+// Total time spent in zones called name, 0 if there weren't any
+double sumZoneMs(const std::vector<ProfileZone> &zones, const char *name);
+
+class ProfileScope {
+public:
+  explicit ProfileScope(const char *name) : zone(profiler.beginZone(name)) {}
+  ~ProfileScope() { profiler.endZone(zone); }
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  int zone;
+};
+
+class GpuProfileScope {
+public:
+  explicit GpuProfileScope(const char *name) : zone(profiler.beginGpuZone(name)) {}
+  ~GpuProfileScope() { profiler.endGpuZone(zone); }
+  GpuProfileScope(const GpuProfileScope &) = delete;
+  GpuProfileScope &operator=(const GpuProfileScope &) = delete;
+
+private:
+  int zone;
+};
+
+} // namespace fred
+
+#define FRED_PROFILE_JOIN2(a, b) a##b
+#define FRED_PROFILE_JOIN(a, b) FRED_PROFILE_JOIN2(a, b)
+
+#if FRED_PROFILER
+// Times the rest of the enclosing block
+#define PROFILE_ZONE(name) fred::ProfileScope FRED_PROFILE_JOIN(profileZone, __LINE__)(name)
+// Times the GL commands issued in the rest of the enclosing block
+#define PROFILE_GPU_ZONE(name) fred::GpuProfileScope FRED_PROFILE_JOIN(gpuProfileZone, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#endif
+
+#endif
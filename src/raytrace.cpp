@@ -0,0 +1,378 @@
+#include "raytrace.h"
+
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRED_RAYTRACE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace fred {
+
+static const int LEAF_SIZE = 4;
+static const int BIN_COUNT = 12;
+// Past this depth nodes split at the median instead, SAH has no depth bound
+// of its own. Halving 2^32 triangles takes another 31 levels at most, so
+// trees stay under 64 deep and the traversal stack (one per level, plus one)
+// can't overflow.
+static const int SAH_DEPTH = 32;
+static const int STACK_SIZE = 64;
+
+// Building ================================================================= //
+
+void TriangleBvh::build(const std::vector<glm::vec3> &corners) {
+  uint32_t triangleCount = (uint32_t)(corners.size() / 3);
+  std::vector<Aabb> bounds(triangleCount);
+  std::vector<glm::vec3> centroids(triangleCount);
+  std::vector<uint32_t> order(triangleCount);
+  for (uint32_t t = 0; t < triangleCount; t++) {
+    const glm::vec3 *corner = &corners[t * 3];
+    bounds[t] = {glm::min(corner[0], glm::min(corner[1], corner[2])),
+                 glm::max(corner[0], glm::max(corner[1], corner[2]))};
+    centroids[t] = (bounds[t].min + bounds[t].max) * 0.5f;
+    order[t] = t;
+  }
+
+  nodes.clear();
+  nodes.reserve(triangleCount / 2 + 1);
+  nodes.push_back(Node());
+  depth = 0;
+  split(0, order, bounds, centroids, 0, triangleCount, 0);
+  assert(depth < STACK_SIZE);
+
+  vertices.resize(triangleCount * 3);
+  triangleIds = order;
+  for (uint32_t i = 0; i < triangleCount; i++) {
+    for (int corner = 0; corner < 3; corner++) {
+      vertices[i * 3 + corner] = corners[order[i] * 3 + corner];
+    }
+  }
+}
+
+void TriangleBvh::split(uint32_t node, std::vector<uint32_t> &order, const std::vector<Aabb> &bounds,
+                        const std::vector<glm::vec3> &centroids, uint32_t first, uint32_t count, int level) {
+  depth = std::max(depth, level);
+  Aabb box = {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+  Aabb centroidBox = box;
+  for (uint32_t i = first; i < first + count; i++) {
+    box = box.merge(bounds[order[i]]);
+    centroidBox = centroidBox.merge({centroids[order[i]], centroids[order[i]]});
+  }
+  nodes[node].min = box.min;
+  nodes[node].max = box.max;
+  if (count <= LEAF_SIZE) {
+    nodes[node].first = first;
+    nodes[node].count = count;
+    return;
+  }
+
+  // Cheapest bin boundary over all three axes, by surface area times
+  // triangles on each side
+  int bestAxis = -1, bestBin = 0;
+  float bestCost = INFINITY;
+  glm::vec3 extent = centroidBox.max - centroidBox.min;
+  for (int axis = 0; axis < 3 && level < SAH_DEPTH; axis++) {
+    if (extent[axis] <= 0.0f) {
+      continue;
+    }
+    Aabb binBounds[BIN_COUNT];
+    int binCounts[BIN_COUNT] = {};
+    for (int b = 0; b < BIN_COUNT; b++) {
+      binBounds[b] = {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+    }
+    float scale = BIN_COUNT / extent[axis];
+    for (uint32_t i = first; i < first + count; i++) {
+      int b = std::min((int)((centroids[order[i]][axis] - centroidBox.min[axis]) * scale), BIN_COUNT - 1);
+      binBounds[b] = binBounds[b].merge(bounds[order[i]]);
+      binCounts[b]++;
+    }
+    float rightAreas[BIN_COUNT];
+    int rightCounts[BIN_COUNT];
+    Aabb right = {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+    int rightCount = 0;
+    for (int b = BIN_COUNT - 1; b > 0; b--) {
+      right = right.merge(binBounds[b]);
+      rightCount += binCounts[b];
+      rightAreas[b] = rightCount > 0 ? right.surfaceArea() : 0.0f;
+      rightCounts[b] = rightCount;
+    }
+    Aabb left = {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+    int leftCount = 0;
+    for (int b = 0; b < BIN_COUNT - 1; b++) {
+      left = left.merge(binBounds[b]);
+      leftCount += binCounts[b];
+      if (leftCount == 0 || rightCounts[b + 1] == 0) {
+        continue;
+      }
+      float cost = left.surfaceArea() * leftCount + rightAreas[b + 1] * rightCounts[b + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  uint32_t middle;
+  if (bestAxis >= 0) {
+    float scale = BIN_COUNT / extent[bestAxis];
+    float minimum = centroidBox.min[bestAxis];
+    middle = (uint32_t)(std::partition(order.begin() + first, order.begin() + first + count,
+                                       [&](uint32_t t) {
+                                         int b = std::min((int)((centroids[t][bestAxis] - minimum) * scale),
+                                                          BIN_COUNT - 1);
+                                         return b <= bestBin;
+                                       }) -
+                        order.begin());
+  } else {
+    // Every centroid in the same spot, or too deep for SAH
+    middle = first + count / 2;
+  }
+
+  uint32_t left = (uint32_t)nodes.size();
+  nodes.push_back(Node());
+  split(left, order, bounds, centroids, first, middle - first, level + 1);
+  uint32_t right = (uint32_t)nodes.size();
+  nodes.push_back(Node());
+  split(right, order, bounds, centroids, middle, first + count - middle, level + 1);
+  nodes[node].first = right;
+  nodes[node].count = 0;
+}
+
+// Scalar traversal ========================================================= //
+
+// Entry distance, or INFINITY on a miss
+static float hitBox(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &origin, const glm::vec3 &inverse,
+                    float tMax) {
+  glm::vec3 t0 = (min - origin) * inverse;
+  glm::vec3 t1 = (max - origin) * inverse;
+  glm::vec3 nearT = glm::min(t0, t1);
+  glm::vec3 farT = glm::max(t0, t1);
+  float enter = std::max(std::max(nearT.x, nearT.y), std::max(nearT.z, 0.0f));
+  float exit = std::min(std::min(farT.x, farT.y), std::min(farT.z, tMax));
+  return enter <= exit ? enter : INFINITY;
+}
+
+// Moller and Trumbore
+static bool hitTriangle(const glm::vec3 *corners, const glm::vec3 &origin, const glm::vec3 &direction, float tMax,
+                        float &t, float &u, float &v) {
+  glm::vec3 edge1 = corners[1] - corners[0];
+  glm::vec3 edge2 = corners[2] - corners[0];
+  glm::vec3 p = glm::cross(direction, edge2);
+  float determinant = glm::dot(edge1, p);
+  if (fabsf(determinant) < 1e-12f) {
+    return false;
+  }
+  float inverse = 1.0f / determinant;
+  glm::vec3 s = origin - corners[0];
+  u = glm::dot(s, p) * inverse;
+  if (u < 0.0f || u > 1.0f) {
+    return false;
+  }
+  glm::vec3 q = glm::cross(s, edge1);
+  v = glm::dot(direction, q) * inverse;
+  if (v < 0.0f || u + v > 1.0f) {
+    return false;
+  }
+  t = glm::dot(edge2, q) * inverse;
+  return t > 0.0f && t < tMax;
+}
+
+bool TriangleBvh::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float tMax, RayHit &hit) const {
+  if (triangleIds.empty()) {
+    return false;
+  }
+  glm::vec3 inverse = 1.0f / direction;
+  bool found = false;
+  uint32_t stack[STACK_SIZE];
+  int depth = 0;
+  stack[depth++] = 0;
+  while (depth > 0) {
+    const Node &node = nodes[stack[--depth]];
+    if (hitBox(node.min, node.max, origin, inverse, tMax) == INFINITY) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        float t, u, v;
+        if (hitTriangle(&vertices[i * 3], origin, direction, tMax, t, u, v)) {
+          tMax = t;
+          hit = {t, triangleIds[i], u, v};
+          found = true;
+        }
+      }
+      continue;
+    }
+    // Nearer child on top so it shortens tMax before the other one is tested
+    uint32_t near = (uint32_t)(&node - &nodes[0]) + 1, far = node.first;
+    float nearT = hitBox(nodes[near].min, nodes[near].max, origin, inverse, tMax);
+    float farT = hitBox(nodes[far].min, nodes[far].max, origin, inverse, tMax);
+    if (farT < nearT) {
+      std::swap(near, far);
+      std::swap(nearT, farT);
+    }
+    if (farT != INFINITY) {
+      stack[depth++] = far;
+    }
+    if (nearT != INFINITY) {
+      stack[depth++] = near;
+    }
+  }
+  return found;
+}
+
+bool TriangleBvh::occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tMax) const {
+  if (triangleIds.empty()) {
+    return false;
+  }
+  glm::vec3 inverse = 1.0f / direction;
+  uint32_t stack[STACK_SIZE];
+  int depth = 0;
+  stack[depth++] = 0;
+  while (depth > 0) {
+    uint32_t index = stack[--depth];
+    const Node &node = nodes[index];
+    if (hitBox(node.min, node.max, origin, inverse, tMax) == INFINITY) {
+      continue;
+    }
+    if (node.count > 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        float t, u, v;
+        if (hitTriangle(&vertices[i * 3], origin, direction, tMax, t, u, v)) {
+          return true;
+        }
+      }
+      continue;
+    }
+    stack[depth++] = node.first;
+    stack[depth++] = index + 1;
+  }
+  return false;
+}
+
+int TriangleBvh::occluded4Scalar(const glm::vec3 origins[4], const glm::vec3 directions[4],
+                                 const float tMax[4]) const {
+  int blocked = 0;
+  for (int i = 0; i < 4; i++) {
+    if (occluded(origins[i], directions[i], tMax[i])) {
+      blocked |= 1 << i;
+    }
+  }
+  return blocked;
+}
+
+// Packet traversal ========================================================= //
+
+#ifdef FRED_RAYTRACE_SSE
+int TriangleBvh::occluded4(const glm::vec3 origins[4], const glm::vec3 directions[4], const float tMax[4]) const {
+  if (triangleIds.empty()) {
+    return 0;
+  }
+  // A lane per ray
+  __m128 originX = _mm_setr_ps(origins[0].x, origins[1].x, origins[2].x, origins[3].x);
+  __m128 originY = _mm_setr_ps(origins[0].y, origins[1].y, origins[2].y, origins[3].y);
+  __m128 originZ = _mm_setr_ps(origins[0].z, origins[1].z, origins[2].z, origins[3].z);
+  __m128 directionX = _mm_setr_ps(directions[0].x, directions[1].x, directions[2].x, directions[3].x);
+  __m128 directionY = _mm_setr_ps(directions[0].y, directions[1].y, directions[2].y, directions[3].y);
+  __m128 directionZ = _mm_setr_ps(directions[0].z, directions[1].z, directions[2].z, directions[3].z);
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 inverseX = _mm_div_ps(one, directionX);
+  __m128 inverseY = _mm_div_ps(one, directionY);
+  __m128 inverseZ = _mm_div_ps(one, directionZ);
+  __m128 limit = _mm_loadu_ps(tMax);
+  __m128 zero = _mm_setzero_ps();
+  __m128 epsilon = _mm_set1_ps(1e-12f);
+  __m128 signBit = _mm_set1_ps(-0.0f);
+
+  int blocked = 0;
+  uint32_t stack[STACK_SIZE];
+  int depth = 0;
+  stack[depth++] = 0;
+  while (depth > 0) {
+    uint32_t index = stack[--depth];
+    const Node &node = nodes[index];
+
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), originX), inverseX);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), originX), inverseX);
+    __m128 enter = _mm_max_ps(_mm_min_ps(t0, t1), zero);
+    __m128 exit = _mm_min_ps(_mm_max_ps(t0, t1), limit);
+    t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), originY), inverseY);
+    t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), originY), inverseY);
+    enter = _mm_max_ps(_mm_min_ps(t0, t1), enter);
+    exit = _mm_min_ps(_mm_max_ps(t0, t1), exit);
+    t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), originZ), inverseZ);
+    t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), originZ), inverseZ);
+    enter = _mm_max_ps(_mm_min_ps(t0, t1), enter);
+    exit = _mm_min_ps(_mm_max_ps(t0, t1), exit);
+    // Rays already blocked don't keep nodes alive
+    if ((_mm_movemask_ps(_mm_cmple_ps(enter, exit)) & ~blocked) == 0) {
+      continue;
+    }
+
+    if (node.count == 0) {
+      stack[depth++] = node.first;
+      stack[depth++] = index + 1;
+      continue;
+    }
+    for (uint32_t i = node.first; i < node.first + node.count; i++) {
+      const glm::vec3 *corners = &vertices[i * 3];
+      glm::vec3 edge1 = corners[1] - corners[0];
+      glm::vec3 edge2 = corners[2] - corners[0];
+      __m128 edge1X = _mm_set1_ps(edge1.x), edge1Y = _mm_set1_ps(edge1.y), edge1Z = _mm_set1_ps(edge1.z);
+      __m128 edge2X = _mm_set1_ps(edge2.x), edge2Y = _mm_set1_ps(edge2.y), edge2Z = _mm_set1_ps(edge2.z);
+
+      // p = direction x edge2
+      __m128 pX = _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y));
+      __m128 pY = _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z));
+      __m128 pZ = _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X));
+      __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, pX), _mm_mul_ps(edge1Y, pY)),
+                                      _mm_mul_ps(edge1Z, pZ));
+      __m128 inverse = _mm_div_ps(one, determinant);
+
+      __m128 sX = _mm_sub_ps(originX, _mm_set1_ps(corners[0].x));
+      __m128 sY = _mm_sub_ps(originY, _mm_set1_ps(corners[0].y));
+      __m128 sZ = _mm_sub_ps(originZ, _mm_set1_ps(corners[0].z));
+      __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, pX), _mm_mul_ps(sY, pY)), _mm_mul_ps(sZ, pZ)),
+                            inverse);
+      // q = s x edge1
+      __m128 qX = _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y));
+      __m128 qY = _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z));
+      __m128 qZ = _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X));
+      __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)),
+                                       _mm_mul_ps(directionZ, qZ)),
+                            inverse);
+      __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)),
+                                       _mm_mul_ps(edge2Z, qZ)),
+                            inverse);
+
+      __m128 hit = _mm_cmpge_ps(_mm_andnot_ps(signBit, determinant), epsilon);
+      hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+      hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+      hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+      hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+      hit = _mm_and_ps(hit, _mm_cmplt_ps(t, limit));
+      blocked |= _mm_movemask_ps(hit);
+    }
+    if (blocked == 0xF) {
+      break;
+    }
+  }
+  return blocked;
+}
+
+const char *TriangleBvh::getSimdName() {
+  return "SSE";
+}
+#else
+int TriangleBvh::occluded4(const glm::vec3 origins[4], const glm::vec3 directions[4], const float tMax[4]) const {
+  return occluded4Scalar(origins, directions, tMax);
+}
+
+const char *TriangleBvh::getSimdName() {
+  return "scalar";
+}
+#endif
+
+} // namespace fred
@@ -0,0 +1,63 @@
+#ifndef FRED_RAYTRACE_H
+#define FRED_RAYTRACE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+
+namespace fred {
+
+struct RayHit {
+  float t;
+  uint32_t triangle; // As it was passed to build
+  float u, v;        // Barycentrics of the second and third corners
+};
+
+// Static triangles for the offline tools, the baker mostly. Built once with a
+// binned SAH, nodes are 32 bytes and leaves hold up to four triangles. Const
+// after build, so any number of threads can trace against it at once.
+class TriangleBvh {
+public:
+  // Three corners per triangle, in world space
+  void build(const std::vector<glm::vec3> &corners);
+
+  // Closest hit in (0, tMax), direction needn't be normalized and t is in
+  // units of it
+  bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float tMax, RayHit &hit) const;
+  // Any hit in (0, tMax), stops at the first one
+  bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, float tMax) const;
+  // Four shadow rays at once, walked down the tree together. Bit i of the
+  // result is set if ray i is blocked. Coherent rays (a tile's worth towards
+  // the sun) share most of their nodes so this beats four occluded calls.
+  int occluded4(const glm::vec3 origins[4], const glm::vec3 directions[4], const float tMax[4]) const;
+  int occluded4Scalar(const glm::vec3 origins[4], const glm::vec3 directions[4], const float tMax[4]) const;
+  static const char *getSimdName();
+
+  size_t getTriangleCount() const { return triangleIds.size(); }
+  size_t getNodeCount() const { return nodes.size(); }
+  int getDepth() const { return depth; } // Of the deepest leaf, the root is 0
+
+private:
+  struct Node {
+    glm::vec3 min;
+    uint32_t first; // Interior nodes, the second child. The first one is right after this.
+    glm::vec3 max;
+    uint32_t count; // 0 for interior nodes, otherwise triangles from first
+  };
+  static_assert(sizeof(Node) == 32, "TriangleBvh nodes should stay at 32 bytes");
+
+  std::vector<Node> nodes;
+  std::vector<glm::vec3> vertices;    // Three per triangle, in leaf order
+  std::vector<uint32_t> triangleIds; // Leaf order back to build order
+  int depth = 0;
+
+  void split(uint32_t node, std::vector<uint32_t> &order, const std::vector<Aabb> &bounds,
+             const std::vector<glm::vec3> &centroids, uint32_t first, uint32_t count, int level);
+};
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,267 @@
+#include <algorithm>
+
+#include <imgui.h>
+
+#include "resources.h"
+
+namespace fred {
+
+ResourceCache resources;
+
+std::string normalizePath(const std::string &path) {
+  std::string unified = path;
+  std::replace(unified.begin(), unified.end(), '\\', '/');
+  bool absolute = !unified.empty() && unified[0] == '/';
+
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (start <= unified.size()) {
+    size_t end = unified.find('/', start);
+    if (end == std::string::npos) {
+      end = unified.size();
+    }
+    std::string part = unified.substr(start, end - start);
+    if (part == "..") {
+      // Leading ..s have nothing to cancel against and have to stay
+      if (!parts.empty() && parts.back() != "..") {
+        parts.pop_back();
+      } else if (!absolute) {
+        parts.push_back(part);
+      }
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    start = end + 1;
+  }
+
+  std::string normalized = absolute ? "/" : "";
+  for (size_t i = 0; i < parts.size(); i++) {
+    normalized += (i == 0 ? "" : "/") + parts[i];
+  }
+  return normalized;
+}
+
+std::shared_ptr<Model> ResourceCache::getModel(const std::string &path, LoadMode mode) {
+  std::string key = "model:" + normalizePath(path);
+  Entry *entry = find(key);
+  if (entry == NULL) {
+    entry = &add(key, ResourceKind::Model);
+    entry->model = std::make_shared<Model>(path, mode);
+  }
+  return entry->model;
+}
+
+std::shared_ptr<Texture> ResourceCache::getTexture(const std::string &path, LoadMode mode) {
+  std::string key = "texture:" + normalizePath(path) + (mode == LoadMode::Async ? "" : "#soil");
+  Entry *entry = find(key);
+  if (entry == NULL) {
+    entry = &add(key, ResourceKind::Texture);
+    entry->texture = std::make_shared<Texture>(path, mode);
+  }
+  return entry->texture;
+}
+
+std::shared_ptr<Shader> ResourceCache::getShader(const std::string &vertPath, const std::string &fragPath,
+                                                 const std::string &instancedVertPath, LoadMode mode) {
+  std::string key = "shader:" + normalizePath(vertPath) + "|" + normalizePath(fragPath);
+  if (!instancedVertPath.empty()) {
+    key += "|" + normalizePath(instancedVertPath);
+  }
+  Entry *entry = find(key);
+  if (entry == NULL) {
+    entry = &add(key, ResourceKind::Shader);
+    entry->shader = std::make_shared<Shader>(vertPath, fragPath, instancedVertPath, mode);
+  }
+  return entry->shader;
+}
+
+std::shared_ptr<Shader> ResourceCache::getShaderVariant(const std::string &vertPath, const std::string &fragPath,
+                                                        uint32_t features) {
+  features &= ~SHADER_INSTANCED;
+  std::string key = "shader:" + normalizePath(vertPath) + "|" + normalizePath(fragPath) + "#" + std::to_string(features);
+  Entry *entry = find(key);
+  if (entry == NULL) {
+    entry = &add(key, ResourceKind::Shader);
+    entry->shader = std::make_shared<Shader>(shaderVariants(vertPath, fragPath), features);
+  }
+  return entry->shader;
+}
+
+ResourceCache::Entry *ResourceCache::find(const std::string &key) {
+  std::unordered_map<std::string, size_t>::iterator found = index.find(key);
+  if (found == index.end()) {
+    return NULL;
+  }
+  Entry &entry = entries[found->second];
+  entry.lastUsed = frame;
+  return &entry;
+}
+
+ResourceCache::Entry &ResourceCache::add(const std::string &key, ResourceKind kind) {
+  index[key] = entries.size();
+  entries.push_back(Entry());
+  Entry &entry = entries.back();
+  entry.key = key;
+  entry.kind = kind;
+  entry.lastUsed = frame;
+  return entry;
+}
+
+long ResourceCache::useCount(const Entry &entry) {
+  switch (entry.kind) {
+  case ResourceKind::Model:
+    return entry.model.use_count();
+  case ResourceKind::Texture:
+    return entry.texture.use_count();
+  default:
+    return entry.shader.use_count();
+  }
+}
+
+bool ResourceCache::isLoaded(const Entry &entry) {
+  switch (entry.kind) {
+  case ResourceKind::Model:
+    return entry.model->isLoaded();
+  case ResourceKind::Texture:
+    return entry.texture->isLoaded();
+  default:
+    return entry.shader->isLoaded();
+  }
+}
+
+void ResourceCache::measure(Entry &entry) {
+  entry.measured = true;
+  if (entry.kind == ResourceKind::Model) {
+    const Model &model = *entry.model;
+    entry.gpuBytes = 0;
+    for (const SubMesh &subMesh : model.subMeshes) {
+      entry.gpuBytes += (size_t)subMesh.vertexCount * model.layout.stride() +
+                        (size_t)subMesh.indexCount * subMesh.indexSize;
+    }
+    // LODs share the vertices, only their indices are extra. A level that
+    // kept its range from the one before gets counted twice, close enough.
+    for (const SubMesh &subMesh : model.lodSubMeshes) {
+      entry.gpuBytes += (size_t)subMesh.indexCount * subMesh.indexSize;
+    }
+    entry.cpuBytes = sizeof(Model) + (model.subMeshes.capacity() + model.lodSubMeshes.capacity()) * sizeof(SubMesh);
+  } else if (entry.kind == ResourceKind::Texture) {
+    // Whatever the driver says the levels are, SOIL2 picks its own formats
+    entry.gpuBytes = 0;
+    glState.bindTexture(0, entry.texture->texture);
+    for (GLint level = 0;; level++) {
+      GLint width = 0, height = 0, compressed = GL_FALSE;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+      if (width == 0 || height == 0) {
+        break;
+      }
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+      if (compressed == GL_TRUE) {
+        GLint size = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        entry.gpuBytes += size;
+      } else {
+        entry.gpuBytes += (size_t)width * height * 4; // RGB8 gets padded to 4 anyway
+      }
+    }
+    entry.cpuBytes = sizeof(Texture);
+  } else {
+    // Program binaries aren't queryable before GL 4.1, not counted
+    entry.gpuBytes = 0;
+    entry.cpuBytes = sizeof(Shader);
+  }
+}
+
+void ResourceCache::evict(size_t slot) {
+  index.erase(entries[slot].key);
+  if (slot != entries.size() - 1) {
+    entries[slot] = std::move(entries.back());
+    index[entries[slot].key] = slot;
+  }
+  entries.pop_back(); // Last handle, the resource goes with it
+  evictions++;
+}
+
+void ResourceCache::update() {
+  frame++;
+  gpuBytes = 0;
+  cpuBytes = 0;
+  for (Entry &entry : entries) {
+    if (!entry.measured && isLoaded(entry)) {
+      measure(entry);
+    }
+    if (entry.kind == ResourceKind::Texture && entry.texture->streamed) {
+      entry.gpuBytes = textureStreamer.getResidentBytes(entry.texture.get()); // Changes as levels come and go
+    }
+    if (useCount(entry) > 1) {
+      entry.lastUsed = frame;
+    }
+    gpuBytes += entry.gpuBytes;
+    cpuBytes += entry.cpuBytes;
+  }
+
+  while (gpuBytes > gpuBudget) {
+    // Oldest of whatever only the cache holds and that actually frees something
+    size_t oldest = entries.size();
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (useCount(entries[i]) == 1 && entries[i].gpuBytes > 0 &&
+          (oldest == entries.size() || entries[i].lastUsed < entries[oldest].lastUsed)) {
+        oldest = i;
+      }
+    }
+    if (oldest == entries.size()) {
+      break; // Everything left is in use
+    }
+    gpuBytes -= entries[oldest].gpuBytes;
+    cpuBytes -= entries[oldest].cpuBytes;
+    evict(oldest);
+  }
+}
+
+void ResourceCache::clear() {
+  entries.clear();
+  index.clear();
+  gpuBytes = 0;
+  cpuBytes = 0;
+}
+
+void ResourceCache::drawWindow() {
+  ImGui::Begin("Resources");
+  const float mebibyte = 1024.0f * 1024.0f;
+  float budget = gpuBudget / mebibyte;
+  if (ImGui::DragFloat("GPU budget (MiB)", &budget, 1.0f, 0.0f, 65536.0f, "%.0f")) {
+    gpuBudget = (size_t)(budget * mebibyte);
+  }
+  ImGui::Text("GPU: %.1f MiB, CPU: %.1f KiB, %d evicted so far", gpuBytes / mebibyte, cpuBytes / 1024.0f, evictions);
+
+  const char *kinds[] = {"Model", "Texture", "Shader"};
+  ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable;
+  if (ImGui::BeginTable("Resources", 6, flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Resource");
+    ImGui::TableSetupColumn("Kind");
+    ImGui::TableSetupColumn("Handles");
+    ImGui::TableSetupColumn("GPU KiB");
+    ImGui::TableSetupColumn("CPU KiB");
+    ImGui::TableSetupColumn("Idle frames");
+    ImGui::TableHeadersRow();
+    for (const Entry &entry : entries) {
+      ImGui::TableNextColumn();
+      ImGui::Text("%s%s", entry.key.c_str() + entry.key.find(':') + 1, isLoaded(entry) ? "" : " (loading)");
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", kinds[(int)entry.kind]);
+      ImGui::TableNextColumn();
+      ImGui::Text("%ld", useCount(entry) - 1); // Not counting the cache
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", entry.gpuBytes / 1024.0f);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", entry.cpuBytes / 1024.0f);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", (int)(frame - entry.lastUsed));
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
+
+} // namespace fred
@@ -0,0 +1,86 @@
+#ifndef FRED_RESOURCES_H
+#define FRED_RESOURCES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "engine.h"
+
+namespace fred {
+
+enum class ResourceKind { Model, Texture, Shader };
+
+// models/./a/../cone.obj and models\cone.obj are both models/cone.obj
+std::string normalizePath(const std::string &path);
+
+// One loaded copy of everything, keyed by normalized path and whatever load
+// flags change the result. Handles are shared_ptrs, the cache holds one of
+// them too, so a resource whose use_count is 1 is only being kept around in
+// case someone asks for it again. Those get evicted least recently used
+// first whenever the GPU side of the cache goes over gpuBudget. Anything
+// still referenced stays, however far over budget that leaves it.
+class ResourceCache {
+public:
+  size_t gpuBudget = (size_t)512 << 20;
+
+  std::shared_ptr<Model> getModel(const std::string &path, LoadMode mode = LoadMode::Async);
+  // Blocking loads go through SOIL2 and come out DXT compressed, async ones
+  // don't, so they're cached separately
+  std::shared_ptr<Texture> getTexture(const std::string &path, LoadMode mode = LoadMode::Async);
+  std::shared_ptr<Shader> getShader(const std::string &vertPath, const std::string &fragPath,
+                                    const std::string &instancedVertPath = "", LoadMode mode = LoadMode::Async);
+  // See variants.h, built on the spot if it wasn't precompiled
+  std::shared_ptr<Shader> getShaderVariant(const std::string &vertPath, const std::string &fragPath, uint32_t features);
+
+  // GL thread, once a frame. Measures anything that finished loading, marks
+  // everything referenced as used and evicts down to the budget.
+  void update();
+  // GL thread, drops the cache's references. Resources with handles elsewhere
+  // live on until those go.
+  void clear();
+
+  size_t getGpuBytes() const { return gpuBytes; }
+  size_t getCpuBytes() const { return cpuBytes; }
+  int getEvictions() const { return evictions; }
+
+  // The "Resources" window, inside an ImGui frame
+  void drawWindow();
+
+private:
+  struct Entry {
+    std::string key;
+    ResourceKind kind;
+    // Just the one matching kind
+    std::shared_ptr<Model> model;
+    std::shared_ptr<Texture> texture;
+    std::shared_ptr<Shader> shader;
+    bool measured = false;
+    size_t gpuBytes = 0; // Estimated from sizes and formats, drivers pad
+    size_t cpuBytes = 0;
+    uint64_t lastUsed = 0; // Frame
+  };
+
+  std::unordered_map<std::string, size_t> index; // Key to entries
+  std::vector<Entry> entries;
+  uint64_t frame = 0;
+  size_t gpuBytes = 0;
+  size_t cpuBytes = 0;
+  int evictions = 0;
+
+  Entry *find(const std::string &key);
+  Entry &add(const std::string &key, ResourceKind kind);
+  static long useCount(const Entry &entry); // The cache's own handle included
+  static bool isLoaded(const Entry &entry);
+  void measure(Entry &entry);
+  void evict(size_t entry);
+};
+
+extern ResourceCache resources;
+
+} // namespace fred
+
+#endif
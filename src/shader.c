@@ -1,6 +1,8 @@
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <clog/extra.h>
 
@@ -22,107 +24,349 @@ errno_t fopen_s(FILE **f, const char *name,
 } // God is here: https://stackoverflow.com/questions/1513209/is-there-a-way-to-use-fopen-s-with-gcc-or-at-least-create-a-define-about-it
 #endif
 #ifdef _WIN32
+#include <direct.h>
 #include <io.h>
 #define lseek _lseek
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
 #endif
 
-GLuint loadShaders(const char *vertex_file_path,
-                   const char *fragment_file_path) {
-  GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-  GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+#include "shader.h"
 
+char *readShaderFile(const char *path) {
   errno_t err;
 
-  FILE *vertexShaderFD;
-  if ((err = fopen_s(&vertexShaderFD, vertex_file_path, "rb"))) {
-    clog_log(CLOG_LEVEL_ERROR, "Failed to open Vertex Shader \"%s\": %d\n",
-             vertex_file_path, err);
+  FILE *shaderFD;
+  if ((err = fopen_s(&shaderFD, path, "rb"))) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to open Shader \"%s\": %d\n", path,
+             err);
+    return NULL;
+  }
+  int shaderLength = lseek(fileno(shaderFD), 0L, SEEK_END) + 1;
+  fseek(shaderFD, 0L, SEEK_SET);
+  char *shaderCode = (char *)calloc(shaderLength, sizeof(char));
+  fread(shaderCode, sizeof(*shaderCode), shaderLength, shaderFD);
+  fclose(shaderFD);
+  return shaderCode;
+}
+
+/* Program binary cache ===================================================== */
+
+#define SHADER_CACHE_MAGIC 0x47525046u /* "FPRG" */
+#define SHADER_CACHE_VERSION 1u
+
+typedef struct ShaderCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format; /* What glGetProgramBinary said, GLenum */
+  uint32_t length;
+} ShaderCacheHeader;
+
+static char shaderCacheDirectory[512] = "shader_cache";
+static int shaderCacheChecked = 0;
+static int shaderCacheUsable = 0;
+static uint64_t driverHash = 0;
+static ShaderCacheStats cacheStats;
+
+static uint64_t fnv1a(uint64_t hash, const char *data) {
+  /* The terminator goes in too, so "ab" + "c" and "a" + "bc" differ */
+  do {
+    hash ^= (unsigned char)*data;
+    hash *= 0x100000001b3ull;
+  } while (*data++ != '\0');
+  return hash;
+}
+
+/* Binaries only load back into the driver that made them, so the driver
+   strings go into every key. Also where parallel compiles get turned on. */
+static void checkShaderCache(void) {
+  if (shaderCacheChecked) {
+    return;
+  }
+  shaderCacheChecked = 1;
+
+  driverHash = 0xcbf29ce484222325ull;
+  driverHash = fnv1a(driverHash, (const char *)glGetString(GL_VENDOR));
+  driverHash = fnv1a(driverHash, (const char *)glGetString(GL_RENDERER));
+  driverHash = fnv1a(driverHash, (const char *)glGetString(GL_VERSION));
+
+  GLint formats = 0;
+  if (GLAD_GL_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  }
+  shaderCacheUsable = formats > 0 && shaderCacheDirectory[0] != '\0';
+  if (shaderCacheUsable) {
+    makeDirectory(shaderCacheDirectory); /* Fails harmlessly if it's there */
+  } else {
+    clog_log(CLOG_LEVEL_DEBUG, "No program binary support, shader cache off\n");
+  }
+
+  /* Let the driver use as many threads as it likes */
+  if (GLAD_GL_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  } else if (GLAD_GL_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  }
+}
+
+void setShaderCacheDirectory(const char *path) {
+  if (path == NULL) {
+    shaderCacheDirectory[0] = '\0';
+  } else {
+    snprintf(shaderCacheDirectory, sizeof(shaderCacheDirectory), "%s", path);
+  }
+  shaderCacheChecked = 0;
+}
+
+ShaderCacheStats getShaderCacheStats(void) {
+  return cacheStats;
+}
+
+static uint64_t programKey(const ShaderProgramSource *source) {
+  uint64_t hash = driverHash;
+  hash = fnv1a(hash, source->vertex_code);
+  hash = fnv1a(hash, source->fragment_code);
+  hash = fnv1a(hash, source->defines != NULL ? source->defines : "");
+  return hash;
+}
+
+static void cachePath(uint64_t key, char *path, size_t size) {
+  snprintf(path, size, "%s/%016llx.bin", shaderCacheDirectory, (unsigned long long)key);
+}
+
+/* Returns 0 unless there was a binary and the driver took it */
+static GLuint loadCachedProgram(uint64_t key) {
+  char path[600];
+  cachePath(key, path, sizeof(path));
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
     return 0;
   }
-  int vertexShaderLength = lseek(fileno(vertexShaderFD), 0L, SEEK_END) + 1;
-  fseek(vertexShaderFD, 0L, SEEK_SET);
-  char *vertexShaderCode = (char *)calloc(vertexShaderLength, sizeof(char));
-  fread(vertexShaderCode, sizeof(*vertexShaderCode), vertexShaderLength,
-        vertexShaderFD);
-  fclose(vertexShaderFD);
-
-  FILE *fragmentShaderFD;
-  if ((err = fopen_s(&fragmentShaderFD, fragment_file_path, "rb"))) {
-    clog_log(CLOG_LEVEL_ERROR, "Failed to open Vertex Shader \"%s\": %d\n",
-             fragment_file_path, err);
+  ShaderCacheHeader header;
+  void *binary = NULL;
+  if (fread(&header, sizeof(header), 1, file) == 1 &&
+      header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION) {
+    binary = malloc(header.length);
+    if (fread(binary, 1, header.length, file) != header.length) {
+      free(binary);
+      binary = NULL;
+    }
+  }
+  fclose(file);
+  if (binary == NULL) {
     return 0;
   }
-  int fragmentShaderLength = lseek(fileno(fragmentShaderFD), 0L, SEEK_END) + 1;
-  fseek(fragmentShaderFD, 0L, SEEK_SET);
-  char *fragmentShaderCode = (char *)calloc(fragmentShaderLength, sizeof(char));
-  fread(fragmentShaderCode, sizeof(*fragmentShaderCode), fragmentShaderLength,
-        fragmentShaderFD);
-  fclose(fragmentShaderFD);
 
-  GLint result = GL_FALSE;
-  int infoLogLength;
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, binary, header.length);
+  free(binary);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (linked != GL_TRUE) {
+    /* Driver update that kept its version string, recompile and overwrite */
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
 
-  clog_log(CLOG_LEVEL_DEBUG, "Compiling shader: %s\n", vertex_file_path);
-  char const *vertexShaderCodeConst = vertexShaderCode;
-  glShaderSource(vertexShaderID, 1, &vertexShaderCodeConst, NULL);
-  glCompileShader(vertexShaderID);
+static void storeCachedProgram(uint64_t key, GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  void *binary = malloc(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, NULL, &format, binary);
 
-  glGetShaderiv(vertexShaderID, GL_COMPILE_STATUS, &result);
-  glGetShaderiv(vertexShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
+  char path[600];
+  cachePath(key, path, sizeof(path));
+  FILE *file = fopen(path, "wb");
+  if (file != NULL) {
+    ShaderCacheHeader header = {SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, format, (uint32_t)length};
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary, 1, length, file);
+    fclose(file);
+  }
+  free(binary);
+}
+
+/* Compiling =============================================================== */
+
+/* defines go in right after the #version line, which has to stay first */
+static void shaderSource(GLuint shader, const char *code, const char *defines) {
+  const char *rest = strchr(code, '\n');
+  if (defines == NULL || rest == NULL) {
+    glShaderSource(shader, 1, &code, NULL);
+    return;
+  }
+  rest++;
+  const char *strings[3] = {code, defines, rest};
+  GLint lengths[3] = {(GLint)(rest - code), -1, -1};
+  glShaderSource(shader, 3, strings, lengths);
+}
+
+static int logShaderErrors(GLuint shader, const char *name) {
+  GLint result = GL_FALSE;
+  int infoLogLength;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
   if (infoLogLength > 0) {
     infoLogLength += 1; // Prevents a sub-expression overflow false positive
-    char *vertexShaderErrorMessage = (char *)malloc(
+    char *shaderErrorMessage = (char *)malloc(
         infoLogLength *
         sizeof(char)); // Not all compilers support VLAs, this will do
-    glGetShaderInfoLog(vertexShaderID, infoLogLength - 1, NULL,
-                       vertexShaderErrorMessage);
-    clog_log(CLOG_LEVEL_ERROR, "%s\n", vertexShaderErrorMessage);
-    free(vertexShaderErrorMessage);
+    glGetShaderInfoLog(shader, infoLogLength - 1, NULL, shaderErrorMessage);
+    clog_log(CLOG_LEVEL_ERROR, "%s: %s\n", name, shaderErrorMessage);
+    free(shaderErrorMessage);
   }
+  return result == GL_TRUE;
+}
 
-  clog_log(CLOG_LEVEL_DEBUG, "Compiling shader: %s\n", fragment_file_path);
-  char const *fragmentShaderCodeConst = fragmentShaderCode;
-  glShaderSource(fragmentShaderID, 1, &fragmentShaderCodeConst, NULL);
-  glCompileShader(fragmentShaderID);
-
-  glGetShaderiv(fragmentShaderID, GL_COMPILE_STATUS, &result);
-  glGetShaderiv(fragmentShaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
-  if (infoLogLength > 0) {
-    infoLogLength += 1; // Prevents a sub-expression overflow false positive
-    char *fragmentShaderErrorMessage =
-        (char *)malloc(infoLogLength * sizeof(char));
-    glGetShaderInfoLog(fragmentShaderID, infoLogLength - 1, NULL,
-                       fragmentShaderErrorMessage);
-    clog_log(CLOG_LEVEL_ERROR, "%s\n", fragmentShaderErrorMessage);
-    free(fragmentShaderErrorMessage);
-  }
-
-  clog_log(CLOG_LEVEL_DEBUG, "Linking shader program\n");
-  GLuint programID = glCreateProgram();
-  glAttachShader(programID, vertexShaderID);
-  glAttachShader(programID, fragmentShaderID);
-  glLinkProgram(programID);
-
-  glGetProgramiv(programID, GL_COMPILE_STATUS, &result);
-  glGetProgramiv(programID, GL_INFO_LOG_LENGTH, &infoLogLength);
+static int logProgramErrors(GLuint program, const char *name) {
+  GLint result = GL_FALSE;
+  int infoLogLength;
+  glGetProgramiv(program, GL_LINK_STATUS, &result);
+  glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
   if (infoLogLength > 0) {
     infoLogLength += 1; // Prevents a sub-expression overflow false positive
     char *programErrorMessage = (char *)malloc(infoLogLength * sizeof(char));
-    ;
-    glGetProgramInfoLog(programID, infoLogLength - 1, NULL,
-                        programErrorMessage);
-    clog_log(CLOG_LEVEL_ERROR, "%s\n", programErrorMessage);
+    glGetProgramInfoLog(program, infoLogLength - 1, NULL, programErrorMessage);
+    clog_log(CLOG_LEVEL_ERROR, "%s: %s\n", name, programErrorMessage);
     free(programErrorMessage);
   }
+  return result == GL_TRUE;
+}
+
+void buildShaderPrograms(ShaderProgramSource *sources, int count) {
+  double start = glfwGetTime();
+  checkShaderCache();
+
+  int hits = 0;
+  int misses = 0;
+  uint64_t *keys = (uint64_t *)calloc(count, sizeof(uint64_t));
+  GLuint *shaders = (GLuint *)calloc(count * 2, sizeof(GLuint));
+
+  /* Cache first, whatever's left gets compiled */
+  for (int i = 0; i < count; i++) {
+    sources[i].program = 0;
+    if (shaderCacheUsable) {
+      keys[i] = programKey(&sources[i]);
+      sources[i].program = loadCachedProgram(keys[i]);
+    }
+    if (sources[i].program != 0) {
+      hits++;
+    }
+  }
+
+  /* Every compile and link goes to the driver before any status is asked
+     for. Asking blocks until that one's done, so with a parallel compiling
+     driver the rest keep going in the meantime. */
+  for (int i = 0; i < count; i++) {
+    if (sources[i].program != 0) {
+      continue;
+    }
+    misses++;
+    clog_log(CLOG_LEVEL_DEBUG, "Compiling shader: %s\n", sources[i].vertex_name);
+    shaders[i * 2] = glCreateShader(GL_VERTEX_SHADER);
+    shaderSource(shaders[i * 2], sources[i].vertex_code, sources[i].defines);
+    glCompileShader(shaders[i * 2]);
+    clog_log(CLOG_LEVEL_DEBUG, "Compiling shader: %s\n", sources[i].fragment_name);
+    shaders[i * 2 + 1] = glCreateShader(GL_FRAGMENT_SHADER);
+    shaderSource(shaders[i * 2 + 1], sources[i].fragment_code, sources[i].defines);
+    glCompileShader(shaders[i * 2 + 1]);
+  }
+  for (int i = 0; i < count; i++) {
+    if (shaders[i * 2] == 0) {
+      continue;
+    }
+    GLuint programID = glCreateProgram();
+    if (shaderCacheUsable) {
+      glProgramParameteri(programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(programID, shaders[i * 2]);
+    glAttachShader(programID, shaders[i * 2 + 1]);
+    glLinkProgram(programID);
+    sources[i].program = programID;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (shaders[i * 2] == 0) {
+      continue;
+    }
+    GLuint programID = sources[i].program;
+    int compiled = logShaderErrors(shaders[i * 2], sources[i].vertex_name);
+    compiled = logShaderErrors(shaders[i * 2 + 1], sources[i].fragment_name) && compiled;
+    int linked = logProgramErrors(programID, sources[i].vertex_name);
+
+    glDetachShader(programID, shaders[i * 2]);
+    glDetachShader(programID, shaders[i * 2 + 1]);
+    glDeleteShader(shaders[i * 2]);
+    glDeleteShader(shaders[i * 2 + 1]);
+
+    if (!compiled || !linked) {
+      glDeleteProgram(programID);
+      sources[i].program = 0;
+    } else if (shaderCacheUsable) {
+      storeCachedProgram(keys[i], programID);
+    }
+  }
+
+  free(keys);
+  free(shaders);
 
-  glDetachShader(programID, vertexShaderID);
-  glDetachShader(programID, fragmentShaderID);
+  double ms = (glfwGetTime() - start) * 1000.0;
+  cacheStats.hits += hits;
+  cacheStats.misses += misses;
+  cacheStats.milliseconds += ms;
+  clog_log(CLOG_LEVEL_DEBUG, "Shader programs: %d cached, %d compiled, %.2f ms\n", hits, misses, ms);
+}
 
-  glDeleteShader(vertexShaderID);
-  glDeleteShader(fragmentShaderID);
+GLuint compileShaderProgram(const char *vertex_code, const char *fragment_code,
+                            const char *vertex_name,
+                            const char *fragment_name) {
+  ShaderProgramSource source = {vertex_code, fragment_code, vertex_name, fragment_name, NULL, 0};
+  buildShaderPrograms(&source, 1);
+  return source.program;
+}
 
-  free(vertexShaderCode);
-  free(fragmentShaderCode);
+void loadShaderPrograms(ShaderProgramFiles *files, int count) {
+  ShaderProgramSource *sources = (ShaderProgramSource *)calloc(count, sizeof(ShaderProgramSource));
+  int *fileIndices = (int *)calloc(count, sizeof(int));
+  int readable = 0;
+  for (int i = 0; i < count; i++) {
+    files[i].program = 0;
+    char *vertexShaderCode = readShaderFile(files[i].vertex_file_path);
+    char *fragmentShaderCode = readShaderFile(files[i].fragment_file_path);
+    if (vertexShaderCode == NULL || fragmentShaderCode == NULL) {
+      free(vertexShaderCode);
+      free(fragmentShaderCode);
+      continue;
+    }
+    ShaderProgramSource source = {vertexShaderCode, fragmentShaderCode,
+                                  files[i].vertex_file_path, files[i].fragment_file_path,
+                                  files[i].defines, 0};
+    fileIndices[readable] = i;
+    sources[readable++] = source;
+  }
 
-  return programID;
+  buildShaderPrograms(sources, readable);
+
+  for (int i = 0; i < readable; i++) {
+    files[fileIndices[i]].program = sources[i].program;
+    free((char *)sources[i].vertex_code);
+    free((char *)sources[i].fragment_code);
+  }
+  free(fileIndices);
+  free(sources);
+}
+
+GLuint loadShaders(const char *vertex_file_path,
+                   const char *fragment_file_path) {
+  ShaderProgramFiles files = {vertex_file_path, fragment_file_path, NULL, 0};
+  loadShaderPrograms(&files, 1);
+  return files.program;
 }
@@ -7,8 +7,49 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+    // No defines, so nothing that reads FrameData. The engine's shaders go
+    // through the batch functions below with FRAME_DATA_GLSL.
     GLuint loadShaders(const char* vertex_file_path,
         const char* fragment_file_path);
+    // The two halves of loadShaders. Reading touches no GL so it can happen
+    // on any thread, the result is NULL terminated and freed with free().
+    char* readShaderFile(const char* path);
+    GLuint compileShaderProgram(const char* vertex_code,
+        const char* fragment_code, const char* vertex_name,
+        const char* fragment_name);
+
+    // Batches. Every compile and link is handed to the driver before any
+    // status is read back, so drivers that compile in parallel get to.
+    // program comes back 0 for anything that failed, errors are logged.
+    typedef struct ShaderProgramSource {
+        const char* vertex_code;
+        const char* fragment_code;
+        const char* vertex_name; // Only for the log
+        const char* fragment_name;
+        const char* defines; // Optional "#define X\n" lines, go in after #version
+        GLuint program;
+    } ShaderProgramSource;
+    void buildShaderPrograms(ShaderProgramSource* sources, int count);
+
+    typedef struct ShaderProgramFiles {
+        const char* vertex_file_path;
+        const char* fragment_file_path;
+        const char* defines; // Optional, as above
+        GLuint program;
+    } ShaderProgramFiles;
+    void loadShaderPrograms(ShaderProgramFiles* files, int count);
+
+    // Linked programs are saved with glGetProgramBinary and loaded back when
+    // the sources, defines and driver all match. Relative to the working
+    // directory, "shader_cache" by default, NULL turns it off.
+    void setShaderCacheDirectory(const char* path);
+
+    typedef struct ShaderCacheStats {
+        int hits;
+        int misses;
+        double milliseconds; // In the build functions, hits and misses both
+    } ShaderCacheStats;
+    ShaderCacheStats getShaderCacheStats(void);
 #ifdef __cplusplus
 }
 #endif
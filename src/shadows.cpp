@@ -0,0 +1,206 @@
+#include "shadows.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "glstate.h"
+#include "shader.h"
+
+namespace fred {
+
+// Fitting ================================================================== //
+
+// Any up that isn't the light direction will do, it only spins the map
+static glm::vec3 lightUp(const glm::vec3 &direction) {
+  return fabsf(direction.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+}
+
+void ShadowMaps::place(Cascade &cascade, const glm::vec3 &center, float radius) {
+  cascade.radius = radius * (1.0f + padding);
+
+  // Snapped to whole texels across the light, so a cascade that does get
+  // redrawn somewhere else rasterizes the same edges instead of crawling
+  glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), lightDirection, lightUp(lightDirection));
+  float texel = 2.0f * cascade.radius / resolution;
+  glm::vec3 lightSpace = glm::vec3(rotation * glm::vec4(center, 1.0f));
+  lightSpace.x = floorf(lightSpace.x / texel) * texel;
+  lightSpace.y = floorf(lightSpace.y / texel) * texel;
+  cascade.center = glm::vec3(glm::inverse(rotation) * glm::vec4(lightSpace, 1.0f));
+
+  // The box runs casterReach past the sphere towards the sun, anything
+  // further out than that is flattened onto the near plane by depth clamping
+  float back = cascade.radius + casterReach;
+  glm::mat4 view = glm::lookAt(cascade.center - lightDirection * back, cascade.center, lightUp(lightDirection));
+  glm::mat4 projection = glm::ortho(-cascade.radius, cascade.radius, -cascade.radius, cascade.radius, 0.0f,
+                                    back + cascade.radius);
+  cascade.viewProjection = projection * view;
+  cascade.casterFrustum = Frustum::fromMatrix(cascade.viewProjection);
+  cascade.valid = false;
+}
+
+void ShadowMaps::fit(const DirectionalLight &sun, const glm::mat4 &view, const glm::mat4 &projection) {
+  stats = ShadowStats();
+  glm::vec3 direction = glm::normalize(sun.direction);
+  bool relight = direction != lightDirection || resolution != textureResolution;
+  lightDirection = direction;
+
+  // Straight out of glm::perspective, like LightGrid does it
+  float nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  float farPlane = std::min(projection[3][2] / (projection[2][2] + 1.0f), std::max(distance, nearPlane * 2.0f));
+  // Half the diagonal of the view at a depth of one
+  float spread = sqrtf(1.0f / (projection[0][0] * projection[0][0]) + 1.0f / (projection[1][1] * projection[1][1]));
+  glm::mat4 inverseView = glm::inverse(view);
+
+  float start = nearPlane;
+  for (int i = 0; i < SHADOW_CASCADES; i++) {
+    float t = (float)(i + 1) / SHADOW_CASCADES;
+    float even = nearPlane + (farPlane - nearPlane) * t;
+    float logarithmic = nearPlane * powf(farPlane / nearPlane, t);
+    float end = even + (logarithmic - even) * splitLambda;
+
+    // Smallest sphere through all eight corners of the slice. It sits on the
+    // view axis, so it's the same size whichever way the camera points.
+    float depth = std::min((start + end) * 0.5f * (1.0f + spread * spread), end);
+    float radius = sqrtf((end - depth) * (end - depth) + spread * end * spread * end);
+    glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -depth, 1.0f));
+
+    Cascade &cascade = cascades[i];
+    cascade.end = end;
+    bool covered = glm::length(center - cascade.center) + radius <= cascade.radius;
+    bool oversized = cascade.radius > radius * (1.0f + padding) * 1.01f;
+    if (relight || !caching || !covered || oversized) {
+      place(cascade, center, radius);
+    }
+    start = end;
+  }
+}
+
+bool ShadowMaps::needsDraw(int cascade, uint64_t casterHash) {
+  Cascade &entry = cascades[cascade];
+  if (caching && entry.valid && entry.casterHash == casterHash) {
+    return false;
+  }
+  // The caller draws it straight after
+  entry.casterHash = casterHash;
+  entry.valid = true;
+  return true;
+}
+
+void ShadowMaps::fillUniforms(FrameUniforms &frame, const DirectionalLight &sun, const glm::mat4 &view) const {
+  glm::mat4 inverseView = glm::inverse(view);
+  // Clip space to texture coordinates and depth
+  glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+  for (int i = 0; i < SHADOW_CASCADES; i++) {
+    frame.shadowMatrices[i] = bias * cascades[i].viewProjection * inverseView;
+    frame.cascadeEnds[i] = cascades[i].end;
+    frame.cascadeTexels[i] = 2.0f * cascades[i].radius / resolution;
+  }
+  glm::vec3 towardsSun = -glm::normalize(glm::mat3(view) * sun.direction);
+  frame.sunDirection = glm::vec4(towardsSun, sun.castsShadows ? 1.0f : 0.0f);
+  frame.sunColor = glm::vec4(sun.color * sun.intensity, 0.0f);
+}
+
+// Drawing ================================================================== //
+
+void ShadowMaps::bind() {
+  if (texture == 0 || textureResolution != resolution) {
+    if (texture == 0) {
+      glGenTextures(1, &texture);
+      glGenFramebuffers(1, &framebuffer);
+    }
+    glState.bindTexture(SHADOW_MAP_UNIT, texture, GL_TEXTURE_2D_ARRAY);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADES, 0,
+                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    // Hardware PCF, and anything off the edge of a cascade is lit
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    textureResolution = resolution; // fit has already thrown the cascades away
+  }
+  glState.bindTexture(SHADOW_MAP_UNIT, texture, GL_TEXTURE_2D_ARRAY);
+}
+
+void ShadowMaps::beginDraw(int cascade) {
+  bind();
+  if (stats.cascadesDrawn == 0) {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0, 0, resolution, resolution);
+    glEnable(GL_DEPTH_CLAMP);
+    // Slope scaled, the normal offset in the shader does the rest
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+  }
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  stats.cascadesDrawn++;
+}
+
+void ShadowMaps::endDraw() {
+  if (stats.cascadesDrawn == 0) {
+    return;
+  }
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_DEPTH_CLAMP);
+  glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+  glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+void ShadowMaps::destroy() {
+  glDeleteTextures(1, &texture);
+  glDeleteFramebuffers(1, &framebuffer);
+  texture = 0;
+  framebuffer = 0;
+  textureResolution = 0;
+  for (Cascade &cascade : cascades) {
+    cascade.valid = false;
+  }
+}
+
+// Default depth program ==================================================== //
+
+static GLuint depthProgram = 0;
+
+static const char *depthVertexCode =
+    "#version 330 core\n"
+    "layout(location = 0) in vec3 vertexPosition_modelspace;\n"
+    "layout(location = 3) in mat4 instanceModel;\n"
+    "void main() {\n"
+    "    gl_Position = vp * instanceModel * vec4(vertexPosition_modelspace, 1);\n"
+    "}\n";
+
+static const char *depthFragmentCode =
+    "#version 330 core\n"
+    "void main() {\n"
+    "}\n";
+
+GLuint defaultDepthProgram() {
+  if (depthProgram == 0) {
+    // FrameData comes in as the defines
+    ShaderProgramSource source = {depthVertexCode, depthFragmentCode, "depth.vert", "depth.frag", FRAME_DATA_GLSL, 0};
+    buildShaderPrograms(&source, 1);
+    depthProgram = source.program;
+    setupProgramInterface(depthProgram);
+  }
+  return depthProgram;
+}
+
+void destroyDefaultDepthProgram() {
+  if (depthProgram != 0) {
+    glState.forgetProgram(depthProgram);
+    glDeleteProgram(depthProgram);
+    depthProgram = 0;
+  }
+}
+
+} // namespace fred
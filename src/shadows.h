@@ -0,0 +1,103 @@
+#ifndef FRED_SHADOWS_H
+#define FRED_SHADOWS_H
+
+#include <stdint.h>
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "uniforms.h"
+
+namespace fred {
+
+// Infinitely far away, lights everything from one direction. Only the LIT
+// shaders use it.
+struct DirectionalLight {
+  glm::vec3 direction = glm::vec3(-0.4f, -1.0f, -0.3f); // The way the light travels, needn't be normalized
+  glm::vec3 color = glm::vec3(1.0f);
+  float intensity = 0.0f; // 0 turns it off
+  bool castsShadows = true;
+};
+
+struct ShadowStats {
+  int cascadesDrawn = 0; // The rest came out of the cache untouched
+  int casters = 0;       // Instances drawn over every cascade that was redrawn
+  int drawCalls = 0;
+  double cpuMs = 0.0;    // Fitting, gathering casters and issuing the draws
+};
+
+// Cascaded shadow maps for the sun, one layer of a depth texture array per
+// cascade. Each cascade is an orthographic box around a bounding sphere of
+// its slice of the view, so it doesn't change size as the camera turns, and
+// it's padded so it can stay put while the camera moves about inside it. A
+// cascade only gets drawn again when the camera leaves that room, the sun
+// moves, or the hash of what's casting into it changes, so static scenes
+// cost nothing past the first frame.
+class ShadowMaps {
+public:
+  int resolution = 2048;
+  float distance = 60.0f;    // Shadows stop this far from the camera
+  float splitLambda = 0.75f; // 0 splits evenly, 1 logarithmically
+  float casterReach = 50.0f; // How far towards the sun casters are picked up from
+  float padding = 0.15f;     // Extra radius each cascade is drawn with, for the cache
+  bool caching = true;
+
+  ShadowMaps() = default;
+  ShadowMaps(const ShadowMaps &) = delete;
+  ShadowMaps &operator=(const ShadowMaps &) = delete;
+
+  // CPU. Splits the view up to distance and refits any cascade the camera
+  // has moved out of. Perspective projections only.
+  void fit(const DirectionalLight &sun, const glm::mat4 &view, const glm::mat4 &projection);
+  // What to gather casters with for a cascade, stretched towards the sun
+  const Frustum &getCasterFrustum(int cascade) const { return cascades[cascade].casterFrustum; }
+  // Takes a hash of everything gathered for a cascade, true if it has to be
+  // drawn again
+  bool needsDraw(int cascade, uint64_t casterHash);
+  // World to the cascade's clip space, for its FrameData
+  const glm::mat4 &getViewProjection(int cascade) const { return cascades[cascade].viewProjection; }
+  // The shadow half of FrameData, cascades and sun
+  void fillUniforms(FrameUniforms &frame, const DirectionalLight &sun, const glm::mat4 &view) const;
+
+  // GL thread. Targets a cascade's layer and clears it, the caller draws
+  // the casters. endDraw puts the framebuffer and viewport back.
+  void beginDraw(int cascade);
+  void endDraw();
+  // GL thread, every frame the sun casts shadows, even if nothing was drawn
+  void bind();
+  void destroy();
+
+  ShadowStats stats; // Filled in by whoever draws the casters, reset by fit
+
+private:
+  struct Cascade {
+    glm::vec3 center = glm::vec3(0.0f); // World space, what the map covers
+    float radius = 0.0f;                // Padded
+    float end = 0.0f;                   // View depth the cascade is used up to
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    Frustum casterFrustum;
+    uint64_t casterHash = 0;
+    bool valid = false; // Drawn, and still what the texture holds
+  };
+
+  Cascade cascades[SHADOW_CASCADES];
+  glm::vec3 lightDirection = glm::vec3(0.0f);
+  int textureResolution = 0;
+
+  GLuint texture = 0;
+  GLuint framebuffer = 0;
+  GLint savedFramebuffer = 0;
+  GLint savedViewport[4];
+
+  void place(Cascade &cascade, const glm::vec3 &center, float radius);
+};
+
+// Positions only, instanced, writes nothing but depth. For shaders without
+// a DEPTH_ONLY variant of their own. Owned here, see destroyDefaultDepthProgram.
+GLuint defaultDepthProgram();
+void destroyDefaultDepthProgram();
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,312 @@
+#include "simplify.h"
+
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+namespace fred {
+
+static const uint32_t NONE = ~0u;
+
+// Symmetric 4x4, the sum of squared distances to a set of planes, each
+// weighted by the area of the triangle it came from
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+  double weight = 0;
+
+  void addPlane(const glm::vec3 &normal, double d, double area) {
+    a00 += area * normal.x * normal.x;
+    a01 += area * normal.x * normal.y;
+    a02 += area * normal.x * normal.z;
+    a03 += area * normal.x * d;
+    a11 += area * normal.y * normal.y;
+    a12 += area * normal.y * normal.z;
+    a13 += area * normal.y * d;
+    a22 += area * normal.z * normal.z;
+    a23 += area * normal.z * d;
+    a33 += area * d * d;
+    weight += area;
+  }
+  void add(const Quadric &other) {
+    a00 += other.a00, a01 += other.a01, a02 += other.a02, a03 += other.a03, a11 += other.a11;
+    a12 += other.a12, a13 += other.a13, a22 += other.a22, a23 += other.a23, a33 += other.a33;
+    weight += other.weight;
+  }
+  // Mean squared distance from p to the planes
+  double error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double sum = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x + a11 * y * y + 2 * a12 * y * z +
+                 2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+    return weight > 0 ? std::max(sum, 0.0) / weight : 0.0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const glm::vec3 &position) const {
+    uint32_t bits[3];
+    memcpy(bits, &position, sizeof(bits));
+    return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+  }
+};
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  double error;
+
+  bool operator<(const Collapse &other) const { return error < other.error; }
+};
+
+static glm::vec3 triangleNormal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c) {
+  return glm::cross(b - a, c - a);
+}
+
+// Collapses edges of one submesh until targetCount indices are left or the
+// cheapest collapse would move the surface further than errorLimit
+// (squared). indices are relative to positions and rewritten in place.
+static void simplify(const glm::vec3 *positions, uint32_t vertexCount, std::vector<uint32_t> &indices,
+                     size_t targetCount, double errorLimit) {
+  // Seams split vertices that sit in the same place, the quadrics and the
+  // topology work on positions so both sides of a seam count as one
+  std::unordered_map<glm::vec3, uint32_t, PositionHash> welds;
+  std::vector<uint32_t> weldOf(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; v++) {
+    weldOf[v] = welds.emplace(positions[v], (uint32_t)welds.size()).first->second;
+  }
+  size_t weldCount = welds.size();
+
+  // Seams, where more than one vertex in a spot is in use, and open borders,
+  // edges only one triangle has, don't move
+  std::vector<bool> locked(weldCount, false);
+  std::vector<uint32_t> user(weldCount, NONE);
+  for (uint32_t index : indices) {
+    uint32_t weld = weldOf[index];
+    if (user[weld] == NONE) {
+      user[weld] = index;
+    } else if (user[weld] != index) {
+      locked[weld] = true;
+    }
+  }
+  std::vector<uint64_t> edges;
+  edges.reserve(indices.size());
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    for (int corner = 0; corner < 3; corner++) {
+      uint64_t a = weldOf[indices[t + corner]], b = weldOf[indices[t + (corner + 1) % 3]];
+      edges.push_back(std::min(a, b) << 32 | std::max(a, b));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for (size_t first = 0; first < edges.size();) {
+    size_t last = first + 1;
+    while (last < edges.size() && edges[last] == edges[first]) {
+      last++;
+    }
+    if (last - first != 2) {
+      locked[edges[first] >> 32] = true;
+      locked[edges[first] & 0xFFFFFFFF] = true;
+    }
+    first = last;
+  }
+
+  std::vector<Quadric> quadrics(weldCount);
+  for (size_t t = 0; t < indices.size(); t += 3) {
+    const glm::vec3 &a = positions[indices[t]];
+    glm::vec3 normal = triangleNormal(a, positions[indices[t + 1]], positions[indices[t + 2]]);
+    float length = glm::length(normal);
+    if (length <= 0.0f) {
+      continue;
+    }
+    normal /= length;
+    double d = -glm::dot(normal, a);
+    for (int corner = 0; corner < 3; corner++) {
+      quadrics[weldOf[indices[t + corner]]].addPlane(normal, d, length * 0.5);
+    }
+  }
+
+  std::vector<uint32_t> remap(vertexCount);
+  std::vector<bool> touched(vertexCount);
+  std::vector<uint32_t> triangleStarts(vertexCount + 1);
+  std::vector<uint32_t> vertexTriangles;
+  std::vector<Collapse> collapses;
+  while (indices.size() > targetCount) {
+    collapses.clear();
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      for (int corner = 0; corner < 3; corner++) {
+        uint32_t a = indices[t + corner], b = indices[t + (corner + 1) % 3];
+        uint32_t weldA = weldOf[a], weldB = weldOf[b];
+        if (weldA == weldB) {
+          continue;
+        }
+        // Both ways round, onto the vertex that's already there
+        Quadric sum = quadrics[weldA];
+        sum.add(quadrics[weldB]);
+        if (!locked[weldA]) {
+          collapses.push_back({a, b, sum.error(positions[b])});
+        }
+        if (!locked[weldB]) {
+          collapses.push_back({b, a, sum.error(positions[a])});
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end());
+
+    // Triangles around each vertex
+    std::fill(triangleStarts.begin(), triangleStarts.end(), 0);
+    for (uint32_t index : indices) {
+      triangleStarts[index + 1]++;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+      triangleStarts[v + 1] += triangleStarts[v];
+    }
+    vertexTriangles.resize(indices.size());
+    std::vector<uint32_t> cursor(triangleStarts.begin(), triangleStarts.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      vertexTriangles[cursor[indices[i]]++] = (uint32_t)(i / 3);
+    }
+
+    // Cheapest first, and nothing that shares a triangle with an earlier
+    // collapse this pass so the flip check sees the real neighbourhood
+    for (uint32_t v = 0; v < vertexCount; v++) {
+      remap[v] = v;
+    }
+    std::fill(touched.begin(), touched.end(), false);
+    size_t removable = (indices.size() - targetCount) / 3;
+    size_t removed = 0;
+    for (const Collapse &collapse : collapses) {
+      if (collapse.error > errorLimit || removed >= removable) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to]) {
+        continue;
+      }
+      bool flips = false;
+      size_t dropped = 0;
+      for (uint32_t i = triangleStarts[collapse.from]; i < triangleStarts[collapse.from + 1] && !flips; i++) {
+        const uint32_t *triangle = &indices[vertexTriangles[i] * 3];
+        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+          dropped++;
+          continue;
+        }
+        glm::vec3 corners[3];
+        for (int corner = 0; corner < 3; corner++) {
+          corners[corner] = positions[triangle[corner]];
+        }
+        glm::vec3 before = triangleNormal(corners[0], corners[1], corners[2]);
+        for (int corner = 0; corner < 3; corner++) {
+          if (triangle[corner] == collapse.from) {
+            corners[corner] = positions[collapse.to];
+          }
+        }
+        flips = glm::dot(before, triangleNormal(corners[0], corners[1], corners[2])) <= 0.0f;
+      }
+      if (flips) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[weldOf[collapse.to]].add(quadrics[weldOf[collapse.from]]);
+      for (uint32_t i = triangleStarts[collapse.from]; i < triangleStarts[collapse.from + 1]; i++) {
+        const uint32_t *triangle = &indices[vertexTriangles[i] * 3];
+        touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+      }
+      removed += dropped;
+    }
+    if (removed == 0) {
+      break;
+    }
+
+    size_t kept = 0;
+    for (size_t t = 0; t < indices.size(); t += 3) {
+      uint32_t a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+      if (a != b && b != c && c != a) {
+        indices[kept++] = a;
+        indices[kept++] = b;
+        indices[kept++] = c;
+      }
+    }
+    indices.resize(kept);
+  }
+}
+
+static void readIndices(const MeshData &mesh, const SubMesh &subMesh, std::vector<uint32_t> &indices) {
+  indices.resize(subMesh.indexCount);
+  const unsigned char *source = &mesh.indices[subMesh.indexOffset];
+  for (uint32_t i = 0; i < subMesh.indexCount; i++) {
+    if (subMesh.indexSize == sizeof(uint16_t)) {
+      uint16_t shortIndex;
+      memcpy(&shortIndex, source + i * sizeof(uint16_t), sizeof(shortIndex));
+      indices[i] = shortIndex;
+    } else {
+      memcpy(&indices[i], source + i * sizeof(uint32_t), sizeof(uint32_t));
+    }
+  }
+}
+
+// Same size and alignment rules as importMesh
+static SubMesh appendIndices(MeshData &mesh, const SubMesh &base, const std::vector<uint32_t> &indices) {
+  SubMesh subMesh = base;
+  mesh.indices.resize((mesh.indices.size() + subMesh.indexSize - 1) & ~(size_t)(subMesh.indexSize - 1), 0);
+  subMesh.indexOffset = mesh.indices.size();
+  subMesh.indexCount = (uint32_t)indices.size();
+  mesh.indices.resize(mesh.indices.size() + indices.size() * subMesh.indexSize);
+  unsigned char *out = &mesh.indices[subMesh.indexOffset];
+  for (uint32_t index : indices) {
+    if (subMesh.indexSize == sizeof(uint16_t)) {
+      uint16_t shortIndex = (uint16_t)index;
+      memcpy(out, &shortIndex, sizeof(shortIndex));
+    } else {
+      memcpy(out, &index, sizeof(index));
+    }
+    out += subMesh.indexSize;
+  }
+  return subMesh;
+}
+
+int generateLods(MeshData &mesh, const LodGenerationSettings &settings) {
+  mesh.lodSubMeshes.clear();
+  float radius = computeBounds(mesh.positions).radius;
+  double errorLimit = (double)settings.maxError * radius * settings.maxError * radius;
+
+  size_t subMeshCount = mesh.subMeshes.size();
+  std::vector<std::vector<uint32_t>> current(subMeshCount);
+  size_t previousTotal = 0;
+  for (size_t s = 0; s < subMeshCount; s++) {
+    readIndices(mesh, mesh.subMeshes[s], current[s]);
+    previousTotal += current[s].size();
+  }
+
+  int levels = std::min(settings.levels, MAX_LODS - 1);
+  int made = 0;
+  std::vector<std::vector<uint32_t>> next;
+  for (int level = 0; level < levels; level++) {
+    next = current;
+    size_t total = 0;
+    for (size_t s = 0; s < subMeshCount; s++) {
+      const SubMesh &subMesh = mesh.subMeshes[s];
+      size_t target = (size_t)(next[s].size() / 3 * settings.ratio) * 3;
+      simplify(&mesh.positions[subMesh.baseVertex], subMesh.vertexCount, next[s], target, errorLimit);
+      total += next[s].size();
+    }
+    // Not worth another draw path for a handful of triangles
+    if (total == 0 || total > previousTotal * 0.85) {
+      break;
+    }
+
+    size_t previousLevel = mesh.lodSubMeshes.size() - (made > 0 ? subMeshCount : 0);
+    for (size_t s = 0; s < subMeshCount; s++) {
+      // A submesh that wouldn't simplify any further keeps the range it had
+      if (next[s].size() == current[s].size()) {
+        SubMesh kept = made > 0 ? mesh.lodSubMeshes[previousLevel + s] : mesh.subMeshes[s];
+        mesh.lodSubMeshes.push_back(kept);
+      } else {
+        mesh.lodSubMeshes.push_back(appendIndices(mesh, mesh.subMeshes[s], next[s]));
+      }
+    }
+    made++;
+    current.swap(next);
+    previousTotal = total;
+  }
+  return made;
+}
+
+} // namespace fred
@@ -0,0 +1,24 @@
+#ifndef FRED_SIMPLIFY_H
+#define FRED_SIMPLIFY_H
+
+#include "mesh.h"
+
+namespace fred {
+
+struct LodGenerationSettings {
+  int levels = MAX_LODS - 1; // Past LOD 0, fewer if the mesh won't simplify any further
+  float ratio = 0.5f;        // Triangles each level keeps of the one before
+  float maxError = 0.05f;    // Furthest a surface may move, as a fraction of the bounding radius
+};
+
+// Quadric error metric edge collapses (Garland and Heckbert), each level
+// simplified from the one before. Vertices only ever collapse onto other
+// vertices, so every level indexes the same vertex buffer and a LOD is
+// just another set of index ranges appended to mesh.indices. UV and normal
+// seams and open borders are locked so nothing tears. Replaces whatever
+// lodSubMeshes the mesh had, returns how many levels it made.
+int generateLods(MeshData &mesh, const LodGenerationSettings &settings);
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,128 @@
+#include "simulation.h"
+
+#include <math.h>
+#include <chrono>
+
+namespace fred {
+
+static SimTransform readTransform(const Transform &transform) {
+  SimTransform value;
+  value.position = transform.getPosition();
+  value.rotation = transform.getRotation();
+  value.scale = transform.getScale();
+  return value;
+}
+
+static bool sameTransform(const SimTransform &a, const SimTransform &b) {
+  return a.position == b.position && a.rotation == b.rotation && a.scale == b.scale;
+}
+
+void Simulation::setStep(SimulationStep stepI, void *userI) {
+  finish();
+  step = stepI;
+  user = userI;
+}
+
+int Simulation::track(Transform &transform) {
+  finish();
+  SimTransform value = readTransform(transform);
+  tracked.push_back(&transform);
+  published.push_back(value);
+  states[0].transforms.push_back(value);
+  states[1].transforms.push_back(value);
+  return (int)tracked.size() - 1;
+}
+
+void Simulation::finish() {
+  jobs.wait(inFlight);
+}
+
+void Simulation::runSteps(int count, float dt) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++) {
+    const SimulationState &previous = states[latest];
+    SimulationState &next = states[1 - latest];
+    next = previous; // Same sizes every time, so no allocation
+    step(previous, next, dt, user);
+    next.step = previous.step + 1;
+    next.time = previous.time + dt;
+    latest = 1 - latest;
+  }
+  ranSteps = count;
+  ranMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Simulation::publish() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  finish();
+  stats.waitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  stats.steps = ranSteps;
+  stats.stepMs = ranMs;
+
+  const SimulationState &current = states[latest];
+  const SimulationState &previous = states[1 - latest];
+  // Only neighbouring steps blend, right after track both states are the same
+  bool blend = interpolate && current.step == previous.step + 1;
+  for (size_t i = 0; i < tracked.size(); i++) {
+    Transform &transform = *tracked[i];
+    SimTransform local = readTransform(transform);
+    if (!sameTransform(local, published[i])) {
+      // Moved from outside, the simulation carries on from there
+      states[0].transforms[i] = local;
+      states[1].transforms[i] = local;
+      published[i] = local;
+      continue;
+    }
+
+    SimTransform value = current.transforms[i];
+    if (blend) {
+      const SimTransform &from = previous.transforms[i];
+      value.position = glm::mix(from.position, value.position, alpha);
+      value.rotation = glm::slerp(from.rotation, value.rotation, alpha);
+      value.scale = glm::mix(from.scale, value.scale, alpha);
+    }
+    // Setting an unchanged value would still bump the revision
+    if (value.position != local.position) {
+      transform.setPosition(value.position);
+    }
+    if (value.rotation != local.rotation) {
+      transform.setRotation(value.rotation);
+    }
+    if (value.scale != local.scale) {
+      transform.setScale(value.scale);
+    }
+    published[i] = value;
+  }
+}
+
+void Simulation::advance(float seconds) {
+  finish();
+  if (step == NULL || timestep <= 0.0f) {
+    return;
+  }
+  accumulator += seconds;
+  int count = (int)floor(accumulator / timestep);
+  if (count > maxSteps) {
+    stats.droppedSteps += count - maxSteps;
+    accumulator -= (count - maxSteps) * (double)timestep;
+    count = maxSteps;
+  }
+  accumulator -= count * (double)timestep;
+  alpha = (float)(accumulator / timestep);
+  ranSteps = 0;
+  ranMs = 0.0;
+  if (count == 0) {
+    return;
+  }
+
+  // Settings can change while the steps run, they get their own timestep
+  float dt = timestep;
+  if (!threaded) {
+    runSteps(count, dt);
+    return;
+  }
+  // One job, the steps run in order
+  jobs.run([this, count, dt] { runSteps(count, dt); }, &inFlight, "Simulation");
+}
+
+} // namespace fred
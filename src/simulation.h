@@ -0,0 +1,103 @@
+#ifndef FRED_SIMULATION_H
+#define FRED_SIMULATION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "jobs.h"
+#include "transform.h"
+
+namespace fred {
+
+// A tracked Transform as the simulation sees it, local like the Transform's
+struct SimTransform {
+  glm::vec3 position = glm::vec3(0.0f);
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+  glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// Everything a step hands over to the renderer. Game state the renderer never
+// sees can live wherever the step likes, only one step runs at a time.
+struct SimulationState {
+  std::vector<SimTransform> transforms; // In the order they were tracked
+  uint64_t step = 0;  // Steps taken to get here
+  double time = 0.0;  // Simulated seconds
+};
+
+// One fixed step. next starts out as a copy of previous. Runs on a worker
+// when the simulation is threaded, so no GL and no touching the scene.
+typedef void (*SimulationStep)(const SimulationState &previous, SimulationState &next, float dt, void *user);
+
+struct SimulationStats {
+  int steps = 0;        // Run for the frame just published
+  int droppedSteps = 0; // So far, time thrown away when a frame needed more than maxSteps
+  double stepMs = 0.0;  // Those steps, on whichever thread ran them
+  double waitMs = 0.0;  // How long publish sat waiting for them
+};
+
+// The game update at a fixed rate, decoupled from the frame rate. State is
+// double buffered: each step reads the last state and writes the other one,
+// and render only ever looks at them between steps. The steps for the next
+// frame are kicked off just before the render list gets built and run as a
+// job while the frame is built, submitted and swapped, so a heavy update
+// costs max(update, frame) instead of the sum. Frames show the last two
+// states blended by however far into the next step the clock is, which puts
+// what's on screen a frame behind the simulation.
+//
+// Anything that moves a tracked transform in between (the gizmo, code
+// between renders) wins over the simulation, the states pick it up.
+class Simulation {
+public:
+  float timestep = 1.0f / 60.0f;
+  int maxSteps = 8;        // A frame longer than this many steps drops the rest
+  bool threaded = true;    // Off steps on the calling thread inside advance
+  bool interpolate = true; // Off snaps to the latest step
+
+  Simulation() = default;
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+  ~Simulation() { finish(); }
+
+  void setStep(SimulationStep stepI, void *userI = NULL);
+  // Starts from where the transform is now. Returns its index into
+  // SimulationState::transforms. It has to stay around for as long as the
+  // simulation gets published.
+  int track(Transform &transform);
+
+  // GL thread, from render. Waits for the steps in flight and writes the
+  // result into the tracked transforms.
+  void publish();
+  // GL thread, from render. Adds seconds of game time and kicks off the
+  // steps that makes whole, then returns.
+  void advance(float seconds);
+  // Waits for the steps in flight, if there are any
+  void finish();
+
+  // Latest state, only safe to read while no steps are in flight
+  const SimulationState &getState() const { return states[latest]; }
+  const SimulationStats &getStats() const { return stats; }
+
+private:
+  SimulationStep step = NULL;
+  void *user = NULL;
+  std::vector<Transform *> tracked;
+  std::vector<SimTransform> published; // What publish last wrote, to spot edits made since
+  SimulationState states[2];
+  int latest = 0;
+  double accumulator = 0.0;
+  float alpha = 1.0f; // Between the last two states, for the steps in flight
+
+  JobCounter inFlight;
+  int ranSteps = 0; // Written by the steps, publish copies them into stats
+  double ranMs = 0.0;
+  SimulationStats stats;
+
+  void runSteps(int count, float dt);
+};
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,273 @@
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include <imgui.h>
+#include <clog/clog.h>
+
+#include "engine.h"
+#include "profiler.h"
+#include "streaming.h"
+
+namespace fred {
+
+TextureStreamer textureStreamer;
+
+// One finer level into a streamed texture. The bytes are already sitting in
+// the mapping, decode just faults them in off the GL thread.
+class StreamLevelJob : public LoadJob {
+public:
+  std::shared_ptr<StreamedTexture> stream;
+  int level;
+
+  StreamLevelJob(std::shared_ptr<StreamedTexture> stream, int level) : stream(stream), level(level) {}
+
+  void decode() override {
+    const CookedTextureLevel &cookedLevel = stream->cooked->levels[level];
+    const unsigned char *data = stream->cooked->levelData(level);
+    volatile unsigned char sink = 0;
+    for (size_t i = 0; i < cookedLevel.size; i += 4096) {
+      sink = sink + data[i];
+    }
+  }
+
+  bool upload(size_t &budgetBytes) override {
+    const CookedTextureLevel &cookedLevel = stream->cooked->levels[level];
+    stagePixels(stream->cooked->levelData(level), cookedLevel.size);
+    glState.bindTexture(0, stream->texture->texture);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, cookedTextureFormat(stream->cooked->format()), cookedLevel.width,
+                           cookedLevel.height, 0, (GLsizei)cookedLevel.size, (void *)0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    budgetBytes -= std::min(budgetBytes, (size_t)cookedLevel.size);
+
+    stream->residentLevel = level;
+    stream->residentBytes += cookedLevel.size;
+    textureStreamer.residentBytes += cookedLevel.size;
+    textureStreamer.inFlightBytes -= cookedLevel.size;
+    stream->pendingLoad.reset();
+    return true;
+  }
+
+  // Cancelled, the texture's gone
+  void discard() override {
+    textureStreamer.inFlightBytes -= stream->cooked->levels[level].size;
+    stream->pendingLoad.reset();
+  }
+};
+
+int TextureStreamer::getTailLevel(const CookedTexture &cooked, uint32_t tailSize) {
+  int level = 0;
+  while (level + 1 < (int)cooked.header->levelCount &&
+         std::max(cooked.levels[level].width, cooked.levels[level].height) > tailSize) {
+    level++;
+  }
+  return level;
+}
+
+void TextureStreamer::add(Texture *texture, const std::string &path, std::unique_ptr<CookedTexture> cooked,
+                          int tailLevel) {
+  std::shared_ptr<StreamedTexture> stream = std::make_shared<StreamedTexture>();
+  stream->texture = texture;
+  stream->path = path;
+  stream->size = std::max(cooked->header->width, cooked->header->height);
+  stream->tailLevel = tailLevel;
+  stream->residentLevel = tailLevel;
+  stream->requestedLevel = tailLevel;
+  stream->nextRequest = tailLevel;
+  stream->lastRequested = frame;
+  for (uint32_t level = tailLevel; level < cooked->header->levelCount; level++) {
+    stream->residentBytes += cooked->levels[level].size;
+  }
+  stream->cooked = std::move(cooked);
+  residentBytes += stream->residentBytes;
+  texture->streamed = true;
+  textures[&texture->texture] = stream;
+}
+
+void TextureStreamer::remove(Texture *texture) {
+  auto found = textures.find(&texture->texture);
+  if (found == textures.end()) {
+    return;
+  }
+  StreamedTexture &stream = *found->second;
+  if (stream.pendingLoad) {
+    stream.pendingLoad->cancelled = true; // Its discard gives inFlightBytes back
+  }
+  residentBytes -= stream.residentBytes;
+  textures.erase(found);
+}
+
+void TextureStreamer::request(const GLuint *texture, float uvPerPixel) {
+  auto found = textures.find(texture);
+  if (found == textures.end()) {
+    return;
+  }
+  StreamedTexture &stream = *found->second;
+  // Level n has 2^n texels to a pixel at level 0
+  int level = 0;
+  if (uvPerPixel > 0.0f) {
+    level = (int)floorf(log2f(uvPerPixel * stream.size) + bias);
+  }
+  level = std::min(std::max(level, 0), stream.tailLevel);
+  stream.nextRequest = std::min(stream.nextRequest, level);
+  stream.lastRequested = frame;
+}
+
+size_t TextureStreamer::levelBytes(const StreamedTexture &stream, int level) const {
+  return stream.cooked->levels[level].size;
+}
+
+void TextureStreamer::dropLevel(StreamedTexture &stream) {
+  int level = stream.residentLevel;
+  glState.bindTexture(0, stream.texture->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+  // Mutable textures only give a level's memory back once it's redefined empty
+  glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  stream.residentLevel++;
+  stream.residentBytes -= levelBytes(stream, level);
+  residentBytes -= levelBytes(stream, level);
+  stats.dropsThisFrame++;
+}
+
+bool TextureStreamer::makeRoom(size_t bytes, const StreamedTexture *keep) {
+  while (residentBytes + inFlightBytes + bytes > budget) {
+    // Finest level of whichever texture has one it didn't ask for and was
+    // drawn longest ago
+    StreamedTexture *victim = NULL;
+    for (auto &entry : textures) {
+      StreamedTexture *stream = entry.second.get();
+      if (stream == keep || stream->pendingLoad || stream->residentLevel >= stream->requestedLevel) {
+        continue;
+      }
+      if (victim == NULL || stream->lastRequested < victim->lastRequested ||
+          (stream->lastRequested == victim->lastRequested &&
+           levelBytes(*stream, stream->residentLevel) > levelBytes(*victim, victim->residentLevel))) {
+        victim = stream;
+      }
+    }
+    if (victim == NULL) {
+      return false;
+    }
+    dropLevel(*victim);
+  }
+  return true;
+}
+
+void TextureStreamer::update() {
+  PROFILE_ZONE("Texture streaming");
+  stats.loadsThisFrame = 0;
+  stats.dropsThisFrame = 0;
+
+  // Last frame's requests become what each texture wants. With streaming off
+  // everything wants level 0 and nothing gets dropped.
+  std::vector<std::shared_ptr<StreamedTexture>> wanting;
+  int loading = 0;
+  for (auto &entry : textures) {
+    StreamedTexture &stream = *entry.second;
+    if (!enabled) {
+      stream.requestedLevel = 0;
+    } else {
+      stream.requestedLevel = stream.lastRequested == frame ? stream.nextRequest : stream.tailLevel;
+    }
+    stream.nextRequest = stream.tailLevel;
+    if (stream.pendingLoad) {
+      loading++;
+    } else if (stream.requestedLevel < stream.residentLevel) {
+      wanting.push_back(entry.second);
+    }
+  }
+  frame++;
+  if (enabled) {
+    makeRoom(0, NULL); // The budget might have gone down
+  }
+
+  // Blurriest first, the biggest jump in quality per byte
+  std::sort(wanting.begin(), wanting.end(), [](const std::shared_ptr<StreamedTexture> &a,
+                                               const std::shared_ptr<StreamedTexture> &b) {
+    int gapA = a->residentLevel - a->requestedLevel;
+    int gapB = b->residentLevel - b->requestedLevel;
+    return gapA != gapB ? gapA > gapB : a->residentLevel > b->residentLevel;
+  });
+  for (const std::shared_ptr<StreamedTexture> &stream : wanting) {
+    if (loading >= maxLoadsInFlight) {
+      break;
+    }
+    int level = stream->residentLevel - 1;
+    size_t bytes = levelBytes(*stream, level);
+    if (enabled && !makeRoom(bytes, stream.get())) {
+      continue; // Something smaller might still fit
+    }
+    stream->pendingLoad = std::make_shared<StreamLevelJob>(stream, level);
+    inFlightBytes += bytes;
+    assetLoader.submit(stream->pendingLoad);
+    loading++;
+    stats.loadsThisFrame++;
+  }
+
+  stats.textures = (int)textures.size();
+  stats.loading = loading;
+  stats.residentBytes = residentBytes;
+  stats.requestedBytes = 0;
+  stats.fullBytes = 0;
+  for (auto &entry : textures) {
+    const StreamedTexture &stream = *entry.second;
+    for (int level = 0; level < (int)stream.cooked->header->levelCount; level++) {
+      size_t bytes = levelBytes(stream, level);
+      stats.fullBytes += bytes;
+      if (level >= stream.requestedLevel) {
+        stats.requestedBytes += bytes;
+      }
+    }
+  }
+}
+
+size_t TextureStreamer::getResidentBytes(const Texture *texture) const {
+  auto found = textures.find(&texture->texture);
+  return found != textures.end() ? found->second->residentBytes : 0;
+}
+
+void TextureStreamer::drawWindow() {
+  ImGui::Begin("Streaming");
+  const float mebibyte = 1024.0f * 1024.0f;
+  ImGui::Checkbox("Stream textures", &enabled);
+  float budgetMiB = budget / mebibyte;
+  if (ImGui::DragFloat("Texture budget (MiB)", &budgetMiB, 1.0f, 0.0f, 65536.0f, "%.0f")) {
+    budget = (size_t)(budgetMiB * mebibyte);
+  }
+  ImGui::SliderFloat("Mip bias", &bias, -2.0f, 2.0f);
+  ImGui::Text("%d textures, %d loading, %d loads and %d drops last frame", stats.textures, stats.loading,
+              stats.loadsThisFrame, stats.dropsThisFrame);
+  ImGui::Text("Resident %.1f MiB, requested %.1f MiB, every level %.1f MiB", stats.residentBytes / mebibyte,
+              stats.requestedBytes / mebibyte, stats.fullBytes / mebibyte);
+
+  ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Resizable;
+  if (ImGui::BeginTable("Streamed textures", 5, flags)) {
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Texture");
+    ImGui::TableSetupColumn("Resident");
+    ImGui::TableSetupColumn("Requested");
+    ImGui::TableSetupColumn("KiB");
+    ImGui::TableSetupColumn("Idle frames");
+    ImGui::TableHeadersRow();
+    for (auto &entry : textures) {
+      const StreamedTexture &stream = *entry.second;
+      const CookedTextureLevel &resident = stream.cooked->levels[stream.residentLevel];
+      const CookedTextureLevel &requested = stream.cooked->levels[stream.requestedLevel];
+      ImGui::TableNextColumn();
+      ImGui::Text("%s%s", stream.path.c_str(), stream.pendingLoad ? " (loading)" : "");
+      ImGui::TableNextColumn();
+      ImGui::Text("%d (%ux%u)", stream.residentLevel, resident.width, resident.height);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d (%ux%u)", stream.requestedLevel, requested.width, requested.height);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f", stream.residentBytes / 1024.0f);
+      ImGui::TableNextColumn();
+      ImGui::Text("%d", (int)(frame - 1 - stream.lastRequested));
+    }
+    ImGui::EndTable();
+  }
+  ImGui::End();
+}
+
+} // namespace fred
@@ -0,0 +1,94 @@
+#ifndef FRED_STREAMING_H
+#define FRED_STREAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <glad/gl.h>
+
+#include "loader.h"
+#include "texture.h"
+
+namespace fred {
+
+// One cooked texture the streamer looks after. Levels residentLevel to the
+// last are on the GPU, GL_TEXTURE_BASE_LEVEL keeps sampling off the rest.
+struct StreamedTexture {
+  Texture *texture;
+  std::string path;
+  std::unique_ptr<CookedTexture> cooked; // Stays mapped so levels can come back in
+  uint32_t size;      // Widest side of level 0, in texels
+  int tailLevel;      // This one and everything coarser never leaves
+  int residentLevel;
+  int requestedLevel; // Finest anything drawn last frame asked for, tailLevel if nothing was
+  int nextRequest;    // This frame's so far
+  uint64_t lastRequested = 0; // Frame
+  size_t residentBytes = 0;
+  std::shared_ptr<LoadJob> pendingLoad; // The next finer level, while it's on its way
+};
+
+struct StreamingStats {
+  int textures = 0;
+  int loading = 0;
+  int loadsThisFrame = 0;
+  int dropsThisFrame = 0;
+  size_t residentBytes = 0;
+  size_t requestedBytes = 0; // If everything had what it asked for
+  size_t fullBytes = 0;      // Every level of every texture
+};
+
+// Cooked textures come up with just their mip tail. Every frame the renderer
+// says how finely each texture it drew gets sampled, and finer levels stream
+// in through the AssetLoader a level at a time from the coarse end. Levels
+// beyond what a texture last asked for stay until the budget needs the room,
+// then go least recently used first.
+class TextureStreamer {
+public:
+  bool enabled = true; // Off has textures loading every level up front again
+  size_t budget = (size_t)256 << 20;
+  uint32_t tailSize = 64; // Levels this wide and under go up with the texture
+  float bias = 0.0f;      // Added to every requested level, negative is sharper
+  int maxLoadsInFlight = 8;
+
+  // First level no wider than tailSize, what a TextureLoadJob puts up
+  static int getTailLevel(const CookedTexture &cooked, uint32_t tailSize);
+  // GL thread. Takes over a texture whose levels from tailLevel down are up.
+  void add(Texture *texture, const std::string &path, std::unique_ptr<CookedTexture> cooked, int tailLevel);
+  void remove(Texture *texture);
+
+  bool isEmpty() const { return textures.empty(); }
+  // From the renderer, for each texture of each draw. uvPerPixel is how much
+  // of the UV square one pixel covers where the draw is closest to the camera.
+  void request(const GLuint *texture, float uvPerPixel);
+  // GL thread, once a frame after the last frame's requests are in
+  void update();
+
+  size_t getResidentBytes(const Texture *texture) const;
+  const StreamingStats &getStats() const { return stats; }
+  // The "Streaming" window, inside an ImGui frame
+  void drawWindow();
+
+private:
+  friend class StreamLevelJob;
+
+  // Keyed by &Texture::texture, which is what assets hold on to
+  std::unordered_map<const GLuint *, std::shared_ptr<StreamedTexture>> textures;
+  uint64_t frame = 0;
+  size_t residentBytes = 0;
+  size_t inFlightBytes = 0;
+  StreamingStats stats;
+
+  size_t levelBytes(const StreamedTexture &stream, int level) const;
+  void dropLevel(StreamedTexture &stream);
+  // Drops levels nobody asked for until bytes more fits, false if it can't
+  bool makeRoom(size_t bytes, const StreamedTexture *keep);
+};
+
+extern TextureStreamer textureStreamer;
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,491 @@
+#include "texture.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#include <clog/clog.h>
+
+namespace fred {
+
+size_t textureBlockSize(TextureFormat format) {
+  return format == TextureFormat::BC1 ? 8 : 16;
+}
+
+size_t textureLevelSize(TextureFormat format, uint32_t width, uint32_t height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * textureBlockSize(format);
+}
+
+TextureUsage guessTextureUsage(const std::string &path) {
+  std::string name = path.substr(path.find_last_of("/\\") + 1);
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+  if (name.find("specular") != std::string::npos) {
+    return TextureUsage::Specular;
+  }
+  if (name.find("normal") != std::string::npos) {
+    return TextureUsage::Normal;
+  }
+  return TextureUsage::Albedo;
+}
+
+// Block encoders =========================================================== //
+
+static void unpack565(uint16_t color, float out[3]) {
+  int r = (color >> 11) & 31;
+  int g = (color >> 5) & 63;
+  int b = color & 31;
+  out[0] = (float)((r << 3) | (r >> 2));
+  out[1] = (float)((g << 2) | (g >> 4));
+  out[2] = (float)((b << 3) | (b >> 2));
+}
+
+static int quantize(float value, int maximum) {
+  return (int)(std::min(std::max(value, 0.0f), 255.0f) * maximum / 255.0f + 0.5f);
+}
+
+static uint16_t pack565(const float color[3]) {
+  return (uint16_t)(quantize(color[0], 31) << 11 | quantize(color[1], 63) << 5 | quantize(color[2], 31));
+}
+
+// Nearest of the four palette entries for each texel, returns the squared error
+static float fitIndices(const float pixels[16][3], uint16_t color0, uint16_t color1, unsigned char indices[16]) {
+  float palette[4][3];
+  unpack565(color0, palette[0]);
+  unpack565(color1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+    palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+  }
+  float error = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float best = 1e30f;
+    for (int p = 0; p < 4; p++) {
+      float dr = pixels[i][0] - palette[p][0];
+      float dg = pixels[i][1] - palette[p][1];
+      float db = pixels[i][2] - palette[p][2];
+      float distance = dr * dr + dg * dg + db * db;
+      if (distance < best) {
+        best = distance;
+        indices[i] = (unsigned char)p;
+      }
+    }
+    error += best;
+  }
+  return error;
+}
+
+void encodeBc1Block(const unsigned char rgba[16 * 4], unsigned char out[8]) {
+  float pixels[16][3];
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++) {
+      pixels[i][c] = rgba[i * 4 + c];
+      mean[c] += pixels[i][c] / 16.0f;
+    }
+  }
+
+  // Principal axis of the colours, a few power iterations on the covariance
+  float covariance[3][3] = {};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {pixels[i][0] - mean[0], pixels[i][1] - mean[1], pixels[i][2] - mean[2]};
+    for (int a = 0; a < 3; a++) {
+      for (int b = 0; b < 3; b++) {
+        covariance[a][b] += d[a] * d[b];
+      }
+    }
+  }
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3];
+    for (int a = 0; a < 3; a++) {
+      next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+    }
+    float length = std::max(fabsf(next[0]), std::max(fabsf(next[1]), fabsf(next[2])));
+    if (length < 1e-6f) {
+      break; // Flat block, any axis will do
+    }
+    for (int a = 0; a < 3; a++) {
+      axis[a] = next[a] / length;
+    }
+  }
+
+  // The texels furthest apart along it are the starting endpoints
+  int minIndex = 0;
+  int maxIndex = 0;
+  float minT = 1e30f;
+  float maxT = -1e30f;
+  for (int i = 0; i < 16; i++) {
+    float t = pixels[i][0] * axis[0] + pixels[i][1] * axis[1] + pixels[i][2] * axis[2];
+    if (t < minT) {
+      minT = t;
+      minIndex = i;
+    }
+    if (t > maxT) {
+      maxT = t;
+      maxIndex = i;
+    }
+  }
+  float endpoint0[3] = {pixels[maxIndex][0], pixels[maxIndex][1], pixels[maxIndex][2]};
+  float endpoint1[3] = {pixels[minIndex][0], pixels[minIndex][1], pixels[minIndex][2]};
+
+  // Then least squares endpoints for the indices they picked, kept if better
+  uint16_t best0 = 0;
+  uint16_t best1 = 0;
+  unsigned char bestIndices[16] = {};
+  float bestError = 1e30f;
+  for (int iteration = 0; iteration < 3; iteration++) {
+    uint16_t color0 = pack565(endpoint0);
+    uint16_t color1 = pack565(endpoint1);
+    if (color0 < color1) {
+      std::swap(color0, color1); // color0 > color1 is the four colour mode
+    }
+    unsigned char indices[16];
+    float error = fitIndices(pixels, color0, color1, indices);
+    if (error < bestError) {
+      bestError = error;
+      best0 = color0;
+      best1 = color1;
+      memcpy(bestIndices, indices, sizeof(indices));
+    }
+    if (color0 == color1) {
+      break;
+    }
+
+    static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {0.0f, 0.0f, 0.0f};
+    float bx[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+      float a = weights[indices[i]];
+      float b = 1.0f - a;
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int c = 0; c < 3; c++) {
+        ax[c] += a * pixels[i][c];
+        bx[c] += b * pixels[i][c];
+      }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f) {
+      break;
+    }
+    for (int c = 0; c < 3; c++) {
+      endpoint0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+      endpoint1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+    }
+  }
+  if (best0 == best1) {
+    // Three colour mode, where index 3 is transparent black
+    memset(bestIndices, 0, sizeof(bestIndices));
+  }
+
+  out[0] = (unsigned char)(best0 & 0xFF);
+  out[1] = (unsigned char)(best0 >> 8);
+  out[2] = (unsigned char)(best1 & 0xFF);
+  out[3] = (unsigned char)(best1 >> 8);
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; i++) {
+    bits |= (uint32_t)bestIndices[i] << (i * 2);
+  }
+  for (int i = 0; i < 4; i++) {
+    out[4 + i] = (unsigned char)(bits >> (i * 8));
+  }
+}
+
+void encodeBc4Block(const unsigned char values[16], unsigned char out[8]) {
+  unsigned char low = 255;
+  unsigned char high = 0;
+  for (int i = 0; i < 16; i++) {
+    low = std::min(low, values[i]);
+    high = std::max(high, values[i]);
+  }
+  // high > low is the eight value mode, equal just repeats one
+  out[0] = high;
+  out[1] = low;
+  float palette[8] = {(float)high, (float)low};
+  for (int p = 2; p < 8; p++) {
+    palette[p] = ((8 - p) * high + (p - 1) * low) / 7.0f;
+  }
+  uint64_t bits = 0;
+  for (int i = 0; i < 16; i++) {
+    uint64_t index = 0;
+    float best = 1e30f;
+    for (int p = 0; p < 8 && high > low; p++) {
+      float distance = fabsf(values[i] - palette[p]);
+      if (distance < best) {
+        best = distance;
+        index = p;
+      }
+    }
+    bits |= index << (i * 3);
+  }
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = (unsigned char)(bits >> (i * 8));
+  }
+}
+
+// Mip chain ================================================================ //
+// Filtered in floats, one RGBA texel after another. Albedo is kept in linear
+// light and normals as vectors until each level gets encoded.
+
+struct FloatImage {
+  uint32_t width;
+  uint32_t height;
+  std::vector<float> texels;
+};
+
+static float srgbToLinear(float value) {
+  return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float value) {
+  return value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Bottom row first on the way in, GL's texture origin is the bottom left
+static FloatImage decodeLevel0(const unsigned char *rgba, uint32_t width, uint32_t height, TextureUsage usage) {
+  FloatImage image = {width, height, std::vector<float>((size_t)width * height * 4)};
+  for (uint32_t y = 0; y < height; y++) {
+    const unsigned char *row = rgba + (size_t)(height - 1 - y) * width * 4;
+    float *texel = &image.texels[(size_t)y * width * 4];
+    for (uint32_t x = 0; x < width * 4; x++) {
+      float value = row[x] / 255.0f;
+      if (x % 4 == 3) {
+        texel[x] = value;
+      } else if (usage == TextureUsage::Albedo) {
+        texel[x] = srgbToLinear(value);
+      } else if (usage == TextureUsage::Normal) {
+        texel[x] = value * 2.0f - 1.0f;
+      } else {
+        texel[x] = value;
+      }
+    }
+  }
+  return image;
+}
+
+// 2x2 box, edge texels repeat on odd sizes
+static FloatImage downsample(const FloatImage &level, TextureUsage usage) {
+  FloatImage next = {std::max(level.width / 2, 1u), std::max(level.height / 2, 1u), {}};
+  next.texels.resize((size_t)next.width * next.height * 4);
+  for (uint32_t y = 0; y < next.height; y++) {
+    uint32_t y0 = std::min(y * 2, level.height - 1);
+    uint32_t y1 = std::min(y * 2 + 1, level.height - 1);
+    for (uint32_t x = 0; x < next.width; x++) {
+      uint32_t x0 = std::min(x * 2, level.width - 1);
+      uint32_t x1 = std::min(x * 2 + 1, level.width - 1);
+      float *out = &next.texels[((size_t)y * next.width + x) * 4];
+      for (int c = 0; c < 4; c++) {
+        out[c] = (level.texels[((size_t)y0 * level.width + x0) * 4 + c] +
+                  level.texels[((size_t)y0 * level.width + x1) * 4 + c] +
+                  level.texels[((size_t)y1 * level.width + x0) * 4 + c] +
+                  level.texels[((size_t)y1 * level.width + x1) * 4 + c]) * 0.25f;
+      }
+      if (usage == TextureUsage::Normal) {
+        float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+        if (length > 1e-6f) {
+          out[0] /= length;
+          out[1] /= length;
+          out[2] /= length;
+        }
+      }
+    }
+  }
+  return next;
+}
+
+static unsigned char encodeTexel(float value, int channel, TextureUsage usage) {
+  if (channel < 3 && usage == TextureUsage::Albedo) {
+    value = linearToSrgb(value);
+  } else if (channel < 3 && usage == TextureUsage::Normal) {
+    value = value * 0.5f + 0.5f;
+  }
+  return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+static void compressLevel(const FloatImage &level, TextureFormat format, TextureUsage usage, unsigned char *out) {
+  std::vector<unsigned char> rgba((size_t)level.width * level.height * 4);
+  for (size_t i = 0; i < rgba.size(); i++) {
+    rgba[i] = encodeTexel(level.texels[i], (int)(i % 4), usage);
+  }
+  uint32_t blocksX = (level.width + 3) / 4;
+  uint32_t blocksY = (level.height + 3) / 4;
+  for (uint32_t blockY = 0; blockY < blocksY; blockY++) {
+    for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+      // Levels under 4 texels repeat their edges into the rest of the block
+      unsigned char block[16 * 4];
+      unsigned char red[16], green[16], alpha[16];
+      for (uint32_t i = 0; i < 16; i++) {
+        uint32_t x = std::min(blockX * 4 + i % 4, level.width - 1);
+        uint32_t y = std::min(blockY * 4 + i / 4, level.height - 1);
+        memcpy(&block[i * 4], &rgba[((size_t)y * level.width + x) * 4], 4);
+        red[i] = block[i * 4 + 0];
+        green[i] = block[i * 4 + 1];
+        alpha[i] = block[i * 4 + 3];
+      }
+      if (format == TextureFormat::BC1) {
+        encodeBc1Block(block, out);
+      } else if (format == TextureFormat::BC3) {
+        encodeBc4Block(alpha, out);
+        encodeBc1Block(block, out + 8);
+      } else {
+        encodeBc4Block(red, out);
+        encodeBc4Block(green, out + 8);
+      }
+      out += textureBlockSize(format);
+    }
+  }
+}
+
+// Cooked textures ========================================================== //
+
+std::string cookedTexturePath(const std::string &sourcePath) {
+  size_t dot = sourcePath.find_last_of('.');
+  size_t slash = sourcePath.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return sourcePath + COOKED_TEXTURE_EXTENSION;
+  }
+  return sourcePath.substr(0, dot) + COOKED_TEXTURE_EXTENSION;
+}
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + COOKED_TEXTURE_ALIGNMENT - 1) & ~(COOKED_TEXTURE_ALIGNMENT - 1);
+}
+
+static TextureFormat chooseFormat(const unsigned char *rgba, uint32_t width, uint32_t height, TextureUsage usage) {
+  if (usage == TextureUsage::Normal) {
+    return TextureFormat::BC5;
+  }
+  if (usage == TextureUsage::Albedo) {
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+      if (rgba[i * 4 + 3] != 255) {
+        return TextureFormat::BC3;
+      }
+    }
+  }
+  return TextureFormat::BC1;
+}
+
+bool writeCookedTexture(const char *path, const unsigned char *rgba, uint32_t width, uint32_t height,
+                        TextureUsage usage) {
+  if (width == 0 || height == 0 || std::max(width, height) >> (MAX_TEXTURE_LEVELS - 1) > 1) {
+    clog_log(CLOG_LEVEL_ERROR, "Can't cook a %ux%u texture\n", width, height);
+    return false;
+  }
+  TextureFormat format = chooseFormat(rgba, width, height, usage);
+
+  CookedTextureHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COOKED_TEXTURE_MAGIC, sizeof(header.magic));
+  header.version = COOKED_TEXTURE_VERSION;
+  header.format = (uint32_t)format;
+  header.usage = (uint32_t)usage;
+  header.width = width;
+  header.height = height;
+  header.levelCount = 1;
+  while ((std::max(width, height) >> header.levelCount) > 0) {
+    header.levelCount++;
+  }
+  header.levelsOffset = alignOffset(sizeof(header));
+
+  std::vector<CookedTextureLevel> levels(header.levelCount);
+  uint64_t offset = alignOffset(header.levelsOffset + levels.size() * sizeof(CookedTextureLevel));
+  for (uint32_t i = 0; i < header.levelCount; i++) {
+    levels[i].width = std::max(width >> i, 1u);
+    levels[i].height = std::max(height >> i, 1u);
+    levels[i].offset = offset;
+    levels[i].size = textureLevelSize(format, levels[i].width, levels[i].height);
+    offset = alignOffset(offset + levels[i].size);
+  }
+  header.fileSize = offset;
+
+  // Small enough to build the whole file in memory, padding is already zero
+  std::vector<unsigned char> data(header.fileSize);
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(&data[header.levelsOffset], levels.data(), levels.size() * sizeof(CookedTextureLevel));
+  FloatImage level = decodeLevel0(rgba, width, height, usage);
+  for (uint32_t i = 0; i < header.levelCount; i++) {
+    if (i > 0) {
+      level = downsample(level, usage);
+    }
+    compressLevel(level, format, usage, &data[levels[i].offset]);
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to open \"%s\" for writing\n", path);
+    return false;
+  }
+  bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok) {
+    clog_log(CLOG_LEVEL_ERROR, "Failed to write cooked texture \"%s\"\n", path);
+    remove(path);
+  }
+  return ok;
+}
+
+bool mapCookedTexture(const char *path, const char *sourcePath, CookedTexture &texture) {
+  struct stat cookedStat;
+  if (stat(path, &cookedStat) != 0) {
+    return false; // Not cooked, not an error
+  }
+  struct stat sourceStat;
+  if (sourcePath != NULL && stat(sourcePath, &sourceStat) == 0 &&
+      sourceStat.st_mtime > cookedStat.st_mtime) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked texture \"%s\" is older than its source, ignoring it\n", path);
+    return false;
+  }
+
+  if (!texture.file.open(path)) {
+    clog_log(CLOG_LEVEL_WARN, "Failed to map cooked texture \"%s\"\n", path);
+    return false;
+  }
+
+  const CookedTextureHeader *header = (const CookedTextureHeader *)texture.file.data;
+  if (texture.file.size < sizeof(CookedTextureHeader) ||
+      memcmp(header->magic, COOKED_TEXTURE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != COOKED_TEXTURE_VERSION ||
+      header->fileSize != texture.file.size) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked texture \"%s\" is invalid or out of date, recook it\n", path);
+    texture.file.close();
+    return false;
+  }
+
+  uint64_t fileSize = texture.file.size;
+  if (header->format > (uint32_t)TextureFormat::BC5 || header->usage > (uint32_t)TextureUsage::Normal ||
+      header->levelCount == 0 || header->levelCount > MAX_TEXTURE_LEVELS ||
+      header->levelsOffset % COOKED_TEXTURE_ALIGNMENT != 0 || header->levelsOffset > fileSize ||
+      header->levelCount * sizeof(CookedTextureLevel) > fileSize - header->levelsOffset) {
+    clog_log(CLOG_LEVEL_WARN, "Cooked texture \"%s\" has a bad header\n", path);
+    texture.file.close();
+    return false;
+  }
+
+  // A wrong size would have the driver reading past the mapping
+  TextureFormat format = (TextureFormat)header->format;
+  const CookedTextureLevel *levels = (const CookedTextureLevel *)(texture.file.data + header->levelsOffset);
+  for (uint32_t i = 0; i < header->levelCount; i++) {
+    const CookedTextureLevel &level = levels[i];
+    if (level.width != std::max(header->width >> i, 1u) || level.height != std::max(header->height >> i, 1u) ||
+        level.size != textureLevelSize(format, level.width, level.height) ||
+        level.offset % COOKED_TEXTURE_ALIGNMENT != 0 || level.offset > fileSize ||
+        level.size > fileSize - level.offset) {
+      clog_log(CLOG_LEVEL_WARN, "Cooked texture \"%s\" has a bad level %u\n", path, i);
+      texture.file.close();
+      return false;
+    }
+  }
+
+  texture.header = header;
+  texture.levels = levels;
+  clog_log(CLOG_LEVEL_DEBUG, "Mapped cooked texture: %s\n", path);
+  return true;
+}
+
+} // namespace fred
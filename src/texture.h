@@ -0,0 +1,98 @@
+#ifndef FRED_TEXTURE_H
+#define FRED_TEXTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "mesh.h"
+
+namespace fred {
+
+// What a texture is for decides how it's compressed and how its mips get
+// filtered. Albedo is averaged in linear light so mips don't darken, normals
+// are renormalized.
+enum class TextureUsage : uint32_t {
+  Albedo,   // BC1, or BC3 if anything isn't opaque
+  Specular, // BC1, straight box filter
+  Normal,   // Two channel BC5, X and Y only. Nothing samples it yet, whatever
+            // does has to rebuild Z itself
+};
+
+enum class TextureFormat : uint32_t {
+  BC1, // DXT1, RGB in 8 bytes per 4x4 block
+  BC3, // DXT5, BC1 plus interpolated alpha, 16 bytes
+  BC5, // RGTC2, two interpolated channels, 16 bytes
+};
+
+size_t textureBlockSize(TextureFormat format);
+size_t textureLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+
+// From the file name, "_specular" and "_normal" are the ones that differ
+TextureUsage guessTextureUsage(const std::string &path);
+
+// Block encoders =========================================================== //
+// Each takes a 4x4 block, rows top to bottom. Principal axis range fit with a
+// least squares refinement for colour, plain min/max for the rest.
+
+void encodeBc1Block(const unsigned char rgba[16 * 4], unsigned char out[8]);
+// One channel of 16, BC3's alpha and each half of BC5
+void encodeBc4Block(const unsigned char values[16], unsigned char out[8]);
+
+// Cooked texture container ================================================= //
+// Same idea as KTX: a header, a table of levels, then every mip level block
+// compressed and back to back. Rows are already bottom first the way GL wants
+// them (what SOIL_FLAG_INVERT_Y did at load), so each level goes straight
+// from the mapping to glCompressedTexImage2D. Bump the version whenever the
+// layout changes, old files get ignored.
+
+constexpr char COOKED_TEXTURE_MAGIC[4] = {'F', 'T', 'E', 'X'};
+constexpr uint32_t COOKED_TEXTURE_VERSION = 1;
+constexpr uint64_t COOKED_TEXTURE_ALIGNMENT = 16;
+constexpr uint32_t MAX_TEXTURE_LEVELS = 16; // 32768 texels a side
+constexpr const char *COOKED_TEXTURE_EXTENSION = ".ftex";
+
+struct CookedTextureHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t format; // TextureFormat
+  uint32_t usage;  // TextureUsage
+  uint32_t width;  // Level 0
+  uint32_t height;
+  uint32_t levelCount; // Down to 1x1
+  uint32_t reserved;
+  uint64_t levelsOffset; // CookedTextureLevel[levelCount]
+  uint64_t fileSize;
+};
+
+struct CookedTextureLevel {
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset; // Bytes from the start of the file, aligned
+  uint64_t size;
+};
+
+// Non owning views into a mapped file, valid for as long as file is
+class CookedTexture {
+public:
+  MappedFile file;
+  const CookedTextureHeader *header = nullptr;
+  const CookedTextureLevel *levels = nullptr;
+
+  TextureFormat format() const { return (TextureFormat)header->format; }
+  const unsigned char *levelData(uint32_t level) const { return file.data + levels[level].offset; }
+};
+
+// textures/teapot.png -> textures/teapot.ftex
+std::string cookedTexturePath(const std::string &sourcePath);
+
+// rgba is 8 bits a channel, top row first as decoded. Flips it, builds the
+// whole mip chain and compresses every level. Picks the format from usage.
+bool writeCookedTexture(const char *path, const unsigned char *rgba, uint32_t width, uint32_t height,
+                        TextureUsage usage);
+// sourcePath is optional, if given a file older than its source is rejected
+bool mapCookedTexture(const char *path, const char *sourcePath, CookedTexture &texture);
+
+} // namespace fred
+
+#endif
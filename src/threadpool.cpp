@@ -0,0 +1,55 @@
+#include "threadpool.h"
+
+namespace fred {
+
+void ThreadPool::start(int workerCount) {
+  if (isRunning()) {
+    return;
+  }
+  if (workerCount <= 0) {
+    workerCount = (int)std::thread::hardware_concurrency() - 1;
+    workerCount = workerCount < 1 ? 1 : workerCount;
+  }
+  stopping = false;
+  for (int i = 0; i < workerCount; i++) {
+    workers.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+void ThreadPool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (tasks.empty()) {
+        return; // Stopping and drained
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace fred
@@ -0,0 +1,43 @@
+#ifndef FRED_THREADPOOL_H
+#define FRED_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fred {
+
+// Plain FIFO of tasks over a fixed set of workers. Tasks must not touch GL,
+// only the main thread has a context.
+class ThreadPool {
+public:
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool() { stop(); }
+
+  // 0 picks one less than the core count, at least one
+  void start(int workerCount);
+  // Finishes whatever is queued, then joins the workers
+  void stop();
+  bool isRunning() const { return !workers.empty(); }
+  int getWorkerCount() const { return (int)workers.size(); }
+
+  void submit(std::function<void()> task);
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  void workerLoop();
+};
+
+} // namespace fred
+
+#endif
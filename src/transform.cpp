@@ -0,0 +1,106 @@
+#include "transform.h"
+
+namespace fred {
+
+Transform::Transform(const Transform &other)
+    : position(other.position), rotation(other.rotation), scaling(other.scaling) {
+  localDirty = true;
+  worldDirty = true;
+}
+
+Transform &Transform::operator=(const Transform &other) {
+  if (this != &other) {
+    position = other.position;
+    rotation = other.rotation;
+    scaling = other.scaling;
+    invalidateLocal();
+  }
+  return *this;
+}
+
+Transform::~Transform() {
+  detach();
+  for (Transform *child : children) {
+    child->parent = NULL;
+    child->invalidateWorld();
+  }
+}
+
+void Transform::setPosition(const glm::vec3 &newPosition) {
+  position = newPosition;
+  invalidateLocal();
+}
+
+void Transform::setRotation(const glm::quat &newRotation) {
+  rotation = newRotation;
+  invalidateLocal();
+}
+
+void Transform::setScale(const glm::vec3 &newScale) {
+  scaling = newScale;
+  invalidateLocal();
+}
+
+void Transform::setParent(Transform *newParent) {
+  if (newParent == parent) {
+    return;
+  }
+  detach();
+  parent = newParent;
+  if (parent != NULL) {
+    childIndex = parent->children.size();
+    parent->children.push_back(this);
+  }
+  invalidateWorld();
+}
+
+void Transform::detach() {
+  if (parent == NULL) {
+    return;
+  }
+  // Swap with the last child instead of shifting everything after it
+  std::vector<Transform *> &siblings = parent->children;
+  siblings[childIndex] = siblings.back();
+  siblings[childIndex]->childIndex = childIndex;
+  siblings.pop_back();
+  parent = NULL;
+}
+
+void Transform::invalidateLocal() {
+  localDirty = true;
+  invalidateWorld();
+}
+
+void Transform::invalidateWorld() {
+  if (worldDirty) {
+    return; // So is everything under it
+  }
+  worldDirty = true;
+  revision++;
+  for (Transform *child : children) {
+    child->invalidateWorld();
+  }
+}
+
+const glm::mat4 &Transform::getLocalMatrix() const {
+  if (localDirty) {
+    // Translation * rotation * scale without the two matrix multiplies
+    localMatrix = glm::mat4_cast(rotation);
+    localMatrix[0] *= scaling.x;
+    localMatrix[1] *= scaling.y;
+    localMatrix[2] *= scaling.z;
+    localMatrix[3] = glm::vec4(position, 1.0f);
+    localDirty = false;
+  }
+  return localMatrix;
+}
+
+const glm::mat4 &Transform::getWorldMatrix() const {
+  if (worldDirty) {
+    worldMatrix = parent != NULL ? parent->getWorldMatrix() * getLocalMatrix() : getLocalMatrix();
+    worldDirty = false;
+  }
+  return worldMatrix;
+}
+
+} // namespace fred
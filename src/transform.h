@@ -0,0 +1,74 @@
+#ifndef FRED_TRANSFORM_H
+#define FRED_TRANSFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace fred {
+
+// A node in the scene graph. Position, rotation and scale are relative to
+// the parent, the world matrix is parent world * local. Both matrices are
+// cached: a change marks the node and everything under it dirty, and they're
+// only rebuilt when someone asks for them. A node that hasn't changed costs a
+// flag check. Not thread safe, reading a matrix can write the cache.
+class Transform {
+public:
+  Transform() = default;
+  // Copies are detached, just the local position, rotation and scale
+  Transform(const Transform &other);
+  // Keeps this one's place in the hierarchy
+  Transform &operator=(const Transform &other);
+  // Children left behind become roots, same world position or not
+  ~Transform();
+
+  const glm::vec3 &getPosition() const { return position; }
+  const glm::quat &getRotation() const { return rotation; }
+  const glm::vec3 &getScale() const { return scaling; }
+  void setPosition(const glm::vec3 &newPosition);
+  void setRotation(const glm::quat &newRotation);
+  void setScale(const glm::vec3 &newScale);
+  void translate(const glm::vec3 &delta) { setPosition(position + delta); }
+  // Applied after the current rotation, in the parent's space
+  void rotate(const glm::quat &delta) { setRotation(delta * rotation); }
+
+  // NULL makes it a root. The local transform stays as it is, so the node
+  // moves with its new parent.
+  void setParent(Transform *newParent);
+  Transform *getParent() const { return parent; }
+  const std::vector<Transform *> &getChildren() const { return children; }
+
+  const glm::mat4 &getLocalMatrix() const;
+  const glm::mat4 &getWorldMatrix() const;
+  // Changes whenever the world matrix might have, so callers can keep their
+  // own derived data (bounds and such) without comparing matrices
+  uint32_t getRevision() const { return revision; }
+
+private:
+  glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
+  glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); // https://en.wikipedia.org/wiki/Quaternion
+  glm::vec3 scaling = glm::vec3(1.0f, 1.0f, 1.0f);
+
+  Transform *parent = NULL;
+  std::vector<Transform *> children;
+  size_t childIndex = 0; // In parent->children, so leaving is O(1)
+
+  // A dirty node's whole subtree is dirty too, which is what lets
+  // invalidation stop at the first node that already is
+  mutable glm::mat4 localMatrix = glm::mat4(1.0f);
+  mutable glm::mat4 worldMatrix = glm::mat4(1.0f);
+  mutable bool localDirty = false;
+  mutable bool worldDirty = false;
+  uint32_t revision = 0;
+
+  void invalidateLocal();
+  void invalidateWorld();
+  void detach();
+};
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,103 @@
+#include "uniforms.h"
+
+#include <string.h>
+
+#include <clog/clog.h>
+
+#include "glstate.h"
+
+namespace fred {
+
+UniformRing uniformRing;
+
+// Shadow cascades get a copy each with their own vp
+const char *const FRAME_DATA_GLSL =
+    "layout(std140) uniform FrameData {\n"
+    "  mat4 v;\n"
+    "  mat4 p;\n"
+    "  mat4 vp;\n"
+    "  vec4 clusterScale;\n"      // xy fragment coordinates to tiles, zw log depth to slices
+    "  vec4 clusterCounts;\n"
+    "  mat4 shadowMatrices[4];\n" // View space to each cascade's shadow map
+    "  vec4 cascadeEnds;\n"       // View depth each cascade reaches
+    "  vec4 cascadeTexels;\n"     // World size of a shadow map texel in each
+    "  vec4 sunDirection;\n"      // View space, towards the sun. w is 1 when it casts shadows
+    "  vec4 sunColor;\n"          // Times intensity, black when there's no sun
+    "};\n";
+
+void setupProgramInterface(GLuint program) {
+  GLuint frameBlock = glGetUniformBlockIndex(program, "FrameData");
+  if (frameBlock != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, frameBlock, FRAME_UNIFORMS_BINDING);
+  }
+  GLuint objectBlock = glGetUniformBlockIndex(program, "ObjectData");
+  if (objectBlock != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, objectBlock, OBJECT_UNIFORMS_BINDING);
+  }
+
+  glState.useProgram(program);
+  glState.uniform1i(glGetUniformLocation(program, "textureSampler"), 0);
+  glState.uniform1i(glGetUniformLocation(program, "albedoSampler"), 0);
+  glState.uniform1i(glGetUniformLocation(program, "specularSampler"), 1);
+  glState.uniform1i(glGetUniformLocation(program, "lightData"), LIGHT_DATA_UNIT);
+  glState.uniform1i(glGetUniformLocation(program, "lightClusters"), LIGHT_CLUSTERS_UNIT);
+  glState.uniform1i(glGetUniformLocation(program, "lightIndices"), LIGHT_INDICES_UNIT);
+  glState.uniform1i(glGetUniformLocation(program, "shadowMap"), SHADOW_MAP_UNIT);
+  glState.uniform1i(glGetUniformLocation(program, "lightmapSampler"), LIGHTMAP_UNIT);
+}
+
+void UniformRing::init(GLsizeiptr initialCapacity) {
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  if (alignment < 1) {
+    alignment = 256;
+  }
+  capacity = alignSize(initialCapacity);
+  head = 0;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+}
+
+void UniformRing::destroy() {
+  glDeleteBuffers(1, &buffer);
+  buffer = 0;
+  capacity = 0;
+}
+
+GLintptr UniformRing::upload(const void *data, GLsizeiptr size) {
+  if (buffer == 0) {
+    init(1 << 20);
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+  GLintptr offset = (head + alignment - 1) / alignment * alignment;
+  GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+  if (size > capacity) {
+    // Too small to ever fit, reallocate, fresh storage needs no invalidate
+    capacity = alignSize(size * 2);
+    clog_log(CLOG_LEVEL_DEBUG, "Growing uniform ring to %ld bytes\n", (long)capacity);
+    glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    offset = 0;
+    access |= GL_MAP_INVALIDATE_RANGE_BIT;
+  } else if (offset + size > capacity) {
+    // Wrapped, orphan so in flight draws keep the old storage
+    offset = 0;
+    access |= GL_MAP_INVALIDATE_BUFFER_BIT;
+    orphans++;
+  } else {
+    access |= GL_MAP_INVALIDATE_RANGE_BIT;
+  }
+
+  void *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, access);
+  if (mapped != NULL) {
+    memcpy(mapped, data, size);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+  } else {
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+  }
+  head = offset + size;
+  bytesThisFrame += size;
+  return offset;
+}
+
+} // namespace fred
@@ -0,0 +1,87 @@
+#ifndef FRED_UNIFORMS_H
+#define FRED_UNIFORMS_H
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+
+namespace fred {
+
+// std140 mirrors of the uniform blocks, keep them in sync. FrameData's GLSL
+// is FRAME_DATA_GLSL below, ObjectData is in the shaders. Every member is a
+// mat4 or vec4 so std140 adds no padding of its own.
+
+constexpr GLuint FRAME_UNIFORMS_BINDING = 0;
+constexpr GLuint OBJECT_UNIFORMS_BINDING = 1;
+
+// Texture units past albedo and specular, the light grid's buffers
+constexpr GLuint LIGHT_DATA_UNIT = 2;
+constexpr GLuint LIGHT_CLUSTERS_UNIT = 3;
+constexpr GLuint LIGHT_INDICES_UNIT = 4;
+// The sun's cascaded shadow maps, one depth texture array
+constexpr GLuint SHADOW_MAP_UNIT = 5;
+// Baked lighting, see Lightmap in src/engine.h
+constexpr GLuint LIGHTMAP_UNIT = 6;
+
+// Sun shadow cascades, the shaders have it hardcoded too
+constexpr int SHADOW_CASCADES = 4;
+
+// FrameData, bound once per frame
+struct FrameUniforms {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 viewProjection;
+  glm::vec4 clusterScale;  // Fragment coordinates and log depth to a cluster, see LightGrid
+  glm::vec4 clusterCounts; // xyz clusters per axis, w unused
+  glm::mat4 shadowMatrices[SHADOW_CASCADES]; // View space to each cascade's shadow map texture space
+  glm::vec4 cascadeEnds;   // View depth each cascade is used up to
+  glm::vec4 cascadeTexels; // World size of one texel in each cascade
+  glm::vec4 sunDirection;  // View space, towards the sun. w is 1 if it casts shadows
+  glm::vec4 sunColor;      // Times intensity, black for no sun
+};
+
+// FrameUniforms as GLSL, the only copy of the block. Every program gets it
+// right after #version along with its defines, so shaders use FrameData
+// without declaring it.
+extern const char *const FRAME_DATA_GLSL;
+
+// ObjectData, one slot per non-instanced draw
+struct ObjectUniforms {
+  glm::mat4 model;
+};
+
+// Hooks the uniform blocks up to their binding points and points the samplers
+// at their texture units. Once per program, nothing per draw.
+void setupProgramInterface(GLuint program);
+
+// Stream buffer for uniform data. Everything goes in at an ever increasing
+// offset through unsynchronized maps, and when it runs out of room the whole
+// buffer is orphaned, so the GPU is never waited on and never sees a write to
+// something it might still be reading.
+class UniformRing {
+public:
+  GLuint buffer = 0;
+  GLint alignment = 256; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+  GLsizeiptr bytesThisFrame = 0;
+  int orphans = 0;
+
+  void init(GLsizeiptr capacity); // Optional, upload starts at 1MiB
+  void destroy();
+  void beginFrame() { bytesThisFrame = 0; }
+
+  // Rounds size up to a multiple of alignment, handy as a per slot stride
+  GLsizeiptr alignSize(GLsizeiptr size) const {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+  // Returns the offset data landed at, always a multiple of alignment
+  GLintptr upload(const void *data, GLsizeiptr size);
+
+private:
+  GLsizeiptr capacity = 0;
+  GLintptr head = 0;
+};
+
+extern UniformRing uniformRing;
+
+} // namespace fred
+
+#endif
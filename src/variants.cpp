@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include <clog/clog.h>
+
+#include "glstate.h"
+#include "resources.h"
+#include "shader.h"
+#include "uniforms.h"
+#include "variants.h"
+
+namespace fred {
+
+const char *const shaderFeatureNames[SHADER_FEATURE_COUNT] = {"INSTANCED", "LIT", "DEPTH_ONLY", "LIGHTMAPPED"};
+
+std::string shaderFeatureDefines(uint32_t features) {
+  std::string defines;
+  for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+    if (features & (1u << i)) {
+      defines += "#define ";
+      defines += shaderFeatureNames[i];
+      defines += "\n";
+    }
+  }
+  return defines;
+}
+
+uint32_t shaderFeatureFromName(const std::string &name) {
+  for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+    if (name == shaderFeatureNames[i]) {
+      return 1u << i;
+    }
+  }
+  return 0;
+}
+
+ShaderVariants::~ShaderVariants() {
+  for (const std::pair<const uint32_t, GLuint> &program : programs) {
+    if (program.second != 0) {
+      glState.forgetProgram(program.second);
+      glDeleteProgram(program.second);
+    }
+  }
+  free(vertCode);
+  free(fragCode);
+}
+
+bool ShaderVariants::readSources() {
+  if (!sourcesRead) {
+    sourcesRead = true;
+    vertCode = readShaderFile(vertPath.c_str());
+    fragCode = readShaderFile(fragPath.c_str());
+  }
+  return vertCode != NULL && fragCode != NULL;
+}
+
+GLuint ShaderVariants::get(uint32_t features) {
+  std::unordered_map<uint32_t, GLuint>::iterator found = programs.find(features);
+  if (found != programs.end()) {
+    return found->second;
+  }
+  precompile({features});
+  return programs[features];
+}
+
+void ShaderVariants::precompile(const std::vector<uint32_t> &keys) {
+  std::vector<uint32_t> missing;
+  for (uint32_t key : keys) {
+    if (programs.find(key) == programs.end() &&
+        std::find(missing.begin(), missing.end(), key) == missing.end()) {
+      missing.push_back(key);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+  if (!readSources()) {
+    for (uint32_t key : missing) {
+      programs[key] = 0;
+    }
+    return;
+  }
+
+  // The define strings have to outlive the batch
+  std::vector<std::string> defines(missing.size());
+  std::vector<ShaderProgramSource> sources(missing.size());
+  for (size_t i = 0; i < missing.size(); i++) {
+    defines[i] = shaderFeatureDefines(missing[i]) + FRAME_DATA_GLSL;
+    ShaderProgramSource source = {vertCode, fragCode, vertPath.c_str(), fragPath.c_str(), defines[i].c_str(), 0};
+    sources[i] = source;
+  }
+  buildShaderPrograms(sources.data(), (int)sources.size());
+  for (size_t i = 0; i < missing.size(); i++) {
+    programs[missing[i]] = sources[i].program;
+    if (sources[i].program != 0) {
+      setupProgramInterface(sources[i].program);
+    }
+  }
+}
+
+static std::map<std::string, std::unique_ptr<ShaderVariants>> registry;
+
+ShaderVariants &shaderVariants(const std::string &vertPath, const std::string &fragPath) {
+  std::string key = normalizePath(vertPath) + "|" + normalizePath(fragPath);
+  std::unique_ptr<ShaderVariants> &variants = registry[key];
+  if (!variants) {
+    variants.reset(new ShaderVariants(vertPath, fragPath));
+  }
+  return *variants;
+}
+
+bool precompileShaderVariants(const char *manifestPath) {
+  FILE *manifest = fopen(manifestPath, "r");
+  if (manifest == NULL) {
+    clog_log(CLOG_LEVEL_WARN, "Couldn't open shader manifest %s\n", manifestPath);
+    return false;
+  }
+  std::string directory = manifestPath;
+  size_t slash = directory.find_last_of("/\\");
+  directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+
+  // Grouped by source pair so each pair builds as one batch
+  std::map<ShaderVariants *, std::vector<uint32_t>> batches;
+  char line[512];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), manifest) != NULL) {
+    lineNumber++;
+    std::string text = line;
+    text = text.substr(0, text.find('#'));
+    std::istringstream words(text);
+    std::string vertPath, fragPath, feature;
+    if (!(words >> vertPath)) {
+      continue; // Blank or just a comment
+    }
+    if (!(words >> fragPath)) {
+      clog_log(CLOG_LEVEL_WARN, "%s:%d: no fragment shader\n", manifestPath, lineNumber);
+      continue;
+    }
+    uint32_t features = 0;
+    while (words >> feature) {
+      uint32_t bit = shaderFeatureFromName(feature);
+      if (bit == 0) {
+        clog_log(CLOG_LEVEL_WARN, "%s:%d: unknown shader feature %s\n", manifestPath, lineNumber, feature.c_str());
+      }
+      features |= bit;
+    }
+    batches[&shaderVariants(directory + vertPath, directory + fragPath)].push_back(features);
+  }
+  fclose(manifest);
+
+  for (std::pair<ShaderVariants *const, std::vector<uint32_t>> &batch : batches) {
+    batch.first->precompile(batch.second);
+  }
+  return true;
+}
+
+void destroyShaderVariants() {
+  registry.clear();
+}
+
+} // namespace fred
@@ -0,0 +1,74 @@
+#ifndef FRED_VARIANTS_H
+#define FRED_VARIANTS_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/gl.h>
+
+namespace fred {
+
+// Compile time shader features. Each bit is a #define injected after
+// #version, so one source pair covers every combination without branching
+// per fragment. New ones go at the end and into shaderFeatureNames.
+enum ShaderFeature : uint32_t {
+  SHADER_INSTANCED = 1 << 0,  // Model matrix from attributes 3 to 6, the renderer adds it
+  SHADER_LIT = 1 << 1,        // The scene's point lights and sun, albedo and specular maps
+  SHADER_DEPTH_ONLY = 1 << 2, // Positions in, no color out, the renderer adds it for shadow maps
+  SHADER_LIGHTMAPPED = 1 << 3, // Baked light from attribute 7 UVs, see fred-bake
+};
+constexpr int SHADER_FEATURE_COUNT = 4;
+// Only change how things are shaded, not where vertices land, so depth only
+// variants leave them out
+constexpr uint32_t SHADER_SHADING_FEATURES = SHADER_LIT | SHADER_LIGHTMAPPED;
+
+// In bit order, spelled the same as the #defines
+extern const char *const shaderFeatureNames[SHADER_FEATURE_COUNT];
+
+// "#define LIT\n" and so on for every bit set
+std::string shaderFeatureDefines(uint32_t features);
+// 0 if it isn't a feature
+uint32_t shaderFeatureFromName(const std::string &name);
+
+// Every variant of one vertex/fragment source pair, keyed by feature mask.
+// Sources are read the first time they're needed, programs are built the
+// first time their key is and kept until this goes. GL thread.
+class ShaderVariants {
+public:
+  ShaderVariants(std::string vertPath, std::string fragPath) : vertPath(vertPath), fragPath(fragPath) {}
+  ShaderVariants(const ShaderVariants &) = delete;
+  ShaderVariants &operator=(const ShaderVariants &) = delete;
+  ~ShaderVariants();
+
+  // 0 if it didn't build, which isn't retried
+  GLuint get(uint32_t features);
+  // Everything in keys that isn't built yet, in one batch
+  void precompile(const std::vector<uint32_t> &keys);
+
+  size_t getBuiltCount() const { return programs.size(); }
+
+private:
+  std::string vertPath;
+  std::string fragPath;
+  char *vertCode = NULL;
+  char *fragCode = NULL;
+  bool sourcesRead = false;
+  std::unordered_map<uint32_t, GLuint> programs;
+
+  bool readSources();
+};
+
+// The one ShaderVariants for a source pair, made on first use
+ShaderVariants &shaderVariants(const std::string &vertPath, const std::string &fragPath);
+// Builds every variant listed in a manifest, a line per variant with the
+// vertex path, fragment path and feature names. Paths are relative to the
+// manifest, # starts a comment.
+bool precompileShaderVariants(const char *manifestPath);
+// GL thread, before the context goes
+void destroyShaderVariants();
+
+} // namespace fred
+
+#endif
@@ -0,0 +1,463 @@
+// fred-bake: bakes one lightmap for a set of models that sit in world space
+// Usage: fred-bake [options] <lightmap.png> <model>...
+// Every model gets lightmap UVs in a shared atlas and is written back out as
+// its .fmesh, so Model picks the baked vertices up on load. The lightmap is
+// RGBM, see LIGHTMAP_RANGE. Cooking a model again throws its UVs away, bake
+// after cook-models, not before.
+//
+// --light point lights only go in as bounce light. Their direct light stays
+// dynamic, LIGHTMAPPED|LIT shaders still loop over the clustered lights, so
+// give the same lights to Scene::lights and they're counted once each.
+//
+// Tiles of the atlas are spread over the threads up front and idle threads
+// steal from the others, so a thread that drew the empty corner of the atlas
+// doesn't sit there while another one traces a busy chart. --scaling bakes
+// once per thread count and prints how it scales.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SOIL2.h>
+#include <clog/clog.h>
+
+#include "lightmap.h"
+#include "mesh.h"
+#include "raytrace.h"
+#include "simplify.h"
+
+static const int TILE_SIZE = 16;
+
+struct PointLight {
+  glm::vec3 position;
+  float power; // Falls off with the square of the distance
+};
+
+struct BakeSettings {
+  fred::LightmapAtlasSettings atlas;
+  int samples = 64; // Hemisphere rays per texel
+  int bounces = 2;
+  int threads = 0;  // 0 is one per core
+  glm::vec3 sunDirection = glm::vec3(-0.4f, -1.0f, -0.3f); // Same as DirectionalLight
+  glm::vec3 sunColor = glm::vec3(0.8f);
+  glm::vec3 sky = glm::vec3(0.15f, 0.18f, 0.25f);
+  float albedo = 0.6f; // Everything bounces the same, the baker doesn't read textures
+  std::vector<PointLight> lights;
+};
+
+struct Scene {
+  fred::TriangleBvh bvh;
+  std::vector<glm::vec3> normals; // Per triangle, for bounces
+  float bias;                     // How far rays start off the surface
+};
+
+// Sampling ================================================================= //
+
+// PCG, seeded per texel so the result doesn't depend on which thread got it
+struct Random {
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed * 6364136223846793005ull + 1442695040888963407ull) { next(); }
+  uint32_t next() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ull + 1442695040888963407ull;
+    uint32_t shifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+    uint32_t rotation = (uint32_t)(old >> 59u);
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+  }
+  float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+static glm::vec3 cosineDirection(const glm::vec3 &normal, Random &random) {
+  float r = sqrtf(random.uniform());
+  float angle = 6.28318531f * random.uniform();
+  glm::vec3 helper = fabsf(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+  glm::vec3 tangent = glm::normalize(glm::cross(helper, normal));
+  glm::vec3 bitangent = glm::cross(normal, tangent);
+  return tangent * (r * cosf(angle)) + bitangent * (r * sinf(angle)) +
+         normal * sqrtf(std::max(0.0f, 1.0f - r * r));
+}
+
+// Lighting ================================================================= //
+// Same units as the shaders, a surface gives off albedo times what lands on
+// it with no 1/pi anywhere, so a baked texel matches a lit one.
+
+static const float FAR_AWAY = 1e30f;
+
+static glm::vec3 pointLighting(const Scene &scene, const BakeSettings &settings, const glm::vec3 &position,
+                               const glm::vec3 &normal) {
+  glm::vec3 light(0.0f);
+  for (const PointLight &point : settings.lights) {
+    glm::vec3 toLight = point.position - position;
+    float distanceSquared = glm::dot(toLight, toLight);
+    float cosine = glm::dot(normal, toLight) / sqrtf(distanceSquared);
+    if (cosine > 0.0f && !scene.bvh.occluded(position, toLight, 1.0f)) {
+      light += glm::vec3(point.power * cosine / distanceSquared);
+    }
+  }
+  return light;
+}
+
+static glm::vec3 sunLighting(const Scene &scene, const BakeSettings &settings, const glm::vec3 &position,
+                             const glm::vec3 &normal) {
+  glm::vec3 towardsSun = -glm::normalize(settings.sunDirection);
+  float cosine = glm::dot(normal, towardsSun);
+  if (cosine <= 0.0f || scene.bvh.occluded(position, towardsSun, FAR_AWAY)) {
+    return glm::vec3(0.0f);
+  }
+  return settings.sunColor * cosine;
+}
+
+// What comes back along a ray, the sky if it gets out
+static glm::vec3 traceRadiance(const Scene &scene, const BakeSettings &settings, glm::vec3 origin,
+                               glm::vec3 direction, Random &random) {
+  glm::vec3 radiance(0.0f);
+  float throughput = 1.0f;
+  for (int bounce = 0; bounce < settings.bounces; bounce++) {
+    fred::RayHit hit;
+    if (!scene.bvh.intersect(origin, direction, FAR_AWAY, hit)) {
+      return radiance + settings.sky * throughput;
+    }
+    glm::vec3 normal = scene.normals[hit.triangle];
+    if (glm::dot(normal, direction) > 0.0f) {
+      normal = -normal;
+    }
+    origin = origin + direction * hit.t + normal * scene.bias;
+    throughput *= settings.albedo;
+    radiance += (sunLighting(scene, settings, origin, normal) + pointLighting(scene, settings, origin, normal)) *
+                throughput;
+    direction = cosineDirection(normal, random);
+  }
+  return radiance;
+}
+
+static void bakeTile(const Scene &scene, const BakeSettings &settings, const std::vector<fred::LightmapTexel> &texels,
+                     int tile, std::vector<glm::vec3> &colors) {
+  int size = settings.atlas.size;
+  int tilesAcross = (size + TILE_SIZE - 1) / TILE_SIZE;
+  int startX = tile % tilesAcross * TILE_SIZE, startY = tile / tilesAcross * TILE_SIZE;
+  int endX = std::min(startX + TILE_SIZE, size), endY = std::min(startY + TILE_SIZE, size);
+
+  std::vector<int> covered;
+  for (int y = startY; y < endY; y++) {
+    for (int x = startX; x < endX; x++) {
+      if (texels[(size_t)y * size + x].covered) {
+        covered.push_back(y * size + x);
+      }
+    }
+  }
+
+  // Sun shadows four texels at a time, neighbouring texels towards the same
+  // sun walk the same nodes
+  glm::vec3 towardsSun = -glm::normalize(settings.sunDirection);
+  for (size_t first = 0; first < covered.size(); first += 4) {
+    glm::vec3 origins[4], directions[4];
+    float limits[4];
+    int lanes = (int)std::min<size_t>(4, covered.size() - first);
+    for (int lane = 0; lane < 4; lane++) {
+      const fred::LightmapTexel &texel = texels[covered[first + std::min(lane, lanes - 1)]];
+      origins[lane] = texel.position + texel.normal * scene.bias;
+      directions[lane] = towardsSun;
+      limits[lane] = FAR_AWAY;
+    }
+    int blocked = scene.bvh.occluded4(origins, directions, limits);
+    for (int lane = 0; lane < lanes; lane++) {
+      const fred::LightmapTexel &texel = texels[covered[first + lane]];
+      float cosine = glm::dot(texel.normal, towardsSun);
+      colors[covered[first + lane]] =
+          cosine > 0.0f && !(blocked & (1 << lane)) ? settings.sunColor * cosine : glm::vec3(0.0f);
+    }
+  }
+
+  for (int index : covered) {
+    const fred::LightmapTexel &texel = texels[index];
+    glm::vec3 origin = texel.position + texel.normal * scene.bias;
+    Random random((uint64_t)index);
+    glm::vec3 gathered(0.0f);
+    if (settings.bounces > 0) {
+      for (int sample = 0; sample < settings.samples; sample++) {
+        gathered += traceRadiance(scene, settings, origin, cosineDirection(texel.normal, random), random);
+      }
+      gathered /= (float)settings.samples;
+    } else {
+      gathered = settings.sky;
+    }
+    // Not the point lights' direct light, the shaders add that at runtime
+    colors[index] += gathered;
+  }
+}
+
+// Scheduling =============================================================== //
+
+// A deque of tiles per thread. Owners take from the front, thieves from the
+// back, so they only meet on the last tile.
+struct TileQueue {
+  std::mutex mutex;
+  std::deque<int> tiles;
+};
+
+static bool takeTile(TileQueue &queue, bool steal, int &tile) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tiles.empty()) {
+    return false;
+  }
+  if (steal) {
+    tile = queue.tiles.back();
+    queue.tiles.pop_back();
+  } else {
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+  }
+  return true;
+}
+
+struct BakeRun {
+  double ms;
+  int steals;
+};
+
+static BakeRun bake(const Scene &scene, const BakeSettings &settings, const std::vector<fred::LightmapTexel> &texels,
+                    int threadCount, std::vector<glm::vec3> &colors) {
+  int size = settings.atlas.size;
+  int tilesAcross = (size + TILE_SIZE - 1) / TILE_SIZE;
+  int tileCount = tilesAcross * tilesAcross;
+  colors.assign((size_t)size * size, glm::vec3(0.0f));
+
+  // Contiguous runs, so each thread starts out on its own stretch of rows
+  std::vector<TileQueue> queues(threadCount);
+  for (int tile = 0; tile < tileCount; tile++) {
+    queues[(size_t)tile * threadCount / tileCount].tiles.push_back(tile);
+  }
+
+  std::atomic<int> steals(0);
+  auto worker = [&](int self) {
+    Random victims((uint64_t)self + 1);
+    int tile;
+    while (true) {
+      if (takeTile(queues[self], false, tile)) {
+        bakeTile(scene, settings, texels, tile, colors);
+        continue;
+      }
+      // Nothing is ever queued again, so one empty sweep means we're done
+      bool stole = false;
+      int start = threadCount > 1 ? (int)(victims.next() % threadCount) : 0;
+      for (int i = 0; i < threadCount && !stole; i++) {
+        int victim = (start + i) % threadCount;
+        stole = victim != self && takeTile(queues[victim], true, tile);
+      }
+      if (!stole) {
+        return;
+      }
+      steals++;
+      bakeTile(scene, settings, texels, tile, colors);
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 1; i < threadCount; i++) {
+    threads.emplace_back(worker, i);
+  }
+  worker(0);
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  BakeRun run;
+  run.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  run.steals = steals;
+  return run;
+}
+
+// Command line ============================================================= //
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--size N] [--density F] [--samples N] [--bounces N] [--threads N]\n"
+          "       [--sun x,y,z] [--sun-color r,g,b] [--sky r,g,b] [--albedo F] [--light x,y,z,power]...\n"
+          "       [--scaling] <lightmap.png> <model>...\n",
+          name);
+  return 1;
+}
+
+static bool parseFloats(const char *text, float *values, int count) {
+  for (int i = 0; i < count; i++) {
+    char *end;
+    values[i] = strtof(text, &end);
+    if (end == text || (i + 1 < count ? *end != ',' : *end != '\0')) {
+      return false;
+    }
+    text = end + 1;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  BakeSettings settings;
+  bool scaling = false;
+  const char *outputPath = NULL;
+  std::vector<const char *> modelPaths;
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    float floats[4];
+    if (strcmp(argv[i], "--scaling") == 0) {
+      scaling = true;
+    } else if (argv[i][0] == '-' && value == NULL) {
+      return usage(argv[0]);
+    } else if (strcmp(argv[i], "--size") == 0) {
+      settings.atlas.size = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--density") == 0) {
+      settings.atlas.texelsPerUnit = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--samples") == 0) {
+      settings.samples = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bounces") == 0) {
+      settings.bounces = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      settings.threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--albedo") == 0) {
+      settings.albedo = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--sun") == 0) {
+      if (!parseFloats(argv[++i], floats, 3)) {
+        return usage(argv[0]);
+      }
+      settings.sunDirection = glm::vec3(floats[0], floats[1], floats[2]);
+    } else if (strcmp(argv[i], "--sun-color") == 0) {
+      if (!parseFloats(argv[++i], floats, 3)) {
+        return usage(argv[0]);
+      }
+      settings.sunColor = glm::vec3(floats[0], floats[1], floats[2]);
+    } else if (strcmp(argv[i], "--sky") == 0) {
+      if (!parseFloats(argv[++i], floats, 3)) {
+        return usage(argv[0]);
+      }
+      settings.sky = glm::vec3(floats[0], floats[1], floats[2]);
+    } else if (strcmp(argv[i], "--light") == 0) {
+      if (!parseFloats(argv[++i], floats, 4)) {
+        return usage(argv[0]);
+      }
+      settings.lights.push_back({glm::vec3(floats[0], floats[1], floats[2]), floats[3]});
+    } else if (argv[i][0] == '-') {
+      return usage(argv[0]);
+    } else if (outputPath == NULL) {
+      outputPath = argv[i];
+    } else {
+      modelPaths.push_back(argv[i]);
+    }
+  }
+  if (outputPath == NULL || modelPaths.empty() || settings.atlas.size <= 0 || settings.samples <= 0 ||
+      settings.bounces < 0 || settings.threads < 0 || glm::length(settings.sunDirection) == 0.0f) {
+    return usage(argv[0]);
+  }
+  int maxThreads = settings.threads > 0 ? settings.threads : std::max(1, (int)std::thread::hardware_concurrency());
+
+  std::vector<fred::MeshData> meshes(modelPaths.size());
+  for (size_t i = 0; i < modelPaths.size(); i++) {
+    if (!fred::importMesh(modelPaths[i], meshes[i])) {
+      return 1;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  fred::LightmapAtlasStats atlasStats;
+  if (!fred::generateLightmapUvs(meshes, settings.atlas, atlasStats)) {
+    return 1;
+  }
+  clog_log(CLOG_LEVEL_INFO, "%d charts at %.2f texels per unit, %.0f%% of the atlas, %d -> %d vertices\n",
+           atlasStats.charts, atlasStats.texelsPerUnit, atlasStats.coverage * 100.0f, atlasStats.verticesBefore,
+           atlasStats.verticesAfter);
+
+  Scene scene;
+  std::vector<glm::vec3> corners;
+  std::vector<uint32_t> triangles;
+  fred::Aabb bounds = {glm::vec3(INFINITY), glm::vec3(-INFINITY)};
+  for (const fred::MeshData &mesh : meshes) {
+    fred::meshTriangles(mesh, triangles);
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3) {
+      for (int corner = 0; corner < 3; corner++) {
+        const glm::vec3 &position = mesh.positions[triangles[t + corner]];
+        corners.push_back(position);
+        bounds = bounds.merge({position, position});
+      }
+      const glm::vec3 *triangle = &corners[corners.size() - 3];
+      glm::vec3 cross = glm::cross(triangle[1] - triangle[0], triangle[2] - triangle[0]);
+      float length = glm::length(cross);
+      scene.normals.push_back(length > 0.0f ? cross / length : glm::vec3(0, 1, 0));
+    }
+  }
+  scene.bias = std::max(glm::length(bounds.max - bounds.min) * 1e-4f, 1e-4f);
+  scene.bvh.build(corners);
+
+  std::vector<fred::LightmapTexel> texels;
+  fred::rasterizeLightmap(meshes, settings.atlas.size, texels);
+  double setupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  size_t coveredTexels = 0;
+  for (const fred::LightmapTexel &texel : texels) {
+    coveredTexels += texel.covered ? 1 : 0;
+  }
+  clog_log(CLOG_LEVEL_INFO, "%zu triangles, %zu BVH nodes %d deep, %zu texels to bake, set up in %.1f ms (%s packets)\n",
+           scene.bvh.getTriangleCount(), scene.bvh.getNodeCount(), scene.bvh.getDepth(), coveredTexels, setupMs,
+           fred::TriangleBvh::getSimdName());
+
+  std::vector<glm::vec3> colors;
+  if (scaling) {
+    // Doubling up to the core count, then the core count itself
+    std::vector<int> counts;
+    for (int count = 1; count < maxThreads; count *= 2) {
+      counts.push_back(count);
+    }
+    counts.push_back(maxThreads);
+
+    std::vector<glm::vec3> reference;
+    double singleMs = 0.0;
+    printf("threads        ms  speedup  efficiency  steals\n");
+    for (int count : counts) {
+      BakeRun run = bake(scene, settings, texels, count, colors);
+      if (count == 1) {
+        singleMs = run.ms;
+        reference = colors;
+      } else if (memcmp(reference.data(), colors.data(), colors.size() * sizeof(glm::vec3)) != 0) {
+        clog_log(CLOG_LEVEL_ERROR, "%d threads baked something different to 1 thread\n", count);
+        return 1;
+      }
+      double speedup = singleMs / run.ms;
+      printf("%7d %9.1f %7.2fx %10.0f%% %7d\n", count, run.ms, speedup, speedup / count * 100.0, run.steals);
+    }
+  } else {
+    BakeRun run = bake(scene, settings, texels, maxThreads, colors);
+    clog_log(CLOG_LEVEL_INFO, "Baked in %.1f ms on %d threads, %d tiles stolen\n", run.ms, maxThreads, run.steals);
+  }
+
+  std::vector<bool> covered(texels.size());
+  for (size_t i = 0; i < texels.size(); i++) {
+    covered[i] = texels[i].covered;
+  }
+  fred::dilateLightmap(colors, covered, settings.atlas.size, settings.atlas.padding);
+  std::vector<unsigned char> rgbm;
+  fred::encodeLightmapRgbm(colors, rgbm);
+  // Row y is v = (y + 0.5) / size, so the first row written is the bottom
+  // one GL expects, load it without flipping
+  if (!SOIL_save_image(outputPath, SOIL_SAVE_TYPE_PNG, settings.atlas.size, settings.atlas.size, 4, rgbm.data())) {
+    clog_log(CLOG_LEVEL_ERROR, "Couldn't write %s: %s\n", outputPath, SOIL_last_result());
+    return 1;
+  }
+
+  fred::VertexLayout layout = fred::VertexLayout::compact();
+  layout.lightmapUvs = true;
+  for (size_t i = 0; i < meshes.size(); i++) {
+    std::string cookedPath = fred::cookedMeshPath(modelPaths[i]);
+    // LODs only drop indices, so they keep the lightmap UVs just made
+    fred::generateLods(meshes[i], fred::LodGenerationSettings());
+    if (!fred::writeCookedMesh(cookedPath.c_str(), meshes[i], layout)) {
+      return 1;
+    }
+    clog_log(CLOG_LEVEL_INFO, "Baked %s -> %s\n", modelPaths[i], cookedPath.c_str());
+  }
+  return 0;
+}
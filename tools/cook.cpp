@@ -0,0 +1,65 @@
+// fred-cook: turns anything Assimp can read into a cooked .fmesh blob
+// Usage: fred-cook [--half-uvs] [--packed-normals] [--compact] [--lods N] <model> [output]
+// Output defaults to <model>.fmesh, --compact is both of the other two.
+// --lods is how many simplified levels to add past LOD 0, 3 unless told.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <clog/clog.h>
+
+#include "mesh.h"
+#include "simplify.h"
+
+static int usage(const char *name) {
+  fprintf(stderr, "Usage: %s [--half-uvs] [--packed-normals] [--compact] [--lods N] <model> [output]\n", name);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  fred::VertexLayout layout;
+  fred::LodGenerationSettings lods;
+  const char *sourcePath = NULL;
+  const char *outputPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--half-uvs") == 0) {
+      layout.uvFormat = fred::UvFormat::Half;
+    } else if (strcmp(argv[i], "--packed-normals") == 0) {
+      layout.normalFormat = fred::NormalFormat::Packed1010102;
+    } else if (strcmp(argv[i], "--compact") == 0) {
+      layout = fred::VertexLayout::compact();
+    } else if (strcmp(argv[i], "--lods") == 0 && i + 1 < argc) {
+      lods.levels = atoi(argv[++i]);
+      if (lods.levels < 0 || lods.levels >= fred::MAX_LODS) {
+        return usage(argv[0]);
+      }
+    } else if (argv[i][0] == '-') {
+      return usage(argv[0]);
+    } else if (sourcePath == NULL) {
+      sourcePath = argv[i];
+    } else if (outputPath == NULL) {
+      outputPath = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (sourcePath == NULL) {
+    return usage(argv[0]);
+  }
+  std::string cookedPath = outputPath != NULL ? outputPath : fred::cookedMeshPath(sourcePath);
+
+  fred::MeshData mesh;
+  if (!fred::importMesh(sourcePath, mesh)) {
+    return 1;
+  }
+  int lodCount = fred::generateLods(mesh, lods);
+  if (!fred::writeCookedMesh(cookedPath.c_str(), mesh, layout)) {
+    return 1;
+  }
+  clog_log(CLOG_LEVEL_INFO, "Cooked %s -> %s (%zu submeshes, %zu vertices, %zu indices, %u byte stride, %d LODs)\n",
+           sourcePath, cookedPath.c_str(), mesh.subMeshes.size(), mesh.positions.size(),
+           mesh.indexCount(), layout.stride(), 1 + lodCount);
+  return 0;
+}
@@ -0,0 +1,84 @@
+// fred-cook-texture: turns anything SOIL2 can read into a cooked .ftex
+// Usage: fred-cook-texture [--usage albedo|specular|normal] <texture> [output]
+// Output defaults to <texture>.ftex, usage is guessed from the file name.
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <SOIL2.h>
+#include <clog/clog.h>
+
+#include "texture.h"
+
+static int usage(const char *name) {
+  fprintf(stderr, "Usage: %s [--usage albedo|specular|normal] <texture> [output]\n", name);
+  return 1;
+}
+
+static const char *formatName(fred::TextureFormat format) {
+  switch (format) {
+  case fred::TextureFormat::BC1:
+    return "BC1";
+  case fred::TextureFormat::BC3:
+    return "BC3";
+  case fred::TextureFormat::BC5:
+    return "BC5";
+  }
+  return "?";
+}
+
+int main(int argc, char **argv) {
+  const char *usageName = NULL;
+  const char *sourcePath = NULL;
+  const char *outputPath = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--usage") == 0 && i + 1 < argc) {
+      usageName = argv[++i];
+    } else if (argv[i][0] == '-') {
+      return usage(argv[0]);
+    } else if (sourcePath == NULL) {
+      sourcePath = argv[i];
+    } else if (outputPath == NULL) {
+      outputPath = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (sourcePath == NULL) {
+    return usage(argv[0]);
+  }
+  fred::TextureUsage textureUsage = fred::guessTextureUsage(sourcePath);
+  if (usageName != NULL) {
+    if (strcmp(usageName, "albedo") == 0) {
+      textureUsage = fred::TextureUsage::Albedo;
+    } else if (strcmp(usageName, "specular") == 0) {
+      textureUsage = fred::TextureUsage::Specular;
+    } else if (strcmp(usageName, "normal") == 0) {
+      textureUsage = fred::TextureUsage::Normal;
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  std::string cookedPath = outputPath != NULL ? outputPath : fred::cookedTexturePath(sourcePath);
+
+  int width, height, channels;
+  unsigned char *image = SOIL_load_image(sourcePath, &width, &height, &channels, SOIL_LOAD_RGBA);
+  if (image == NULL) {
+    clog_log(CLOG_LEVEL_ERROR, "Couldn't read %s: %s\n", sourcePath, SOIL_last_result());
+    return 1;
+  }
+  bool ok = fred::writeCookedTexture(cookedPath.c_str(), image, width, height, textureUsage);
+  SOIL_free_image_data(image);
+  if (!ok) {
+    return 1;
+  }
+
+  fred::CookedTexture cooked;
+  if (!fred::mapCookedTexture(cookedPath.c_str(), NULL, cooked)) {
+    return 1;
+  }
+  clog_log(CLOG_LEVEL_INFO, "Cooked %s -> %s (%dx%d %s, %u levels, %zu bytes)\n", sourcePath, cookedPath.c_str(),
+           width, height, formatName(cooked.format()), cooked.header->levelCount, cooked.file.size);
+  return 0;
+}